@@ -0,0 +1,1110 @@
+/*
+
+				CPU micro benchmarks
+
+	Standalone benchmarks for the CPU side of Charlie_Submission.cpp. This does NOT link
+	against The Forge and needs no GPU, so it builds anywhere with a C++17 compiler:
+
+		make -C Benchmarks
+		./Benchmarks/cpu_benchmarks --benchmark_format=json --benchmark_out=bench.json
+
+	The app code depends on The Forge (tf_malloc, vectormath, resource loader...), so
+	everything measured here is a mirror of it. #Volatile: if you change one of the
+	mirrored functions in the app, change it here as well. Each mirror says where it
+	comes from.
+
+	The harness is a tiny subset of Google Benchmark (fixtures, KeepRunning loop,
+	Arg(), bytes/items per second, JSON output in the same shape), so the output can be
+	fed to the usual compare tools without pulling in the dependency.
+
+	Flags:
+		--benchmark_filter=<substring>    Only run benchmarks whose name contains this
+		--benchmark_format=<console|json> Output format on stdout (default console)
+		--benchmark_out=<file>            Also write json to this file
+		--benchmark_min_time=<seconds>    Minimum time per repetition (default 0.2)
+		--benchmark_repetitions=<n>       Repetitions, the median is reported (default 5)
+		--benchmark_full                  Include the full MAX_GRASS_CAP sized runs (400mb)
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <assert.h>
+#include <math.h>
+#include <time.h>
+
+#include <chrono>
+#include <algorithm>
+#include <vector>
+
+#include "../terrain_config.h"
+#include "../grass_query.h"
+#include "../shader_layouts.h"
+
+#define PI 3.14159265358979323846f
+#define TAU (PI*2)
+
+#define ARRAY_COUNT(a) (sizeof(a)/sizeof((a)[0]))
+
+///
+// Harness
+//
+
+// Keep the compiler from optimizing away work whose result we don't use
+#if defined(_MSC_VER)
+#include <intrin.h>
+template <class T> inline void doNotOptimize(T const &value) {
+	static volatile const void *sink;
+	sink = &value;
+	_ReadWriteBarrier();
+}
+inline void clobberMemory() { _ReadWriteBarrier(); }
+#else
+template <class T> inline void doNotOptimize(T const &value) {
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+inline void clobberMemory() { asm volatile("" : : : "memory"); }
+#endif
+
+typedef struct BenchmarkState {
+	uint64_t mIterations;
+	uint64_t mCurrentIteration;
+	int64_t  mArg;
+	uint64_t mBytesProcessed;
+	uint64_t mItemsProcessed;
+
+	bool keepRunning() {
+		if (mCurrentIteration < mIterations) {
+			mCurrentIteration += 1;
+			return true;
+		}
+		return false;
+	}
+	int64_t range() const { return mArg; }
+} BenchmarkState;
+
+class Fixture {
+public:
+	virtual ~Fixture() {}
+	virtual void setUp(const BenchmarkState &state) { (void)state; }
+	virtual void tearDown() {}
+	virtual void run(BenchmarkState &state) = 0;
+};
+
+typedef Fixture *(*FixtureFactory)();
+
+#define MAX_BENCHMARKS 64
+#define MAX_BENCHMARK_ARGS 8
+
+typedef struct BenchmarkEntry {
+	const char *pName;
+	FixtureFactory pFactory;
+	int64_t mArgs[MAX_BENCHMARK_ARGS];
+	uint32_t mArgCount;
+	bool mFullOnly[MAX_BENCHMARK_ARGS]; // Only run with --benchmark_full
+} BenchmarkEntry;
+
+BenchmarkEntry gBenchmarks[MAX_BENCHMARKS];
+uint32_t gBenchmarkCount = 0;
+
+struct BenchmarkRegistration {
+	BenchmarkEntry *pEntry;
+	BenchmarkRegistration(const char *pName, FixtureFactory pFactory) {
+		assert(gBenchmarkCount < MAX_BENCHMARKS);
+		pEntry = &gBenchmarks[gBenchmarkCount++];
+		memset(pEntry, 0, sizeof(*pEntry));
+		pEntry->pName = pName;
+		pEntry->pFactory = pFactory;
+	}
+	BenchmarkRegistration &arg(int64_t a, bool fullOnly = false) {
+		assert(pEntry->mArgCount < MAX_BENCHMARK_ARGS);
+		pEntry->mFullOnly[pEntry->mArgCount] = fullOnly;
+		pEntry->mArgs[pEntry->mArgCount++] = a;
+		return *this;
+	}
+};
+
+#define BENCHMARK_CONCAT_(a, b) a##b
+#define BENCHMARK_CONCAT(a, b) BENCHMARK_CONCAT_(a, b)
+
+// Usage:
+//     BENCHMARK_F(MyFixture, Name)(BenchmarkState &state) { while (state.keepRunning()) {...} }
+//     REGISTER_F(MyFixture, Name).arg(16).arg(1024);
+#define BENCHMARK_F(FixtureType, Name) \
+	class FixtureType##_##Name : public FixtureType { \
+	public: \
+		static Fixture *create() { return new FixtureType##_##Name(); } \
+		void run(BenchmarkState &state) override; \
+	}; \
+	void FixtureType##_##Name::run
+
+static BenchmarkRegistration &registerBenchmark(const char *pName, FixtureFactory pFactory) {
+	return *new BenchmarkRegistration(pName, pFactory);
+}
+
+#define REGISTER_F(FixtureType, Name) \
+	static BenchmarkRegistration &BENCHMARK_CONCAT(gRegistration_, __LINE__) = \
+		registerBenchmark(#FixtureType "/" #Name, &FixtureType##_##Name::create)
+
+typedef struct BenchmarkSettings {
+	const char *pFilter = NULL;
+	bool mJson = false;
+	const char *pOutPath = NULL;
+	double mMinTime = 0.2;
+	uint32_t mRepetitions = 5;
+	bool mFull = false;
+} BenchmarkSettings;
+
+typedef struct BenchmarkResult {
+	char mName[128];
+	uint64_t mIterations;
+	double mRealTimeNs; // Per iteration, median of repetitions
+	double mCpuTimeNs;
+	double mRealTimeMinNs;
+	double mRealTimeMaxNs;
+	double mBytesPerSecond;
+	double mItemsPerSecond;
+} BenchmarkResult;
+
+static double cpuSeconds() {
+	return (double)clock()/(double)CLOCKS_PER_SEC;
+}
+
+typedef struct RunTiming {
+	double mReal;
+	double mCpu;
+	uint64_t mBytes;
+	uint64_t mItems;
+} RunTiming;
+
+static RunTiming runOnce(Fixture *pFixture, int64_t arg, uint64_t iterations) {
+	BenchmarkState state = {};
+	state.mIterations = iterations;
+	state.mArg = arg;
+
+	pFixture->setUp(state);
+
+	double cpuStart = cpuSeconds();
+	auto realStart = std::chrono::steady_clock::now();
+	pFixture->run(state);
+	auto realEnd = std::chrono::steady_clock::now();
+	double cpuEnd = cpuSeconds();
+
+	pFixture->tearDown();
+
+	RunTiming t;
+	t.mReal = std::chrono::duration<double>(realEnd-realStart).count();
+	t.mCpu = cpuEnd-cpuStart;
+	t.mBytes = state.mBytesProcessed;
+	t.mItems = state.mItemsProcessed;
+	return t;
+}
+
+static void runBenchmark(const BenchmarkEntry *pEntry, int64_t arg, bool hasArg, const BenchmarkSettings *pSettings, BenchmarkResult *pResult) {
+	Fixture *pFixture = pEntry->pFactory();
+
+	if (hasArg) snprintf(pResult->mName, sizeof(pResult->mName), "%s/%lld", pEntry->pName, (long long)arg);
+	else        snprintf(pResult->mName, sizeof(pResult->mName), "%s", pEntry->pName);
+
+	// Find an iteration count that runs for at least the min time, like google benchmark does.
+	uint64_t iterations = 1;
+	for (;;) {
+		RunTiming t = runOnce(pFixture, arg, iterations);
+		if (t.mReal >= pSettings->mMinTime || iterations >= 1000000000ull) break;
+
+		double multiplier = t.mReal > 0.0 ? (pSettings->mMinTime*1.4)/t.mReal : 10.0;
+		multiplier = std::min(std::max(multiplier, 2.0), 10.0);
+		iterations = (uint64_t)((double)iterations*multiplier)+1;
+	}
+
+	// Median over repetitions keeps the numbers stable between runs
+	double realTimes[64];
+	double cpuTimes[64];
+	uint32_t repetitions = std::min(std::max(pSettings->mRepetitions, 1u), (uint32_t)ARRAY_COUNT(realTimes));
+	RunTiming last = {};
+	for (uint32_t r = 0; r < repetitions; r += 1) {
+		last = runOnce(pFixture, arg, iterations);
+		realTimes[r] = last.mReal/(double)iterations*1e9;
+		cpuTimes[r] = last.mCpu/(double)iterations*1e9;
+	}
+	std::sort(realTimes, realTimes+repetitions);
+	std::sort(cpuTimes, cpuTimes+repetitions);
+
+	pResult->mIterations = iterations;
+	pResult->mRealTimeNs = realTimes[repetitions/2];
+	pResult->mCpuTimeNs = cpuTimes[repetitions/2];
+	pResult->mRealTimeMinNs = realTimes[0];
+	pResult->mRealTimeMaxNs = realTimes[repetitions-1];
+
+	double secondsPerIteration = pResult->mRealTimeNs*1e-9;
+	pResult->mBytesPerSecond = secondsPerIteration > 0.0 ? ((double)last.mBytes/(double)iterations)/secondsPerIteration : 0.0;
+	pResult->mItemsPerSecond = secondsPerIteration > 0.0 ? ((double)last.mItems/(double)iterations)/secondsPerIteration : 0.0;
+
+	delete pFixture;
+}
+
+static void writeJson(FILE *f, const BenchmarkResult *pResults, uint32_t count, const BenchmarkSettings *pSettings) {
+	fprintf(f, "{\n");
+	fprintf(f, "  \"context\": {\n");
+	fprintf(f, "    \"executable\": \"cpu_benchmarks\",\n");
+	fprintf(f, "    \"min_time\": %.3f,\n", pSettings->mMinTime);
+	fprintf(f, "    \"repetitions\": %u,\n", pSettings->mRepetitions);
+	fprintf(f, "    \"aggregate\": \"median\"\n");
+	fprintf(f, "  },\n");
+	fprintf(f, "  \"benchmarks\": [\n");
+	for (uint32_t i = 0; i < count; i += 1) {
+		const BenchmarkResult *r = &pResults[i];
+		fprintf(f, "    {\n");
+		fprintf(f, "      \"name\": \"%s\",\n", r->mName);
+		fprintf(f, "      \"iterations\": %llu,\n", (unsigned long long)r->mIterations);
+		fprintf(f, "      \"real_time\": %.3f,\n", r->mRealTimeNs);
+		fprintf(f, "      \"cpu_time\": %.3f,\n", r->mCpuTimeNs);
+		fprintf(f, "      \"real_time_min\": %.3f,\n", r->mRealTimeMinNs);
+		fprintf(f, "      \"real_time_max\": %.3f,\n", r->mRealTimeMaxNs);
+		fprintf(f, "      \"time_unit\": \"ns\",\n");
+		fprintf(f, "      \"bytes_per_second\": %.1f,\n", r->mBytesPerSecond);
+		fprintf(f, "      \"items_per_second\": %.1f\n", r->mItemsPerSecond);
+		fprintf(f, "    }%s\n", i+1 < count ? "," : "");
+	}
+	fprintf(f, "  ]\n");
+	fprintf(f, "}\n");
+}
+
+static void writeConsole(FILE *f, const BenchmarkResult *pResults, uint32_t count) {
+	fprintf(f, "%-52s %14s %14s %12s %14s\n", "Benchmark", "Time (ns)", "CPU (ns)", "Iterations", "Throughput");
+	fprintf(f, "-------------------------------------------------------------------------------------------------------------\n");
+	for (uint32_t i = 0; i < count; i += 1) {
+		const BenchmarkResult *r = &pResults[i];
+		char throughput[32] = "";
+		if (r->mBytesPerSecond > 0.0)      snprintf(throughput, sizeof(throughput), "%.2f GB/s", r->mBytesPerSecond/1e9);
+		else if (r->mItemsPerSecond > 0.0) snprintf(throughput, sizeof(throughput), "%.2f M/s", r->mItemsPerSecond/1e6);
+		fprintf(f, "%-52s %14.1f %14.1f %12llu %14s\n", r->mName, r->mRealTimeNs, r->mCpuTimeNs, (unsigned long long)r->mIterations, throughput);
+	}
+}
+
+///
+// Mirrors of the app code
+//
+
+///
+// Temporary storage, mirrored from Charlie_Submission.cpp "Temporary storage"
+
+void *pTemporaryStorage = NULL;
+void *pTemporaryStorageNext = NULL;
+const size_t pTemporaryStorageSize = 1024*500; // 500kib
+
+void initTemporaryStorage() {
+	pTemporaryStorage = malloc(pTemporaryStorageSize);
+	pTemporaryStorageNext = pTemporaryStorage;
+}
+void exitTemporaryStorage() {
+	free(pTemporaryStorage);
+	pTemporaryStorage = NULL;
+	pTemporaryStorageNext = NULL;
+}
+void resetTemporaryStorage() {
+	pTemporaryStorageNext = pTemporaryStorage;
+}
+void *tempAlloc(size_t size) {
+	void *p = pTemporaryStorageNext;
+
+	size = (size+15) & ~15; // Align to 16
+
+	pTemporaryStorageNext = (uint8_t*)pTemporaryStorageNext+size;
+
+	assert(pTemporaryStorageNext <= (uint8_t*)pTemporaryStorage+pTemporaryStorageSize);
+
+	return p;
+}
+char* tempPrint(const char *fmt, ...) {
+    va_list args1;
+    va_list args2;
+    va_start(args1, fmt);
+
+    int bufferSize = vsnprintf(NULL, 0, fmt, args1) + 1;
+
+    va_end(args1);
+
+    if (bufferSize <= 0) {
+        return NULL;
+    }
+
+    va_start(args2, fmt);
+
+    char *buffer = (char*)tempAlloc(bufferSize);
+    if (buffer == NULL) {
+        va_end(args2);
+        return NULL;
+    }
+    vsnprintf(buffer, bufferSize, fmt, args2);
+
+    va_end(args2);
+
+    return buffer;
+}
+
+///
+// Minimal vectormath, laid out like The Forge's (SSE aligned Vector3/Vector4, column major Matrix4)
+
+typedef struct alignas(16) Vec4 {
+	float x, y, z, w;
+} Vec4;
+typedef Vec4 Vec3; // Vector3 is 16 bytes in The Forge as well
+
+typedef struct alignas(16) Mat4 {
+	Vec4 mCol[4];
+} Mat4;
+
+typedef struct float3 {
+	float x, y, z;
+} float3;
+
+static inline Vec4 vec4(float x, float y, float z, float w) { Vec4 v = { x, y, z, w }; return v; }
+static inline Vec4 add(Vec4 a, Vec4 b) { return vec4(a.x+b.x, a.y+b.y, a.z+b.z, a.w+b.w); }
+static inline Vec4 sub(Vec4 a, Vec4 b) { return vec4(a.x-b.x, a.y-b.y, a.z-b.z, a.w-b.w); }
+static inline Vec4 scale(Vec4 a, float s) { return vec4(a.x*s, a.y*s, a.z*s, a.w*s); }
+static inline float dot3(Vec4 a, Vec4 b) { return a.x*b.x+a.y*b.y+a.z*b.z; }
+static inline float length3(Vec4 a) { return sqrtf(dot3(a, a)); }
+static inline Vec4 normalize3(Vec4 a) { float l = 1.0f/length3(a); return vec4(a.x*l, a.y*l, a.z*l, 0); }
+static inline Vec4 cross3(Vec4 a, Vec4 b) {
+	return vec4(a.y*b.z-a.z*b.y, a.z*b.x-a.x*b.z, a.x*b.y-a.y*b.x, 0);
+}
+static inline Vec4 getRow(const Mat4 &m, int r) {
+	return vec4((&m.mCol[0].x)[r], (&m.mCol[1].x)[r], (&m.mCol[2].x)[r], (&m.mCol[3].x)[r]);
+}
+static inline Mat4 mul(const Mat4 &a, const Mat4 &b) {
+	Mat4 r;
+	for (int c = 0; c < 4; c += 1) {
+		const Vec4 &bc = b.mCol[c];
+		r.mCol[c] = add(add(scale(a.mCol[0], bc.x), scale(a.mCol[1], bc.y)), add(scale(a.mCol[2], bc.z), scale(a.mCol[3], bc.w)));
+	}
+	return r;
+}
+
+// Mirror of CameraMatrix::perspectiveReverseZ (left handed, reverse z)
+static Mat4 perspectiveReverseZ(float fovxRadians, float aspectInverse, float zNear, float zFar) {
+	float f = 1.0f/tanf(fovxRadians*0.5f);
+	float rangeInv = 1.0f/(zFar-zNear);
+	Mat4 m = {};
+	m.mCol[0] = vec4(f, 0, 0, 0);
+	m.mCol[1] = vec4(0, f/aspectInverse, 0, 0);
+	m.mCol[2] = vec4(0, 0, -zNear*rangeInv, 1);
+	m.mCol[3] = vec4(0, 0, zNear*zFar*rangeInv, 0);
+	return m;
+}
+
+// Mirror of CameraMatrix::extractFrustumClipPlanes
+static void extractFrustumClipPlanes(const Mat4 &vp, Vec4 &rcp, Vec4 &lcp, Vec4 &tcp, Vec4 &bcp, Vec4 &fcp, Vec4 &ncp, bool normalizePlanes) {
+	Vec4 r0 = getRow(vp, 0);
+	Vec4 r1 = getRow(vp, 1);
+	Vec4 r2 = getRow(vp, 2);
+	Vec4 r3 = getRow(vp, 3);
+
+	lcp = add(r3, r0);
+	rcp = sub(r3, r0);
+	bcp = add(r3, r1);
+	tcp = sub(r3, r1);
+	ncp = r2;
+	fcp = sub(r3, r2);
+
+	if (normalizePlanes) {
+		lcp = scale(lcp, 1.0f/length3(lcp));
+		rcp = scale(rcp, 1.0f/length3(rcp));
+		bcp = scale(bcp, 1.0f/length3(bcp));
+		tcp = scale(tcp, 1.0f/length3(tcp));
+		ncp = scale(ncp, 1.0f/length3(ncp));
+		fcp = scale(fcp, 1.0f/length3(fcp));
+	}
+}
+
+///
+// Uniform structures, mirrored from Charlie_Submission.cpp "Structures reflected in shaders".
+// Only the layout matters here, it decides how much memcpy() per frame. Both sides check it
+// against shader_layouts.h.
+
+typedef struct LodLevelInfo {
+	float mThreshold;
+	uint32_t mIndexCount;
+	uint32_t mBladesPerInstance;
+	uint32_t mBladeSegments;
+} LodLevelInfo;
+typedef struct LodSettings {
+	LodLevelInfo mLevels[MAX_GRASS_LOD] = {
+		{ 0.0f, 0, 0, 0 },
+		{ 60.0f, 0, 0, 0 },
+		{ 450.0f, 0, 0, 0 },
+		{ 750.0f, 0, 0, 0 },
+	};
+	float mDensityFadeStartPercent = 0.3f;
+	float mMinDensityPercent = 0.4f;
+	float mLowestDetailDistance = 935.0f;
+	uint32_t mLevelCount = 4;
+} LodSettings;
+
+typedef struct SceneUniformData {
+	Mat4 mCameraToClip;
+	Vec3 mSunDirection;
+	float mTerrainSize[2];
+	float mDaylightFactor;
+	float mMaxFloorY;
+	float mTime;
+	float mWindStrength;
+	float mMaxWindLeanAngle;
+	float mWindSpeed;
+	float mMaxNaturalAngle;
+	float mMinGrassWidth;
+	float mMaxGrassWidth;
+	float mMinGrassHeight;
+	float mMaxGrassHeight;
+	uint32_t mMaxInstancesPerTile;
+	float mSampleGranularity;
+	float mBladeSegmentScale;
+	Vec3 mViewDir;
+	Vec3 mCameraPos;
+	Vec3 mGrassBaseColor;
+	Vec3 mGrassTipColor;
+	Vec3 mWindDir;
+	Vec4 mFarGrass;
+	uint32_t mTileGrid[4];
+	uint32_t mTemporalGrass[4];
+	uint32_t mTemporalHistory[4];
+	Mat4 mTemporalReprojection[TEMPORAL_GRASS_MAX_FRAMES-1];
+	uint32_t mHeightEdits[4];
+} SceneUniformData;
+
+typedef struct GrassViewData {
+	float3 mViewPosition;
+	float mLodDistanceScale = 1.0f;
+	Vec4 rcp, lcp, tcp, bcp, fcp, ncp;
+	Vec4 fhp;
+	Vec4 fvp;
+	Vec4 mMotion;
+} GrassViewData;
+
+typedef struct GrassDrawUniformData {
+	uint32_t mPerceivedNumberOfGrass = 10000000;
+	uint32_t mViewCount = 1;
+	uint32_t mProceduralBlades = 0;
+	uint32_t mCullEpoch;
+	LodSettings mLod;
+	GrassViewData mViews[MAX_GRASS_VIEWS];
+	float mSplatMaxPixels;
+	float mSplatPixelScale;
+	uint32_t mSplatWidth;
+	uint32_t mSplatHeight;
+	uint32_t mFarVariantLevel;
+	uint32_t mTemporalFrames;
+	float mMaxBladeHeight;
+	uint32_t mSpeciesCount = MAX_GRASS_SPECIES;
+	uint32_t mTemporalSectors;
+	uint32_t mTemporalRefresh;
+	uint32_t mTemporalFrame;
+	uint32_t pad;
+	uint32_t mTemporalSectorFrames[4];
+} GrassDrawUniformData;
+
+typedef struct GrassSpecies {
+	float3   mBaseColor;
+	float    mDensity;
+	float3   mTipColor;
+	float    pad0;
+	float    mMinWidth;
+	float    mMaxWidth;
+	float    mMinHeight;
+	float    mMaxHeight;
+	uint32_t mFirstLod;
+	uint32_t mLastLod;
+	uint32_t pad1[2];
+} GrassSpecies;
+
+typedef struct SkyboxUniformData {
+	Mat4 mView;
+	Mat4 mProjection;
+} SkyboxUniformData;
+
+typedef struct GrassVertex {
+	float mPosition[3];
+	uint32_t mNormal;
+	uint32_t mClump;
+} GrassVertex;
+
+SHADER_LAYOUT_CHECK()
+
+///
+// Shader math mirrors
+
+// Mirror of hash()/rand() in grass.vert.fsl
+static inline float hashFloat(uint32_t x) {
+	x = ((x >> 16) ^ x) * 0x45d9f3b;
+	x = ((x >> 16) ^ x) * 0x45d9f3b;
+	x = (x >> 16) ^ x;
+	return float(x) / float(0xFFFFFFFF);
+}
+static inline float randFloat(uint32_t *pSeed) {
+	*pSeed *= 0xDEADBEEF;
+	return hashFloat(*pSeed);
+}
+
+// Mirror of IsPointOutsideFrustum() in grass_draw.comp.fsl
+static inline bool isPointOutsideFrustum(Vec4 p, const GrassViewData *pView) {
+	Vec4 viewPos = vec4(pView->mViewPosition.x, pView->mViewPosition.y, pView->mViewPosition.z, 0);
+	Vec4 dir = normalize3(sub(p, viewPos));
+	return dot3(dir, pView->lcp) < 0.0f || dot3(dir, pView->tcp) < 0.0f || dot3(dir, pView->rcp) < 0.0f
+	    || dot3(dir, pView->bcp) < 0.0f || dot3(dir, pView->fcp) < 0.0f || dot3(dir, pView->ncp) < 0.0f;
+}
+
+// Mirror of IsTileVisibleInView() in grass_draw.comp.fsl
+static bool isTileVisibleInView(const Vec4 corners[8], const GrassViewData *pView) {
+	Vec4 viewPos = vec4(pView->mViewPosition.x, pView->mViewPosition.y, pView->mViewPosition.z, 0);
+	bool canCull = true;
+	for (int i = 0; i < 8 && canCull; i += 1) {
+		Vec4 d0 = normalize3(sub(corners[i], viewPos));
+		float h0 = dot3(d0, pView->fhp);
+		float v0 = dot3(d0, pView->fvp);
+		for (int j = 0; j < 8; j += 1) {
+			if (j == i) continue;
+			Vec4 d1 = normalize3(sub(corners[j], viewPos));
+			if ((h0 >= 0) != (dot3(d1, pView->fhp) >= 0) || (v0 >= 0) != (dot3(d1, pView->fvp) >= 0)) {
+				canCull = false;
+				break;
+			}
+		}
+	}
+	if (canCull) {
+		for (int i = 0; i < 8; i += 1) {
+			if (!isPointOutsideFrustum(corners[i], pView)) return true;
+		}
+		return false;
+	}
+	return true;
+}
+
+static void fillMainView(GrassViewData *pView, float3 cameraPos, float yaw) {
+	// A camera looking along yaw, slightly down, like the app's start position
+	Mat4 view = {};
+	float c = cosf(yaw), s = sinf(yaw);
+	view.mCol[0] = vec4(c, 0, s, 0);
+	view.mCol[1] = vec4(0, 1, 0, 0);
+	view.mCol[2] = vec4(-s, 0, c, 0);
+	view.mCol[3] = vec4(-(c*cameraPos.x - s*cameraPos.z), -cameraPos.y, -(s*cameraPos.x + c*cameraPos.z), 1);
+	Mat4 proj = perspectiveReverseZ(PI/2.0f, 9.0f/16.0f, 0.1f, 10000.0f);
+	Mat4 pv = mul(proj, view);
+
+	pView->mViewPosition = cameraPos;
+	pView->mLodDistanceScale = 1.0f;
+	extractFrustumClipPlanes(pv, pView->rcp, pView->lcp, pView->tcp, pView->bcp, pView->fcp, pView->ncp, true);
+	pView->fhp = normalize3(cross3(pView->rcp, vec4(0, 1, 0, 0)));
+	pView->fvp = normalize3(cross3(vec4(0, 1, 0, 0), pView->rcp));
+}
+
+// Cheap stand-in for the height map
+static inline float syntheticHeight(float x, float z) {
+	return 40.0f + 40.0f*sinf(x*0.01f)*cosf(z*0.013f);
+}
+
+///
+// Benchmarks
+//
+
+///
+// Temporary storage
+
+class TempStorageFixture : public Fixture {
+public:
+	void setUp(const BenchmarkState &state) override { (void)state; initTemporaryStorage(); }
+	void tearDown() override { exitTemporaryStorage(); }
+};
+
+// tempAlloc() of arg bytes, reset every 256 allocations like a frame would
+BENCHMARK_F(TempStorageFixture, TempAlloc)(BenchmarkState &state) {
+	size_t size = (size_t)state.range();
+	uint32_t n = 0;
+	while (state.keepRunning()) {
+		void *p = tempAlloc(size);
+		doNotOptimize(p);
+		if (++n == 256) { resetTemporaryStorage(); n = 0; }
+	}
+	state.mItemsProcessed = state.mIterations;
+}
+REGISTER_F(TempStorageFixture, TempAlloc).arg(16).arg(128).arg(1024);
+
+BENCHMARK_F(TempStorageFixture, TempPrint)(BenchmarkState &state) {
+	uint32_t n = 0;
+	while (state.keepRunning()) {
+		char *p = tempPrint("grass_lod_%i.bin", (int)n);
+		doNotOptimize(p);
+		if (++n == 256) { resetTemporaryStorage(); n = 0; }
+	}
+	state.mItemsProcessed = state.mIterations;
+}
+REGISTER_F(TempStorageFixture, TempPrint);
+
+///
+// Load(): grass instance identity fill
+
+class InstanceFillFixture : public Fixture {
+public:
+	uint32_t *pData = NULL;
+	void setUp(const BenchmarkState &state) override {
+		pData = (uint32_t*)malloc(sizeof(uint32_t)*(size_t)state.range());
+	}
+	void tearDown() override { free(pData); pData = NULL; }
+};
+
+// Mirror of the MAX_GRASS_CAP loop that fills grassInstanceData in Load()
+BENCHMARK_F(InstanceFillFixture, IdentityFill)(BenchmarkState &state) {
+	uint32_t count = (uint32_t)state.range();
+	while (state.keepRunning()) {
+		for (uint32_t i = 0; i < count; i += 1) {
+			pData[i] = i;
+		}
+		clobberMemory();
+	}
+	state.mBytesProcessed = state.mIterations*count*sizeof(uint32_t);
+}
+REGISTER_F(InstanceFillFixture, IdentityFill).arg(1 << 20).arg(1 << 24).arg(MAX_GRASS_CAP, true);
+
+///
+// Load(): LOD mesh merge
+
+class LodMergeFixture : public Fixture {
+public:
+	// Same vertex/index counts as RawAssets/Models/grass_lod_*.gltf
+	static const uint32_t LEVEL_COUNT = 4;
+	uint32_t mVertexCounts[LEVEL_COUNT] = { 26, 7, 4, 3 };
+	uint32_t mIndexCounts[LEVEL_COUNT] = { 72, 15, 6, 3 };
+
+	float    *pPositions[LEVEL_COUNT] = {};
+	uint32_t *pNormals[LEVEL_COUNT] = {};
+	uint16_t *pIndices[LEVEL_COUNT] = {};
+
+	void setUp(const BenchmarkState &state) override {
+		(void)state;
+		initTemporaryStorage();
+		for (uint32_t i = 0; i < LEVEL_COUNT; i += 1) {
+			pPositions[i] = (float*)malloc(sizeof(float)*3*mVertexCounts[i]);
+			pNormals[i] = (uint32_t*)malloc(sizeof(uint32_t)*mVertexCounts[i]);
+			pIndices[i] = (uint16_t*)malloc(sizeof(uint16_t)*mIndexCounts[i]);
+			for (uint32_t j = 0; j < mVertexCounts[i]*3; j += 1) pPositions[i][j] = (float)j;
+			for (uint32_t j = 0; j < mVertexCounts[i]; j += 1) pNormals[i][j] = j;
+			for (uint32_t j = 0; j < mIndexCounts[i]; j += 1) pIndices[i][j] = (uint16_t)(j % mVertexCounts[i]);
+		}
+	}
+	void tearDown() override {
+		for (uint32_t i = 0; i < LEVEL_COUNT; i += 1) {
+			free(pPositions[i]);
+			free(pNormals[i]);
+			free(pIndices[i]);
+		}
+		exitTemporaryStorage();
+	}
+};
+
+// Mirror of mergeGrassMeshes(), with blade clumps
+BENCHMARK_F(LodMergeFixture, MergeLodMeshes)(BenchmarkState &state) {
+	while (state.keepRunning()) {
+		resetTemporaryStorage();
+
+		uint32_t blades[LEVEL_COUNT];
+		uint32_t totalVertexCount = 0;
+		uint32_t totalIndexCount = 0;
+		for (uint32_t i = 0; i < LEVEL_COUNT; i += 1) {
+			blades[i] = 1;
+			if (i > 0) {
+				blades[i] = 64/mVertexCounts[i]; // GRASS_CLUMP_TARGET_VERTICES
+				blades[i] = blades[i] < 1 ? 1 : (blades[i] > 16 ? 16 : blades[i]); // GRASS_MAX_CLUMP_SIZE
+			}
+			totalVertexCount += mVertexCounts[i]*blades[i];
+			totalIndexCount += mIndexCounts[i]*blades[i];
+		}
+
+		GrassVertex *vertices = (GrassVertex*)tempAlloc(sizeof(GrassVertex)*totalVertexCount);
+		uint32_t *indices = (uint32_t*)tempAlloc(sizeof(uint32_t)*totalIndexCount);
+
+		uint32_t nextBaseVertex = 0;
+		uint32_t nextBaseIndex = 0;
+		for (uint32_t i = 0; i < LEVEL_COUNT; i += 1) {
+			for (uint32_t blade = 0; blade < blades[i]; blade += 1) {
+				for (uint32_t j = 0; j < mVertexCounts[i]; j += 1) {
+					memcpy(vertices[nextBaseVertex+j].mPosition, &pPositions[i][j*3], sizeof(float)*3);
+					vertices[nextBaseVertex+j].mNormal = pNormals[i][j];
+					vertices[nextBaseVertex+j].mClump = blade | (blades[i] << 16);
+				}
+				for (uint32_t j = 0; j < mIndexCounts[i]; j += 1) {
+					indices[nextBaseIndex+j] = pIndices[i][j] + nextBaseVertex;
+				}
+				nextBaseVertex += mVertexCounts[i];
+				nextBaseIndex += mIndexCounts[i];
+			}
+		}
+		doNotOptimize(vertices);
+		doNotOptimize(indices);
+		clobberMemory();
+	}
+	state.mItemsProcessed = state.mIterations;
+}
+REGISTER_F(LodMergeFixture, MergeLodMeshes);
+
+///
+// Update(): view matrices and frustum planes
+
+class ViewFixture : public Fixture {
+public:
+	GrassDrawUniformData mGrassDrawData = {};
+};
+
+// Mirror of the per view loop in Update(), for arg views
+BENCHMARK_F(ViewFixture, ViewsAndFrustumPlanes)(BenchmarkState &state) {
+	uint32_t viewCount = (uint32_t)state.range();
+	float yaw = 0.0f;
+	while (state.keepRunning()) {
+		for (uint32_t v = 0; v < viewCount; v += 1) {
+			fillMainView(&mGrassDrawData.mViews[v], float3{ 1240.0f, 48.0f, 1240.0f }, yaw + (float)v);
+		}
+		yaw += 0.001f;
+		doNotOptimize(mGrassDrawData);
+	}
+	state.mItemsProcessed = state.mIterations*viewCount;
+}
+REGISTER_F(ViewFixture, ViewsAndFrustumPlanes).arg(1).arg(MAX_GRASS_VIEWS);
+
+///
+// Draw(): per frame ubo memcpy's
+
+class UboUploadFixture : public Fixture {
+public:
+	SceneUniformData     mScene = {};
+	GrassDrawUniformData mGrassDraw = {};
+	SkyboxUniformData    mSkybox = {};
+	GrassSpecies         mSpecies[MAX_GRASS_SPECIES] = {};
+	// Stands in for the persistently mapped ubo memory
+	uint8_t *pMapped = NULL;
+	void setUp(const BenchmarkState &state) override {
+		(void)state;
+		pMapped = (uint8_t*)malloc(64*1024);
+	}
+	void tearDown() override { free(pMapped); pMapped = NULL; }
+};
+
+// Offsets in the upload heap are aligned like heapAlloc() does, to mUniformBufferAlignment
+#define UBO_ALIGNED(size) (((size)+255) & ~(size_t)255)
+
+// Mirror of the ubo updates at the start of Draw(), for arg views
+BENCHMARK_F(UboUploadFixture, FrameUboMemcpy)(BenchmarkState &state) {
+	uint32_t viewCount = (uint32_t)state.range();
+	uint64_t bytesPerFrame = viewCount*(sizeof(SceneUniformData)+sizeof(SkyboxUniformData))+sizeof(GrassDrawUniformData)+sizeof(mSpecies);
+	while (state.keepRunning()) {
+		uint8_t *p = pMapped;
+		for (uint32_t v = 0; v < viewCount; v += 1) {
+			memcpy(p, &mScene, sizeof(SceneUniformData));
+			p += UBO_ALIGNED(sizeof(SceneUniformData));
+			memcpy(p, &mSkybox, sizeof(SkyboxUniformData));
+			p += UBO_ALIGNED(sizeof(SkyboxUniformData));
+		}
+		memcpy(p, &mGrassDraw, sizeof(GrassDrawUniformData));
+		p += UBO_ALIGNED(sizeof(GrassDrawUniformData));
+		memcpy(p, mSpecies, sizeof(mSpecies));
+		clobberMemory();
+	}
+	state.mBytesProcessed = state.mIterations*bytesPerFrame;
+}
+REGISTER_F(UboUploadFixture, FrameUboMemcpy).arg(1).arg(MAX_GRASS_VIEWS);
+
+///
+// Shader mirrors
+
+class ShaderMirrorFixture : public Fixture {
+public:
+	GrassDrawUniformData mDraw = {};
+	void setUp(const BenchmarkState &state) override {
+		(void)state;
+		mDraw.mViewCount = 1;
+		fillMainView(&mDraw.mViews[0], float3{ TERRAIN_WIDTH/2, 48.0f, TERRAIN_HEIGHT/2 }, 0.3f);
+	}
+};
+
+// CPU mirror of grass_draw.comp for every tile: bounds, frustum test and LOD selection.
+// Run at the tile sizes the tuner tries, see "Tile grid".
+BENCHMARK_F(ShaderMirrorFixture, TileCulling)(BenchmarkState &state) {
+	const uint32_t tileDimension = (uint32_t)state.range();
+	const uint32_t tileCountX = TERRAIN_WIDTH/tileDimension;
+	const uint32_t tileCountY = TERRAIN_HEIGHT/tileDimension;
+	const float maxGrassHeight = 26.0f; // drawInfo.MaxBladeHeight with every species mixed in
+	const float xPad = maxGrassHeight*((TAU*0.1f+TAU*0.25f)/PI);
+	const float h = (float)tileDimension/2.0f;
+	while (state.keepRunning()) {
+		uint32_t visible = 0;
+		uint32_t lodSum = 0;
+		for (uint32_t yTile = 0; yTile < tileCountY; yTile += 1) {
+			for (uint32_t xTile = 0; xTile < tileCountX; xTile += 1) {
+				Vec4 c = vec4((float)(xTile*tileDimension)+h, 0, (float)(yTile*tileDimension)+h, 0);
+				c.y = syntheticHeight(c.x, c.z);
+				float minY = c.y, maxY = c.y+maxGrassHeight;
+				Vec4 corners[8] = {
+					vec4(c.x-h-xPad, minY, c.z-h, 0), vec4(c.x-h-xPad, maxY, c.z-h, 0),
+					vec4(c.x+h+xPad, maxY, c.z-h, 0), vec4(c.x+h+xPad, minY, c.z-h, 0),
+					vec4(c.x-h-xPad, minY, c.z+h, 0), vec4(c.x-h-xPad, maxY, c.z+h, 0),
+					vec4(c.x+h+xPad, maxY, c.z+h, 0), vec4(c.x+h+xPad, minY, c.z+h, 0),
+				};
+				for (uint32_t v = 0; v < mDraw.mViewCount; v += 1) {
+					if (!isTileVisibleInView(corners, &mDraw.mViews[v])) continue;
+					Vec4 viewPos = vec4(mDraw.mViews[v].mViewPosition.x, mDraw.mViews[v].mViewPosition.y, mDraw.mViews[v].mViewPosition.z, 0);
+					float d = length3(sub(viewPos, c));
+					uint32_t lod = 0;
+					for (int32_t i = (int32_t)mDraw.mLod.mLevelCount-1; i >= 0; i -= 1) {
+						if (d >= mDraw.mLod.mLevels[i].mThreshold) { lod = (uint32_t)i; break; }
+					}
+					visible += 1;
+					lodSum += lod;
+				}
+			}
+		}
+		doNotOptimize(visible);
+		doNotOptimize(lodSum);
+	}
+	state.mItemsProcessed = state.mIterations*tileCountX*tileCountY;
+}
+REGISTER_F(ShaderMirrorFixture, TileCulling).arg(10).arg(15).arg(20).arg(31).arg(40);
+
+// CPU mirror of the blade placement random sequence in grass.vert.fsl
+BENCHMARK_F(ShaderMirrorFixture, BladePlacement)(BenchmarkState &state) {
+	const uint32_t bladeCount = (uint32_t)state.range();
+	const uint32_t tileSeed = 0x1234567u;
+	while (state.keepRunning()) {
+		float acc = 0.0f;
+		for (uint32_t instance = 0; instance < bladeCount; instance += 1) {
+			uint32_t seed = tileSeed*instance; // SpeciesSeed() of species 0 is the tile seed
+			float x = randFloat(&seed)*DEFAULT_GRASS_TILE_DIMENSION;
+			float z = randFloat(&seed)*DEFAULT_GRASS_TILE_DIMENSION;
+			float width = randFloat(&seed);
+			float height = randFloat(&seed);
+			float rotation = randFloat(&seed)*TAU;
+			acc += x+z+width+height+rotation;
+		}
+		doNotOptimize(acc);
+	}
+	state.mItemsProcessed = state.mIterations*bladeCount;
+}
+REGISTER_F(ShaderMirrorFixture, BladePlacement).arg(MAX_GRASS_CAP/((TERRAIN_WIDTH/DEFAULT_GRASS_TILE_DIMENSION)*(TERRAIN_HEIGHT/DEFAULT_GRASS_TILE_DIMENSION)));
+
+///
+// Grass queries (grass_query.h, used as is)
+
+class GrassQueryFixture : public Fixture {
+public:
+	std::vector<uint32_t> mTiles; // TileEntry layout: x, y, seed, species mix
+	std::vector<float>    mHeights;
+	GrassQuery mQuery = {};
+	
+	void setUp(const BenchmarkState &state) override {
+		(void)state;
+		const uint32_t tileCountX = TERRAIN_WIDTH/DEFAULT_GRASS_TILE_DIMENSION;
+		const uint32_t tileCountY = TERRAIN_HEIGHT/DEFAULT_GRASS_TILE_DIMENSION;
+		const uint32_t tileCount = tileCountX*tileCountY;
+		mTiles.resize(tileCount*4);
+		for (uint32_t i = 0; i < tileCount; i += 1) {
+			uint32_t seed = i+1;
+			mTiles[i*4+0] = i % tileCountX;
+			mTiles[i*4+1] = i/tileCountX;
+			mTiles[i*4+2] = (uint32_t)(randFloat(&seed)*4294967040.0f);
+			mTiles[i*4+3] = 200 | (40 << 8) | (10 << 16) | (5 << 24);
+		}
+		
+		const uint32_t heightMapSize = 512;
+		mHeights.resize(heightMapSize*heightMapSize);
+		for (uint32_t y = 0; y < heightMapSize; y += 1) {
+			for (uint32_t x = 0; x < heightMapSize; x += 1) {
+				mHeights[y*heightMapSize+x] = syntheticHeight((float)x*8.0f, (float)y*8.0f)/80.0f;
+			}
+		}
+		
+		// The built-in species, see gGrassSpecies
+		const GrassQuerySpecies species[MAX_GRASS_SPECIES] = {
+			{ 1.0f,  0.4f,  0.9f,  5.0f, 14.0f, 1 },
+			{ 1.5f,  0.9f,  1.6f,  1.2f,  2.8f, 1 },
+			{ 0.35f, 0.15f, 0.45f, 12.0f, 26.0f, 1 },
+			{ 0.3f,  0.3f,  0.7f,  5.0f, 10.0f, 1 },
+		};
+		GrassQueryField field;
+		memset(&field, 0, sizeof(field));
+		field.mTileDimension = (float)DEFAULT_GRASS_TILE_DIMENSION;
+		field.mTileCountX = tileCountX;
+		field.mTileCountY = tileCountY;
+		field.pTileSeeds = &mTiles[2];
+		field.pSpeciesMixes = &mTiles[3];
+		field.mTileStride = 4*sizeof(uint32_t);
+		field.mBladesPerTile = 10000000/tileCount;
+		field.mMaxInstancesPerTile = MAX_GRASS_CAP/tileCount;
+		field.mSpeciesCount = MAX_GRASS_SPECIES;
+		memcpy(field.mSpecies, species, sizeof(species));
+		field.mMaxNaturalAngle = TAU*0.1f;
+		field.mMaxFloorY = 80.0f;
+		field.mTerrainSize[0] = TERRAIN_WIDTH;
+		field.mTerrainSize[1] = TERRAIN_HEIGHT;
+		field.mHeightSamplePercent = (float)HEIGHT_MAP_SAMPLE_FOR_HEIGHT_PERCENT;
+		field.mHeightField.pHeights = mHeights.data();
+		field.mHeightField.mWidth = heightMapSize;
+		field.mHeightField.mHeight = heightMapSize;
+		
+		grassQueryInit(&mQuery, 0);
+		grassQuerySetField(&mQuery, &field);
+	}
+	void tearDown() override {
+		grassQueryExit(&mQuery);
+	}
+};
+
+// Arg rays fanned out from eye height at the middle of the terrain, like --grass-queries.
+// Tiles are generated on the first iteration and cached after that.
+BENCHMARK_F(GrassQueryFixture, Raycast)(BenchmarkState &state) {
+	const uint32_t rayCount = (uint32_t)state.range();
+	const float x = TERRAIN_WIDTH/2, z = TERRAIN_HEIGHT/2;
+	GrassQueryTileBlades const *pTile = grassQueryTile(&mQuery, (uint32_t)(z/DEFAULT_GRASS_TILE_DIMENSION)*mQuery.mField.mTileCountX+(uint32_t)(x/DEFAULT_GRASS_TILE_DIMENSION));
+	const float origin[3] = { x, pTile->mBaseMaxY+2.0f, z };
+	while (state.keepRunning()) {
+		uint32_t hits = 0;
+		for (uint32_t i = 0; i < rayCount; i += 1) {
+			const float r = 0.25f*sqrtf((float)i/(float)rayCount);
+			const float angle = (float)i*2.39996323f;
+			const float direction[3] = { r*cosf(angle), -0.1f+r*sinf(angle), 1.0f };
+			GrassQueryHit hit;
+			hits += grassQueryRaycast(&mQuery, origin, direction, 300.0f, &hit) ? 1 : 0;
+		}
+		doNotOptimize(hits);
+	}
+	state.mItemsProcessed = state.mIterations*rayCount;
+}
+REGISTER_F(GrassQueryFixture, Raycast).arg(64).arg(1024);
+
+// The same rays through grassQueryRaycast4(), 4 consecutive ones at a time
+BENCHMARK_F(GrassQueryFixture, Raycast4)(BenchmarkState &state) {
+	const uint32_t rayCount = (uint32_t)state.range();
+	const float x = TERRAIN_WIDTH/2, z = TERRAIN_HEIGHT/2;
+	GrassQueryTileBlades const *pTile = grassQueryTile(&mQuery, (uint32_t)(z/DEFAULT_GRASS_TILE_DIMENSION)*mQuery.mField.mTileCountX+(uint32_t)(x/DEFAULT_GRASS_TILE_DIMENSION));
+	const float origins[4][3] = {
+		{ x, pTile->mBaseMaxY+2.0f, z }, { x, pTile->mBaseMaxY+2.0f, z },
+		{ x, pTile->mBaseMaxY+2.0f, z }, { x, pTile->mBaseMaxY+2.0f, z },
+	};
+	while (state.keepRunning()) {
+		uint32_t hits = 0;
+		for (uint32_t i = 0; i < rayCount; i += 4) {
+			float directions[4][3];
+			for (uint32_t lane = 0; lane < 4; lane += 1) {
+				const float r = 0.25f*sqrtf((float)(i+lane)/(float)rayCount);
+				const float angle = (float)(i+lane)*2.39996323f;
+				directions[lane][0] = r*cosf(angle);
+				directions[lane][1] = -0.1f+r*sinf(angle);
+				directions[lane][2] = 1.0f;
+			}
+			GrassQueryHit hit[4];
+			hits += grassQueryRaycast4(&mQuery, origins, directions, 300.0f, hit);
+		}
+		doNotOptimize(hits);
+	}
+	state.mItemsProcessed = state.mIterations*rayCount;
+}
+REGISTER_F(GrassQueryFixture, Raycast4).arg(64).arg(1024);
+
+// Blades within arg meters of a point on the ground
+BENCHMARK_F(GrassQueryFixture, GatherRadius)(BenchmarkState &state) {
+	const float radius = (float)state.range();
+	const float x = TERRAIN_WIDTH/2, z = TERRAIN_HEIGHT/2;
+	const float center[3] = { x, mQuery.mField.mMaxFloorY*grassQuerySampleHeight(&mQuery.mField, x, z), z };
+	GrassQueryBlade blades[256];
+	while (state.keepRunning()) {
+		uint32_t count = grassQueryGatherRadius(&mQuery, center, radius, blades, (uint32_t)ARRAY_COUNT(blades));
+		doNotOptimize(count);
+		clobberMemory();
+	}
+	state.mItemsProcessed = state.mIterations;
+}
+REGISTER_F(GrassQueryFixture, GatherRadius).arg(2).arg(8);
+
+// Blades in a box arg meters on a side, spanning every height
+BENCHMARK_F(GrassQueryFixture, CountInBox)(BenchmarkState &state) {
+	const float h = (float)state.range()/2.0f;
+	const float x = TERRAIN_WIDTH/2, z = TERRAIN_HEIGHT/2;
+	const float boxMin[3] = { x-h, -1000.0f, z-h };
+	const float boxMax[3] = { x+h, 1000.0f, z+h };
+	while (state.keepRunning()) {
+		uint32_t count = grassQueryCountInBox(&mQuery, boxMin, boxMax);
+		doNotOptimize(count);
+	}
+	state.mItemsProcessed = state.mIterations;
+}
+REGISTER_F(GrassQueryFixture, CountInBox).arg(20).arg(60);
+
+///
+// Main
+//
+
+static bool parseFlag(const char *pArg, const char *pName, const char **ppValue) {
+	size_t len = strlen(pName);
+	if (strncmp(pArg, pName, len) != 0) return false;
+	if (pArg[len] == '=') { *ppValue = pArg+len+1; return true; }
+	if (pArg[len] == 0) { *ppValue = ""; return true; }
+	return false;
+}
+
+int main(int argc, char **argv) {
+	BenchmarkSettings settings;
+
+	for (int i = 1; i < argc; i += 1) {
+		const char *pValue = NULL;
+		if (parseFlag(argv[i], "--benchmark_filter", &pValue))            settings.pFilter = pValue;
+		else if (parseFlag(argv[i], "--benchmark_format", &pValue))       settings.mJson = strcmp(pValue, "json") == 0;
+		else if (parseFlag(argv[i], "--benchmark_out", &pValue))          settings.pOutPath = pValue;
+		else if (parseFlag(argv[i], "--benchmark_min_time", &pValue))     settings.mMinTime = atof(pValue);
+		else if (parseFlag(argv[i], "--benchmark_repetitions", &pValue))  settings.mRepetitions = (uint32_t)atoi(pValue);
+		else if (parseFlag(argv[i], "--benchmark_full", &pValue))         settings.mFull = true;
+		else {
+			fprintf(stderr, "Unknown argument '%s'\n", argv[i]);
+			return 1;
+		}
+	}
+
+	static BenchmarkResult results[MAX_BENCHMARKS*MAX_BENCHMARK_ARGS];
+	uint32_t resultCount = 0;
+
+	for (uint32_t b = 0; b < gBenchmarkCount; b += 1) {
+		const BenchmarkEntry *pEntry = &gBenchmarks[b];
+		uint32_t runCount = pEntry->mArgCount ? pEntry->mArgCount : 1;
+		for (uint32_t a = 0; a < runCount; a += 1) {
+			bool hasArg = pEntry->mArgCount > 0;
+			if (hasArg && pEntry->mFullOnly[a] && !settings.mFull) continue;
+
+			BenchmarkResult *pResult = &results[resultCount];
+			memset(pResult, 0, sizeof(*pResult));
+
+			// Check the filter against the full name before spending time on it
+			char name[128];
+			if (hasArg) snprintf(name, sizeof(name), "%s/%lld", pEntry->pName, (long long)pEntry->mArgs[a]);
+			else        snprintf(name, sizeof(name), "%s", pEntry->pName);
+			if (settings.pFilter && settings.pFilter[0] && !strstr(name, settings.pFilter)) continue;
+
+			runBenchmark(pEntry, hasArg ? pEntry->mArgs[a] : 0, hasArg, &settings, pResult);
+			resultCount += 1;
+
+			if (!settings.mJson) {
+				fprintf(stderr, "%s done\n", pResult->mName);
+			}
+		}
+	}
+
+	if (settings.mJson) writeJson(stdout, results, resultCount, &settings);
+	else                writeConsole(stdout, results, resultCount);
+
+	if (settings.pOutPath) {
+		FILE *f = fopen(settings.pOutPath, "w");
+		if (!f) {
+			fprintf(stderr, "Failed to open '%s' for writing\n", settings.pOutPath);
+			return 1;
+		}
+		writeJson(f, results, resultCount, &settings);
+		fclose(f);
+	}
+
+	return 0;
+}
@@ -8,10 +8,21 @@
 		
 	Major techniques used:
 		- Instanced drawing of grass meshes and terrain. Completely procedural.
-		- Mesh LOD's
+		- Mesh LOD's, with several blades per instance at the farther ones
+		- Optionally, procedural blades built from the vertex index with continuous LOD
+		- Sub-pixel far grass splatted in compute instead of rasterized
 		- Tile-based grass density LOD's
 		- Distance-based widening of grass models, to improve aliasing in far-away grass
 		- Wind simulation based of perlin-noise
+		- Multi-view grass culling (rear mirror, minimap) in a single compute dispatch
+		- Coherent culling, only tiles whose result could have changed since last frame are retested
+		- Far-field grass shading on the terrain, so the blades can fade out well before the horizon
+		- Optionally, temporal grass: far blades spread over several frames & reprojected
+		- Or the far field redrawn a sector at a time, reprojected in between
+		- Several grass species (clover, weeds, flowers) mixed per tile, from the same culling pass & draws
+		- CPU grass queries (raycasts, counts, gathers) that place blades exactly like the shaders, see grass_query.h
+		- Runtime terrain sculpting, only the edited rows are uploaded & only the tiles under them culled again
+		- Optionally, a render thread a frame behind Update(), fed immutable per-frame snapshots
 		
 	Note:
 	
@@ -23,6 +34,16 @@
 		clear sections.
 		
 		If your colors look wrong, see "@SwapchainFormat".
+		
+		For a CPU/GPU timeline you can open offline, see "Trace capture".
+		
+		To record a flythrough to disk without stalling, see "Frame capture".
+		
+		Sky & terrain show up before the grass has finished loading, see "Startup loading".
+		
+		Barriers between passes are derived from what each pass declares, see "Frame graph".
+		
+		The grass tile size is picked at load & can be tuned per GPU, see "Tile grid".
 */
 
 
@@ -31,13 +52,20 @@
 #include "The-Forge/Common_3/Application/Interfaces/IFont.h"
 #include "The-Forge/Common_3/Application/Interfaces/IProfiler.h"
 #include "The-Forge/Common_3/Application/Interfaces/IUI.h"
+#include "The-Forge/Common_3/Utilities/Interfaces/IFileSystem.h"
+#include "The-Forge/Common_3/Utilities/Interfaces/IThread.h"
+#include "The-Forge/Common_3/Utilities/Threading/Atomics.h"
 
 #include "The-Forge/Common_3/Utilities/RingBuffer.h"
 #include "The-Forge/Common_3/Utilities/Math/Random.h"
 
 #include "The-Forge/Common_3/Application/Interfaces/ICameraController.h"
 
+#include <time.h>
+
 #include "terrain_config.h"
+#include "grass_query.h"
+#include "shader_layouts.h"
 
 #define TAU (PI*2)
 
@@ -46,13 +74,14 @@
 //
 typedef struct LodLevelInfo {
 	float mThreshold;
-	uint32_t mIndexCount;
+	uint32_t mIndexCount; // Of the whole clump, vertex count for procedural blades
 	
-	float pad1;
-	float pad2;
+	uint32_t mBladesPerInstance; // See "Blade clumps"
+	uint32_t mBladeSegments; // 0 when drawing the meshes, see "Procedural blades"
 } LodLevelInfo;
 typedef struct LodSettings {
-	LodLevelInfo mLevels[NUMBER_OF_GRASS_LOD] = {
+	// Defaults match the hand-authored meshes, replaced by Models/grass_lods.txt if there is one
+	LodLevelInfo mLevels[MAX_GRASS_LOD] = {
 		{ 0.0f, 0, 0, 0 },
     	{ 60.0f, 0, 0, 0 },
     	{ 450.0f, 0, 0, 0 },
@@ -61,14 +90,22 @@ typedef struct LodSettings {
 	float mDensityFadeStartPercent = 0.3f;
 	float mMinDensityPercent = 0.4f;
 	float mLowestDetailDistance = 935.0f;
+	uint32_t mLevelCount = 4;
 } LodSettings;
 
+// Part of a buffer heap, bound with an offset & size. See "Buffer heaps".
+typedef struct BufferRange {
+	Buffer              *pBuffer; // The heap's
+	DescriptorDataRange  mRange;
+} BufferRange;
+
 ///
 // Structures reflected in shaders
 //
 typedef struct GrassVertex {
 	float3 mPosition;
 	uint32_t mNormal;
+	uint32_t mClump; // Blade index in the clump | blades per clump << 16
 } GrassVertex;
 
 typedef struct SceneUniformData {
@@ -89,24 +126,40 @@ typedef struct SceneUniformData {
 	float mMaxGrassHeight = 18.5f;
 	uint32_t mMaxInstancesPerTile;
 	float mSampleGranularity = 8;
-	float pad3;
+	float mBladeSegmentScale; // See "Procedural blades"
 	Vector3 mViewDir;
 	Vector3 mCameraPos;
 	Vector3 mGrassBaseColor = Vector3(0.05f, 0.3f, 0.01f);
 	Vector3 mGrassTipColor = Vector3(0.3f, 0.5f, 0.1f);
 	Vector3 mWindDir = Vector3(1, 0, 0.2f);
+	Vector4 mFarGrass; // Fade start, end & blades per m^2, see "Far-field grass"
+	uint32_t mTileGrid[4]; // Tile side, tiles along x & z, tile count. See "Tile grid"
+	// See "Temporal grass", main view only
+	uint32_t mTemporalGrass[4];   // 1 in N blades drawn (0 is off), phase, start of the slot written, row pitch
+	uint32_t mTemporalHistory[4]; // Slots to reproject, then their indices, newest first
+	Matrix4  mTemporalReprojection[TEMPORAL_GRASS_MAX_FRAMES-1];
+	uint32_t mHeightEdits[4]; // Width & height of the sculpted offsets, see "Terrain editing"
 } SceneUniformData;
 
 typedef struct TileEntry {
 	uint32_t mXTile;
 	uint32_t mYTile;
 	uint32_t mTileSeed;
-	uint32_t pad;
+	uint32_t mSpeciesMix; // One byte of weight per species, see "Grass species"
 } TileEntry;
-typedef struct GrassTileData {
-	TileEntry mTiles[GRASS_TILE_COUNT];
-} GrassTileData;
-
+typedef struct GrassSpecies {
+	float3   mBaseColor;
+	float    mDensity;
+	float3   mTipColor;
+	float    pad0;
+	float    mMinWidth;
+	float    mMaxWidth;
+	float    mMinHeight;
+	float    mMaxHeight;
+	uint32_t mFirstLod;
+	uint32_t mLastLod;
+	uint32_t pad1[2];
+} GrassSpecies;
 typedef struct GrassDrawArgument {
 	uint32_t mIndexCount;
     uint32_t mInstanceCount;
@@ -114,11 +167,16 @@ typedef struct GrassDrawArgument {
     uint32_t mVertexOffset;
     uint32_t mStartInstance;
 } GrassDrawArgument;
+typedef struct GrassProceduralDrawArgument {
+	uint32_t mVertexCount;
+    uint32_t mInstanceCount;
+    uint32_t mStartVertex;
+    uint32_t mStartInstance;
+} GrassProceduralDrawArgument;
 
-typedef struct GrassDrawUniformData {
+typedef struct GrassViewData {
 	float3 mViewPosition;
-	uint32_t mPerceivedNumberOfGrass = 10000000;
-	LodSettings mLod;
+	float mLodDistanceScale = 1.0f;
 	
 	// Frustum planes
 	Vector4 rcp;
@@ -129,14 +187,138 @@ typedef struct GrassDrawUniformData {
 	Vector4 ncp;
 	Vector4 fhp; // forward horizontal plane
 	Vector4 fvp; // forward vertical plane
+	
+	Vector4 mMotion; // Accumulated translation & plane rotation, see "Coherent culling"
+} GrassViewData;
+
+typedef struct GrassDrawUniformData {
+	uint32_t mPerceivedNumberOfGrass = 10000000;
+	uint32_t mViewCount = 1;
+	uint32_t mProceduralBlades = 0;
+	uint32_t mCullEpoch; // See "Coherent culling", 0 when it's off
+	LodSettings mLod;
+	
+	GrassViewData mViews[MAX_GRASS_VIEWS];
+	
+	// See "Grass splatting"
+	float mSplatMaxPixels;
+	float mSplatPixelScale; // Pixels per unit of height at distance 1, in the main view
+	uint32_t mSplatWidth;
+	uint32_t mSplatHeight;
+	
+	uint32_t mFarVariantLevel; // See "Grass shader variants"
+	uint32_t mTemporalFrames;  // See "Temporal grass"
+	
+	// See "Grass species"
+	float    mMaxBladeHeight;
+	uint32_t mSpeciesCount = MAX_GRASS_SPECIES;
+	
+	// See "Temporal grass", sector mode
+	uint32_t mTemporalSectors; // 0 is off
+	uint32_t mTemporalRefresh; // Sectors redrawn this frame, one bit each
+	uint32_t mTemporalFrame;
+	uint32_t pad;
+	uint32_t mTemporalSectorFrames[4]; // A uint4, TEMPORAL_GRASS_MAX_FRAMES at most
 } GrassDrawUniformData;
 
+// Only written & read by grass_draw.comp
+typedef struct GrassTileCullState {
+	uint32_t mResult;
+	uint32_t mEpoch;
+	float mTranslation;
+	float mRotation;
+	float mFrustumSlack;
+	float mLever;
+	float mDistanceSlack;
+	uint32_t mLayerFrame; // See "Temporal grass", sector mode
+} GrassTileCullState;
+
 typedef struct SkyboxUniformData {
 	Matrix4 mView;
 	CameraMatrix mProjection;
 } SkyboxUniformData;
 
-const uint32_t gNumberOfFrames = 3;
+// Benchmarks/cpu_benchmarks.cpp checks its mirrors against the same table
+SHADER_LAYOUT_CHECK()
+
+///
+// Frame pacing
+//
+// Per frame resources (ubo's, descriptor sets) are allocated for gMaxFramesInFlight,
+// but only the first gFramesInFlight are cycled through. Changing it at runtime only
+// recreates the command ring.
+const uint32_t gMaxFramesInFlight = 4;
+uint32_t gFramesInFlight = 3;
+uint32_t gRequestedFramesInFlight = 3; // Set from UI/command line, applied at the start of Draw()
+
+// Submit culling & terrain as soon as they're recorded, so the GPU can start
+// on them while we're still recording grass & UI.
+bool gSplitSubmission = true;
+
+// Wait for the GPU to finish everything before sampling input in Update(). Trades
+// CPU/GPU overlap for having the freshest input possible in every frame.
+bool gLowLatencyMode = false;
+
+// CPU time of GPU timestamps, see gpuClockCalibrate()
+typedef struct GpuClock {
+	double   mTicksPerUs;
+	uint64_t mCalibrationTicks; // This GPU timestamp
+	int64_t  mCalibrationUs;    // happened at this CPU time
+} GpuClock;
+
+// Input to present latency. We timestamp input sampling, and consider the frame presented
+// when the GPU finishes its last command buffer (which is what present waits on), going by
+// a timestamp written at the end of it. So it doesn't matter how late we notice the fence.
+// Vsync/compositor time after that isn't visible to us.
+typedef struct LatencyStats {
+	int64_t mInputTimeUs[gMaxFramesInFlight];  // When input was sampled for the frame in this slot
+	Fence  *pFences[gMaxFramesInFlight];       // Signaled when the frame in this slot is done
+	bool    mPending[gMaxFramesInFlight];      // Submitted, but not observed complete yet
+	QueryPool *pQueryPools[gMaxFramesInFlight]; // End of the frame in this slot on the GPU
+	GpuClock   mGpuClock;
+	float   mLastMs;
+	float   mAverageMs;                        // Exponential moving average
+	float   mMaxMs;                            // Max over the last second-ish, for spotting spikes
+	uint32_t mMaxAge;
+} LatencyStats;
+LatencyStats gLatencyStats = {};
+int64_t gInputSampleTimeUs = 0;
+Fence *pLastSubmittedFence = NULL;
+
+///
+// Views
+//
+// Every view gets its own scene/skybox ubo's and its own compacted list of grass
+// draws, but they all share a single culling dispatch. View 0 is the main camera,
+// the others are placed relative to it every frame.
+typedef enum ViewKind {
+	VIEW_KIND_MAIN,
+	VIEW_KIND_REAR_MIRROR,
+	VIEW_KIND_MINIMAP,
+} ViewKind;
+typedef struct RenderView {
+	ViewKind mKind;
+	// Viewport, in percent of the render target
+	float mViewportX;
+	float mViewportY;
+	float mViewportWidth;
+	float mViewportHeight;
+	float mLodDistanceScale;
+	
+	// Filled in Update()
+	Matrix4      mView;
+	CameraMatrix mProjection;
+	CameraMatrix mCameraToClip;
+	Vector3      mViewDir;
+	Vector3      mCameraPos;
+} RenderView;
+
+RenderView gViews[MAX_GRASS_VIEWS] = {
+	{ VIEW_KIND_MAIN,        0.0f,   0.0f,  1.0f,  1.0f,  1.0f },
+	{ VIEW_KIND_REAR_MIRROR, 0.35f,  0.02f, 0.3f,  0.15f, 2.0f },
+	{ VIEW_KIND_MINIMAP,     0.78f,  0.02f, 0.2f,  0.2f,  3.0f },
+};
+uint32_t gViewCount = 1;
 
 ///
 // Base graphics resources
@@ -155,41 +337,289 @@ DescriptorSet      *pDescriptorSetTerrainUbo      = { NULL };
 
 ///
 // Grass resources
-Shader           *pGrassShader                    = NULL;
-Pipeline         *pGrassPipeline                  = NULL;
-Buffer           *pGrassTileBuffer                = NULL; // Readonly, we only need one
+Shader           *pGrassShaders[GRASS_VARIANT_COUNT]   = { NULL };
+Pipeline         *pGrassPipelines[GRASS_VARIANT_COUNT] = { NULL };
+BufferRange      gGrassTileData                  = {};   // In gStaticHeap, readonly, we only need one
 Buffer           *pGrassInstanceVbo               = NULL;
 // We need to get a single integer index to each draw call of each grass tile.
 // I REALLY wanted to use vulkan push constant/d3d12 root signature constant here.
 // I couldn't figure out a way to do so with the The Forge, so now I'm making 100's
 // of tiny ubo's instead...
 DescriptorSet    *pDescriptorSetGrass             = { NULL };
-GrassTileData    gGrassTileData                   = {};
 VertexLayout     gGrassVertexLayoutForLoading     = {}; // We need per instance layout, but model loader will be unhappy about that.
 VertexLayout     gGrassVertexLayoutForDrawing     = {};
-Geometry         *pGrassGeoms[NUMBER_OF_GRASS_LOD]     = { NULL }; // 4 LOD levels
-GeometryData     *pGrassGeomDatas[NUMBER_OF_GRASS_LOD] = { NULL };
+Geometry         *pGrassGeoms[MAX_GRASS_LOD]     = { NULL }; // gGrassDrawUniformData.mLod.mLevelCount are used
+GeometryData     *pGrassGeomDatas[MAX_GRASS_LOD] = { NULL };
 Buffer           *pGrassVbo = NULL;
 Buffer           *pGrassIbo = NULL;
-Buffer           *pGrassDrawBuffer                = NULL;
+// Blade clumps
+//
+// At the farther LOD's a blade is only a handful of triangles, so one blade per instance
+// means we're mostly paying per-instance overhead and running half empty vertex waves.
+// Instead each LOD level's mesh is repeated into a clump of N blades when the meshes are
+// merged, with every vertex knowing which blade of the clump it belongs to. The vertex
+// shader places each blade from its own seed like before, so a clump looks exactly like N
+// separate instances, and blade k of a tile gets the same seed at every LOD.
+//
+// Levels get as many blades as it takes to reach GRASS_CLUMP_TARGET_VERTICES, up to
+// GRASS_MAX_CLUMP_SIZE. LOD 0 always stays 1 blade per instance.
+#define GRASS_CLUMP_TARGET_VERTICES 64
+#define GRASS_MAX_CLUMP_SIZE        16
+bool             gGrassClumps = true; // --no-grass-clumps
+// What mergeGrassMeshes() came up with for each level
+typedef struct GrassMeshLod {
+	uint32_t mIndexCount; // Of the whole clump
+	uint32_t mBladesPerInstance;
+} GrassMeshLod;
+GrassMeshLod     gGrassMeshLods[MAX_GRASS_LOD] = {};
+// Procedural blades
+//
+// Instead of the LOD meshes, grass_procedural.vert can build each blade as a tapered strip
+// from SV_VertexID, so there's no vertex/index buffer to fetch from (only the instance buffer)
+// and the draws are non-indexed. A blade of S segments is 2S-1 triangles.
+//
+// Segments follow 1/distance, so they stay about the same size on screen: blades closer than
+// gBladeSegmentDistance get gBladeSegmentsNear. Each LOD level's draws get enough segments for
+// the closest blade they can be used for (see updateGrassLodDraws()), and each blade then
+// folds away the segments it doesn't need, with a fractional count so detail fades out
+// continuously instead of popping at LOD boundaries.
+#define GRASS_MAX_BLADE_SEGMENTS 16
+bool             gProceduralBlades = false; // --procedural-grass
+float            gBladeSegmentsNear = 10.0f;
+float            gBladeSegmentDistance = 30.0f;
+Shader           *pGrassProceduralShaders[GRASS_VARIANT_COUNT]   = { NULL };
+Pipeline         *pGrassProceduralPipelines[GRASS_VARIANT_COUNT] = { NULL };
+VertexLayout     gGrassVertexLayoutProcedural     = {};
+// Grass shader variants
+//
+// Past the first few LOD's, blades are a few pixels wide and most of the grass vertex shader
+// is spent on detail nobody can see. So grass.vert & grass.frag are also compiled with
+// GRASS_FAR_VARIANT (see ShaderList.fsl), which
+//  - bends the blade by natural lean & wind by rotating the vertex about each axis in turn,
+//    instead of building & multiplying an axis-angle matrix for each
+//  - drops the time-varying sway of the natural lean
+//  - drops the billboarding, along with its extra clip space transform
+//  - drops the rounded normals, and the 2 interpolants they need
+// Blade placement, size & seed are the same, so a blade doesn't move when its tile changes variant.
+//
+// LOD levels whose threshold is at or past gGrassFarVariantDistance use the far variant.
+// grass_draw.comp appends each tile to a list per view & variant, and each list is drawn
+// with one indirect draw & its own pipeline.
+float            gGrassFarVariantDistance = 60.0f; // --far-variant-distance
+Buffer           *pGrassProceduralDrawBuffer      = NULL; // Same as pGrassDrawBuffer, but non-indexed
+Buffer           *pGrassDrawBuffer                = NULL; // gTileGrid.mCount*MAX_GRASS_SPECIES draws per view & variant, compacted
+Buffer           *pGrassDrawCountBuffer           = NULL; // Number of draws filled in per view & variant
+BufferRange      gGrassDrawCountReset            = {};   // In gStaticHeap, zeroes copied into the count buffer each frame
 Shader           *pGrassDrawShader                = NULL;
 RootSignature    *pGrassDrawRootSignature         = NULL;
 Pipeline         *pGrassDrawComputePipeline       = NULL;
 DescriptorSet    *pDescriptorSetGrassDrawCompute  = NULL;
-Buffer           *pGrassDrawUbos[gNumberOfFrames] = {};
+BufferRange      gGrassDrawUbos[gMaxFramesInFlight]  = {}; // In gUploadHeap
 GrassDrawUniformData gGrassDrawUniformData        = {};
 
+///
+// Grass splatting
+//
+// Far away blades are smaller than a pixel, and the rasterizer shades in 2x2 quads, so most of
+// the work spent on them is thrown away. Instead, the culling pass hands main view tiles whose
+// tallest blade is below gSplatMaxPixels to grass_splat.comp. It draws each blade as a short
+// line of pixels into pGrassSplatBuffer, with one AtomicMax of packed depth & shading per pixel
+// (see grass_splat.h.fsl). A fullscreen pass then resolves that into the main view with depth,
+// before the skybox. Other views always rasterize. 0 turns splatting off.
+float            gSplatMaxPixels = 1.0f; // --splat-pixels <px>
+Buffer           *pGrassSplatBuffer               = NULL; // One uint per pixel of the swapchain, see addRenderTargets()
+Buffer           *pGrassSplatTileBuffer           = NULL; // Tile index & blade count, for each splatted tile
+Buffer           *pGrassSplatArgsBuffer           = NULL; // Indirect dispatch, one group per splatted tile
+BufferRange      gGrassSplatArgsReset            = {};   // In gStaticHeap, { 0, 1, 1 } copied into the args each frame
+Shader           *pGrassSplatClearShader          = NULL;
+Shader           *pGrassSplatShader               = NULL;
+Shader           *pGrassSplatResolveShader        = NULL;
+RootSignature    *pGrassSplatRootSignature        = NULL; // Clear & splat
+RootSignature    *pGrassSplatResolveRootSignature = NULL;
+Pipeline         *pGrassSplatClearPipeline        = NULL;
+Pipeline         *pGrassSplatPipeline             = NULL;
+Pipeline         *pGrassSplatResolvePipeline      = NULL;
+DescriptorSet    *pDescriptorSetGrassSplat                = NULL;
+DescriptorSet    *pDescriptorSetGrassSplatPerFrame        = NULL;
+DescriptorSet    *pDescriptorSetGrassSplatResolve         = NULL;
+DescriptorSet    *pDescriptorSetGrassSplatResolvePerFrame = NULL;
+
+///
+// Temporal grass
+//
+// Matching the look of mPerceivedNumberOfGrass takes that many blades every frame. Instead, the
+// main view's far variant tiles (see "Grass shader variants") can draw 1 in N of their blades,
+// a different one each frame (the blade index is offset by a per-frame phase, jittered per tile
+// by its seed), and show the other N-1 from the frames before:
+//   - grass_far.frag packs each pixel it draws like a splat (depth, height & sun term) into
+//     this frame's slot of pGrassTemporalBuffer
+//   - before the terrain, grass_temporal.comp reprojects the last N-1 slots to this frame's
+//     camera into the splat buffer, and clears the slot this frame writes
+//   - the splat resolve depth tests them against this frame's terrain & grass
+// Anything that moved in front of an old blade hides it. If the main camera has moved or
+// turned too far since one of those frames (a cut, or faster than reprojecting holes up), the
+// history is dropped and that frame draws every blade. Wind isn't reprojected, so old blades
+// lag their sway by up to N-1 frames, which is why it's only used where blades are small.
+// Near tiles always draw all of their blades at full precision.
+//
+// Sector mode (--temporal-grass-sectors) splits the work by tile instead: the far variant tiles
+// are dealt into N sectors by their seed, so each sector is spread evenly over the far field,
+// and a frame redraws every blade of one sector, round-robin. The slots then hold the far field
+// as each sector was last drawn, and are reprojected the same way, so the far field's GPU cost
+// drops by about N where blade thinning only saves on vertices. Anything missing is drawn this
+// frame rather than left as a hole until its sector comes round:
+//   - a sector whose slot was drawn from too far away (or any older than such a slot, they'd
+//     have been reprojected through it) is redrawn, the other slots are kept
+//   - a tile that wasn't drawn when its sector last was (it was near, splatted or out of view)
+//     is drawn, grass_draw.comp keeps the frame each tile was last drawn in the cull state
+// A slot lives for N frames & each sector is redrawn at least every N, so every far tile is
+// always in a slot that's reprojected.
+typedef struct TemporalGrass {
+	uint32_t mFrames;            // Blades or sectors are spread over this many frames, 1 is off. --temporal-grass <frames>
+	uint32_t mRequestedFrames;   // From the UI, see applyTemporalGrass()
+	bool     mBySector;          // --temporal-grass-sectors
+	bool     mRequestedBySector;
+	float    mMaxMotion;         // Meters & radians the main camera can move & turn since a frame
+	float    mMaxTurn;           // before its history is dropped
+	
+	uint32_t mFrame;      // Picks the phase & the slot written
+	uint32_t mDrawFrames; // This frame draws 1 in this many far blades. 0 is off, 1 when the history was dropped
+	uint32_t mDroppedFrames;
+	
+	// The main view each slot was drawn with
+	bool     mSlotValid[TEMPORAL_GRASS_MAX_FRAMES];
+	Matrix4  mSlotCameraToClip[TEMPORAL_GRASS_MAX_FRAMES];
+	Vector3  mSlotCameraPos[TEMPORAL_GRASS_MAX_FRAMES];
+	Vector3  mSlotViewDir[TEMPORAL_GRASS_MAX_FRAMES];
+	
+	// Sector mode, the frame each sector was last drawn in
+	bool     mSectorDrawn[TEMPORAL_GRASS_MAX_FRAMES];
+	uint32_t mSectorFrame[TEMPORAL_GRASS_MAX_FRAMES];
+	uint32_t mRefreshedSectors; // This frame
+	uint32_t mForcedRefreshes;  // Sectors redrawn before their turn
+} TemporalGrass;
+TemporalGrass    gTemporalGrass = { 1, 1, false, false, 4.0f, 0.15f };
+Buffer           *pGrassTemporalBuffer            = NULL; // mFrames slots of one uint per pixel, see addRenderTargets()
+Shader           *pGrassTemporalShader            = NULL;
+Pipeline         *pGrassTemporalPipeline          = NULL; // Uses pGrassSplatRootSignature
+
+///
+// Grass species
+//
+// Rather than a set of buffers, a culling pass & draws per kind of plant, every blade belongs to
+// one of MAX_GRASS_SPECIES species in gGrassSpecies: colors, size range, density & which of the
+// LOD meshes it's drawn with. Each tile has a mix (TileEntry::mSpeciesMix, from low frequency
+// noise over the terrain, so clover & flowers come in patches), and grass_draw.comp splits the
+// tile's blades by it, emitting one draw per species into the same per view & variant list.
+// Each species gets a range of the tile's instances in proportion to its share of the blades,
+// & the vertex shader gets the species from the instance (see grass_species.h.fsl), so it's still
+// one indirect draw & one pipeline per variant, however many species there are.
+//
+// Species 0 is the plain grass, & follows the grass colors & sizes in the UI. The table is small,
+// so it's uploaded every frame like the ubo's. Splatted & reprojected blades keep their species
+// too, it takes two bits of the splat's depth (see grass_splat.h.fsl).
+GrassSpecies     gGrassSpecies[MAX_GRASS_SPECIES] = {
+	// Base color, density, tip color, pad, width, height, mesh LOD's
+	{ float3(0.0f), 1.0f, float3(0.0f), 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0, MAX_GRASS_LOD-1, {} },   // Grass, from gSceneUniformData
+	{ float3(0.03f, 0.22f, 0.02f), 1.5f, float3(0.12f, 0.42f, 0.08f), 0.0f, 0.9f, 1.6f, 1.2f, 2.8f, 1, MAX_GRASS_LOD-1, {} },   // Clover, short enough for the coarser meshes
+	{ float3(0.12f, 0.22f, 0.03f), 0.35f, float3(0.55f, 0.5f, 0.2f), 0.0f, 0.15f, 0.45f, 12.0f, 26.0f, 0, MAX_GRASS_LOD-1, {} }, // Weeds
+	{ float3(0.05f, 0.3f, 0.02f), 0.3f, float3(0.95f, 0.8f, 0.15f), 0.0f, 0.3f, 0.7f, 5.0f, 10.0f, 0, MAX_GRASS_LOD-1, {} },     // Flowers
+};
+BufferRange      gGrassSpeciesBuffers[gMaxFramesInFlight] = {}; // In gUploadHeap
+
+// Smooth noise in [0, 1] over the terrain, with a 160m lattice
+float grassSpeciesNoise(float x, float z, uint32_t seed) {
+	const float cell = 160.0f;
+	int32_t ix = (int32_t)floorf(x/cell);
+	int32_t iz = (int32_t)floorf(z/cell);
+	float fx = x/cell-(float)ix;
+	float fz = z/cell-(float)iz;
+	fx = fx*fx*(3.0f-2.0f*fx);
+	fz = fz*fz*(3.0f-2.0f*fz);
+	
+	float corners[4];
+	for (uint32_t i = 0; i < 4; i += 1) {
+		uint32_t h = (uint32_t)(ix+(int32_t)(i & 1))*73856093u ^ (uint32_t)(iz+(int32_t)(i >> 1))*19349663u ^ seed*83492791u;
+		h = ((h >> 16) ^ h)*0x45d9f3bu;
+		h = ((h >> 16) ^ h)*0x45d9f3bu;
+		h = (h >> 16) ^ h;
+		corners[i] = (float)h/(float)0xFFFFFFFFu;
+	}
+	float top = corners[0]+(corners[1]-corners[0])*fx;
+	float bottom = corners[2]+(corners[3]-corners[2])*fx;
+	return top+(bottom-top)*fz;
+}
+
+// Species weights of the tile centered at x, z, one byte each. Grass always keeps a share, so
+// grass_draw.comp never sees an empty mix.
+uint32_t grassSpeciesMix(float x, float z) {
+	float weights[MAX_GRASS_SPECIES];
+	weights[1] = fminf(fmaxf((grassSpeciesNoise(x, z, 1)-0.55f)*4.0f, 0.0f), 1.0f);      // Clover
+	weights[2] = fminf(fmaxf((grassSpeciesNoise(x, z, 2)-0.6f)*3.0f, 0.0f), 1.0f)*0.6f;  // Weeds
+	weights[3] = fminf(fmaxf((grassSpeciesNoise(x, z, 3)-0.65f)*5.0f, 0.0f), 1.0f)*0.5f; // Flowers
+	weights[0] = fmaxf(1.0f-weights[1]-weights[2]-weights[3], 0.2f);
+	
+	float total = 0.0f;
+	for (uint32_t i = 0; i < MAX_GRASS_SPECIES; i += 1) total += weights[i];
+	uint32_t mix = 0;
+	for (uint32_t i = 0; i < MAX_GRASS_SPECIES; i += 1) mix |= (uint32_t)(weights[i]/total*255.0f+0.5f) << (8*i);
+	return mix;
+}
+
+///
+// Far-field grass
+//
+// The terrain used to be a flat green that looked nothing like lit grass, so the grass had to
+// reach the horizon to hide it. Instead, past gFarGrassStart terrain.frag blends towards what
+// the grass field averages out to per pixel: coverage from the blade density & view angle, the
+// base to tip blend of the part of the blades that's visible, the mean sun term of randomly
+// rotated blades, and the same wind field leaning them. Sizes & colors are blended over the
+// species of the tile under the pixel, by how much of the view each covers, so a clover patch
+// stays a clover patch past the fade. All from SceneData, the tile data & the species table, so
+// it follows the UI. Over the same range the culling pass fades the blade count to zero, so by
+// gFarGrassEnd there's no grass left to draw and no seam where it stops.
+bool             gFarGrass = true; // --no-far-grass
+float            gFarGrassStart = 350.0f; // --far-grass <start> <end>
+float            gFarGrassEnd = 500.0f;
+
+///
+// Coherent culling
+//
+// Most frames the camera barely moves, so most tiles come out of culling exactly like they did
+// last frame. grass_draw.comp keeps each tile's result per view in pGrassCullStateBuffer, along
+// with how far the view can move & turn before that result could change. Every frame we
+// accumulate how far each view has moved and how far its frustum planes have turned, and only
+// tiles that have used up their slack are tested again (the others are still appended to the
+// draw lists). Anything else culling depends on (LOD, density & splat settings, view count...)
+// bumps the epoch, which retests everything. If nothing moved or changed at all, the culling
+// dispatch is skipped and last frame's draws are reused, unless temporal grass is picking sectors,
+// which it does in that dispatch & differently every frame.
+#define COHERENT_MOTION_RESET 10000.0f // Accumulated motion is rebased before float precision suffers
+
+typedef struct CoherentCulling {
+	bool     mEnabled;     // --no-coherent-culling
+	uint32_t mEpoch;       // Never 0, that's "off" in the shader
+	uint32_t mCulledEpoch; // Epoch of the last culling dispatch
+	bool     mViewsMoved;  // In the last Update()
+	
+	// What was checked last frame. Parameters have the views' positions, planes & motion cleared.
+	GrassDrawUniformData mLastParameters;
+	float                mLastSceneParameters[6];
+	float3               mLastPositions[MAX_GRASS_VIEWS];
+	Vector4              mLastPlanes[MAX_GRASS_VIEWS][8];
+} CoherentCulling;
+CoherentCulling gCoherentCulling = { true, 1 };
+Buffer          *pGrassCullStateBuffer = NULL; // GrassTileCullState per view per tile
 
 ///
 // Skybox resources 
 Shader             *pSkyboxShader                = NULL;
 Pipeline           *pSkyboxPipeline              = NULL;
-Buffer             *pSkyboxUbos[gNumberOfFrames] = {};
+BufferRange        gSkyboxUbos[gMaxFramesInFlight][MAX_GRASS_VIEWS] = {}; // In gUploadHeap
 SkyboxUniformData  gSkyboxUniformData            = {};
 DescriptorSet      *pDescriptorSetSkyboxUbos     = { NULL };
 DescriptorSet      *pDescriptorSetSkyboxTextures = { NULL };
-// 0: back -> 1: left -> 2: front -> 3: right -> 4: bottom -> 5: top
-Texture            *pSkyboxTextures[6]           = { NULL }; 
+Texture            *pSkyboxTexture               = NULL;
 
 ///
 // Shared resources
@@ -199,26 +629,967 @@ Texture           *pHeightMap               = NULL;
 Sampler           *pSampler                 = NULL;
 ICameraController *pCameraController        = NULL;
 RenderTarget      *pDepthBuffer             = NULL;
+RenderTarget      *pSecondaryViewDepthBuffer = NULL; // Shared by all views but the main one
 UIComponent       *pGuiWindow              = NULL;
-Buffer            *pSceneUbos[gNumberOfFrames] = {};
-SceneUniformData  gSceneUniformData;
+BufferRange       gSceneUbos[gMaxFramesInFlight][MAX_GRASS_VIEWS] = {}; // In gUploadHeap
+SceneUniformData  gSceneUniformData; // Camera members are overwritten per view when uploaded
 
 uint32_t          gFrameIndex;
+uint32_t          gCmdRingFrameCount = 0; // How many pools the current gGraphicsCmdRing was made with
 uint32_t          gFontID = 0;
 ProfileToken      gGpuProfileToken = PROFILE_INVALID_TOKEN;
 ProfileToken      pGrassUpdateToken = PROFILE_INVALID_TOKEN;
 ProfileToken      gQueueSubmitToken = PROFILE_INVALID_TOKEN;
+ProfileToken      gUpdateToken = PROFILE_INVALID_TOKEN;
+ProfileToken      gAcquireImageToken = PROFILE_INVALID_TOKEN;
+ProfileToken      gUboUpdateToken = PROFILE_INVALID_TOKEN;
+ProfileToken      gRecordCommandsToken = PROFILE_INVALID_TOKEN;
+ProfileToken      gPresentToken = PROFILE_INVALID_TOKEN;
+
+///
+// Startup loading
+//
+// Nothing in Init() waits for the resource loader. Loads are issued in dependency order and
+// polled once per frame in updateStartupLoading(), and each feature is drawn as soon as its
+// inputs have landed:
+//
+//     height map, skybox                                      -> terrain & sky
+//     height map, grass LOD meshes -> merged vbo/ibo,
+//         instance fill (worker thread) -> instance vbo, tile data -> grass (incl. culling)
+//
+// Time-to-first-frame (first frame presented with terrain & sky) and time-to-full-quality
+// (first frame presented with grass) are measured from the start of Init() and logged.
+typedef struct StartupLoading {
+	int64_t   mStartUs;
+
+	SyncToken mSkyAndTerrainToken;  // Height map, skybox
+	SyncToken mGrassMeshToken;      // LOD meshes, then the merged vbo/ibo
+	SyncToken mGrassBufferToken;    // Instance vbo. Queued after the static heap's uploads, so covers them
+
+	// The instance vbo is 100M sequential indices. Filled on a worker so the first frames don't wait for it.
+	uint32_t        *pGrassInstanceData;
+	ThreadHandle    mInstanceFillThread;
+	tfrg_atomic32_t mInstanceFillDone;
+	bool            mInstanceFillJoined;
+
+	bool mSkyAndTerrainReady;
+	bool mGrassMeshMerged;
+	bool mGrassInstancesQueued;
+	bool mGrassReady;
+
+	int64_t mFirstFrameUs;
+	int64_t mFullQualityUs;
+} StartupLoading;
+StartupLoading gStartup = {};
+
+void fillGrassInstanceData(void *pUserData) {
+	uint32_t *pData = (uint32_t*)pUserData;
+	for (uint32_t i = 0; i < MAX_GRASS_CAP; i += 1) {
+		pData[i] = i;
+	}
+	tfrg_atomic32_store_release(&gStartup.mInstanceFillDone, 1);
+}
 
 ///
 // Utility
 //
 
+// Index into per frame descriptor sets that have one entry per view
+uint32_t viewSetIndex(uint32_t frameIndex, uint32_t viewIndex) {
+	return frameIndex*MAX_GRASS_VIEWS+viewIndex;
+}
+
+///
+// Memory accounting
+//
+// Every GPU resource & big host allocation is registered with a category and its size, so we
+// can see where memory goes per subsystem, and check it against a budget (lower-end SKUs).
+// Buffers & render targets go through addTracked*()/removeTracked*(). Textures & meshes are
+// created by the loader thread, so they're registered once their loads have completed.
+//
+// Sizes are what we asked for, not what the driver actually allocated (alignment, padding,
+// metadata), so treat them as a lower bound.
+
+#define MAX_TRACKED_ALLOCATIONS 256
+
+typedef enum MemoryCategory {
+	MEMORY_CATEGORY_GRASS,
+	MEMORY_CATEGORY_TERRAIN,
+	MEMORY_CATEGORY_SKYBOX,
+	MEMORY_CATEGORY_SCENE,          // Per frame, per view scene ubo's
+	MEMORY_CATEGORY_RENDER_TARGETS, // Swapchain & depth buffers
+	MEMORY_CATEGORY_TOOLS,          // Temporary storage, trace & frame capture
+	MEMORY_CATEGORY_COUNT,
+} MemoryCategory;
+const char *gMemoryCategoryNames[MEMORY_CATEGORY_COUNT] = {
+	"Grass",
+	"Terrain",
+	"Skybox",
+	"Scene",
+	"Render targets",
+	"Tools",
+};
+
+typedef struct TrackedAllocation {
+	const void     *pResource;
+	uint64_t       mBytes;
+	MemoryCategory mCategory;
+	bool           mHost;
+} TrackedAllocation;
+typedef struct MemoryCategoryStats {
+	uint64_t mGpuBytes;
+	uint64_t mGpuPeakBytes;
+	uint64_t mHostBytes;
+	uint64_t mHostPeakBytes;
+} MemoryCategoryStats;
+typedef struct MemoryAccounting {
+	TrackedAllocation   mAllocations[MAX_TRACKED_ALLOCATIONS];
+	uint32_t            mAllocationCount;
+	MemoryCategoryStats mCategories[MEMORY_CATEGORY_COUNT];
+	MemoryCategoryStats mTotal;
+
+	// 0 means no budget. Set with --gpu-budget-mb/--host-budget-mb.
+	uint64_t mGpuBudgetBytes;
+	uint64_t mHostBudgetBytes;
+	bool     mEnforceBudget; // --enforce-memory-budget, fail instead of warn
+} MemoryAccounting;
+MemoryAccounting gMemory = {};
+bool gShowMemoryPanel = true;
+
+void memAddBytes(MemoryCategoryStats *pStats, int64_t bytes, bool host) {
+	if (host) {
+		pStats->mHostBytes += bytes;
+		if (pStats->mHostBytes > pStats->mHostPeakBytes) pStats->mHostPeakBytes = pStats->mHostBytes;
+	} else {
+		pStats->mGpuBytes += bytes;
+		if (pStats->mGpuBytes > pStats->mGpuPeakBytes) pStats->mGpuPeakBytes = pStats->mGpuBytes;
+	}
+}
+
+void memTrack(const void *pResource, MemoryCategory category, uint64_t bytes, bool host) {
+	if (!pResource) return;
+	if (gMemory.mAllocationCount >= MAX_TRACKED_ALLOCATIONS) {
+		LOGF(LogLevel::eWARNING, "Memory accounting: out of slots, raise MAX_TRACKED_ALLOCATIONS");
+		return;
+	}
+
+	TrackedAllocation *pAllocation = &gMemory.mAllocations[gMemory.mAllocationCount];
+	pAllocation->pResource = pResource;
+	pAllocation->mBytes = bytes;
+	pAllocation->mCategory = category;
+	pAllocation->mHost = host;
+	gMemory.mAllocationCount += 1;
+
+	memAddBytes(&gMemory.mCategories[category], (int64_t)bytes, host);
+	memAddBytes(&gMemory.mTotal, (int64_t)bytes, host);
+}
+
+void memUntrack(const void *pResource) {
+	if (!pResource) return;
+	for (uint32_t i = 0; i < gMemory.mAllocationCount; i += 1) {
+		TrackedAllocation *pAllocation = &gMemory.mAllocations[i];
+		if (pAllocation->pResource != pResource) continue;
+
+		memAddBytes(&gMemory.mCategories[pAllocation->mCategory], -(int64_t)pAllocation->mBytes, pAllocation->mHost);
+		memAddBytes(&gMemory.mTotal, -(int64_t)pAllocation->mBytes, pAllocation->mHost);
+
+		// Order doesn't matter, swap in the last one
+		gMemory.mAllocationCount -= 1;
+		*pAllocation = gMemory.mAllocations[gMemory.mAllocationCount];
+		return;
+	}
+}
+
+uint64_t memImageBytes(TinyImageFormat format, uint32_t width, uint32_t height, uint32_t depth, uint32_t mipLevels, uint32_t layers) {
+	uint64_t blockBits = TinyImageFormat_BitSizeOfBlock(format);
+	uint32_t blockWidth = TinyImageFormat_WidthOfBlock(format);
+	uint32_t blockHeight = TinyImageFormat_HeightOfBlock(format);
+
+	uint64_t bytes = 0;
+	for (uint32_t mip = 0; mip < mipLevels; mip += 1) {
+		uint32_t w = width >> mip;   if (w == 0) w = 1;
+		uint32_t h = height >> mip;  if (h == 0) h = 1;
+		uint32_t d = depth >> mip;   if (d == 0) d = 1;
+		uint64_t blocks = (uint64_t)((w+blockWidth-1)/blockWidth) * ((h+blockHeight-1)/blockHeight) * d;
+		bytes += blocks*blockBits/8;
+	}
+	return bytes*layers;
+}
+
+void memTrackTexture(const Texture *pTexture, MemoryCategory category) {
+	if (!pTexture) return;
+	memTrack(pTexture, category, memImageBytes((TinyImageFormat)pTexture->mFormat, pTexture->mWidth, pTexture->mHeight,
+		pTexture->mDepth, pTexture->mMipLevels, pTexture->mArraySizeMinusOne+1), false);
+}
+
+uint64_t memRenderTargetBytes(const RenderTarget *pRenderTarget) {
+	return memImageBytes((TinyImageFormat)pRenderTarget->mFormat, pRenderTarget->mWidth, pRenderTarget->mHeight,
+		pRenderTarget->mDepth, 1, pRenderTarget->mArraySize) * (uint32_t)pRenderTarget->mSampleCount;
+}
+
+// Readback memory lives on the host, everything else is counted as VRAM
+void addTrackedBuffer(BufferLoadDesc *pDesc, SyncToken *pToken, MemoryCategory category) {
+	addResource(pDesc, pToken);
+	memTrack(*pDesc->ppBuffer, category, pDesc->mDesc.mSize, pDesc->mDesc.mMemoryUsage == RESOURCE_MEMORY_USAGE_GPU_TO_CPU);
+}
+void removeTrackedBuffer(Buffer *pBuffer) {
+	memUntrack(pBuffer);
+	removeResource(pBuffer);
+}
+
+void addTrackedRenderTarget(Renderer *pRenderer, const RenderTargetDesc *pDesc, RenderTarget **ppRenderTarget, MemoryCategory category) {
+	addRenderTarget(pRenderer, pDesc, ppRenderTarget);
+	if (*ppRenderTarget) memTrack(*ppRenderTarget, category, memRenderTargetBytes(*ppRenderTarget), false);
+}
+void removeTrackedRenderTarget(Renderer *pRenderer, RenderTarget *pRenderTarget) {
+	memUntrack(pRenderTarget);
+	removeRenderTarget(pRenderer, pRenderTarget);
+}
+
+float memToMB(uint64_t bytes) {
+	return (float)((double)bytes/(1024.0*1024.0));
+}
+
+void memLogReport(const char *pWhen) {
+	LOGF(LogLevel::eINFO, "Memory (%s), current/peak:", pWhen);
+	for (uint32_t i = 0; i < MEMORY_CATEGORY_COUNT; i += 1) {
+		MemoryCategoryStats *pStats = &gMemory.mCategories[i];
+		LOGF(LogLevel::eINFO, "    %-15s VRAM %9.2f / %9.2f MB    host %9.2f / %9.2f MB", gMemoryCategoryNames[i],
+			memToMB(pStats->mGpuBytes), memToMB(pStats->mGpuPeakBytes), memToMB(pStats->mHostBytes), memToMB(pStats->mHostPeakBytes));
+	}
+	LOGF(LogLevel::eINFO, "    %-15s VRAM %9.2f / %9.2f MB    host %9.2f / %9.2f MB", "Total",
+		memToMB(gMemory.mTotal.mGpuBytes), memToMB(gMemory.mTotal.mGpuPeakBytes), memToMB(gMemory.mTotal.mHostBytes), memToMB(gMemory.mTotal.mHostPeakBytes));
+}
+
+bool memGpuOverBudget() {
+	return gMemory.mGpuBudgetBytes != 0 && gMemory.mTotal.mGpuPeakBytes > gMemory.mGpuBudgetBytes;
+}
+bool memHostOverBudget() {
+	return gMemory.mHostBudgetBytes != 0 && gMemory.mTotal.mHostPeakBytes > gMemory.mHostBudgetBytes;
+}
+
+// Peaks are checked rather than current usage, since transient allocations (the instance
+// data during startup) count against a budget as well. Returns false if over budget and
+// the budget is enforced.
+bool memCheckBudget(const char *pWhen) {
+	bool ok = true;
+	if (memGpuOverBudget()) {
+		LOGF(gMemory.mEnforceBudget ? LogLevel::eERROR : LogLevel::eWARNING, "Over VRAM budget (%s): peak %.2f MB, budget %.2f MB",
+			pWhen, memToMB(gMemory.mTotal.mGpuPeakBytes), memToMB(gMemory.mGpuBudgetBytes));
+		ok = false;
+	}
+	if (memHostOverBudget()) {
+		LOGF(gMemory.mEnforceBudget ? LogLevel::eERROR : LogLevel::eWARNING, "Over host memory budget (%s): peak %.2f MB, budget %.2f MB",
+			pWhen, memToMB(gMemory.mTotal.mHostPeakBytes), memToMB(gMemory.mHostBudgetBytes));
+		ok = false;
+	}
+	if (!ok) memLogReport(pWhen);
+	return ok || !gMemory.mEnforceBudget;
+}
+
+///
+// Buffer heaps
+//
+// Small long-lived buffers used to each be their own allocation, with its own descriptor: a
+// scene & skybox ubo per frame in flight & view, a grass draw ubo & species table per frame.
+// Instead they're sub-allocated from one large buffer, and bound with an offset & size
+// (BufferRange::mRange goes straight into DescriptorData::pRanges). Ranges are first-fit from a
+// free list sorted by offset, and freed ranges merge with their neighbours, so resizing
+// something at runtime doesn't leak space. Fragmentation is how much of the free space is
+// outside the largest free block, i.e. how much a single allocation can't use.
+//
+// Only buffers with a single, fixed state belong in a heap. The frame graph tracks states &
+// barriers per Buffer, so anything written on the GPU (draw args, counters, splats) keeps a
+// buffer of its own, as do the instance vbo (hundreds of MB) & the merged grass meshes, which
+// are already one vbo & one ibo filled by the loader thread.
+//
+// Tables the CPU writes once (the tile data, the values the draw counts & splat args are reset
+// to each frame) go in a second, GPU_ONLY heap instead, see gStaticHeap. It's sized for the
+// tile data at the smallest tile size, so changing the tile size only moves ranges around.
+//
+// Memory accounting tracks each range in its own category, the unused part of a heap is only
+// shown in the memory panel.
+
+#define MAX_BUFFER_HEAP_BLOCKS 64
+#define UPLOAD_HEAP_SIZE (512*1024)
+// Tile data at the smallest tile size, plus room for the reset values
+#define STATIC_HEAP_SIZE (sizeof(TileEntry)*(TERRAIN_WIDTH/MIN_GRASS_TILE_DIMENSION)*(TERRAIN_HEIGHT/MIN_GRASS_TILE_DIMENSION) + 64*1024)
+
+typedef struct BufferHeapBlock {
+	uint64_t mOffset;
+	uint64_t mSize;
+} BufferHeapBlock;
+typedef struct BufferHeap {
+	Buffer          *pBuffer;
+	const char      *pName;
+	uint64_t         mSize;
+	uint64_t         mAlignment;
+	BufferHeapBlock  mFree[MAX_BUFFER_HEAP_BLOCKS]; // Sorted by offset, never adjacent
+	uint32_t         mFreeCount;
+	uint32_t         mAllocationCount;
+	uint64_t         mUsedBytes;      // Including mLostBytes
+	uint64_t         mLostBytes;      // Freed without a free block to go in, see heapFree()
+} BufferHeap;
+// CPU_TO_GPU & persistently mapped: every per-frame ubo & table, see addStaticResources()
+BufferHeap gUploadHeap = {};
+// GPU_ONLY: tables written once (or when the tile size changes) & only read after, through
+// heapUpload(). The tile data, and the reset values copied into the draw counts & splat args.
+BufferHeap gStaticHeap = {};
+
+void addBufferHeap(BufferHeap *pHeap, BufferLoadDesc *pDesc, uint64_t alignment) {
+	*pHeap = {};
+	pHeap->pName = pDesc->mDesc.pName;
+	pHeap->mSize = pDesc->mDesc.mSize;
+	pHeap->mAlignment = alignment;
+	pHeap->mFree[0] = { 0, pHeap->mSize };
+	pHeap->mFreeCount = 1;
+	pDesc->ppBuffer = &pHeap->pBuffer;
+	addResource(pDesc, nullptr);
+}
+void removeBufferHeap(BufferHeap *pHeap) {
+	if (pHeap->mAllocationCount != 0)
+		LOGF(LogLevel::eWARNING, "%s: removed with %u ranges still allocated.", pHeap->pName, pHeap->mAllocationCount);
+	removeResource(pHeap->pBuffer);
+	*pHeap = {};
+}
+
+// structStride is for structured buffer views, whose offset has to be a whole number of elements
+bool heapAlloc(BufferHeap *pHeap, uint64_t size, uint32_t structStride, MemoryCategory category, BufferRange *pRange) {
+	const uint64_t alignment = pHeap->mAlignment;
+	for (uint32_t i = 0; i < pHeap->mFreeCount; i += 1) {
+		BufferHeapBlock *pBlock = &pHeap->mFree[i];
+		uint64_t offset = (pBlock->mOffset+alignment-1)/alignment*alignment;
+		if (structStride > 1) offset = (offset+structStride-1)/structStride*structStride;
+		if (offset+size > pBlock->mOffset+pBlock->mSize) continue;
+		
+		// What's skipped for alignment stays free, in front of the range
+		uint64_t end = pBlock->mOffset+pBlock->mSize;
+		uint64_t head = offset-pBlock->mOffset;
+		if (head > 0 && offset+size < end) {
+			if (pHeap->mFreeCount >= MAX_BUFFER_HEAP_BLOCKS) continue;
+			memmove(pBlock+2, pBlock+1, sizeof(BufferHeapBlock)*(pHeap->mFreeCount-i-1));
+			pHeap->mFreeCount += 1;
+			pHeap->mFree[i+1] = { offset+size, end-(offset+size) };
+			pBlock->mSize = head;
+		} else if (head > 0) {
+			pBlock->mSize = head;
+		} else if (offset+size < end) {
+			*pBlock = { offset+size, end-(offset+size) };
+		} else {
+			memmove(pBlock, pBlock+1, sizeof(BufferHeapBlock)*(pHeap->mFreeCount-i-1));
+			pHeap->mFreeCount -= 1;
+		}
+		
+		pRange->pBuffer = pHeap->pBuffer;
+		pRange->mRange.mOffset = (uint32_t)offset;
+		pRange->mRange.mSize = (uint32_t)size;
+		pRange->mRange.mStructStride = structStride;
+		pHeap->mAllocationCount += 1;
+		pHeap->mUsedBytes += size;
+		memTrack(pRange, category, size, false);
+		return true;
+	}
+	
+	LOGF(LogLevel::eERROR, "%s: no room for %llu bytes (%llu of %llu used), raise its size.",
+		pHeap->pName, (unsigned long long)size, (unsigned long long)pHeap->mUsedBytes, (unsigned long long)pHeap->mSize);
+	return false;
+}
+
+void heapFree(BufferHeap *pHeap, BufferRange *pRange) {
+	if (!pRange->pBuffer) return;
+	
+	uint64_t offset = pRange->mRange.mOffset;
+	uint64_t size = pRange->mRange.mSize;
+	uint32_t i = 0;
+	while (i < pHeap->mFreeCount && pHeap->mFree[i].mOffset < offset) i += 1;
+	
+	bool joinsPrevious = i > 0 && pHeap->mFree[i-1].mOffset+pHeap->mFree[i-1].mSize == offset;
+	bool joinsNext = i < pHeap->mFreeCount && offset+size == pHeap->mFree[i].mOffset;
+	if (joinsPrevious && joinsNext) {
+		pHeap->mFree[i-1].mSize += size+pHeap->mFree[i].mSize;
+		memmove(&pHeap->mFree[i], &pHeap->mFree[i+1], sizeof(BufferHeapBlock)*(pHeap->mFreeCount-i-1));
+		pHeap->mFreeCount -= 1;
+	} else if (joinsPrevious) {
+		pHeap->mFree[i-1].mSize += size;
+	} else if (joinsNext) {
+		pHeap->mFree[i].mOffset = offset;
+		pHeap->mFree[i].mSize += size;
+	} else if (pHeap->mFreeCount < MAX_BUFFER_HEAP_BLOCKS) {
+		memmove(&pHeap->mFree[i+1], &pHeap->mFree[i], sizeof(BufferHeapBlock)*(pHeap->mFreeCount-i));
+		pHeap->mFree[i] = { offset, size };
+		pHeap->mFreeCount += 1;
+	} else {
+		// Free blocks are never adjacent, so this takes more than MAX_BUFFER_HEAP_BLOCKS ranges
+		// allocated at once. The range stays lost (& counted as used) until the heap is removed.
+		LOGF(LogLevel::eERROR, "%s: out of free blocks, raise MAX_BUFFER_HEAP_BLOCKS.", pHeap->pName);
+		ASSERT(false && "Buffer heap out of free blocks");
+		pHeap->mLostBytes += size;
+		size = 0;
+	}
+	
+	pHeap->mAllocationCount -= 1;
+	pHeap->mUsedBytes -= size;
+	memUntrack(pRange);
+	*pRange = {};
+}
+
+// 0 when all the free space is in one block
+float heapFragmentation(const BufferHeap *pHeap) {
+	uint64_t freeBytes = 0;
+	uint64_t largest = 0;
+	for (uint32_t i = 0; i < pHeap->mFreeCount; i += 1) {
+		freeBytes += pHeap->mFree[i].mSize;
+		if (pHeap->mFree[i].mSize > largest) largest = pHeap->mFree[i].mSize;
+	}
+	return freeBytes == 0 ? 0.0f : 1.0f-(float)largest/(float)freeBytes;
+}
+
+// For beginUpdateResource(), which maps just the range
+BufferUpdateDesc heapUpdateDesc(const BufferRange *pRange) {
+	BufferUpdateDesc desc = { pRange->pBuffer };
+	desc.mDstOffset = pRange->mRange.mOffset;
+	desc.mSize = pRange->mRange.mSize;
+	return desc;
+}
+
+// Copies data into the whole range through the resource loader, which stages it for GPU_ONLY
+// heaps. It lands in order with the loads queued before it.
+void heapUpload(const BufferRange *pRange, const void *pData) {
+	BufferUpdateDesc desc = heapUpdateDesc(pRange);
+	beginUpdateResource(&desc);
+	memcpy(desc.pMappedData, pData, pRange->mRange.mSize);
+	endUpdateResource(&desc);
+}
+
+// Points a descriptor at the range
+void heapDescriptor(DescriptorData *pParam, const char *pName, BufferRange *pRange) {
+	pParam->pName = pName;
+	pParam->mCount = 1;
+	pParam->ppBuffers = &pRange->pBuffer;
+	pParam->pRanges = &pRange->mRange;
+}
+
+///
+// Frame graph
+//
+// Draw() still records the passes itself, but each frame starts by declaring what every pass
+// reads & writes (see declareFrameGraph()), and every pass is wrapped in fgBeginPass(). From
+// the declarations fgCompile():
+//   - culls passes that nothing alive depends on. Passes that write an output (a resource
+//     with a final state, e.g. the swapchain) are always alive.
+//   - derives the transitions & UAV barriers between passes. A barrier can go anywhere after
+//     the previous access & before the next one, so we place as many as possible on the same
+//     pass, as late as possible, and issue each pass's barriers in a single call.
+//   - tracks states across frames, so nothing is transitioned back to a "resting" state at the
+//     end of the frame. Only outputs are put in their final state, in fgEndFrame().
+//
+// Transient resources only live within a frame and are created by the graph in
+// addRenderTargets(). Transients with the same description whose lifetimes don't overlap in
+// the worst-case frame share one resource (see fgAssignTransientSlots()). We don't manage our
+// own heaps, so this aliases whole resources rather than byte ranges, but it's what keeps
+// extra passes (depth pyramids, low-res targets) from each adding their own screen-sized
+// allocation. The two we have now (the secondary depth buffer & the splat buffer) differ, so
+// they don't share yet.
+//
+// Passes are recorded in FrameGraphPassId order, which is also the order barriers are derived in.
+
+#define FG_MAX_PASS_ACCESSES 8
+#define FG_MAX_PHYSICAL_RESOURCES (FG_RESOURCE_COUNT*2)
+
+typedef enum FrameGraphResourceId {
+	FG_RESOURCE_SWAPCHAIN,
+	FG_RESOURCE_DEPTH,
+	FG_RESOURCE_SECONDARY_DEPTH, // Transient
+	FG_RESOURCE_GRASS_DRAW_ARGS,
+	FG_RESOURCE_GRASS_PROCEDURAL_DRAW_ARGS,
+	FG_RESOURCE_GRASS_DRAW_COUNTS,
+	FG_RESOURCE_SPLAT_ARGS,
+	FG_RESOURCE_SPLAT_TILES,
+	FG_RESOURCE_GRASS_CULL_STATE,
+	FG_RESOURCE_SPLAT_BUFFER,    // Transient
+	FG_RESOURCE_CAPTURE_BUFFER,  // This frame's readback buffer, see "Frame capture"
+	FG_RESOURCE_TEMPORAL_HISTORY,
+	FG_RESOURCE_HEIGHT_EDITS,    // See "Terrain editing"
+	FG_RESOURCE_COUNT,
+} FrameGraphResourceId;
+
+typedef enum FrameGraphPassId {
+	FG_PASS_EDIT_TERRAIN,
+	FG_PASS_RESET_GRASS_COUNTERS,
+	FG_PASS_CLEAR_SPLATS,
+	FG_PASS_CULL_GRASS,
+	FG_PASS_SPLAT_GRASS,
+	FG_PASS_REPROJECT_GRASS,
+	FG_PASS_TERRAIN,
+	FG_PASS_SCENE, // Grass, splat resolve & skybox
+	FG_PASS_CAPTURE,
+	FG_PASS_UI,
+	FG_PASS_COUNT,
+} FrameGraphPassId;
+const char *gFrameGraphPassNames[FG_PASS_COUNT] = {
+	"Edit terrain",
+	"Reset grass counters",
+	"Clear grass splats",
+	"Cull grass",
+	"Splat grass",
+	"Reproject grass",
+	"Terrain",
+	"Scene",
+	"Capture",
+	"UI",
+};
+
+typedef struct FrameGraphAccess {
+	FrameGraphResourceId mResource;
+	ResourceState        mState;
+	bool                 mWrite;
+} FrameGraphAccess;
+
+typedef struct FrameGraphPass {
+	FrameGraphAccess mAccesses[FG_MAX_PASS_ACCESSES];
+	uint32_t         mAccessCount;
+	bool             mDeclared;
+	bool             mAlive;
+	bool             mInsideRenderPass; // Render targets are still bound by the pass before it, so no barriers here
+	
+	// Issued in fgBeginPass(), at most one per physical resource
+	BufferBarrier       mBufferBarriers[FG_MAX_PHYSICAL_RESOURCES];
+	RenderTargetBarrier mRenderTargetBarriers[FG_MAX_PHYSICAL_RESOURCES];
+	uint32_t            mBufferBarrierCount;
+	uint32_t            mRenderTargetBarrierCount;
+} FrameGraphPass;
+
+// The actual resource. Imports use the slot of their FrameGraphResourceId, transients get
+// slots after FG_RESOURCE_COUNT.
+typedef struct FrameGraphPhysical {
+	Buffer        *pBuffer;
+	RenderTarget  *pRenderTarget;
+	ResourceState mState;     // As of the end of the last compiled frame
+	bool          mAccessed;  // By any pass since it was created
+	bool          mLastWrite; // Last access wrote it, so any UAV access after it needs a barrier
+} FrameGraphPhysical;
+
+typedef struct FrameGraphResource {
+	uint32_t      mPhysical;
+	ResourceState mFinalState; // RESOURCE_STATE_UNDEFINED if it can be left in any state
+	
+	bool             mTransient;
+	bool             mTransientIsBuffer;
+	BufferDesc       mTransientBufferDesc;
+	RenderTargetDesc mTransientRenderTargetDesc;
+	uint32_t         mFirstPass; // Worst-case lifetime, see fgAddTransients()
+	uint32_t         mLastPass;
+} FrameGraphResource;
+
+typedef struct FrameGraph {
+	FrameGraphPass     mPasses[FG_PASS_COUNT];
+	FrameGraphResource mResources[FG_RESOURCE_COUNT];
+	FrameGraphPhysical mPhysical[FG_MAX_PHYSICAL_RESOURCES];
+	uint32_t           mPhysicalCount;
+	
+	// Outputs that aren't in their final state after the last pass, see fgEndFrame()
+	BufferBarrier       mEndBufferBarriers[FG_RESOURCE_COUNT];
+	RenderTargetBarrier mEndRenderTargetBarriers[FG_RESOURCE_COUNT];
+	uint32_t            mEndBufferBarrierCount;
+	uint32_t            mEndRenderTargetBarrierCount;
+	FrameGraphPhysical  mEndStates[FG_MAX_PHYSICAL_RESOURCES];
+	
+	// Last compiled frame, for the UI
+	uint32_t mPassCount;
+	uint32_t mCulledPassCount;
+	uint32_t mBarrierCount;
+	uint32_t mBarrierBatchCount;
+	uint64_t mAliasedBytes; // Transient bytes we didn't have to allocate
+} FrameGraph;
+FrameGraph gFrameGraph = {};
+
+// Call before declaring the frame's passes
+void fgReset() {
+	for (uint32_t i = 0; i < FG_PASS_COUNT; i += 1) {
+		FrameGraphPass *pPass = &gFrameGraph.mPasses[i];
+		pPass->mAccessCount = 0;
+		pPass->mDeclared = false;
+		pPass->mAlive = false;
+		pPass->mInsideRenderPass = false;
+		pPass->mBufferBarrierCount = 0;
+		pPass->mRenderTargetBarrierCount = 0;
+	}
+	if (gFrameGraph.mPhysicalCount < FG_RESOURCE_COUNT) gFrameGraph.mPhysicalCount = FG_RESOURCE_COUNT;
+}
+
+void fgDeclarePass(FrameGraphPassId pass, bool insideRenderPass) {
+	gFrameGraph.mPasses[pass].mDeclared = true;
+	gFrameGraph.mPasses[pass].mInsideRenderPass = insideRenderPass;
+}
+void fgAccess(FrameGraphPassId pass, FrameGraphResourceId resource, ResourceState state, bool write) {
+	FrameGraphPass *pPass = &gFrameGraph.mPasses[pass];
+	ASSERT(pPass->mDeclared && pPass->mAccessCount < FG_MAX_PASS_ACCESSES);
+	pPass->mAccesses[pPass->mAccessCount] = { resource, state, write };
+	pPass->mAccessCount += 1;
+}
+void fgRead(FrameGraphPassId pass, FrameGraphResourceId resource, ResourceState state) {
+	fgAccess(pass, resource, state, false);
+}
+void fgWrite(FrameGraphPassId pass, FrameGraphResourceId resource, ResourceState state) {
+	fgAccess(pass, resource, state, true);
+}
+
+// State is what the resource is in if the graph hasn't seen it before (its start state).
+// Re-importing the same resource keeps the tracked state.
+void fgImportBuffer(FrameGraphResourceId resource, Buffer *pBuffer, ResourceState state, ResourceState finalState) {
+	FrameGraphPhysical *pPhysical = &gFrameGraph.mPhysical[resource];
+	gFrameGraph.mResources[resource].mPhysical = resource;
+	gFrameGraph.mResources[resource].mFinalState = finalState;
+	if (pPhysical->pBuffer == pBuffer) return;
+	*pPhysical = { pBuffer, NULL, state, false, false };
+}
+void fgImportRenderTarget(FrameGraphResourceId resource, RenderTarget *pRenderTarget, ResourceState state, ResourceState finalState) {
+	FrameGraphPhysical *pPhysical = &gFrameGraph.mPhysical[resource];
+	gFrameGraph.mResources[resource].mPhysical = resource;
+	gFrameGraph.mResources[resource].mFinalState = finalState;
+	if (pPhysical->pRenderTarget == pRenderTarget) return;
+	*pPhysical = { NULL, pRenderTarget, state, false, false };
+}
+// Call when imported render targets are removed, so new ones at the same address aren't
+// mistaken for them. Imported buffers live until Exit().
+void fgForgetRenderTargets() {
+	for (uint32_t i = 0; i < FG_RESOURCE_COUNT; i += 1) {
+		if (gFrameGraph.mPhysical[i].pRenderTarget) gFrameGraph.mPhysical[i] = {};
+	}
+}
+
+void fgDeclareTransientBuffer(FrameGraphResourceId resource, const BufferDesc *pDesc) {
+	FrameGraphResource *pResource = &gFrameGraph.mResources[resource];
+	pResource->mTransient = true;
+	pResource->mTransientIsBuffer = true;
+	pResource->mTransientBufferDesc = *pDesc;
+}
+void fgDeclareTransientRenderTarget(FrameGraphResourceId resource, const RenderTargetDesc *pDesc) {
+	FrameGraphResource *pResource = &gFrameGraph.mResources[resource];
+	pResource->mTransient = true;
+	pResource->mTransientIsBuffer = false;
+	pResource->mTransientRenderTargetDesc = *pDesc;
+}
+
+Buffer *fgBuffer(FrameGraphResourceId resource) {
+	return gFrameGraph.mPhysical[gFrameGraph.mResources[resource].mPhysical].pBuffer;
+}
+RenderTarget *fgRenderTarget(FrameGraphResourceId resource) {
+	return gFrameGraph.mPhysical[gFrameGraph.mResources[resource].mPhysical].pRenderTarget;
+}
+
+bool fgTransientsCompatible(const FrameGraphResource *pA, const FrameGraphResource *pB) {
+	if (pA->mTransientIsBuffer != pB->mTransientIsBuffer) return false;
+	if (pA->mTransientIsBuffer) {
+		const BufferDesc *a = &pA->mTransientBufferDesc;
+		const BufferDesc *b = &pB->mTransientBufferDesc;
+		return a->mSize == b->mSize && a->mDescriptors == b->mDescriptors && a->mMemoryUsage == b->mMemoryUsage
+			&& a->mFlags == b->mFlags && a->mStructStride == b->mStructStride && a->mFormat == b->mFormat;
+	}
+	const RenderTargetDesc *a = &pA->mTransientRenderTargetDesc;
+	const RenderTargetDesc *b = &pB->mTransientRenderTargetDesc;
+	return a->mWidth == b->mWidth && a->mHeight == b->mHeight && a->mDepth == b->mDepth && a->mArraySize == b->mArraySize
+		&& a->mFormat == b->mFormat && a->mSampleCount == b->mSampleCount && a->mFlags == b->mFlags && a->mDescriptors == b->mDescriptors;
+}
+
+// First-fit: each transient goes to the first slot holding transients of a compatible
+// description whose lifetimes all end before its own starts, or a new slot. Resource ids are
+// roughly in order of first use, which is all first-fit needs here. Transients no pass uses
+// get a slot of their own. Returns the slot count, pSlots gets each transient's (UINT32_MAX for
+// the others).
+uint32_t fgAssignTransientSlots(const FrameGraphResource *pResources, uint32_t resourceCount, uint32_t *pSlots) {
+	uint32_t slotCount = 0;
+	uint32_t owner[FG_MAX_PHYSICAL_RESOURCES];   // First transient in each slot, for its description
+	uint32_t lastUse[FG_MAX_PHYSICAL_RESOURCES]; // Last pass any transient in it is used in
+	for (uint32_t r = 0; r < resourceCount; r += 1) {
+		const FrameGraphResource *pResource = &pResources[r];
+		pSlots[r] = UINT32_MAX;
+		if (!pResource->mTransient) continue;
+		
+		const bool used = pResource->mFirstPass <= pResource->mLastPass;
+		for (uint32_t i = 0; i < slotCount && used; i += 1) {
+			if (lastUse[i] != UINT32_MAX && lastUse[i] < pResource->mFirstPass && fgTransientsCompatible(&pResources[owner[i]], pResource)) {
+				pSlots[r] = i;
+				lastUse[i] = pResource->mLastPass;
+				break;
+			}
+		}
+		if (pSlots[r] != UINT32_MAX) continue;
+		
+		ASSERT(slotCount < FG_MAX_PHYSICAL_RESOURCES);
+		pSlots[r] = slotCount;
+		owner[slotCount] = r;
+		lastUse[slotCount] = used ? pResource->mLastPass : UINT32_MAX;
+		slotCount += 1;
+	}
+	return slotCount;
+}
+
+// Two transients of the same description share a slot if their lifetimes are disjoint, &
+// don't if they overlap. Checked once, in fgAddTransients().
+void fgCheckAliasing() {
+	FrameGraphResource resources[3] = {};
+	for (uint32_t r = 0; r < 3; r += 1) {
+		resources[r].mTransient = true;
+		resources[r].mTransientIsBuffer = true;
+		resources[r].mTransientBufferDesc.mSize = 1024;
+	}
+	resources[0].mFirstPass = 0; resources[0].mLastPass = 2;
+	resources[1].mFirstPass = 1; resources[1].mLastPass = 3;
+	resources[2].mFirstPass = 3; resources[2].mLastPass = 5;
+	
+	uint32_t slots[3];
+	const uint32_t slotCount = fgAssignTransientSlots(resources, 3, slots);
+	ASSERT(slotCount == 2 && slots[0] == slots[2] && slots[1] != slots[0] && "Disjoint transients should share a slot");
+	(void)slotCount;
+}
+
+// Call with the worst-case frame declared (every pass that can run). Lifetimes in any other
+// frame are a subset of these, so the aliasing holds for all of them.
+bool fgAddTransients(Renderer *pRenderer) {
+	static bool checked = false;
+	if (!checked) {
+		fgCheckAliasing();
+		checked = true;
+	}
+	
+	for (uint32_t r = 0; r < FG_RESOURCE_COUNT; r += 1) {
+		FrameGraphResource *pResource = &gFrameGraph.mResources[r];
+		pResource->mFirstPass = FG_PASS_COUNT;
+		pResource->mLastPass = 0;
+	}
+	for (uint32_t p = 0; p < FG_PASS_COUNT; p += 1) {
+		FrameGraphPass *pPass = &gFrameGraph.mPasses[p];
+		if (!pPass->mDeclared) continue;
+		for (uint32_t a = 0; a < pPass->mAccessCount; a += 1) {
+			FrameGraphResource *pResource = &gFrameGraph.mResources[pPass->mAccesses[a].mResource];
+			if (p < pResource->mFirstPass) pResource->mFirstPass = p;
+			pResource->mLastPass = p;
+		}
+	}
+	
+	uint32_t slots[FG_RESOURCE_COUNT];
+	const uint32_t slotCount = fgAssignTransientSlots(gFrameGraph.mResources, FG_RESOURCE_COUNT, slots);
+	ASSERT(FG_RESOURCE_COUNT+slotCount <= FG_MAX_PHYSICAL_RESOURCES);
+	
+	gFrameGraph.mPhysicalCount = FG_RESOURCE_COUNT+slotCount;
+	gFrameGraph.mAliasedBytes = 0;
+	for (uint32_t i = FG_RESOURCE_COUNT; i < gFrameGraph.mPhysicalCount; i += 1) gFrameGraph.mPhysical[i] = {};
+	for (uint32_t r = 0; r < FG_RESOURCE_COUNT; r += 1) {
+		FrameGraphResource *pResource = &gFrameGraph.mResources[r];
+		if (!pResource->mTransient) continue;
+		
+		const uint32_t physical = FG_RESOURCE_COUNT+slots[r];
+		pResource->mPhysical = physical;
+		FrameGraphPhysical *pPhysical = &gFrameGraph.mPhysical[physical];
+		if (pPhysical->pBuffer || pPhysical->pRenderTarget) {
+			gFrameGraph.mAliasedBytes += pPhysical->pBuffer ? pResource->mTransientBufferDesc.mSize : memRenderTargetBytes(pPhysical->pRenderTarget);
+			continue;
+		}
+		
+		if (pResource->mTransientIsBuffer) {
+			BufferLoadDesc loadDesc = {};
+			loadDesc.mDesc = pResource->mTransientBufferDesc;
+			loadDesc.ppBuffer = &pPhysical->pBuffer;
+			addTrackedBuffer(&loadDesc, nullptr, MEMORY_CATEGORY_RENDER_TARGETS);
+			pPhysical->mState = pResource->mTransientBufferDesc.mStartState;
+		} else {
+			addTrackedRenderTarget(pRenderer, &pResource->mTransientRenderTargetDesc, &pPhysical->pRenderTarget, MEMORY_CATEGORY_RENDER_TARGETS);
+			pPhysical->mState = pResource->mTransientRenderTargetDesc.mStartState;
+		}
+		if (!pPhysical->pBuffer && !pPhysical->pRenderTarget) return false;
+	}
+	
+	if (gFrameGraph.mAliasedBytes > 0) {
+		LOGF(LogLevel::eINFO, "Frame graph: aliasing saved %.2f MB of transients", memToMB(gFrameGraph.mAliasedBytes));
+	}
+	return true;
+}
+void fgRemoveTransients(Renderer *pRenderer) {
+	for (uint32_t i = FG_RESOURCE_COUNT; i < gFrameGraph.mPhysicalCount; i += 1) {
+		FrameGraphPhysical *pPhysical = &gFrameGraph.mPhysical[i];
+		if (pPhysical->pBuffer) removeTrackedBuffer(pPhysical->pBuffer);
+		if (pPhysical->pRenderTarget) removeTrackedRenderTarget(pRenderer, pPhysical->pRenderTarget);
+		*pPhysical = {};
+	}
+	gFrameGraph.mPhysicalCount = FG_RESOURCE_COUNT;
+}
+
+typedef struct FrameGraphTransition {
+	uint32_t      mPhysical;
+	ResourceState mFrom;
+	ResourceState mTo;
+	uint32_t      mEarliestPass; // First alive pass after the previous access
+	uint32_t      mLatestPass;   // The accessing pass, or the last one before it that can take barriers
+} FrameGraphTransition;
+
+void fgCompile() {
+	///
+	// Cull. Walking backwards, a pass lives if it writes an output or something a later
+	// live pass accesses (render targets are loaded, so writes don't end a dependency).
+	
+	bool needed[FG_RESOURCE_COUNT] = {};
+	for (uint32_t r = 0; r < FG_RESOURCE_COUNT; r += 1) {
+		needed[r] = gFrameGraph.mResources[r].mFinalState != RESOURCE_STATE_UNDEFINED;
+	}
+	gFrameGraph.mPassCount = 0;
+	gFrameGraph.mCulledPassCount = 0;
+	for (int32_t p = FG_PASS_COUNT-1; p >= 0; p -= 1) {
+		FrameGraphPass *pPass = &gFrameGraph.mPasses[p];
+		if (!pPass->mDeclared) continue;
+		
+		for (uint32_t a = 0; a < pPass->mAccessCount; a += 1) {
+			if (pPass->mAccesses[a].mWrite && needed[pPass->mAccesses[a].mResource]) pPass->mAlive = true;
+		}
+		if (!pPass->mAlive) {
+			gFrameGraph.mCulledPassCount += 1;
+			continue;
+		}
+		gFrameGraph.mPassCount += 1;
+		for (uint32_t a = 0; a < pPass->mAccessCount; a += 1) {
+			needed[pPass->mAccesses[a].mResource] = true;
+		}
+	}
+	
+	///
+	// Find every transition & the window it can be placed in
+	
+	FrameGraphPhysical *pStates = gFrameGraph.mEndStates;
+	memcpy(pStates, gFrameGraph.mPhysical, sizeof(FrameGraphPhysical)*gFrameGraph.mPhysicalCount);
+	
+	uint32_t lastAccess[FG_MAX_PHYSICAL_RESOURCES];
+	for (uint32_t i = 0; i < FG_MAX_PHYSICAL_RESOURCES; i += 1) lastAccess[i] = UINT32_MAX;
+	
+	FrameGraphTransition transitions[FG_PASS_COUNT*FG_MAX_PASS_ACCESSES];
+	uint32_t transitionCount = 0;
+	uint32_t firstAlivePass = UINT32_MAX;
+	
+	for (uint32_t p = 0; p < FG_PASS_COUNT; p += 1) {
+		FrameGraphPass *pPass = &gFrameGraph.mPasses[p];
+		if (!pPass->mAlive) continue;
+		if (firstAlivePass == UINT32_MAX) firstAlivePass = p;
+		
+		for (uint32_t a = 0; a < pPass->mAccessCount; a += 1) {
+			const FrameGraphAccess *pAccess = &pPass->mAccesses[a];
+			uint32_t physical = gFrameGraph.mResources[pAccess->mResource].mPhysical;
+			FrameGraphPhysical *pState = &pStates[physical];
+			
+			// Writes after reads need one too, unless nothing has touched it yet
+			bool uavHazard = pAccess->mState == RESOURCE_STATE_UNORDERED_ACCESS
+				&& (pState->mLastWrite || (pAccess->mWrite && pState->mAccessed));
+			if (pState->mState != pAccess->mState || uavHazard) {
+				FrameGraphTransition *pTransition = &transitions[transitionCount];
+				transitionCount += 1;
+				pTransition->mPhysical = physical;
+				pTransition->mFrom = pState->mState;
+				pTransition->mTo = pAccess->mState;
+				
+				// Previous access is in an earlier frame, so anywhere before this pass is fine
+				pTransition->mEarliestPass = firstAlivePass;
+				if (lastAccess[physical] != UINT32_MAX) {
+					pTransition->mEarliestPass = lastAccess[physical]+1;
+					while (!gFrameGraph.mPasses[pTransition->mEarliestPass].mAlive) pTransition->mEarliestPass += 1;
+				}
+				pTransition->mLatestPass = p;
+				while (pTransition->mLatestPass > pTransition->mEarliestPass
+					&& (!gFrameGraph.mPasses[pTransition->mLatestPass].mAlive || gFrameGraph.mPasses[pTransition->mLatestPass].mInsideRenderPass)) {
+					pTransition->mLatestPass -= 1;
+				}
+				ASSERT(!gFrameGraph.mPasses[pTransition->mLatestPass].mInsideRenderPass && "No pass to put this barrier on, see declareFrameGraph()");
+			}
+			
+			pState->mState = pAccess->mState;
+			pState->mAccessed = true;
+			pState->mLastWrite = pAccess->mWrite;
+			lastAccess[physical] = p;
+		}
+	}
+	
+	///
+	// Place barriers. Sorted by the latest pass they can go on, putting each one on the last
+	// chosen pass if it's within its window, otherwise on its latest pass, gives the fewest
+	// batches (& each barrier as late as it can be within that).
+	
+	for (uint32_t i = 1; i < transitionCount; i += 1) {
+		FrameGraphTransition transition = transitions[i];
+		uint32_t j = i;
+		for (; j > 0 && transitions[j-1].mLatestPass > transition.mLatestPass; j -= 1) {
+			transitions[j] = transitions[j-1];
+		}
+		transitions[j] = transition;
+	}
+	
+	gFrameGraph.mBarrierCount = transitionCount;
+	gFrameGraph.mBarrierBatchCount = 0;
+	uint32_t batchPass = UINT32_MAX;
+	for (uint32_t i = 0; i < transitionCount; i += 1) {
+		const FrameGraphTransition *pTransition = &transitions[i];
+		if (batchPass == UINT32_MAX || batchPass < pTransition->mEarliestPass) {
+			batchPass = pTransition->mLatestPass;
+			gFrameGraph.mBarrierBatchCount += 1;
+		}
+		
+		FrameGraphPass *pPass = &gFrameGraph.mPasses[batchPass];
+		const FrameGraphPhysical *pPhysical = &gFrameGraph.mPhysical[pTransition->mPhysical];
+		if (pPhysical->pBuffer) {
+			pPass->mBufferBarriers[pPass->mBufferBarrierCount] = { pPhysical->pBuffer, pTransition->mFrom, pTransition->mTo };
+			pPass->mBufferBarrierCount += 1;
+		} else {
+			pPass->mRenderTargetBarriers[pPass->mRenderTargetBarrierCount] = { pPhysical->pRenderTarget, pTransition->mFrom, pTransition->mTo };
+			pPass->mRenderTargetBarrierCount += 1;
+		}
+	}
+	
+	///
+	// Outputs
+	
+	gFrameGraph.mEndBufferBarrierCount = 0;
+	gFrameGraph.mEndRenderTargetBarrierCount = 0;
+	for (uint32_t r = 0; r < FG_RESOURCE_COUNT; r += 1) {
+		const FrameGraphResource *pResource = &gFrameGraph.mResources[r];
+		FrameGraphPhysical *pState = &pStates[pResource->mPhysical];
+		if (pResource->mFinalState == RESOURCE_STATE_UNDEFINED || pState->mState == pResource->mFinalState) continue;
+		
+		if (pState->pBuffer) {
+			gFrameGraph.mEndBufferBarriers[gFrameGraph.mEndBufferBarrierCount] = { pState->pBuffer, pState->mState, pResource->mFinalState };
+			gFrameGraph.mEndBufferBarrierCount += 1;
+		} else {
+			gFrameGraph.mEndRenderTargetBarriers[gFrameGraph.mEndRenderTargetBarrierCount] = { pState->pRenderTarget, pState->mState, pResource->mFinalState };
+			gFrameGraph.mEndRenderTargetBarrierCount += 1;
+		}
+		pState->mState = pResource->mFinalState;
+		pState->mLastWrite = false;
+	}
+}
+
+// Issues the barriers placed on this pass. Returns false if the pass was culled (or never
+// declared), in which case it shouldn't be recorded.
+bool fgBeginPass(Cmd *cmd, FrameGraphPassId pass) {
+	FrameGraphPass *pPass = &gFrameGraph.mPasses[pass];
+	if (!pPass->mAlive) return false;
+	if (pPass->mBufferBarrierCount > 0 || pPass->mRenderTargetBarrierCount > 0) {
+		cmdResourceBarrier(cmd, pPass->mBufferBarrierCount, pPass->mBufferBarriers, 0, NULL, pPass->mRenderTargetBarrierCount, pPass->mRenderTargetBarriers);
+	}
+	return true;
+}
+
+// Call after the last pass, with render targets unbound
+void fgEndFrame(Cmd *cmd) {
+	if (gFrameGraph.mEndBufferBarrierCount > 0 || gFrameGraph.mEndRenderTargetBarrierCount > 0) {
+		cmdResourceBarrier(cmd, gFrameGraph.mEndBufferBarrierCount, gFrameGraph.mEndBufferBarriers, 0, NULL,
+			gFrameGraph.mEndRenderTargetBarrierCount, gFrameGraph.mEndRenderTargetBarriers);
+	}
+	memcpy(gFrameGraph.mPhysical, gFrameGraph.mEndStates, sizeof(FrameGraphPhysical)*gFrameGraph.mPhysicalCount);
+}
+
 ///
 // Temporary storage
 //
 // Very simple and low-cost "garbage collection" to avoid small temporary malloc()'s
 // and free()'s when I don't really care what happens to the memory after I'm done,
 // with no real overhead.
+//
+// #Volatile mirrored in Benchmarks/cpu_benchmarks.cpp
 
 void *pTemporaryStorage = NULL;
 void *pTemporaryStorageNext = NULL;
@@ -227,8 +1598,10 @@ const size_t pTemporaryStorageSize = 1024*500; // 500kib
 void initTemporaryStorage() {
 	pTemporaryStorage = tf_malloc(pTemporaryStorageSize);
 	pTemporaryStorageNext = pTemporaryStorage;
+	memTrack(pTemporaryStorage, MEMORY_CATEGORY_TOOLS, pTemporaryStorageSize, true);
 }
 void exitTemporaryStorage() {
+	memUntrack(pTemporaryStorage);
 	tf_free(pTemporaryStorage);
 	pTemporaryStorage = NULL;
 	pTemporaryStorageNext = NULL;
@@ -291,7 +1664,1847 @@ char* tempPrint(const char *fmt, ...) {
     return buffer;
 }
 
-void addUiWidgets();
+///
+// Trace capture
+//
+// Records CPU scopes & GPU timestamps for a window of frames, and writes them to RD_DEBUG
+// as a Chrome trace (open in chrome://tracing or ui.perfetto.dev). Started from the UI, or
+// with --trace-frames N which also captures startup (Init() & the first Load()).
+//
+// CPU scopes also enter their profiler token if they have one, and GPU scopes forward to
+// the gpu profiler, so the on-screen microprofiler shows the same thing as before.
+//
+// GPU timestamps are written to our own query pools (one per frame in flight), read back
+// when the frame's fence has been waited on, and converted to CPU time with an offset we
+// measure when the capture starts (see gpuClockCalibrate()).
+
+#define MAX_TRACE_EVENTS     (1 << 16)
+#define MAX_TRACE_GPU_SCOPES 32 // Per frame
+#define MAX_TRACE_GPU_DEPTH  8
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name, token) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name, token)
+
+typedef enum TraceTrack {
+	TRACE_TRACK_CPU = 1,
+	TRACE_TRACK_GPU = 2,
+} TraceTrack;
+
+typedef struct TraceEvent {
+	const char *pName; // Must outlive the capture, so string literals only
+	int64_t     mStartUs;
+	int64_t     mEndUs;
+	uint32_t    mTrack;
+	uint32_t    mFrame;
+} TraceEvent;
+
+typedef struct TraceGpuFrame {
+	const char *pNames[MAX_TRACE_GPU_SCOPES];
+	uint32_t    mScopeCount;
+	uint32_t    mOpenScopes[MAX_TRACE_GPU_DEPTH];
+	uint32_t    mDepth;
+	uint32_t    mFrame;
+	bool        mPending; // Submitted, not read back yet
+} TraceGpuFrame;
+
+typedef struct TraceCapture {
+	bool        mActive;
+	TraceEvent *pEvents;
+	uint32_t    mEventCount;
+	uint32_t    mDroppedEventCount;
+	uint32_t    mFrame;      // Frames since the capture started
+	uint32_t    mFramesLeft;
+	int64_t     mStartUs;
+	int64_t     mFrameStartUs;
+	
+	QueryPool     *pQueryPools[gMaxFramesInFlight];
+	TraceGpuFrame  mGpuFrames[gMaxFramesInFlight];
+	uint32_t       mGpuSlot; // Frame in flight slot being recorded
+	GpuClock       mGpuClock;
+} TraceCapture;
+
+TraceCapture gTrace = {};
+uint32_t     gTraceFrameCount = 120;  // Frames per capture, set from UI/command line
+bool         gTraceRequested = false; // Start a capture at the start of next Update()
+
+void traceAddEvent(const char *pName, int64_t startUs, int64_t endUs, uint32_t track, uint32_t frame) {
+	if (!gTrace.mActive) return;
+	
+	if (gTrace.mEventCount >= MAX_TRACE_EVENTS) {
+		gTrace.mDroppedEventCount += 1;
+		return;
+	}
+	
+	TraceEvent *pEvent = &gTrace.pEvents[gTrace.mEventCount];
+	pEvent->pName = pName;
+	pEvent->mStartUs = startUs;
+	pEvent->mEndUs = endUs;
+	pEvent->mTrack = track;
+	pEvent->mFrame = frame;
+	gTrace.mEventCount += 1;
+}
+
+// CPU scope. Token can be PROFILE_INVALID_TOKEN to only trace.
+// Use TRACE_SCOPE(name, token) when the scope matches a C++ scope.
+typedef struct TraceCpuScope {
+	const char  *pName;
+	ProfileToken mToken;
+	uint64_t     mProfileHandle;
+	int64_t      mStartUs;
+} TraceCpuScope;
+
+TraceCpuScope traceCpuBegin(const char *pName, ProfileToken token) {
+	TraceCpuScope scope = { pName, token, 0, 0 };
+	if (token != PROFILE_INVALID_TOKEN) scope.mProfileHandle = cpuProfileEnter(token);
+	if (gTrace.mActive) scope.mStartUs = getUSec(true);
+	return scope;
+}
+void traceCpuEnd(TraceCpuScope *pScope) {
+	// Scopes that started before the capture did are skipped
+	if (gTrace.mActive && pScope->mStartUs != 0) traceAddEvent(pScope->pName, pScope->mStartUs, getUSec(true), TRACE_TRACK_CPU, gTrace.mFrame);
+	if (pScope->mToken != PROFILE_INVALID_TOKEN) cpuProfileLeave(pScope->mToken, pScope->mProfileHandle);
+}
+
+struct TraceScope {
+	TraceCpuScope mScope;
+	TraceScope(const char *pName, ProfileToken token) { mScope = traceCpuBegin(pName, token); }
+	~TraceScope() { traceCpuEnd(&mScope); }
+};
+
+// Finds which CPU time GPU timestamps correspond to, by timestamping an empty command
+// buffer and assuming it executed halfway between submit and the fence being signaled.
+// Good to within the submit latency, which is plenty to see bubbles. Waits for the GPU,
+// pPool's first query is overwritten.
+void gpuClockCalibrate(GpuClock *pClock, QueryPool *pPool) {
+	double frequency = 0.0;
+	getTimestampFrequency(pGraphicsQueue, &frequency);
+	pClock->mTicksPerUs = frequency/1000000.0;
+	
+	CmdPool *pCmdPool = NULL;
+	Cmd *pCmd = NULL;
+	Fence *pFence = NULL;
+	CmdPoolDesc cmdPoolDesc = {};
+	cmdPoolDesc.pQueue = pGraphicsQueue;
+	initCmdPool(pRenderer, &cmdPoolDesc, &pCmdPool);
+	CmdDesc cmdDesc = {};
+	cmdDesc.pPool = pCmdPool;
+	initCmd(pRenderer, &cmdDesc, &pCmd);
+	initFence(pRenderer, &pFence);
+	
+	QueryDesc queryDesc = { 0 };
+	beginCmd(pCmd);
+	cmdResetQuery(pCmd, pPool, 0, 1);
+	cmdBeginQuery(pCmd, pPool, &queryDesc);
+	cmdEndQuery(pCmd, pPool, &queryDesc);
+	cmdResolveQuery(pCmd, pPool, 0, 1);
+	endCmd(pCmd);
+	
+	QueueSubmitDesc submitDesc = {};
+	submitDesc.mCmdCount = 1;
+	submitDesc.ppCmds = &pCmd;
+	submitDesc.pSignalFence = pFence;
+	int64_t beforeUs = getUSec(true);
+	queueSubmit(pGraphicsQueue, &submitDesc);
+	waitForFences(pRenderer, 1, &pFence);
+	int64_t afterUs = getUSec(true);
+	
+	QueryData data = {};
+	getQueryData(pRenderer, pPool, 0, &data);
+	pClock->mCalibrationTicks = data.mBeginTimestamp;
+	pClock->mCalibrationUs = (beforeUs+afterUs)/2;
+	
+	exitFence(pRenderer, pFence);
+	exitCmd(pRenderer, pCmd);
+	exitCmdPool(pRenderer, pCmdPool);
+}
+
+int64_t gpuClockToUs(const GpuClock *pClock, uint64_t ticks) {
+	double deltaTicks = (double)(int64_t)(ticks - pClock->mCalibrationTicks);
+	return pClock->mCalibrationUs + (int64_t)(deltaTicks/pClock->mTicksPerUs);
+}
+
+void traceStart(uint32_t frameCount) {
+	if (gTrace.mActive) return;
+	
+	waitQueueIdle(pGraphicsQueue);
+	
+	gTrace = {};
+	gTrace.pEvents = (TraceEvent*)tf_malloc(sizeof(TraceEvent)*MAX_TRACE_EVENTS);
+	memTrack(gTrace.pEvents, MEMORY_CATEGORY_TOOLS, sizeof(TraceEvent)*MAX_TRACE_EVENTS, true);
+	gTrace.mFramesLeft = frameCount;
+	
+	QueryPoolDesc poolDesc = {};
+	poolDesc.mType = QUERY_TYPE_TIMESTAMP;
+	poolDesc.mQueryCount = MAX_TRACE_GPU_SCOPES;
+	for (uint32_t i = 0; i < gMaxFramesInFlight; i += 1) {
+		addQueryPool(pRenderer, &poolDesc, &gTrace.pQueryPools[i]);
+	}
+	
+	gpuClockCalibrate(&gTrace.mGpuClock, gTrace.pQueryPools[0]);
+	
+	gTrace.mActive = true;
+	gTrace.mStartUs = getUSec(true);
+	gTrace.mFrameStartUs = gTrace.mStartUs;
+	
+	LOGF(LogLevel::eINFO, "Trace capture started (%u frames)", frameCount);
+}
+
+// Turns a frame slot's timestamps into events. Only call once its fence has signaled.
+void traceReadGpuFrame(uint32_t slot) {
+	TraceGpuFrame *pFrame = &gTrace.mGpuFrames[slot];
+	if (!pFrame->mPending) return;
+	pFrame->mPending = false;
+	
+	for (uint32_t i = 0; i < pFrame->mScopeCount; i += 1) {
+		QueryData data = {};
+		getQueryData(pRenderer, gTrace.pQueryPools[slot], i, &data);
+		if (!data.mValid) continue;
+		traceAddEvent(pFrame->pNames[i], gpuClockToUs(&gTrace.mGpuClock, data.mBeginTimestamp), gpuClockToUs(&gTrace.mGpuClock, data.mEndTimestamp), TRACE_TRACK_GPU, pFrame->mFrame);
+	}
+}
+
+// Reads back everything that's still in flight. Only call when the queue is idle.
+void traceReadAllGpuFrames() {
+	for (uint32_t i = 0; i < gMaxFramesInFlight; i += 1) traceReadGpuFrame(i);
+}
+
+void traceWrite() {
+	const char *fileName = tempPrint("trace_%lld.json", (long long)time(NULL));
+	
+	FileStream file = {};
+	if (!fsOpenStreamFromPath(RD_DEBUG, fileName, FM_WRITE, &file)) {
+		LOGF(LogLevel::eERROR, "Failed to open '%s' for writing trace.", fileName);
+		return;
+	}
+	
+	char line[512];
+	int length = snprintf(line, sizeof(line),
+		"{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+		"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"Charlie_Submission\"}},\n"
+		"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"CPU main thread\"}},\n"
+		"{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"GPU graphics queue\"}}",
+		TRACE_TRACK_CPU, TRACE_TRACK_GPU);
+	fsWriteToStream(&file, line, (size_t)length);
+	
+	for (uint32_t i = 0; i < gTrace.mEventCount; i += 1) {
+		TraceEvent *pEvent = &gTrace.pEvents[i];
+		length = snprintf(line, sizeof(line),
+			",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%lld,\"dur\":%lld,\"args\":{\"frame\":%u}}",
+			pEvent->pName, pEvent->mTrack,
+			(long long)(pEvent->mStartUs-gTrace.mStartUs),
+			(long long)(pEvent->mEndUs-pEvent->mStartUs),
+			pEvent->mFrame);
+		fsWriteToStream(&file, line, (size_t)length);
+	}
+	
+	fsWriteToStream(&file, "\n]}\n", 4);
+	fsCloseStream(&file);
+	
+	LOGF(LogLevel::eINFO, "Wrote trace with %u events to '%s'%s", gTrace.mEventCount, fileName,
+		gTrace.mDroppedEventCount ? tempPrint(", %u events didn't fit", gTrace.mDroppedEventCount) : "");
+}
+
+void traceStop() {
+	if (!gTrace.mActive) return;
+	
+	waitQueueIdle(pGraphicsQueue);
+	traceReadAllGpuFrames();
+	
+	traceWrite();
+	
+	gTrace.mActive = false;
+	for (uint32_t i = 0; i < gMaxFramesInFlight; i += 1) {
+		removeQueryPool(pRenderer, gTrace.pQueryPools[i]);
+	}
+	memUntrack(gTrace.pEvents);
+	tf_free(gTrace.pEvents);
+	gTrace = {};
+}
+
+// Call at the start of Update()
+void traceBeginFrame() {
+	if (gTraceRequested) {
+		gTraceRequested = false;
+		traceStart(gTraceFrameCount);
+	}
+	if (gTrace.mActive) gTrace.mFrameStartUs = getUSec(true);
+}
+
+// Call at the end of Draw(), after present
+void traceEndFrame() {
+	if (!gTrace.mActive) return;
+	
+	traceAddEvent("Frame", gTrace.mFrameStartUs, getUSec(true), TRACE_TRACK_CPU, gTrace.mFrame);
+	
+	gTrace.mFrame += 1;
+	gTrace.mFramesLeft -= 1;
+	if (gTrace.mFramesLeft == 0) traceStop();
+}
+
+// Call right after beginning the frame's first cmd
+void traceGpuBeginFrame(Cmd *cmd, uint32_t slot) {
+	if (!gTrace.mActive) return;
+	
+	TraceGpuFrame *pFrame = &gTrace.mGpuFrames[slot];
+	ASSERT(!pFrame->mPending);
+	*pFrame = {};
+	pFrame->mFrame = gTrace.mFrame;
+	gTrace.mGpuSlot = slot;
+	
+	cmdResetQuery(cmd, gTrace.pQueryPools[slot], 0, MAX_TRACE_GPU_SCOPES);
+}
+
+// Call before ending the frame's last cmd
+void traceGpuEndFrame(Cmd *cmd) {
+	if (!gTrace.mActive) return;
+	
+	TraceGpuFrame *pFrame = &gTrace.mGpuFrames[gTrace.mGpuSlot];
+	if (pFrame->mScopeCount > 0) cmdResolveQuery(cmd, gTrace.pQueryPools[gTrace.mGpuSlot], 0, pFrame->mScopeCount);
+	pFrame->mPending = true;
+}
+
+// GPU scope, replaces cmdBegin/EndGpuTimestampQuery with gGpuProfileToken
+void gpuScopeBegin(Cmd *cmd, const char *pName) {
+	cmdBeginGpuTimestampQuery(cmd, gGpuProfileToken, pName);
+	
+	if (!gTrace.mActive) return;
+	
+	TraceGpuFrame *pFrame = &gTrace.mGpuFrames[gTrace.mGpuSlot];
+	if (pFrame->mScopeCount >= MAX_TRACE_GPU_SCOPES || pFrame->mDepth >= MAX_TRACE_GPU_DEPTH) {
+		gTrace.mDroppedEventCount += 1;
+		return;
+	}
+	
+	QueryDesc queryDesc = { pFrame->mScopeCount };
+	cmdBeginQuery(cmd, gTrace.pQueryPools[gTrace.mGpuSlot], &queryDesc);
+	pFrame->pNames[pFrame->mScopeCount] = pName;
+	pFrame->mOpenScopes[pFrame->mDepth] = pFrame->mScopeCount;
+	pFrame->mScopeCount += 1;
+	pFrame->mDepth += 1;
+}
+void gpuScopeEnd(Cmd *cmd) {
+	cmdEndGpuTimestampQuery(cmd, gGpuProfileToken);
+	
+	if (!gTrace.mActive) return;
+	
+	TraceGpuFrame *pFrame = &gTrace.mGpuFrames[gTrace.mGpuSlot];
+	if (pFrame->mDepth == 0) return; // Begin was dropped
+	
+	pFrame->mDepth -= 1;
+	QueryDesc queryDesc = { pFrame->mOpenScopes[pFrame->mDepth] };
+	cmdEndQuery(cmd, gTrace.pQueryPools[gTrace.mGpuSlot], &queryDesc);
+}
+
+///
+// Frame capture
+//
+// Records frames to RD_SCREENSHOTS without stalling, for flythroughs. Started from the UI, or
+// with --capture-frames N (--capture-raw for raw frames instead of PNG's).
+//
+// The swapchain is copied into a readback buffer right after the scene (so without the UI),
+// by its own frame graph pass. Nothing reads the buffer until the frame's fence has been
+// waited on anyway, gFramesInFlight frames later, and then it's handed as-is to a worker
+// thread which encodes it straight out of the mapped memory & writes it to disk. The main
+// thread never copies pixels or waits on the worker, so capturing costs a copy on the GPU.
+//
+// If the worker falls behind, the ring runs out of free buffers & frames are dropped rather
+// than stalling. Files are numbered by frame, so drops show up as gaps in the sequence.
+//
+// The PNG's are written with stored (uncompressed) deflate blocks, so encoding is a swizzle
+// & a checksum and the worker keeps up at full frame rate. They're big, re-encode offline if
+// that matters. Raw frames are the readback rows with the padding dropped, in the swapchain's
+// channel order (the file extension says which), e.g.
+//     ffmpeg -f rawvideo -pix_fmt bgra -s 1920x1080 -i capture_%05d.bgra ...
+
+#define CAPTURE_RING_SIZE     8     // Buffers being copied to, waiting on their fence, or being encoded
+#define CAPTURE_DEFLATE_BLOCK 65535 // Max size of a stored deflate block
+
+typedef enum CaptureSlotState {
+	CAPTURE_SLOT_FREE,
+	CAPTURE_SLOT_IN_FLIGHT, // Copy recorded, owned by the main thread until its fence has signaled
+	CAPTURE_SLOT_ENCODING,  // Owned by the worker
+} CaptureSlotState;
+
+typedef struct CaptureSlot {
+	Buffer          *pBuffer;    // Persistently mapped
+	tfrg_atomic32_t mState;      // CaptureSlotState
+	uint32_t        mFrameIndex; // Frame in flight slot that recorded the copy
+	uint32_t        mFrame;      // Frames since the capture started, used for the file name
+} CaptureSlot;
+
+typedef struct FrameCapture {
+	bool     mActive;    // Ring & worker exist, until everything recorded has been written
+	bool     mRecording; // Still copying new frames
+	uint32_t mFramesLeft;
+	uint32_t mFrame;
+	uint32_t mDroppedFrameCount;
+	int64_t  mId; // Start time, prefixes the file names
+	
+	// Fixed for the whole capture
+	uint32_t mWidth;
+	uint32_t mHeight;
+	uint32_t mRowPitch;
+	bool     mBgra;
+	bool     mRaw;
+	
+	CaptureSlot mSlots[CAPTURE_RING_SIZE];
+	
+	// Slots waiting for the worker, FIFO
+	Mutex             mMutex;
+	ConditionVariable mWake;
+	uint32_t          mQueue[CAPTURE_RING_SIZE];
+	uint32_t          mQueueHead;
+	uint32_t          mQueueCount;
+	bool              mQuit;
+	
+	ThreadHandle    mWorker;
+	uint8_t         *pScratch; // Worker only, a deflate block & a converted row
+	tfrg_atomic32_t mWrittenFrameCount;
+	tfrg_atomic32_t mFailedFrameCount;
+} FrameCapture;
+
+FrameCapture gCapture = {};
+uint32_t     gCaptureFrameCount = 600;   // Frames per capture, set from UI/command line
+bool         gCaptureRaw = false;        // Raw frames instead of PNG's
+bool         gCaptureRequested = false;  // Start a capture at the start of next Draw()
+uint32_t     gCaptureCrcTable[256] = {};
+
+uint32_t captureCrc(uint32_t crc, const uint8_t *pData, size_t size) {
+	for (size_t i = 0; i < size; i += 1) crc = gCaptureCrcTable[(crc ^ pData[i]) & 0xff] ^ (crc >> 8);
+	return crc;
+}
+
+uint32_t captureAdler(uint32_t adler, const uint8_t *pData, size_t size) {
+	uint32_t a = adler & 0xffff;
+	uint32_t b = adler >> 16;
+	while (size > 0) {
+		// Largest run before b can overflow
+		size_t run = size < 5552 ? size : 5552;
+		size -= run;
+		for (size_t i = 0; i < run; i += 1) {
+			a += pData[i];
+			b += a;
+		}
+		pData += run;
+		a %= 65521;
+		b %= 65521;
+	}
+	return (b << 16) | a;
+}
+
+void captureWriteU32BE(uint8_t *pDst, uint32_t value) {
+	pDst[0] = (uint8_t)(value >> 24);
+	pDst[1] = (uint8_t)(value >> 16);
+	pDst[2] = (uint8_t)(value >> 8);
+	pDst[3] = (uint8_t)value;
+}
+
+// For the chunks small enough to build in memory
+void captureWritePngChunk(FileStream *pFile, const char *pType, const uint8_t *pData, uint32_t size) {
+	uint8_t header[8];
+	captureWriteU32BE(header, size);
+	memcpy(header+4, pType, 4);
+	uint32_t crc = captureCrc(0xffffffff, header+4, 4);
+	crc = captureCrc(crc, pData, size) ^ 0xffffffff;
+	uint8_t footer[4];
+	captureWriteU32BE(footer, crc);
+	
+	fsWriteToStream(pFile, header, 8);
+	if (size > 0) fsWriteToStream(pFile, pData, size);
+	fsWriteToStream(pFile, footer, 4);
+}
+
+// Zlib stream of stored deflate blocks, written as one IDAT chunk. The total size is known up
+// front, so the chunk length can be written before the data.
+typedef struct CaptureDeflateStream {
+	FileStream *pFile;
+	uint8_t    *pBlock;     // 5 byte block header, then the data
+	uint32_t   mBlockSize;
+	uint64_t   mRemaining;  // Uncompressed bytes not added yet
+	uint32_t   mAdler;      // Of the uncompressed data
+	uint32_t   mCrc;        // Of the IDAT chunk so far
+} CaptureDeflateStream;
+
+void captureDeflateFlush(CaptureDeflateStream *pStream) {
+	uint8_t *pBlock = pStream->pBlock;
+	uint32_t size = pStream->mBlockSize;
+	pBlock[0] = pStream->mRemaining == 0 ? 1 : 0; // BFINAL, BTYPE 00 (stored)
+	pBlock[1] = (uint8_t)size;
+	pBlock[2] = (uint8_t)(size >> 8);
+	pBlock[3] = (uint8_t)~size;
+	pBlock[4] = (uint8_t)(~size >> 8);
+	
+	pStream->mAdler = captureAdler(pStream->mAdler, pBlock+5, size);
+	pStream->mCrc = captureCrc(pStream->mCrc, pBlock, 5+size);
+	fsWriteToStream(pStream->pFile, pBlock, 5+size);
+	pStream->mBlockSize = 0;
+}
+
+void captureDeflateAdd(CaptureDeflateStream *pStream, const uint8_t *pData, uint32_t size) {
+	while (size > 0) {
+		uint32_t count = CAPTURE_DEFLATE_BLOCK-pStream->mBlockSize;
+		if (count > size) count = size;
+		memcpy(pStream->pBlock+5+pStream->mBlockSize, pData, count);
+		pStream->mBlockSize += count;
+		pStream->mRemaining -= count;
+		pData += count;
+		size -= count;
+		
+		if (pStream->mBlockSize == CAPTURE_DEFLATE_BLOCK || pStream->mRemaining == 0) captureDeflateFlush(pStream);
+	}
+}
+
+void captureWritePng(FileStream *pFile, const uint8_t *pPixels) {
+	const FrameCapture *pCapture = &gCapture;
+	const uint32_t width = pCapture->mWidth;
+	const uint32_t height = pCapture->mHeight;
+	
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	fsWriteToStream(pFile, signature, sizeof(signature));
+	
+	uint8_t header[13] = {};
+	captureWriteU32BE(header, width);
+	captureWriteU32BE(header+4, height);
+	header[8] = 8; // Bit depth
+	header[9] = 2; // RGB, alpha is dropped
+	captureWritePngChunk(pFile, "IHDR", header, sizeof(header));
+	
+	///
+	// IDAT: zlib header, stored blocks of filter type 0 rows, adler32
+	
+	const uint32_t rowSize = 1+width*3;
+	const uint64_t rawSize = (uint64_t)rowSize*height;
+	const uint64_t blockCount = (rawSize+CAPTURE_DEFLATE_BLOCK-1)/CAPTURE_DEFLATE_BLOCK;
+	const uint32_t dataSize = (uint32_t)(2+rawSize+blockCount*5+4);
+	
+	CaptureDeflateStream stream = {};
+	stream.pFile = pFile;
+	stream.pBlock = pCapture->pScratch;
+	stream.mRemaining = rawSize;
+	stream.mAdler = 1;
+	
+	uint8_t idat[10];
+	captureWriteU32BE(idat, dataSize);
+	memcpy(idat+4, "IDAT", 4);
+	idat[8] = 0x78; // Deflate, 32K window
+	idat[9] = 0x01; // No dictionary, fastest. Makes the header a multiple of 31.
+	stream.mCrc = captureCrc(0xffffffff, idat+4, 6);
+	fsWriteToStream(pFile, idat, sizeof(idat));
+	
+	uint8_t *pRow = pCapture->pScratch+5+CAPTURE_DEFLATE_BLOCK;
+	const uint32_t red = pCapture->mBgra ? 2 : 0;
+	const uint32_t blue = pCapture->mBgra ? 0 : 2;
+	for (uint32_t y = 0; y < height; y += 1) {
+		const uint8_t *pSrc = pPixels+(uint64_t)y*pCapture->mRowPitch;
+		pRow[0] = 0; // Filter: none
+		for (uint32_t x = 0; x < width; x += 1) {
+			pRow[1+x*3+0] = pSrc[x*4+red];
+			pRow[1+x*3+1] = pSrc[x*4+1];
+			pRow[1+x*3+2] = pSrc[x*4+blue];
+		}
+		captureDeflateAdd(&stream, pRow, rowSize);
+	}
+	
+	uint8_t footer[8];
+	captureWriteU32BE(footer, stream.mAdler);
+	stream.mCrc = captureCrc(stream.mCrc, footer, 4) ^ 0xffffffff;
+	captureWriteU32BE(footer+4, stream.mCrc);
+	fsWriteToStream(pFile, footer, sizeof(footer));
+	
+	captureWritePngChunk(pFile, "IEND", NULL, 0);
+}
+
+void captureWriteRaw(FileStream *pFile, const uint8_t *pPixels) {
+	const FrameCapture *pCapture = &gCapture;
+	const uint32_t rowBytes = pCapture->mWidth*4;
+	if (pCapture->mRowPitch == rowBytes) {
+		fsWriteToStream(pFile, pPixels, (size_t)rowBytes*pCapture->mHeight);
+		return;
+	}
+	for (uint32_t y = 0; y < pCapture->mHeight; y += 1) {
+		fsWriteToStream(pFile, pPixels+(uint64_t)y*pCapture->mRowPitch, rowBytes);
+	}
+}
+
+// Runs for the whole capture, until it's told to quit & the queue is empty
+void captureWorker(void *pUserData) {
+	FrameCapture *pCapture = &gCapture;
+	for (;;) {
+		acquireMutex(&pCapture->mMutex);
+		while (pCapture->mQueueCount == 0 && !pCapture->mQuit) {
+			waitConditionVariable(&pCapture->mWake, &pCapture->mMutex, UINT32_MAX); // No timeout
+		}
+		if (pCapture->mQueueCount == 0) {
+			releaseMutex(&pCapture->mMutex);
+			return;
+		}
+		uint32_t slotIndex = pCapture->mQueue[pCapture->mQueueHead];
+		pCapture->mQueueHead = (pCapture->mQueueHead+1) % CAPTURE_RING_SIZE;
+		pCapture->mQueueCount -= 1;
+		releaseMutex(&pCapture->mMutex);
+		
+		CaptureSlot *pSlot = &pCapture->mSlots[slotIndex];
+		const uint8_t *pPixels = (const uint8_t*)pSlot->pBuffer->pCpuMappedAddress;
+		
+		// Not tempPrint(), temporary storage belongs to the main thread
+		char fileName[128];
+		if (pCapture->mRaw) {
+			snprintf(fileName, sizeof(fileName), "capture_%lld_%05u_%ux%u.%s", (long long)pCapture->mId, pSlot->mFrame,
+				pCapture->mWidth, pCapture->mHeight, pCapture->mBgra ? "bgra" : "rgba");
+		} else {
+			snprintf(fileName, sizeof(fileName), "capture_%lld_%05u.png", (long long)pCapture->mId, pSlot->mFrame);
+		}
+		
+		FileStream file = {};
+		if (fsOpenStreamFromPath(RD_SCREENSHOTS, fileName, FM_WRITE, &file)) {
+			if (pCapture->mRaw) captureWriteRaw(&file, pPixels);
+			else                captureWritePng(&file, pPixels);
+			fsCloseStream(&file);
+			tfrg_atomic32_add_relaxed(&pCapture->mWrittenFrameCount, 1);
+		} else {
+			tfrg_atomic32_add_relaxed(&pCapture->mFailedFrameCount, 1);
+		}
+		
+		tfrg_atomic32_store_release(&pSlot->mState, CAPTURE_SLOT_FREE);
+	}
+}
+
+void captureStart(RenderTarget *pRenderTarget) {
+	if (gCapture.mActive) return;
+	
+	TinyImageFormat format = (TinyImageFormat)pRenderTarget->mFormat;
+	bool bgra = format == TinyImageFormat_B8G8R8A8_UNORM || format == TinyImageFormat_B8G8R8A8_SRGB;
+	bool rgba = format == TinyImageFormat_R8G8B8A8_UNORM || format == TinyImageFormat_R8G8B8A8_SRGB;
+	if (!bgra && !rgba) {
+		LOGF(LogLevel::eERROR, "Frame capture only supports 8 bit RGBA/BGRA swapchains, see \"@SwapchainFormat\".");
+		return;
+	}
+	
+	FrameCapture *pCapture = &gCapture;
+	*pCapture = {};
+	pCapture->mWidth = pRenderTarget->mWidth;
+	pCapture->mHeight = pRenderTarget->mHeight;
+	pCapture->mBgra = bgra;
+	pCapture->mRaw = gCaptureRaw;
+	pCapture->mFramesLeft = gCaptureFrameCount;
+	pCapture->mId = (int64_t)time(NULL);
+	
+	const uint32_t rowAlignment = pRenderer->pGpu->mUploadBufferTextureRowAlignment > 0 ? pRenderer->pGpu->mUploadBufferTextureRowAlignment : 1;
+	pCapture->mRowPitch = (pCapture->mWidth*4+rowAlignment-1)/rowAlignment*rowAlignment;
+	
+	for (uint32_t i = 0; i < CAPTURE_RING_SIZE; i += 1) {
+		BufferLoadDesc loadDesc = {};
+		loadDesc.mDesc.mSize = (uint64_t)pCapture->mRowPitch*pCapture->mHeight;
+		loadDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_TO_CPU;
+		loadDesc.mDesc.mFlags = BUFFER_CREATION_FLAG_PERSISTENT_MAP_BIT;
+		loadDesc.mDesc.mStartState = RESOURCE_STATE_COPY_DEST;
+		loadDesc.mDesc.pName = "Frame capture readback";
+		loadDesc.ppBuffer = &pCapture->mSlots[i].pBuffer;
+		addTrackedBuffer(&loadDesc, NULL, MEMORY_CATEGORY_TOOLS);
+	}
+	
+	const uint64_t scratchSize = 5+CAPTURE_DEFLATE_BLOCK+1+(uint64_t)pCapture->mWidth*3;
+	pCapture->pScratch = (uint8_t*)tf_malloc(scratchSize);
+	memTrack(pCapture->pScratch, MEMORY_CATEGORY_TOOLS, scratchSize, true);
+	
+	if (gCaptureCrcTable[1] == 0) {
+		for (uint32_t i = 0; i < 256; i += 1) {
+			uint32_t crc = i;
+			for (uint32_t bit = 0; bit < 8; bit += 1) crc = (crc & 1) ? 0xedb88320 ^ (crc >> 1) : crc >> 1;
+			gCaptureCrcTable[i] = crc;
+		}
+	}
+	
+	initMutex(&pCapture->mMutex);
+	initConditionVariable(&pCapture->mWake);
+	ThreadDesc threadDesc = {};
+	threadDesc.pFunc = captureWorker;
+	threadDesc.pData = NULL;
+	strcpy(threadDesc.mThreadName, "FrameCapture");
+	initThread(&threadDesc, &pCapture->mWorker);
+	
+	pCapture->mActive = true;
+	pCapture->mRecording = true;
+	
+	LOGF(LogLevel::eINFO, "Frame capture started (%u frames, %ux%u %s)", pCapture->mFramesLeft,
+		pCapture->mWidth, pCapture->mHeight, pCapture->mRaw ? "raw" : "png");
+}
+
+// A free slot to copy this frame into, or NULL if it isn't captured
+CaptureSlot *captureBeginFrame(uint32_t frameIndex) {
+	FrameCapture *pCapture = &gCapture;
+	if (!pCapture->mRecording) return NULL;
+	
+	const uint32_t frame = pCapture->mFrame;
+	pCapture->mFrame += 1;
+	pCapture->mFramesLeft -= 1;
+	if (pCapture->mFramesLeft == 0) pCapture->mRecording = false;
+	
+	for (uint32_t i = 0; i < CAPTURE_RING_SIZE; i += 1) {
+		CaptureSlot *pSlot = &pCapture->mSlots[i];
+		if (tfrg_atomic32_load_acquire(&pSlot->mState) != CAPTURE_SLOT_FREE) continue;
+		
+		tfrg_atomic32_store_relaxed(&pSlot->mState, CAPTURE_SLOT_IN_FLIGHT);
+		pSlot->mFrameIndex = frameIndex;
+		pSlot->mFrame = frame;
+		return pSlot;
+	}
+	
+	pCapture->mDroppedFrameCount += 1;
+	return NULL;
+}
+
+// Run by the frame graph's capture pass, after the scene
+void captureRecordCopy(Cmd *cmd, const CaptureSlot *pSlot, RenderTarget *pRenderTarget) {
+	SubresourceDataDesc copyDesc = {};
+	copyDesc.mRowPitch = gCapture.mRowPitch;
+	copyDesc.mSlicePitch = gCapture.mRowPitch*gCapture.mHeight;
+	cmdCopySubresource(cmd, pSlot->pBuffer, pRenderTarget->pTexture, &copyDesc);
+}
+
+// Hands a frame slot's copies to the worker. Only call once its fence has signaled.
+void captureReadFrame(uint32_t frameIndex) {
+	FrameCapture *pCapture = &gCapture;
+	if (!pCapture->mActive) return;
+	
+	for (uint32_t i = 0; i < CAPTURE_RING_SIZE; i += 1) {
+		CaptureSlot *pSlot = &pCapture->mSlots[i];
+		if (pSlot->mFrameIndex != frameIndex || tfrg_atomic32_load_relaxed(&pSlot->mState) != CAPTURE_SLOT_IN_FLIGHT) continue;
+		
+		tfrg_atomic32_store_relaxed(&pSlot->mState, CAPTURE_SLOT_ENCODING);
+		acquireMutex(&pCapture->mMutex);
+		pCapture->mQueue[(pCapture->mQueueHead+pCapture->mQueueCount) % CAPTURE_RING_SIZE] = i;
+		pCapture->mQueueCount += 1;
+		releaseMutex(&pCapture->mMutex);
+		wakeOneConditionVariable(&pCapture->mWake);
+	}
+}
+
+// Reads back everything that's still in flight. Only call when the queue is idle.
+void captureReadAllFrames() {
+	for (uint32_t i = 0; i < gMaxFramesInFlight; i += 1) captureReadFrame(i);
+}
+
+// Joins the worker, which first writes out everything it's been handed
+void captureFinish() {
+	FrameCapture *pCapture = &gCapture;
+	if (!pCapture->mActive) return;
+	
+	acquireMutex(&pCapture->mMutex);
+	pCapture->mQuit = true;
+	releaseMutex(&pCapture->mMutex);
+	wakeAllConditionVariable(&pCapture->mWake);
+	joinThread(pCapture->mWorker);
+	
+	exitConditionVariable(&pCapture->mWake);
+	exitMutex(&pCapture->mMutex);
+	for (uint32_t i = 0; i < CAPTURE_RING_SIZE; i += 1) {
+		removeTrackedBuffer(pCapture->mSlots[i].pBuffer);
+	}
+	memUntrack(pCapture->pScratch);
+	tf_free(pCapture->pScratch);
+	
+	uint32_t failedCount = tfrg_atomic32_load_relaxed(&pCapture->mFailedFrameCount);
+	LOGF(LogLevel::eINFO, "Frame capture wrote %u frames to Screenshots/capture_%lld_*, %u dropped%s",
+		tfrg_atomic32_load_relaxed(&pCapture->mWrittenFrameCount), (long long)pCapture->mId, pCapture->mDroppedFrameCount,
+		failedCount ? tempPrint(", %u couldn't be opened for writing", failedCount) : "");
+	
+	pCapture->mActive = false;
+	pCapture->mRecording = false;
+}
+
+// Call at the start of Draw(), after this frame slot's fence has been waited on. Tears the
+// capture down once it's done recording & everything has been written.
+void captureUpdate(uint32_t frameIndex) {
+	FrameCapture *pCapture = &gCapture;
+	captureReadFrame(frameIndex);
+	if (!pCapture->mActive || pCapture->mRecording) return;
+	
+	for (uint32_t i = 0; i < CAPTURE_RING_SIZE; i += 1) {
+		if (tfrg_atomic32_load_acquire(&pCapture->mSlots[i].mState) != CAPTURE_SLOT_FREE) return;
+	}
+	captureFinish();
+}
+
+// Stops copying new frames, what's been copied is still written
+void captureStop() {
+	if (gCapture.mRecording) LOGF(LogLevel::eINFO, "Frame capture stopped with %u frames left", gCapture.mFramesLeft);
+	gCapture.mRecording = false;
+}
+
+///
+// Tile grid
+//
+// Grass is placed, culled & drawn in square tiles. Small tiles cull tightly & pick LOD's
+// closely, but every tile is a thread in grass_draw.comp and an indirect draw, so past some
+// count the draws cost more than the blades they save. Where that is depends on the GPU.
+//
+// So the tile size is picked at load rather than compiled in: --tile-size N, else the size
+// tile_sizes.txt (RD_OTHER_FILES) has for this GPU ("<tile size> <GPU name>" lines, '#' lines
+// are comments), else DEFAULT_GRASS_TILE_DIMENSION. The tile data, draw args, splat tile & cull
+// state buffers are sized for it, and the shaders get the grid from SceneData::TileGrid.
+// Changing it at runtime (UI) rebuilds those buffers at the start of the next Draw().
+//
+// --tune-tile-size (or the UI button) draws a few candidate sizes from a fixed set of cameras,
+// keeps the one with the lowest GPU frame time & writes it to tile_sizes.txt for next time.
+// Only the tiles change between candidates, so the whole frame is timed, with coherent culling
+// off so every frame pays for a full cull like a moving camera would.
+
+#define TILE_SIZES_FILE          "tile_sizes.txt"
+#define TILE_TUNE_WARMUP_FRAMES  16 // Per candidate & camera, covers the profiler's latency
+#define TILE_TUNE_MEASURE_FRAMES 32
+
+typedef struct TileGrid {
+	uint32_t   mDimension; // Meters per tile side
+	uint32_t   mCountX;
+	uint32_t   mCountY;
+	uint32_t   mCount;
+	uint32_t   mRequestedDimension; // Applied at the start of Draw(), 0 until Init() picks one
+	TileEntry *pTiles;              // What gGrassTileData was filled with
+} TileGrid;
+TileGrid gTileGrid = {};
+
+// 2480 is 16*5*31, so most of these cover the terrain exactly
+const uint32_t gTileTuneCandidates[] = { 10, 15, 20, 31, 40 };
+// Position & look-at: in the grass, across the field, from above & straight down
+const float gTileTuneCameras[][6] = {
+	{ TERRAIN_WIDTH/2, 48.0f, TERRAIN_HEIGHT/2, 0.0f, 0.0f, 0.0f },
+	{ 200.0f, 30.0f, 200.0f, 2000.0f, 20.0f, 2000.0f },
+	{ TERRAIN_WIDTH/2, 400.0f, 300.0f, TERRAIN_WIDTH/2, 0.0f, 1400.0f },
+	{ 600.0f, 120.0f, 1800.0f, 610.0f, 0.0f, 1810.0f },
+};
+
+typedef struct TileTuner {
+	bool     mActive;
+	uint32_t mCandidate; // Index into gTileTuneCandidates
+	uint32_t mCamera;    // Index into gTileTuneCameras
+	uint32_t mFrame;     // At this candidate & camera
+	float    mGpuMs[TF_ARRAY_COUNT(gTileTuneCandidates)]; // Summed over the measured frames
+	Vector3  mCameraPos; // Camera to go back to when done
+	Vector3  mCameraLookAt;
+} TileTuner;
+TileTuner gTileTuner = {};
+bool      gTileTuneRequested = false; // Start tuning at the start of next Update()
+
+void tileGridSetDimension(uint32_t dimension) {
+	TileGrid *pGrid = &gTileGrid;
+	pGrid->mDimension = dimension;
+	pGrid->mRequestedDimension = dimension;
+	pGrid->mCountX = TERRAIN_WIDTH/dimension;
+	pGrid->mCountY = TERRAIN_HEIGHT/dimension;
+	pGrid->mCount = pGrid->mCountX*pGrid->mCountY;
+	
+	gSceneUniformData.mTileGrid[0] = dimension;
+	gSceneUniformData.mTileGrid[1] = pGrid->mCountX;
+	gSceneUniformData.mTileGrid[2] = pGrid->mCountY;
+	gSceneUniformData.mTileGrid[3] = pGrid->mCount;
+	gSceneUniformData.mMaxInstancesPerTile = MAX_GRASS_CAP/pGrid->mCount;
+}
+
+const char *tileGridGpuName() {
+	return pRenderer->pGpu->mGpuVendorPreset.mGpuName;
+}
+
+// Returns the tile size tile_sizes.txt has for this GPU, or 0
+uint32_t tileGridLoadTuned() {
+	FileStream file = {};
+	if (!fsOpenStreamFromPath(RD_OTHER_FILES, TILE_SIZES_FILE, FM_READ, &file)) return 0;
+
+	ssize_t size = fsGetStreamFileSize(&file);
+	char *text = (char*)tempAlloc((size_t)size+1);
+	size_t readSize = fsReadFromStream(&file, text, (size_t)size);
+	text[readSize] = 0;
+	fsCloseStream(&file);
+
+	const char *pGpuName = tileGridGpuName();
+	char *line = text;
+	while (*line) {
+		char *next = strchr(line, '\n');
+		if (next) *next = 0;
+
+		uint32_t dimension;
+		char name[256];
+		if (line[0] != '#' && sscanf(line, "%u %255[^\r\n]", &dimension, name) == 2 && strcmp(name, pGpuName) == 0) {
+			if (dimension < MIN_GRASS_TILE_DIMENSION || dimension > MAX_GRASS_TILE_DIMENSION) {
+				LOGF(LogLevel::eWARNING, "%s: tile size %u for '%s' is out of range, ignoring it.", TILE_SIZES_FILE, dimension, pGpuName);
+				return 0;
+			}
+			LOGF(LogLevel::eINFO, "Using the %um grass tiles tuned for '%s'.", dimension, pGpuName);
+			return dimension;
+		}
+
+		if (!next) break;
+		line = next+1;
+	}
+	return 0;
+}
+
+// Replaces this GPU's line in tile_sizes.txt, or adds one
+void tileGridSaveTuned(uint32_t dimension) {
+	const char *pGpuName = tileGridGpuName();
+	
+	char *text = NULL;
+	FileStream file = {};
+	if (fsOpenStreamFromPath(RD_OTHER_FILES, TILE_SIZES_FILE, FM_READ, &file)) {
+		ssize_t size = fsGetStreamFileSize(&file);
+		text = (char*)tempAlloc((size_t)size+1);
+		size_t readSize = fsReadFromStream(&file, text, (size_t)size);
+		text[readSize] = 0;
+		fsCloseStream(&file);
+	}
+	
+	if (!fsOpenStreamFromPath(RD_OTHER_FILES, TILE_SIZES_FILE, FM_WRITE, &file)) {
+		LOGF(LogLevel::eERROR, "Failed to open '%s' for writing the tuned tile size.", TILE_SIZES_FILE);
+		return;
+	}
+	
+	const char *header = "# <grass tile size> <GPU name>, written by --tune-tile-size\n";
+	fsWriteToStream(&file, header, strlen(header));
+	
+	// Keep what the other GPUs were tuned to
+	char *line = text;
+	while (line && *line) {
+		char *next = strchr(line, '\n');
+		if (next) *next = 0;
+
+		uint32_t lineDimension;
+		char name[256];
+		if (line[0] != '#' && sscanf(line, "%u %255[^\r\n]", &lineDimension, name) == 2 && strcmp(name, pGpuName) != 0) {
+			const char *entry = tempPrint("%u %s\n", lineDimension, name);
+			fsWriteToStream(&file, entry, strlen(entry));
+		}
+
+		if (!next) break;
+		line = next+1;
+	}
+	
+	const char *entry = tempPrint("%u %s\n", dimension, pGpuName);
+	fsWriteToStream(&file, entry, strlen(entry));
+	fsCloseStream(&file);
+	
+	LOGF(LogLevel::eINFO, "Wrote tuned tile size %um for '%s' to '%s'", dimension, pGpuName, TILE_SIZES_FILE);
+}
+
+void tileTuneStart() {
+	if (gTileTuner.mActive) return;
+	
+	gTileTuner = {};
+	gTileTuner.mActive = true;
+	gTileTuner.mCameraPos = pCameraController->getViewPosition();
+	// The camera looks down +z
+	Matrix4 cameraToWorld = inverse(pCameraController->getViewMatrix());
+	gTileTuner.mCameraLookAt = gTileTuner.mCameraPos + cameraToWorld.getCol2().getXYZ();
+	
+	LOGF(LogLevel::eINFO, "Tuning grass tile size (%u candidates)", (uint32_t)TF_ARRAY_COUNT(gTileTuneCandidates));
+}
+
+// Call in Update(), after the camera controller. Moves the camera while tuning.
+void tileTuneUpdate() {
+	if (gTileTuneRequested) {
+		gTileTuneRequested = false;
+		tileTuneStart();
+	}
+	
+	TileTuner *pTuner = &gTileTuner;
+	if (!pTuner->mActive) return;
+	
+	const float *pCamera = gTileTuneCameras[pTuner->mCamera];
+	pCameraController->moveTo(Vector3(pCamera[0], pCamera[1], pCamera[2]));
+	pCameraController->lookAt(Vector3(pCamera[3], pCamera[4], pCamera[5]));
+	
+	// Nothing's timed until the grass has loaded & the candidate's buffers are in
+	uint32_t dimension = gTileTuneCandidates[pTuner->mCandidate];
+	if (!gStartup.mGrassReady || gTileGrid.mDimension != dimension) {
+		gTileGrid.mRequestedDimension = dimension;
+		return;
+	}
+	
+	pTuner->mFrame += 1;
+	if (pTuner->mFrame > TILE_TUNE_WARMUP_FRAMES) pTuner->mGpuMs[pTuner->mCandidate] += getGpuProfileTime(gGpuProfileToken);
+	if (pTuner->mFrame < TILE_TUNE_WARMUP_FRAMES+TILE_TUNE_MEASURE_FRAMES) return;
+	
+	pTuner->mFrame = 0;
+	pTuner->mCamera += 1;
+	if (pTuner->mCamera < TF_ARRAY_COUNT(gTileTuneCameras)) return;
+	
+	pTuner->mCamera = 0;
+	LOGF(LogLevel::eINFO, "Tile size %um: %.3f ms", dimension,
+		pTuner->mGpuMs[pTuner->mCandidate]/(float)(TF_ARRAY_COUNT(gTileTuneCameras)*TILE_TUNE_MEASURE_FRAMES));
+	pTuner->mCandidate += 1;
+	if (pTuner->mCandidate < TF_ARRAY_COUNT(gTileTuneCandidates)) return;
+	
+	uint32_t best = 0;
+	for (uint32_t i = 1; i < TF_ARRAY_COUNT(gTileTuneCandidates); i += 1) {
+		if (pTuner->mGpuMs[i] < pTuner->mGpuMs[best]) best = i;
+	}
+	gTileGrid.mRequestedDimension = gTileTuneCandidates[best];
+	tileGridSaveTuned(gTileTuneCandidates[best]);
+	
+	pCameraController->moveTo(pTuner->mCameraPos);
+	pCameraController->lookAt(pTuner->mCameraLookAt);
+	pTuner->mActive = false;
+}
+
+///
+// CPU height field
+//
+// The height map only lives on the GPU, the resource loader uploads it straight from the
+// file. Grass queries need it on the CPU to stand blades where grass.vert does, so once it's
+// loaded we copy it to a readback buffer in the next frame's command list (once, outside the
+// frame graph, nothing else uses the texture as a copy source) and unpack the .r the shaders
+// sample into floats when that frame's fence has been waited on. It's loaded as sRGB, so
+// those are linearized the same way sampling does.
+
+typedef struct CpuHeightField {
+	float    *pHeights; // NULL until the readback has landed
+	uint32_t  mWidth;
+	uint32_t  mHeight;
+	
+	Buffer   *pReadback;
+	uint32_t  mRowPitch;
+	uint32_t  mFrameIndex; // Frame slot the copy was recorded in
+	bool      mRecorded;
+} CpuHeightField;
+CpuHeightField gCpuHeightField = {};
+
+// Call after beginCmd(), it's a no-op once the heights are there
+void heightFieldRecordReadback(Cmd *cmd, uint32_t frameIndex) {
+	CpuHeightField *pField = &gCpuHeightField;
+	if (pField->mRecorded || !gStartup.mSkyAndTerrainReady) return;
+	
+	const uint32_t rowAlignment = pRenderer->pGpu->mUploadBufferTextureRowAlignment > 0 ? pRenderer->pGpu->mUploadBufferTextureRowAlignment : 1;
+	const uint32_t texelSize = TinyImageFormat_BitSizeOfBlock((TinyImageFormat)pHeightMap->mFormat)/8;
+	pField->mWidth = pHeightMap->mWidth;
+	pField->mHeight = pHeightMap->mHeight;
+	pField->mRowPitch = (pField->mWidth*texelSize+rowAlignment-1)/rowAlignment*rowAlignment;
+	
+	BufferLoadDesc loadDesc = {};
+	loadDesc.mDesc.mSize = (uint64_t)pField->mRowPitch*pField->mHeight;
+	loadDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_TO_CPU;
+	loadDesc.mDesc.mFlags = BUFFER_CREATION_FLAG_PERSISTENT_MAP_BIT;
+	loadDesc.mDesc.mStartState = RESOURCE_STATE_COPY_DEST;
+	loadDesc.mDesc.pName = "Height map readback";
+	loadDesc.ppBuffer = &pField->pReadback;
+	addTrackedBuffer(&loadDesc, NULL, MEMORY_CATEGORY_TERRAIN);
+	
+	TextureBarrier barrier = { pHeightMap, RESOURCE_STATE_SHADER_RESOURCE, RESOURCE_STATE_COPY_SOURCE };
+	cmdResourceBarrier(cmd, 0, NULL, 1, &barrier, 0, NULL);
+	SubresourceDataDesc copyDesc = {};
+	copyDesc.mRowPitch = pField->mRowPitch;
+	copyDesc.mSlicePitch = pField->mRowPitch*pField->mHeight;
+	cmdCopySubresource(cmd, pField->pReadback, pHeightMap, &copyDesc);
+	barrier = { pHeightMap, RESOURCE_STATE_COPY_SOURCE, RESOURCE_STATE_SHADER_RESOURCE };
+	cmdResourceBarrier(cmd, 0, NULL, 1, &barrier, 0, NULL);
+	
+	pField->mFrameIndex = frameIndex;
+	pField->mRecorded = true;
+}
+
+void heightFieldFreeReadback() {
+	CpuHeightField *pField = &gCpuHeightField;
+	if (!pField->pReadback) return;
+	removeTrackedBuffer(pField->pReadback);
+	pField->pReadback = NULL;
+}
+
+// Unpacks the copy. Only call once the frame slot's fence has signaled.
+void heightFieldReadFrame(uint32_t frameIndex) {
+	CpuHeightField *pField = &gCpuHeightField;
+	if (!pField->pReadback || pField->mFrameIndex != frameIndex) return;
+	
+	// Which byte(s) of a texel hold .r
+	const TinyImageFormat format = (TinyImageFormat)pHeightMap->mFormat;
+	uint32_t texelSize = 4, red = 0;
+	bool srgb = false, sixteenBit = false;
+	switch (format) {
+		case TinyImageFormat_R8_UNORM:       texelSize = 1; break;
+		case TinyImageFormat_R16_UNORM:      texelSize = 2; sixteenBit = true; break;
+		case TinyImageFormat_R8G8B8A8_UNORM: break;
+		case TinyImageFormat_R8G8B8A8_SRGB:  srgb = true; break;
+		case TinyImageFormat_B8G8R8A8_UNORM: red = 2; break;
+		case TinyImageFormat_B8G8R8A8_SRGB:  red = 2; srgb = true; break;
+		default:
+			LOGF(LogLevel::eWARNING, "The height map's format (%u) can't be read on the CPU, grass queries won't find anything.", (uint32_t)format);
+			heightFieldFreeReadback();
+			return;
+	}
+	
+	float decode[256];
+	for (uint32_t i = 0; i < 256; i += 1) {
+		const float c = (float)i/255.0f;
+		decode[i] = !srgb ? c : c <= 0.04045f ? c/12.92f : powf((c+0.055f)/1.055f, 2.4f);
+	}
+	
+	const uint64_t size = (uint64_t)pField->mWidth*pField->mHeight*sizeof(float);
+	pField->pHeights = (float*)tf_malloc(size);
+	memTrack(pField->pHeights, MEMORY_CATEGORY_TERRAIN, size, true);
+	
+	const uint8_t *pTexels = (const uint8_t*)pField->pReadback->pCpuMappedAddress;
+	for (uint32_t y = 0; y < pField->mHeight; y += 1) {
+		const uint8_t *pRow = pTexels+(uint64_t)y*pField->mRowPitch;
+		float *pDst = pField->pHeights+(uint64_t)y*pField->mWidth;
+		for (uint32_t x = 0; x < pField->mWidth; x += 1) {
+			const uint8_t *pTexel = pRow+x*texelSize;
+			if (sixteenBit) pDst[x] = (float)(pTexel[0] | (pTexel[1] << 8))/65535.0f;
+			else            pDst[x] = decode[pTexel[red]];
+		}
+	}
+	heightFieldFreeReadback();
+	
+	LOGF(LogLevel::eINFO, "Height map read back for grass queries (%ux%u)", pField->mWidth, pField->mHeight);
+}
+
+// Only call when the queue is idle
+void heightFieldReadAllFrames() {
+	if (gCpuHeightField.pReadback) heightFieldReadFrame(gCpuHeightField.mFrameIndex);
+}
+
+void heightFieldExit() {
+	heightFieldFreeReadback();
+	memUntrack(gCpuHeightField.pHeights);
+	tf_free(gCpuHeightField.pHeights);
+	gCpuHeightField = {};
+}
+
+///
+// Grass queries
+//
+// grass_query.h places the blades up close on the CPU the way grass.vert does, for gameplay
+// queries (how much grass is here, what does this ray hit, which blades are around this)
+// without reading anything back. Here it's fed what the shaders get: the tile grid's seeds &
+// species mixes, the species & the mesh each is drawn with up close, and the heights from the
+// "CPU height field". Until those have landed the field is empty and queries find nothing.
+// When anything placement depends on changes (tile size, grass count, the species panel...)
+// grassQuerySetField() flushes its cached tiles.
+//
+// --grass-queries <rays> runs a demo every frame: that many rays fanned out around where the
+// camera looks, then a box count & a radius gather where the middle one lands, and shows what
+// they found & cost.
+
+#define GRASS_QUERY_DEMO_MAX_RAYS 4096
+#define GRASS_QUERY_DEMO_MAX_DISTANCE 300.0f
+#define GRASS_QUERY_DEMO_CONE 0.25f     // Tangent of the fan's half angle
+#define GRASS_QUERY_DEMO_BOX 10.0f      // Half size, meters
+#define GRASS_QUERY_DEMO_RADIUS 2.0f
+#define GRASS_QUERY_DEMO_MAX_GATHER 256
+
+typedef struct GrassQueryDemo {
+	uint32_t mRays; // Per frame, 0 is off
+	uint32_t mHitCount;
+	float    mCenterDistance; // Of the middle ray, 0 if it missed
+	uint32_t mBoxCount;
+	uint32_t mRadiusCount;
+	float    mMicroseconds;
+	float    mCacheHitRate;
+} GrassQueryDemo;
+
+GrassQuery      gGrassQuery = {};
+GrassQueryDemo  gGrassQueryDemo = {};
+float          *pTrackedGrassQueryArena = NULL; // grassQuerySetField() may reallocate it
+GrassQueryBlade gGrassQueryGathered[GRASS_QUERY_DEMO_MAX_GATHER];
+
+void runGrassQueryDemo(Vector3 cameraPos, Vector3 viewDir) {
+	GrassQueryDemo *pDemo = &gGrassQueryDemo;
+	const uint64_t hits = gGrassQuery.mHits, misses = gGrassQuery.mMisses;
+	const int64_t startUs = getUSec(true);
+	
+	// Around the view direction, spread evenly over a disc with the golden angle
+	Vector3 right = cross(Vector3(0, 1, 0), viewDir);
+	if (dot(right, right) < 1e-6f) {
+		right = Vector3(1, 0, 0); // Looking straight up or down
+	}
+	right = normalize(right);
+	const Vector3 up = cross(viewDir, right);
+	const float origin[3] = { cameraPos.getX(), cameraPos.getY(), cameraPos.getZ() };
+	
+	pDemo->mHitCount = 0;
+	pDemo->mCenterDistance = 0.0f;
+	float center[3] = { origin[0], origin[1], origin[2] };
+	// 4 rays at a time, a zero direction past the last one casts nothing
+	for (uint32_t i = 0; i < pDemo->mRays; i += 4) {
+		float origins[4][3], directions[4][3];
+		for (uint32_t lane = 0; lane < 4; lane += 1) {
+			const uint32_t ray = i+lane;
+			const float r = GRASS_QUERY_DEMO_CONE*sqrtf((float)ray/(float)pDemo->mRays);
+			const float angle = (float)ray*2.39996323f;
+			const Vector3 d = ray < pDemo->mRays ? viewDir + right*(r*cosf(angle)) + up*(r*sinf(angle)) : Vector3(0.0f);
+			memcpy(origins[lane], origin, sizeof(origin));
+			directions[lane][0] = d.getX();
+			directions[lane][1] = d.getY();
+			directions[lane][2] = d.getZ();
+		}
+		
+		GrassQueryHit hits[4];
+		const uint32_t hitMask = grassQueryRaycast4(&gGrassQuery, origins, directions, GRASS_QUERY_DEMO_MAX_DISTANCE, hits);
+		for (uint32_t lane = 0; lane < 4; lane += 1) pDemo->mHitCount += (hitMask >> lane) & 1;
+		if (i == 0 && (hitMask & 1) != 0) {
+			pDemo->mCenterDistance = hits[0].mDistance;
+			for (uint32_t k = 0; k < 3; k += 1) center[k] = hits[0].mBlade.mBase[k];
+		}
+	}
+	
+	const float boxMin[3] = { center[0]-GRASS_QUERY_DEMO_BOX, center[1]-GRASS_QUERY_DEMO_BOX, center[2]-GRASS_QUERY_DEMO_BOX };
+	const float boxMax[3] = { center[0]+GRASS_QUERY_DEMO_BOX, center[1]+GRASS_QUERY_DEMO_BOX, center[2]+GRASS_QUERY_DEMO_BOX };
+	pDemo->mBoxCount = grassQueryCountInBox(&gGrassQuery, boxMin, boxMax);
+	pDemo->mRadiusCount = grassQueryGatherRadius(&gGrassQuery, center, GRASS_QUERY_DEMO_RADIUS, gGrassQueryGathered, GRASS_QUERY_DEMO_MAX_GATHER);
+	
+	pDemo->mMicroseconds = (float)(getUSec(true)-startUs);
+	const uint64_t lookups = (gGrassQuery.mHits-hits)+(gGrassQuery.mMisses-misses);
+	pDemo->mCacheHitRate = lookups > 0 ? (float)(gGrassQuery.mHits-hits)/(float)lookups : 1.0f;
+}
+
+void updateGrassQueries(Vector3 cameraPos, Vector3 viewDir) {
+	GrassQueryField field;
+	memset(&field, 0, sizeof(field)); // Compared with memcmp(), padding included
+	
+	const CpuHeightField *pHeights = &gCpuHeightField;
+	if (pHeights->pHeights && gTileGrid.pTiles && gGrassDrawUniformData.mLod.mLevelCount > 0) {
+		field.mTileDimension = (float)gTileGrid.mDimension;
+		field.mTileCountX = gTileGrid.mCountX;
+		field.mTileCountY = gTileGrid.mCountY;
+		field.pTileSeeds = &gTileGrid.pTiles[0].mTileSeed;
+		field.pSpeciesMixes = &gTileGrid.pTiles[0].mSpeciesMix;
+		field.mTileStride = sizeof(TileEntry);
+		
+		field.mBladesPerTile = gGrassDrawUniformData.mPerceivedNumberOfGrass/gTileGrid.mCount;
+		field.mMaxInstancesPerTile = gSceneUniformData.mMaxInstancesPerTile;
+		field.mSpeciesCount = gGrassDrawUniformData.mSpeciesCount < MAX_GRASS_SPECIES ? gGrassDrawUniformData.mSpeciesCount : MAX_GRASS_SPECIES;
+		const LodSettings *pLod = &gGrassDrawUniformData.mLod;
+		for (uint32_t s = 0; s < field.mSpeciesCount; s += 1) {
+			const GrassSpecies *pSpecies = &gGrassSpecies[s];
+			// The nearest level the species is drawn with, like grass_draw.comp picks it
+			uint32_t meshLod = pSpecies->mLastLod < pLod->mLevelCount-1 ? pSpecies->mLastLod : pLod->mLevelCount-1;
+			if (pSpecies->mFirstLod < meshLod) meshLod = pSpecies->mFirstLod;
+			GrassQuerySpecies *pQuerySpecies = &field.mSpecies[s];
+			pQuerySpecies->mDensity = pSpecies->mDensity;
+			pQuerySpecies->mMinWidth = pSpecies->mMinWidth;
+			pQuerySpecies->mMaxWidth = pSpecies->mMaxWidth;
+			pQuerySpecies->mMinHeight = pSpecies->mMinHeight;
+			pQuerySpecies->mMaxHeight = pSpecies->mMaxHeight;
+			pQuerySpecies->mBladesPerInstance = pLod->mLevels[meshLod].mBladesPerInstance;
+		}
+		
+		field.mMaxNaturalAngle = gSceneUniformData.mMaxNaturalAngle;
+		field.mMaxFloorY = gSceneUniformData.mMaxFloorY;
+		field.mTerrainSize[0] = gSceneUniformData.mTerrainSize.getX();
+		field.mTerrainSize[1] = gSceneUniformData.mTerrainSize.getY();
+		field.mHeightSamplePercent = (float)HEIGHT_MAP_SAMPLE_FOR_HEIGHT_PERCENT;
+		field.mHeightField.pHeights = pHeights->pHeights;
+		field.mHeightField.mWidth = pHeights->mWidth;
+		field.mHeightField.mHeight = pHeights->mHeight;
+	}
+	
+	if (grassQuerySetField(&gGrassQuery, &field) && gGrassQuery.pArena != pTrackedGrassQueryArena) {
+		memUntrack(pTrackedGrassQueryArena);
+		pTrackedGrassQueryArena = gGrassQuery.pArena;
+		memTrack(pTrackedGrassQueryArena, MEMORY_CATEGORY_GRASS, gGrassQuery.mArenaBytes, true);
+	}
+	
+	if (gGrassQueryDemo.mRays > 0 && gGrassQuery.mTileCount > 0) runGrassQueryDemo(cameraPos, viewDir);
+}
+
+void exitGrassQueries() {
+	memUntrack(pTrackedGrassQueryArena);
+	pTrackedGrassQueryArena = NULL;
+	grassQueryExit(&gGrassQuery);
+}
+
+///
+// Terrain editing
+//
+// The terrain can be sculpted at runtime. The height map texture stays as it was loaded (The
+// Forge only uploads whole mip levels, and it's 2048x2048 RGBA), instead heightEdits holds a
+// float per texel that terrainHeight() in shared.h.fsl adds to its .r. It only covers the part
+// of the map the terrain stretches over (HEIGHT_MAP_SAMPLE_FOR_HEIGHT_PERCENT of it, about
+// 310x310 texels, 8m apart).
+//
+// terrainEditBrush() changes the CPU height field (so grass queries see it straight away) & the
+// offsets, and grows a dirty rectangle. In the next frame the "Edit terrain" pass copies just
+// the dirty rows of it from this frame's staging buffer. Everything derived from the heights is
+// either recomputed from terrainHeight() every frame (terrain normals & the far-field grass
+// shading in terrain.vert/frag, blade bases in grass.vert & grass_splat.comp) or is only
+// recomputed for the tiles under the edit:
+//   - tile bounds come from grass_draw.comp, which skips tiles coherent culling still trusts, so
+//     the same pass zeroes the cull state of those tiles in every view and culling runs that
+//     frame even if nothing else changed, see "Coherent culling"
+//   - grass queries drop their cached blades for those tiles, see "Grass queries"
+// Tile seeds & species mixes don't depend on the height, so they stay as they are.
+//
+// The "Sculpt" UI applies a brush where the camera looks, every frame, scaled by frame time.
+
+#define TERRAIN_EDIT_MAX_RADIUS 200.0f
+#define TERRAIN_EDIT_MAX_DISTANCE 3000.0f // How far the camera ray looks for ground
+
+typedef enum TerrainBrush {
+	TERRAIN_BRUSH_NONE,
+	TERRAIN_BRUSH_RAISE,   // By amount meters at the center
+	TERRAIN_BRUSH_LOWER,
+	TERRAIN_BRUSH_SMOOTH,  // Amount (0..1) of the way to the average of the neighbours at the center
+	TERRAIN_BRUSH_FLATTEN, // Amount (0..1) of the way to the height at the center
+	TERRAIN_BRUSH_COUNT,
+} TerrainBrush;
+
+typedef struct TerrainEdits {
+	Buffer   *pBuffer;  // heightEdits
+	Buffer   *pStaging[gMaxFramesInFlight]; // CPU_TO_GPU: zeroes for the cull state, then the dirty rows
+	uint64_t  mZeroBytes;
+	uint32_t  mWidth;   // Texels of the height map the terrain covers, also SceneData::HeightEdits
+	uint32_t  mHeight;
+	float    *pOffsets; // What pBuffer holds once uploaded, mWidth*mHeight
+	
+	// Texels changed since the last upload, [x0, x1) x [y0, y1), and the world x0, z0, x1, z1
+	// those texels reach
+	bool      mDirty;
+	uint32_t  mDirtyTexels[4];
+	float     mDirtyArea[4];
+	
+	// From the UI
+	uint32_t  mSculptBrush    = TERRAIN_BRUSH_NONE;
+	float     mSculptRadius   = 40.0f;
+	float     mSculptStrength = 6.0f; // Meters per second, a tenth of that is the smooth & flatten rate
+	
+	// For the stats line
+	float     mBrushMicroseconds;
+	uint32_t  mUploadedTexels;
+	uint32_t  mUploadCopies;
+	uint32_t  mResetTiles;
+} TerrainEdits;
+TerrainEdits gTerrainEdits;
+
+// Ground height in meters at x, z, as terrainHeight() sees it. 0 until the heights are read back.
+float heightFieldSample(float x, float z) {
+	GrassQueryField field;
+	memset(&field, 0, sizeof(field));
+	field.mTerrainSize[0] = gSceneUniformData.mTerrainSize.getX();
+	field.mTerrainSize[1] = gSceneUniformData.mTerrainSize.getY();
+	field.mHeightSamplePercent = (float)HEIGHT_MAP_SAMPLE_FOR_HEIGHT_PERCENT;
+	field.mHeightField.pHeights = gCpuHeightField.pHeights;
+	field.mHeightField.mWidth = gCpuHeightField.mWidth;
+	field.mHeightField.mHeight = gCpuHeightField.mHeight;
+	return gSceneUniformData.mMaxFloorY*grassQuerySampleHeight(&field, x, z);
+}
+
+// Once the height map has loaded, before its descriptor sets are filled in
+void addTerrainEdits() {
+	TerrainEdits *pEdits = &gTerrainEdits;
+	const float percent = (float)HEIGHT_MAP_SAMPLE_FOR_HEIGHT_PERCENT;
+	// The bilinear samples at the far edge reach one texel further
+	pEdits->mWidth = (uint32_t)ceilf(pHeightMap->mWidth*percent)+1;
+	pEdits->mHeight = (uint32_t)ceilf(pHeightMap->mHeight*percent)+1;
+	if (pEdits->mWidth > pHeightMap->mWidth) pEdits->mWidth = pHeightMap->mWidth;
+	if (pEdits->mHeight > pHeightMap->mHeight) pEdits->mHeight = pHeightMap->mHeight;
+	const uint64_t size = (uint64_t)pEdits->mWidth*pEdits->mHeight*sizeof(float);
+	
+	BufferLoadDesc loadDesc = {};
+	loadDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_BUFFER;
+	loadDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_ONLY;
+	loadDesc.mDesc.mStartState = RESOURCE_STATE_SHADER_RESOURCE;
+	loadDesc.mDesc.mSize = size;
+	loadDesc.mDesc.mElementCount = pEdits->mWidth*pEdits->mHeight;
+	loadDesc.mDesc.mStructStride = sizeof(float);
+	loadDesc.mDesc.pName = "HeightEdits";
+	loadDesc.mForceReset = true;
+	loadDesc.ppBuffer = &pEdits->pBuffer;
+	addTrackedBuffer(&loadDesc, nullptr, MEMORY_CATEGORY_TERRAIN);
+	
+	// Room for a row of cull states of the smallest tiles, & every offset in case all are dirty
+	pEdits->mZeroBytes = sizeof(GrassTileCullState)*(TERRAIN_WIDTH/MIN_GRASS_TILE_DIMENSION+1);
+	BufferLoadDesc stagingDesc = {};
+	stagingDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_CPU_TO_GPU;
+	stagingDesc.mDesc.mFlags = BUFFER_CREATION_FLAG_PERSISTENT_MAP_BIT;
+	stagingDesc.mDesc.mStartState = RESOURCE_STATE_COPY_SOURCE;
+	stagingDesc.mDesc.mSize = pEdits->mZeroBytes+size;
+	stagingDesc.mDesc.pName = "HeightEditsStaging";
+	for (uint32_t i = 0; i < gMaxFramesInFlight; i += 1) {
+		stagingDesc.ppBuffer = &pEdits->pStaging[i];
+		addTrackedBuffer(&stagingDesc, nullptr, MEMORY_CATEGORY_TERRAIN);
+		memset(pEdits->pStaging[i]->pCpuMappedAddress, 0, pEdits->mZeroBytes);
+	}
+	
+	pEdits->pOffsets = (float*)tf_calloc(pEdits->mWidth*pEdits->mHeight, sizeof(float));
+	memTrack(pEdits->pOffsets, MEMORY_CATEGORY_TERRAIN, size, true);
+	
+	gSceneUniformData.mHeightEdits[0] = pEdits->mWidth;
+	gSceneUniformData.mHeightEdits[1] = pEdits->mHeight;
+}
+
+void removeTerrainEdits() {
+	TerrainEdits *pEdits = &gTerrainEdits;
+	if (pEdits->pBuffer) removeTrackedBuffer(pEdits->pBuffer);
+	for (uint32_t i = 0; i < gMaxFramesInFlight; i += 1) {
+		if (pEdits->pStaging[i]) removeTrackedBuffer(pEdits->pStaging[i]);
+	}
+	memUntrack(pEdits->pOffsets);
+	tf_free(pEdits->pOffsets);
+	*pEdits = TerrainEdits();
+}
+
+// Edits the terrain within radius of x, z, fading out towards the edge. See TerrainBrush for
+// what amount means. False if there's nothing to edit yet or the brush misses the terrain.
+bool terrainEditBrush(float x, float z, float radius, float amount, TerrainBrush brush) {
+	TerrainEdits *pEdits = &gTerrainEdits;
+	CpuHeightField *pField = &gCpuHeightField;
+	if (!pEdits->pOffsets || !pField->pHeights || !(radius > 0.0f) || brush == TERRAIN_BRUSH_NONE) return false;
+	
+	// Texels per meter, see terrainHeight()
+	const float percent = (float)HEIGHT_MAP_SAMPLE_FOR_HEIGHT_PERCENT;
+	const float scaleX = percent*(float)pField->mWidth/gSceneUniformData.mTerrainSize.getX();
+	const float scaleZ = percent*(float)pField->mHeight/gSceneUniformData.mTerrainSize.getY();
+	const int32_t x0 = (int32_t)fmaxf(floorf((x-radius)*scaleX), 0.0f);
+	const int32_t y0 = (int32_t)fmaxf(floorf((z-radius)*scaleZ), 0.0f);
+	const int32_t x1 = (int32_t)fminf(ceilf((x+radius)*scaleX)+1.0f, (float)pEdits->mWidth);
+	const int32_t y1 = (int32_t)fminf(ceilf((z+radius)*scaleZ)+1.0f, (float)pEdits->mHeight);
+	if (x0 >= x1 || y0 >= y1) return false;
+	
+	const float toHeight = 1.0f/gSceneUniformData.mMaxFloorY;
+	const float target = heightFieldSample(x, z)*toHeight;
+	const uint32_t rowPitch = pField->mWidth;
+	
+	// Smoothing reads the neighbours as they were before this edit
+	const uint32_t copyWidth = (uint32_t)(x1-x0)+2;
+	float *pBefore = NULL;
+	if (brush == TERRAIN_BRUSH_SMOOTH) {
+		pBefore = (float*)tempAlloc(sizeof(float)*copyWidth*(uint32_t)(y1-y0+2));
+		for (int32_t ty = y0-1; ty <= y1; ty += 1) {
+			for (int32_t tx = x0-1; tx <= x1; tx += 1) {
+				const uint32_t cx = (uint32_t)(tx < 0 ? 0 : tx >= (int32_t)pField->mWidth ? pField->mWidth-1 : tx);
+				const uint32_t cy = (uint32_t)(ty < 0 ? 0 : ty >= (int32_t)pField->mHeight ? pField->mHeight-1 : ty);
+				pBefore[(uint32_t)(ty-y0+1)*copyWidth+(uint32_t)(tx-x0+1)] = pField->pHeights[cy*rowPitch+cx];
+			}
+		}
+	}
+	
+	for (int32_t ty = y0; ty < y1; ty += 1) {
+		for (int32_t tx = x0; tx < x1; tx += 1) {
+			const float dx = (float)tx/scaleX-x;
+			const float dz = (float)ty/scaleZ-z;
+			const float d = (dx*dx+dz*dz)/(radius*radius);
+			if (d >= 1.0f) continue;
+			const float falloff = (1.0f-d)*(1.0f-d);
+			
+			float *pHeight = &pField->pHeights[(uint32_t)ty*rowPitch+(uint32_t)tx];
+			float height = *pHeight;
+			switch (brush) {
+				case TERRAIN_BRUSH_RAISE: height += amount*toHeight*falloff; break;
+				case TERRAIN_BRUSH_LOWER: height -= amount*toHeight*falloff; break;
+				case TERRAIN_BRUSH_SMOOTH: {
+					const float *pCenter = &pBefore[(uint32_t)(ty-y0+1)*copyWidth+(uint32_t)(tx-x0+1)];
+					const float average = (pCenter[-1]+pCenter[1]+pCenter[-(int32_t)copyWidth]+pCenter[copyWidth])*0.25f;
+					height += (average-height)*amount*falloff;
+				} break;
+				case TERRAIN_BRUSH_FLATTEN: height += (target-height)*amount*falloff; break;
+				default: break;
+			}
+			pEdits->pOffsets[(uint32_t)ty*pEdits->mWidth+(uint32_t)tx] += height-*pHeight;
+			*pHeight = height;
+		}
+	}
+	
+	// A texel is blended into everything up to a texel away from it
+	const float area[4] = { (float)(x0-1)/scaleX, (float)(y0-1)/scaleZ, (float)x1/scaleX, (float)y1/scaleZ };
+	if (!pEdits->mDirty) {
+		pEdits->mDirtyTexels[0] = (uint32_t)x0;
+		pEdits->mDirtyTexels[1] = (uint32_t)y0;
+		pEdits->mDirtyTexels[2] = (uint32_t)x1;
+		pEdits->mDirtyTexels[3] = (uint32_t)y1;
+		memcpy(pEdits->mDirtyArea, area, sizeof(area));
+		pEdits->mDirty = true;
+	} else {
+		if ((uint32_t)x0 < pEdits->mDirtyTexels[0]) pEdits->mDirtyTexels[0] = (uint32_t)x0;
+		if ((uint32_t)y0 < pEdits->mDirtyTexels[1]) pEdits->mDirtyTexels[1] = (uint32_t)y0;
+		if ((uint32_t)x1 > pEdits->mDirtyTexels[2]) pEdits->mDirtyTexels[2] = (uint32_t)x1;
+		if ((uint32_t)y1 > pEdits->mDirtyTexels[3]) pEdits->mDirtyTexels[3] = (uint32_t)y1;
+		for (uint32_t i = 0; i < 2; i += 1) pEdits->mDirtyArea[i] = fminf(pEdits->mDirtyArea[i], area[i]);
+		for (uint32_t i = 2; i < 4; i += 1) pEdits->mDirtyArea[i] = fmaxf(pEdits->mDirtyArea[i], area[i]);
+	}
+	
+	// The grass queries' blades under it stand on the new heights next time they're asked for
+	const float tileDimension = (float)gTileGrid.mDimension;
+	if (gTileGrid.mCount > 0) {
+		const uint32_t tx0 = (uint32_t)fmaxf(floorf(area[0]/tileDimension), 0.0f);
+		const uint32_t tz0 = (uint32_t)fmaxf(floorf(area[1]/tileDimension), 0.0f);
+		const uint32_t tx1 = (uint32_t)fminf(floorf(area[2]/tileDimension), (float)gTileGrid.mCountX-1);
+		const uint32_t tz1 = (uint32_t)fminf(floorf(area[3]/tileDimension), (float)gTileGrid.mCountY-1);
+		for (uint32_t tz = tz0; tz <= tz1; tz += 1) {
+			for (uint32_t tx = tx0; tx <= tx1; tx += 1) grassQueryInvalidateTile(&gGrassQuery, tz*gTileGrid.mCountX+tx);
+		}
+	}
+	return true;
+}
+
+// What the "Edit terrain" pass uploads. Taken from gTerrainEdits along with the rest of the
+// frame's snapshot, so the brush can carry on while the render thread records it, see "Render thread".
+typedef struct TerrainEditUpload {
+	bool      mDirty;
+	uint32_t  mTexels[4]; // See TerrainEdits::mDirtyTexels
+	float     mArea[4];
+	float    *pRows;      // The dirty rectangle's offsets, row after row
+} TerrainEditUpload;
+
+void terrainEditTakeUpload(TerrainEditUpload *pUpload) {
+	TerrainEdits *pEdits = &gTerrainEdits;
+	pUpload->mDirty = pEdits->mDirty;
+	if (!pEdits->mDirty) return;
+	
+	// Room for every offset, it's never reallocated
+	if (!pUpload->pRows) {
+		const uint64_t size = (uint64_t)pEdits->mWidth*pEdits->mHeight*sizeof(float);
+		pUpload->pRows = (float*)tf_malloc(size);
+		memTrack(pUpload->pRows, MEMORY_CATEGORY_TERRAIN, size, true);
+	}
+	const uint32_t x0 = pEdits->mDirtyTexels[0], y0 = pEdits->mDirtyTexels[1];
+	const uint32_t x1 = pEdits->mDirtyTexels[2], y1 = pEdits->mDirtyTexels[3];
+	for (uint32_t y = y0; y < y1; y += 1) {
+		memcpy(&pUpload->pRows[(y-y0)*(x1-x0)], &pEdits->pOffsets[y*pEdits->mWidth+x0], (x1-x0)*sizeof(float));
+	}
+	memcpy(pUpload->mTexels, pEdits->mDirtyTexels, sizeof(pUpload->mTexels));
+	memcpy(pUpload->mArea, pEdits->mDirtyArea, sizeof(pUpload->mArea));
+	pEdits->mDirty = false;
+}
+
+void terrainEditFreeUpload(TerrainEditUpload *pUpload) {
+	memUntrack(pUpload->pRows);
+	tf_free(pUpload->pRows);
+	*pUpload = {};
+}
+
+// Run by the frame graph's "Edit terrain" pass, only declared when the upload is dirty. Only
+// touches the cull state when grass is drawn.
+void terrainEditRecordUploads(Cmd *cmd, uint32_t frameIndex, const TerrainEditUpload *pUpload, bool drawGrass) {
+	TerrainEdits *pEdits = &gTerrainEdits;
+	Buffer *pStaging = pEdits->pStaging[frameIndex];
+	
+	// Each row of the dirty rectangle is contiguous in heightEdits, & a full-width rectangle is
+	// one range
+	const uint32_t x0 = pUpload->mTexels[0], y0 = pUpload->mTexels[1];
+	const uint32_t x1 = pUpload->mTexels[2], y1 = pUpload->mTexels[3];
+	const bool fullRows = x0 == 0 && x1 == pEdits->mWidth;
+	const uint32_t rowTexels = fullRows ? (y1-y0)*pEdits->mWidth : x1-x0;
+	memcpy((uint8_t*)pStaging->pCpuMappedAddress+pEdits->mZeroBytes, pUpload->pRows, (uint64_t)(x1-x0)*(y1-y0)*sizeof(float));
+	pEdits->mUploadedTexels = (x1-x0)*(y1-y0);
+	pEdits->mUploadCopies = 0;
+	uint64_t stagingOffset = pEdits->mZeroBytes;
+	for (uint32_t y = y0; y < (fullRows ? y0+1 : y1); y += 1) {
+		const uint64_t first = (uint64_t)y*pEdits->mWidth+x0;
+		cmdUpdateBuffer(cmd, pEdits->pBuffer, first*sizeof(float), pStaging, stagingOffset, rowTexels*sizeof(float));
+		stagingOffset += rowTexels*sizeof(float);
+		pEdits->mUploadCopies += 1;
+	}
+	
+	pEdits->mResetTiles = 0;
+	if (drawGrass) {
+		const float tileDimension = (float)gTileGrid.mDimension;
+		const uint32_t tx0 = (uint32_t)fmaxf(floorf(pUpload->mArea[0]/tileDimension), 0.0f);
+		const uint32_t tz0 = (uint32_t)fmaxf(floorf(pUpload->mArea[1]/tileDimension), 0.0f);
+		const uint32_t tx1 = (uint32_t)fminf(floorf(pUpload->mArea[2]/tileDimension), (float)gTileGrid.mCountX-1);
+		const uint32_t tz1 = (uint32_t)fminf(floorf(pUpload->mArea[3]/tileDimension), (float)gTileGrid.mCountY-1);
+		if (tx0 <= tx1 && tz0 <= tz1) {
+			// An epoch of 0 is never current, so these tiles are tested again
+			const uint64_t rowBytes = sizeof(GrassTileCullState)*(tx1-tx0+1);
+			for (uint32_t v = 0; v < MAX_GRASS_VIEWS; v += 1) {
+				for (uint32_t tz = tz0; tz <= tz1; tz += 1) {
+					const uint64_t first = (uint64_t)v*gTileGrid.mCount+(uint64_t)tz*gTileGrid.mCountX+tx0;
+					cmdUpdateBuffer(cmd, pGrassCullStateBuffer, first*sizeof(GrassTileCullState), pStaging, 0, rowBytes);
+				}
+			}
+			pEdits->mResetTiles = (tx1-tx0+1)*(tz1-tz0+1);
+		}
+	}
+}
+
+// Where the camera looks, on the CPU height field. Marches in steps, then bisects the step it crossed in.
+bool terrainRaycast(Vector3 origin, Vector3 direction, float *pDistance) {
+	const float step = 4.0f;
+	float previous = 0.0f;
+	for (float t = step; t <= TERRAIN_EDIT_MAX_DISTANCE; t += step) {
+		const Vector3 p = origin+direction*t;
+		if (p.getY() > heightFieldSample(p.getX(), p.getZ())) {
+			previous = t;
+			continue;
+		}
+		float lo = previous, hi = t;
+		for (uint32_t i = 0; i < 8; i += 1) {
+			const float mid = (lo+hi)*0.5f;
+			const Vector3 m = origin+direction*mid;
+			if (m.getY() > heightFieldSample(m.getX(), m.getZ())) lo = mid;
+			else hi = mid;
+		}
+		*pDistance = hi;
+		return true;
+	}
+	return false;
+}
+
+void updateTerrainSculpt(Vector3 cameraPos, Vector3 viewDir, float deltaTime) {
+	TerrainEdits *pEdits = &gTerrainEdits;
+	const TerrainBrush brush = (TerrainBrush)pEdits->mSculptBrush;
+	if (brush == TERRAIN_BRUSH_NONE || !gCpuHeightField.pHeights || !pEdits->pOffsets) return;
+	
+	float distance;
+	if (!terrainRaycast(cameraPos, viewDir, &distance)) return;
+	const Vector3 hit = cameraPos+viewDir*distance;
+	
+	const bool blend = brush == TERRAIN_BRUSH_SMOOTH || brush == TERRAIN_BRUSH_FLATTEN;
+	const float amount = blend ? fminf(pEdits->mSculptStrength*0.1f*deltaTime, 1.0f) : pEdits->mSculptStrength*deltaTime;
+	
+	const int64_t startUs = getUSec(true);
+	terrainEditBrush(hit.getX(), hit.getZ(), pEdits->mSculptRadius, amount, brush);
+	pEdits->mBrushMicroseconds = (float)(getUSec(true)-startUs);
+}
+
+///
+// Render thread
+//
+// Optionally Draw()'s work (waiting for the frame's fence & swapchain image, ubo writes,
+// recording, submit & present) runs on its own thread, one frame behind Update(). The main
+// thread copies everything a frame needs that Update() changes into a FrameSnapshot, the ubo
+// contents of every view included, and queues it. The render thread only reads its snapshot, so
+// the next Update() can run meanwhile, and the frame time tends towards the slower of the two
+// rather than their sum.
+//
+// There's one snapshot being rendered and at most one queued, if the main thread gets a frame
+// further ahead it waits for a slot. Without the render thread the main thread renders its
+// snapshot itself, so both modes take the same path.
+//
+// Not everything fits in a snapshot:
+//   - The UI writes straight into globals as it's drawn, and shows stats from both threads.
+//     Update() holds mStateMutex throughout, the render thread holds it to draw the UI, to read
+//     back the height field & to start captures. It's also what guards temporary storage.
+//   - Resources are only recreated (frames in flight, tile size, temporal grass, vsync, resizing)
+//     once the render thread is idle, as are trace captures, whose events aren't thread safe.
+//   - Low latency mode waits for the render thread as well as the GPU before sampling input.
+
+// Ring of snapshots, one rendering & one queued
+#define RENDER_THREAD_SNAPSHOTS 2
+
+typedef struct FrameSnapshot {
+	SceneUniformData     mScenes[MAX_GRASS_VIEWS];   // Filled in for each view
+	SkyboxUniformData    mSkyboxes[MAX_GRASS_VIEWS];
+	GrassDrawUniformData mGrassDraw;
+	GrassSpecies         mSpecies[MAX_GRASS_SPECIES];
+	RenderView           mViews[MAX_GRASS_VIEWS];
+	uint32_t             mViewCount;
+	
+	bool     mDrawTerrainAndSky; // See "Startup loading"
+	bool     mDrawGrass;
+	bool     mSplitSubmission;
+	uint32_t mTemporalDrawFrames;
+	bool     mViewsMoved;        // See "Coherent culling"
+	uint32_t mCullEpoch;
+	
+	Buffer            *pHeightEdits; // See "Terrain editing"
+	TerrainEditUpload  mHeightEditUpload;
+	
+	int64_t  mInputSampleUs;
+	bool     mThreaded;   // Rendered on the render thread
+	float    mMainWaitMs; // How long the main thread waited for a free snapshot
+} FrameSnapshot;
+
+typedef void (*RenderFrameFunc)(void *pUserData, const FrameSnapshot *pSnapshot);
+
+typedef struct RenderThread {
+	bool             mRequested; // From UI/command line
+	bool             mIdle;      // Main thread only, nothing queued or rendering since renderThreadWait()
+	
+	RenderFrameFunc  pRender;
+	void            *pUserData;
+	ThreadHandle     mThread;
+	bool             mStarted;
+	
+	// Guards the ring. Snapshots [mRendered, mPushed) belong to the render thread.
+	Mutex             mMutex;
+	ConditionVariable mPushedCondition;
+	ConditionVariable mRenderedCondition;
+	FrameSnapshot     mSnapshots[RENDER_THREAD_SNAPSHOTS];
+	uint64_t          mPushed;
+	uint64_t          mRendered;
+	bool              mQuit;
+	
+	Mutex   mStateMutex;
+	float   mRenderWaitMs; // Render thread only, how long it waited for the last snapshot
+} RenderThread;
+RenderThread gRenderThread = {};
+
+void renderThreadInit(RenderFrameFunc pRender, void *pUserData) {
+	RenderThread *pThread = &gRenderThread;
+	pThread->pRender = pRender;
+	pThread->pUserData = pUserData;
+	pThread->mIdle = true;
+	initMutex(&pThread->mMutex);
+	initMutex(&pThread->mStateMutex);
+	initConditionVariable(&pThread->mPushedCondition);
+	initConditionVariable(&pThread->mRenderedCondition);
+}
+
+void renderThreadLockState() {
+	acquireMutex(&gRenderThread.mStateMutex);
+}
+void renderThreadUnlockState() {
+	releaseMutex(&gRenderThread.mStateMutex);
+}
+
+void renderThreadMain(void *pUserData) {
+	RenderThread *pThread = &gRenderThread;
+	for (;;) {
+		int64_t waitStartUs = getUSec(true);
+		acquireMutex(&pThread->mMutex);
+		while (pThread->mRendered == pThread->mPushed && !pThread->mQuit) {
+			waitConditionVariable(&pThread->mPushedCondition, &pThread->mMutex, UINT32_MAX); // No timeout
+		}
+		if (pThread->mRendered == pThread->mPushed) {
+			releaseMutex(&pThread->mMutex);
+			return;
+		}
+		const FrameSnapshot *pSnapshot = &pThread->mSnapshots[pThread->mRendered % RENDER_THREAD_SNAPSHOTS];
+		releaseMutex(&pThread->mMutex);
+		pThread->mRenderWaitMs = (float)(getUSec(true)-waitStartUs)/1000.0f;
+		
+		pThread->pRender(pThread->pUserData, pSnapshot);
+		
+		acquireMutex(&pThread->mMutex);
+		pThread->mRendered += 1;
+		releaseMutex(&pThread->mMutex);
+		wakeAllConditionVariable(&pThread->mRenderedCondition);
+	}
+}
+
+// Main thread only. Waits for everything queued to be rendered, after which the render thread
+// stays idle until the next renderThreadPush(). Don't hold mStateMutex, the render thread may
+// need it to finish.
+void renderThreadWait() {
+	RenderThread *pThread = &gRenderThread;
+	if (pThread->mIdle) return;
+	acquireMutex(&pThread->mMutex);
+	while (pThread->mRendered != pThread->mPushed) {
+		waitConditionVariable(&pThread->mRenderedCondition, &pThread->mMutex, UINT32_MAX);
+	}
+	releaseMutex(&pThread->mMutex);
+	pThread->mIdle = true;
+}
+
+// Main thread only. The snapshot to fill in next, waits until the render thread is done with it.
+// Same as renderThreadWait(), don't hold mStateMutex.
+FrameSnapshot *renderThreadNextSnapshot(float *pWaitMs) {
+	RenderThread *pThread = &gRenderThread;
+	const int64_t startUs = getUSec(true);
+	acquireMutex(&pThread->mMutex);
+	while (pThread->mPushed-pThread->mRendered >= RENDER_THREAD_SNAPSHOTS) {
+		waitConditionVariable(&pThread->mRenderedCondition, &pThread->mMutex, UINT32_MAX);
+	}
+	FrameSnapshot *pSnapshot = &pThread->mSnapshots[pThread->mPushed % RENDER_THREAD_SNAPSHOTS];
+	releaseMutex(&pThread->mMutex);
+	*pWaitMs = (float)(getUSec(true)-startUs)/1000.0f;
+	return pSnapshot;
+}
+
+// Main thread only. Hands the snapshot from renderThreadNextSnapshot() to the render thread.
+void renderThreadPush() {
+	RenderThread *pThread = &gRenderThread;
+	if (!pThread->mStarted) {
+		ThreadDesc threadDesc = {};
+		threadDesc.pFunc = renderThreadMain;
+		threadDesc.pData = NULL;
+		strcpy(threadDesc.mThreadName, "Render");
+		initThread(&threadDesc, &pThread->mThread);
+		pThread->mStarted = true;
+	}
+	
+	acquireMutex(&pThread->mMutex);
+	pThread->mPushed += 1;
+	releaseMutex(&pThread->mMutex);
+	wakeOneConditionVariable(&pThread->mPushedCondition);
+	pThread->mIdle = false;
+}
+
+void renderThreadExit() {
+	RenderThread *pThread = &gRenderThread;
+	if (pThread->mStarted) {
+		acquireMutex(&pThread->mMutex);
+		pThread->mQuit = true;
+		releaseMutex(&pThread->mMutex);
+		wakeAllConditionVariable(&pThread->mPushedCondition);
+		joinThread(pThread->mThread);
+	}
+	
+	for (uint32_t i = 0; i < RENDER_THREAD_SNAPSHOTS; i += 1) terrainEditFreeUpload(&pThread->mSnapshots[i].mHeightEditUpload);
+	exitConditionVariable(&pThread->mRenderedCondition);
+	exitConditionVariable(&pThread->mPushedCondition);
+	exitMutex(&pThread->mStateMutex);
+	exitMutex(&pThread->mMutex);
+	*pThread = {};
+}
+
+///
+// LOD chain
+//
+// Tools/generate_grass_lods.py generates grass_lod_0..N-1 from grass_lod_0.gltf, and writes
+// Models/grass_lods.txt with one "<distance threshold> <index count>" line per level
+// ('#' lines are comments). The thresholds are where the level's geometric error stays
+// below a pixel. If there's no such file we keep the hand-authored 4 levels in LodSettings.
+//
+// Index counts are only there to catch meshes & thresholds that are out of sync, the real
+// counts come from the meshes once they're loaded.
+
+uint32_t gExpectedLodIndexCounts[MAX_GRASS_LOD] = { 0 };
+
+void loadGrassLodChain() {
+	FileStream file = {};
+	if (!fsOpenStreamFromPath(RD_MESHES, "grass_lods.txt", FM_READ, &file)) {
+		LOGF(LogLevel::eINFO, "No grass_lods.txt, using the built-in %u grass LOD levels.", gGrassDrawUniformData.mLod.mLevelCount);
+		return;
+	}
+
+	ssize_t size = fsGetStreamFileSize(&file);
+	char *text = (char*)tempAlloc((size_t)size+1);
+	size_t readSize = fsReadFromStream(&file, text, (size_t)size);
+	text[readSize] = 0;
+	fsCloseStream(&file);
+
+	LodLevelInfo levels[MAX_GRASS_LOD] = {};
+	uint32_t indexCounts[MAX_GRASS_LOD] = { 0 };
+	uint32_t levelCount = 0;
+
+	char *line = text;
+	while (*line) {
+		char *next = strchr(line, '\n');
+		if (next) *next = 0;
+
+		float threshold;
+		uint32_t indexCount;
+		if (line[0] != '#' && sscanf(line, "%f %u", &threshold, &indexCount) == 2) {
+			if (levelCount == MAX_GRASS_LOD) {
+				LOGF(LogLevel::eWARNING, "grass_lods.txt has more than MAX_GRASS_LOD (%u) levels, ignoring the rest.", MAX_GRASS_LOD);
+				break;
+			}
+			if (levelCount > 0 && threshold <= levels[levelCount-1].mThreshold) {
+				LOGF(LogLevel::eERROR, "grass_lods.txt: LOD thresholds must be increasing, using the built-in levels.");
+				return;
+			}
+			levels[levelCount].mThreshold = threshold;
+			indexCounts[levelCount] = indexCount;
+			levelCount += 1;
+		}
+
+		if (!next) break;
+		line = next+1;
+	}
+
+	if (levelCount == 0) {
+		LOGF(LogLevel::eERROR, "grass_lods.txt has no LOD levels, using the built-in levels.");
+		return;
+	}
+
+	for (uint32_t i = 0; i < MAX_GRASS_LOD; i += 1) {
+		gGrassDrawUniformData.mLod.mLevels[i] = levels[i];
+		gExpectedLodIndexCounts[i] = indexCounts[i];
+	}
+	gGrassDrawUniformData.mLod.mLevelCount = levelCount;
+
+	LOGF(LogLevel::eINFO, "Loaded %u grass LOD levels from grass_lods.txt.", levelCount);
+}
+
+void addUiWidgets();
 
 class Charlie_Submission: public IApp
 {
@@ -299,7 +3512,11 @@ public:
     bool Init()
     {
     	initTemporaryStorage();
-    
+    	renderThreadInit([](void *pApp, const FrameSnapshot *pSnapshot) { ((Charlie_Submission*)pApp)->renderFrame(pSnapshot); }, this);
+
+    	gStartup.mStartUs = getUSec(true);
+    	grassQueryInit(&gGrassQuery, 0);
+
     	///
     	// Init Renderer
     	RendererDesc rendDesc {};
@@ -322,14 +3539,106 @@ public:
         queueDesc.mFlag = QUEUE_FLAG_INIT_MICROPROFILE;
         initQueue(pRenderer, &queueDesc, &pGraphicsQueue);
     
+    	///
+    	// Options from command line
+    	for (int i = 1; i < argc; i += 1) {
+    		if (strcmp(argv[i], "--frames-in-flight") == 0 && i+1 < argc) {
+    			int requested = atoi(argv[i+1]);
+    			gRequestedFramesInFlight = requested < 1 ? 1 : (requested > (int)gMaxFramesInFlight ? gMaxFramesInFlight : (uint32_t)requested);
+    			gFramesInFlight = gRequestedFramesInFlight;
+    			i += 1;
+    		} else if (strcmp(argv[i], "--low-latency") == 0) {
+    			gLowLatencyMode = true;
+    		} else if (strcmp(argv[i], "--no-split-submission") == 0) {
+    			gSplitSubmission = false;
+    		} else if (strcmp(argv[i], "--render-thread") == 0) {
+    			gRenderThread.mRequested = true;
+    		} else if (strcmp(argv[i], "--gpu-budget-mb") == 0 && i+1 < argc) {
+    			gMemory.mGpuBudgetBytes = (uint64_t)atoi(argv[i+1])*1024*1024;
+    			i += 1;
+    		} else if (strcmp(argv[i], "--host-budget-mb") == 0 && i+1 < argc) {
+    			gMemory.mHostBudgetBytes = (uint64_t)atoi(argv[i+1])*1024*1024;
+    			i += 1;
+    		} else if (strcmp(argv[i], "--enforce-memory-budget") == 0) {
+    			gMemory.mEnforceBudget = true;
+    		} else if (strcmp(argv[i], "--no-grass-clumps") == 0) {
+    			gGrassClumps = false;
+    		} else if (strcmp(argv[i], "--no-coherent-culling") == 0) {
+    			gCoherentCulling.mEnabled = false;
+    		} else if (strcmp(argv[i], "--procedural-grass") == 0) {
+    			gProceduralBlades = true;
+    		} else if (strcmp(argv[i], "--far-variant-distance") == 0 && i+1 < argc) {
+    			gGrassFarVariantDistance = (float)atof(argv[i+1]);
+    			i += 1;
+    		} else if (strcmp(argv[i], "--species") == 0 && i+1 < argc) {
+    			int count = atoi(argv[i+1]);
+    			gGrassDrawUniformData.mSpeciesCount = count < 1 ? 1 : (count > MAX_GRASS_SPECIES ? MAX_GRASS_SPECIES : (uint32_t)count);
+    			i += 1;
+    		} else if (strcmp(argv[i], "--no-far-grass") == 0) {
+    			gFarGrass = false;
+    		} else if (strcmp(argv[i], "--far-grass") == 0 && i+2 < argc) {
+    			gFarGrassStart = (float)atof(argv[i+1]);
+    			gFarGrassEnd = (float)atof(argv[i+2]);
+    			i += 2;
+    		} else if (strcmp(argv[i], "--tile-size") == 0 && i+1 < argc) {
+    			int dimension = atoi(argv[i+1]);
+    			gTileGrid.mRequestedDimension = dimension < MIN_GRASS_TILE_DIMENSION ? MIN_GRASS_TILE_DIMENSION
+    				: (dimension > MAX_GRASS_TILE_DIMENSION ? MAX_GRASS_TILE_DIMENSION : (uint32_t)dimension);
+    			i += 1;
+    		} else if (strcmp(argv[i], "--tune-tile-size") == 0) {
+    			gTileTuneRequested = true;
+    		} else if (strcmp(argv[i], "--temporal-grass") == 0 && i+1 < argc) {
+    			int frames = atoi(argv[i+1]);
+    			gTemporalGrass.mFrames = frames < 1 ? 1 : (frames > TEMPORAL_GRASS_MAX_FRAMES ? TEMPORAL_GRASS_MAX_FRAMES : (uint32_t)frames);
+    			gTemporalGrass.mRequestedFrames = gTemporalGrass.mFrames;
+    			i += 1;
+    		} else if (strcmp(argv[i], "--temporal-grass-sectors") == 0) {
+    			gTemporalGrass.mBySector = true;
+    			gTemporalGrass.mRequestedBySector = true;
+    		} else if (strcmp(argv[i], "--grass-queries") == 0 && i+1 < argc) {
+    			gGrassQueryDemo.mRays = (uint32_t)atoi(argv[i+1]);
+    			if (gGrassQueryDemo.mRays > GRASS_QUERY_DEMO_MAX_RAYS) gGrassQueryDemo.mRays = GRASS_QUERY_DEMO_MAX_RAYS;
+    			i += 1;
+    		} else if (strcmp(argv[i], "--splat-pixels") == 0 && i+1 < argc) {
+    			gSplatMaxPixels = (float)atof(argv[i+1]);
+    			i += 1;
+    		} else if (strcmp(argv[i], "--capture-frames") == 0 && i+1 < argc) {
+    			int frames = atoi(argv[i+1]);
+    			gCaptureFrameCount = frames < 1 ? 1 : (uint32_t)frames;
+    			gCaptureRequested = true;
+    			i += 1;
+    		} else if (strcmp(argv[i], "--capture-raw") == 0) {
+    			gCaptureRaw = true;
+    		} else if (strcmp(argv[i], "--trace-frames") == 0 && i+1 < argc) {
+    			int frames = atoi(argv[i+1]);
+    			gTraceFrameCount = frames < 1 ? 1 : (uint32_t)frames;
+    			gTraceRequested = true;
+    			i += 1;
+    		}
+    	}
+    	
+    	// See "Tile grid"
+    	if (gTileGrid.mRequestedDimension == 0) gTileGrid.mRequestedDimension = tileGridLoadTuned();
+    	if (gTileGrid.mRequestedDimension == 0) gTileGrid.mRequestedDimension = DEFAULT_GRASS_TILE_DIMENSION;
+    	tileGridSetDimension(gTileGrid.mRequestedDimension);
+    	
+    	// Started here rather than in Update(), so startup is captured too
+    	if (gTraceRequested) {
+    		gTraceRequested = false;
+    		traceStart(gTraceFrameCount);
+    	}
+    
     	///
     	// Make a command ring buffer
-		GpuCmdRingDesc cmdRingDesc = {};
-        cmdRingDesc.pQueue = pGraphicsQueue;
-        cmdRingDesc.mPoolCount = gNumberOfFrames;
-        cmdRingDesc.mCmdPerPoolCount = 1;
-        cmdRingDesc.mAddSyncPrimitives = true;
-        initGpuCmdRing(pRenderer, &cmdRingDesc, &gGraphicsCmdRing);
+    	initGraphicsCmdRing(gFramesInFlight);
+    	
+    	QueryPoolDesc latencyPoolDesc = {};
+    	latencyPoolDesc.mType = QUERY_TYPE_TIMESTAMP;
+    	latencyPoolDesc.mQueryCount = 1;
+    	for (uint32_t i = 0; i < gMaxFramesInFlight; i += 1) {
+    		addQueryPool(pRenderer, &latencyPoolDesc, &gLatencyStats.pQueryPools[i]);
+    	}
+    	gpuClockCalibrate(&gLatencyStats.mGpuClock, gLatencyStats.pQueryPools[0]);
 		
 		
 		initSemaphore(pRenderer, &pImageAcquiredSemaphore);
@@ -370,52 +3679,845 @@ public:
         gGpuProfileToken = initGpuProfiler(pRenderer, pGraphicsQueue, "Graphics");
         pGrassUpdateToken = getCpuProfileToken("CPU", "Grass update", 0xff00ffff);
         gQueueSubmitToken = getCpuProfileToken("CPU", "Queue submit", 0xff00ffff);
+        gUpdateToken = getCpuProfileToken("CPU", "Update", 0xff00ffff);
+        gAcquireImageToken = getCpuProfileToken("CPU", "Acquire image", 0xff00ffff);
+        gUboUpdateToken = getCpuProfileToken("CPU", "Ubo updates", 0xff00ffff);
+        gRecordCommandsToken = getCpuProfileToken("CPU", "Record commands", 0xff00ffff);
+        gPresentToken = getCpuProfileToken("CPU", "Present", 0xff00ffff);
+        
+        ///
+        // UI window
+        
+		UIComponentDesc guiDesc = {};
+        guiDesc.mStartPosition = vec2(mSettings.mWidth * 0.01f, mSettings.mHeight * 0.2f);
+		uiAddComponent(GetName(), &guiDesc, &pGuiWindow);
+		uiSetComponentFlags(pGuiWindow, GUI_COMPONENT_FLAGS_NONE);
+		
+		// Before the UI, which has a slider per level
+		loadGrassLodChain();
+		addUiWidgets();
+        
+        {
+        	TRACE_SCOPE("Init: static resources", PROFILE_INVALID_TOKEN);
+        	if (!addStaticResources()) return false;
+        }
+
+        return true;
+    }
+	
+    // Two cmds per pool, so the frame can be submitted in two parts
+    void initGraphicsCmdRing(uint32_t framesInFlight)
+    {
+		GpuCmdRingDesc cmdRingDesc = {};
+        cmdRingDesc.pQueue = pGraphicsQueue;
+        cmdRingDesc.mPoolCount = framesInFlight;
+        cmdRingDesc.mCmdPerPoolCount = 2;
+        cmdRingDesc.mAddSyncPrimitives = true;
+        initGpuCmdRing(pRenderer, &cmdRingDesc, &gGraphicsCmdRing);
+        gCmdRingFrameCount = framesInFlight;
+    }
+    
+    void applyFramesInFlight()
+    {
+    	if (gRequestedFramesInFlight == gCmdRingFrameCount) return;
+    	
+    	waitQueueIdle(pGraphicsQueue);
+    	traceReadAllGpuFrames(); // Slots are about to be renumbered
+    	captureReadAllFrames();
+    	heightFieldReadAllFrames();
+    	exitGpuCmdRing(pRenderer, &gGraphicsCmdRing);
+    	
+    	gFramesInFlight = gRequestedFramesInFlight;
+    	initGraphicsCmdRing(gFramesInFlight);
+    	
+    	gFrameIndex = 0;
+    	pLastSubmittedFence = NULL;
+    	memset(gLatencyStats.mPending, 0, sizeof(gLatencyStats.mPending));
+    	gpuClockCalibrate(&gLatencyStats.mGpuClock, gLatencyStats.pQueryPools[0]); // While we're idle anyway, against drift
+    	
+    	LOGF(LogLevel::eINFO, "Frames in flight: %u", gFramesInFlight);
+    }
+    
+    // Records latency of any frame whose fence has signaled since we last checked
+    void pollFrameLatency()
+    {
+    	for (uint32_t i = 0; i < gMaxFramesInFlight; i += 1) {
+    		if (!gLatencyStats.mPending[i]) continue;
+    		
+    		FenceStatus status;
+    		getFenceStatus(pRenderer, gLatencyStats.pFences[i], &status);
+    		if (status != FENCE_STATUS_COMPLETE) continue;
+    		
+    		gLatencyStats.mPending[i] = false;
+    		
+    		QueryData data = {};
+    		getQueryData(pRenderer, gLatencyStats.pQueryPools[i], 0, &data);
+    		if (!data.mValid) continue;
+    		int64_t doneUs = gpuClockToUs(&gLatencyStats.mGpuClock, data.mEndTimestamp);
+    		
+    		float ms = (float)(doneUs-gLatencyStats.mInputTimeUs[i])/1000.0f;
+    		gLatencyStats.mLastMs = ms;
+    		gLatencyStats.mAverageMs = gLatencyStats.mAverageMs == 0.0f ? ms : gLatencyStats.mAverageMs + (ms-gLatencyStats.mAverageMs)*0.05f;
+    		
+    		gLatencyStats.mMaxAge += 1;
+    		if (ms > gLatencyStats.mMaxMs || gLatencyStats.mMaxAge > 60) {
+    			gLatencyStats.mMaxMs = ms;
+    			gLatencyStats.mMaxAge = 0;
+    		}
+    	}
+    }
+	
+    void Exit()
+    {
+    	renderThreadWait();
+    	renderThreadExit();
+        waitQueueIdle(pGraphicsQueue);
+        
+        traceStop(); // Write out a capture that hadn't finished yet
+        captureStop();
+        captureReadAllFrames();
+        captureFinish();
+        
+        memLogReport("shutdown");
+        
+        removeStaticResources();
+        exitGrassQueries();
+        
+        uiRemoveComponent(pGuiWindow);
+        
+        exitUserInterface();
+
+        exitFontSystem();
+
+        exitProfiler();
+        
+        exitCameraController(pCameraController);
+        
+        exitResourceLoaderInterface(pRenderer);
+        
+        exitSemaphore(pRenderer, pImageAcquiredSemaphore);
+        
+        exitGpuCmdRing(pRenderer, &gGraphicsCmdRing);
+        
+        for (uint32_t i = 0; i < gMaxFramesInFlight; i += 1) {
+        	removeQueryPool(pRenderer, gLatencyStats.pQueryPools[i]);
+        }
+        
+        exitQueue(pRenderer, pGraphicsQueue);
+
+        exitRenderer(pRenderer);
+        pRenderer = NULL;
+        
+        exitGPUConfiguration();
+        
+        exitTemporaryStorage();
+    }
+
+    bool Load(ReloadDesc *pReloadDesc)
+    {
+    	// Textures, geometry & buffers live from Init() to Exit(). Here we only (re)create what
+    	// depends on the reason for reloading, so resizing doesn't touch the instance vbo etc.
+    	
+    	if (pReloadDesc->mType & RELOAD_TYPE_SHADER)
+    	{
+    		{
+    			TRACE_SCOPE("Load: shaders", PROFILE_INVALID_TOKEN);
+    			if (!addShaders()) return false;
+    		}
+    		{
+    			TRACE_SCOPE("Load: root signatures", PROFILE_INVALID_TOKEN);
+    			if (!addRootSignatures()) return false;
+    		}
+    		{
+    			TRACE_SCOPE("Load: descriptor sets", PROFILE_INVALID_TOKEN);
+    			addDescriptorSets();
+    		}
+    	}
+    	
+    	if (pReloadDesc->mType & (RELOAD_TYPE_RESIZE | RELOAD_TYPE_RENDERTARGET))
+    	{
+    		TRACE_SCOPE("Load: render targets", PROFILE_INVALID_TOKEN);
+    		
+    		loadProfilerUI(mSettings.mWidth, mSettings.mHeight);
+    		
+    		if (!addRenderTargets()) return false;
+    		if (!memCheckBudget("render targets")) return false;
+    	}
+    	
+    	// The splat sets need both the descriptor sets & the (size dependent) splat & temporal grass buffers
+    	if (pReloadDesc->mType & (RELOAD_TYPE_SHADER | RELOAD_TYPE_RESIZE | RELOAD_TYPE_RENDERTARGET))
+    	{
+    		updateSplatDescriptorSets();
+    	}
+    	
+    	// Pipelines only depend on render target formats, not their size
+    	if (pReloadDesc->mType & (RELOAD_TYPE_SHADER | RELOAD_TYPE_RENDERTARGET))
+    	{
+    		TRACE_SCOPE("Load: pipelines", PROFILE_INVALID_TOKEN);
+    		if (!addPipelines()) return false;
+    	}
+		
+		TRACE_SCOPE("Load: UI & fonts", PROFILE_INVALID_TOKEN);
+		
+		///
+		// Load UI
+		UserInterfaceLoadDesc uiLoad = {};
+        uiLoad.mColorFormat = pSwapChain->ppRenderTargets[0]->mFormat;
+        uiLoad.mHeight = mSettings.mHeight;
+        uiLoad.mWidth = mSettings.mWidth;
+        uiLoad.mLoadType = pReloadDesc->mType;
+        loadUserInterface(&uiLoad);
 
+		///
+		// Load font system
+        FontSystemLoadDesc fontLoad = {};
+        fontLoad.mColorFormat = pSwapChain->ppRenderTargets[0]->mFormat;
+        fontLoad.mHeight = mSettings.mHeight;
+        fontLoad.mWidth = mSettings.mWidth;
+        fontLoad.mLoadType = pReloadDesc->mType;
+        loadFontSystem(&fontLoad);
+		
         return true;
     }
-	
-    void Exit()
+
+    void Unload(ReloadDesc *pReloadDesc)
+    {
+    	TRACE_SCOPE("Unload", PROFILE_INVALID_TOKEN);
+    	
+    	renderThreadWait();
+        waitQueueIdle(pGraphicsQueue);
+        
+        unloadFontSystem(pReloadDesc->mType);
+        unloadUserInterface(pReloadDesc->mType);
+        
+        if (pReloadDesc->mType & (RELOAD_TYPE_SHADER | RELOAD_TYPE_RENDERTARGET))
+        {
+        	removePipelines();
+        }
+        
+        if (pReloadDesc->mType & (RELOAD_TYPE_RESIZE | RELOAD_TYPE_RENDERTARGET))
+        {
+        	// The ring is sized for the old swapchain, what's been copied is still written
+        	captureStop();
+        	captureReadAllFrames();
+        	removeRenderTargets();
+        	unloadProfilerUI();
+        }
+        
+        if (pReloadDesc->mType & RELOAD_TYPE_SHADER)
+        {
+        	removeDescriptorSets();
+        	removeRootSignatures();
+        	removeShaders();
+        }
+    }
+    
+    ///
+    // Static resources
+    //
+    // Everything that doesn't depend on shaders or the swapchain. Created once in Init(), but
+    // only issued here. Textures, meshes & the grass buffers finish loading in updateStartupLoading().
+    bool addStaticResources()
+    {
+    	///
+	    // Init buffers
+    	
+    	{ // Shared
+    		// Every ubo & per-frame table below is a range of this, see "Buffer heaps"
+    		BufferLoadDesc heapDesc = {};
+		    heapDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_UNIFORM_BUFFER | DESCRIPTOR_TYPE_BUFFER;
+		    heapDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_CPU_TO_GPU;
+		    heapDesc.mDesc.mFlags = BUFFER_CREATION_FLAG_PERSISTENT_MAP_BIT;
+		    heapDesc.mDesc.mSize = UPLOAD_HEAP_SIZE;
+		    heapDesc.pData = NULL;
+		    heapDesc.mDesc.pName = "UploadHeap";
+		    addBufferHeap(&gUploadHeap, &heapDesc, pRenderer->pGpu->mUniformBufferAlignment);
+		    
+		    // Tables written once, see gStaticHeap
+		    heapDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_BUFFER;
+		    heapDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_ONLY;
+		    heapDesc.mDesc.mFlags = BUFFER_CREATION_FLAG_NONE;
+		    heapDesc.mDesc.mStartState = (ResourceState)(RESOURCE_STATE_SHADER_RESOURCE | RESOURCE_STATE_COPY_SOURCE);
+		    heapDesc.mDesc.mSize = STATIC_HEAP_SIZE;
+		    heapDesc.mDesc.pName = "StaticHeap";
+		    addBufferHeap(&gStaticHeap, &heapDesc, pRenderer->pGpu->mUniformBufferAlignment);
+		    
+		    for (uint32_t i = 0; i < gMaxFramesInFlight; i += 1) {
+		    	for (uint32_t v = 0; v < MAX_GRASS_VIEWS; v += 1) {
+		    		if (!heapAlloc(&gUploadHeap, sizeof(SceneUniformData), 0, MEMORY_CATEGORY_SCENE, &gSceneUbos[i][v])) return false;
+		    	}
+		    }
+		
+		    gSceneUniformData.mTerrainSize = Vector2(TERRAIN_WIDTH, TERRAIN_HEIGHT);
+		    gSceneUniformData.mSunDirection = Vector3(-1.f, -0.6f,  0.2f);
+    	}
+    	
+	    { // Grass
+		    
+		    if (!addTileGridBuffers()) return false;
+		    
+		    // Uploaded in updateStartupLoading() once the worker is done filling it
+		    gStartup.pGrassInstanceData = (uint32_t*)tf_malloc(sizeof(uint32_t)*MAX_GRASS_CAP);
+		    memTrack(gStartup.pGrassInstanceData, MEMORY_CATEGORY_GRASS, sizeof(uint32_t)*MAX_GRASS_CAP, true);
+		    ThreadDesc threadDesc = {};
+		    threadDesc.pFunc = fillGrassInstanceData;
+		    threadDesc.pData = gStartup.pGrassInstanceData;
+		    strcpy(threadDesc.mThreadName, "GrassInstanceFill");
+		    initThread(&threadDesc, &gStartup.mInstanceFillThread);
+		    
+		    // Draw counts, one uint per view, consumed as the indirect count.
+		    BufferLoadDesc indirectDesc = {};
+		    indirectDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_BUFFER | DESCRIPTOR_TYPE_RW_BUFFER | DESCRIPTOR_TYPE_INDIRECT_BUFFER;
+		    indirectDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_ONLY;
+		    indirectDesc.mDesc.mFlags = BUFFER_CREATION_FLAG_NONE;
+		    indirectDesc.mDesc.mStartState = RESOURCE_STATE_INDIRECT_ARGUMENT;
+		    indirectDesc.mDesc.mSize = sizeof(uint32_t)*MAX_GRASS_VIEWS*GRASS_VARIANT_COUNT;
+		    indirectDesc.mDesc.pName = "GrassDrawCountBuffer";
+		    indirectDesc.ppBuffer = &pGrassDrawCountBuffer;
+		    indirectDesc.mDesc.mElementCount = MAX_GRASS_VIEWS*GRASS_VARIANT_COUNT;
+		    indirectDesc.mDesc.mStructStride = sizeof(uint32_t);
+		    addTrackedBuffer(&indirectDesc, nullptr, MEMORY_CATEGORY_GRASS);
+		    
+		    static const uint32_t zeroCounts[MAX_GRASS_VIEWS*GRASS_VARIANT_COUNT] = {};
+		    if (!heapAlloc(&gStaticHeap, sizeof(zeroCounts), 0, MEMORY_CATEGORY_GRASS, &gGrassDrawCountReset)) return false;
+		    heapUpload(&gGrassDrawCountReset, zeroCounts);
+		    
+		    // Grass splatting, see "Grass splatting"
+		    indirectDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_BUFFER | DESCRIPTOR_TYPE_RW_BUFFER | DESCRIPTOR_TYPE_INDIRECT_BUFFER;
+		    indirectDesc.mDesc.mStartState = RESOURCE_STATE_INDIRECT_ARGUMENT;
+		    indirectDesc.mDesc.mSize = sizeof(uint32_t)*3;
+		    indirectDesc.mDesc.pName = "GrassSplatArgsBuffer";
+		    indirectDesc.ppBuffer = &pGrassSplatArgsBuffer;
+		    indirectDesc.mDesc.mElementCount = 3;
+		    indirectDesc.mDesc.mStructStride = sizeof(uint32_t);
+		    addTrackedBuffer(&indirectDesc, nullptr, MEMORY_CATEGORY_GRASS);
+		    
+		    static const uint32_t splatArgsReset[3] = { 0, 1, 1 };
+		    if (!heapAlloc(&gStaticHeap, sizeof(splatArgsReset), 0, MEMORY_CATEGORY_GRASS, &gGrassSplatArgsReset)) return false;
+		    heapUpload(&gGrassSplatArgsReset, splatArgsReset);
+		    
+		    for (uint32_t i = 0; i < gMaxFramesInFlight; i += 1) {
+		    	if (!heapAlloc(&gUploadHeap, sizeof(GrassDrawUniformData), 0, MEMORY_CATEGORY_GRASS, &gGrassDrawUbos[i])) return false;
+		    	// See "Grass species"
+		    	if (!heapAlloc(&gUploadHeap, sizeof(gGrassSpecies), sizeof(GrassSpecies), MEMORY_CATEGORY_GRASS, &gGrassSpeciesBuffers[i])) return false;
+		    }
+		    
+	    }
+	    { // Skybox
+		    for (uint32_t i = 0; i < gMaxFramesInFlight; i += 1) {
+		    	for (uint32_t v = 0; v < MAX_GRASS_VIEWS; v += 1) {
+		    		if (!heapAlloc(&gUploadHeap, sizeof(SkyboxUniformData), 0, MEMORY_CATEGORY_SKYBOX, &gSkyboxUbos[i][v])) return false;
+		    	}
+		    }
+	    }
+	    
+	    ///
+	    // Grass vertex layouts
+	    
+        gGrassVertexLayoutForLoading.mBindingCount = 1;
+        gGrassVertexLayoutForLoading.mAttribCount = 2;
+        
+        gGrassVertexLayoutForLoading.mBindings[0].mStride = sizeof(GrassVertex);
+        gGrassVertexLayoutForLoading.mBindings[0].mRate = VERTEX_BINDING_RATE_VERTEX;
+        
+        gGrassVertexLayoutForLoading.mAttribs[0].mSemantic = SEMANTIC_POSITION;
+        gGrassVertexLayoutForLoading.mAttribs[0].mFormat = TinyImageFormat_R32G32B32_SFLOAT;
+        gGrassVertexLayoutForLoading.mAttribs[0].mBinding = 0;
+        gGrassVertexLayoutForLoading.mAttribs[0].mLocation = 0;
+        gGrassVertexLayoutForLoading.mAttribs[0].mOffset = offsetof(GrassVertex, mPosition);;
+        
+        gGrassVertexLayoutForLoading.mAttribs[1].mSemantic = SEMANTIC_NORMAL;
+        gGrassVertexLayoutForLoading.mAttribs[1].mFormat = TinyImageFormat_R32_UINT;
+        gGrassVertexLayoutForLoading.mAttribs[1].mBinding = 0;
+        gGrassVertexLayoutForLoading.mAttribs[1].mLocation = 1;
+        gGrassVertexLayoutForLoading.mAttribs[1].mOffset = offsetof(GrassVertex, mNormal);
+        
+        gGrassVertexLayoutForDrawing = gGrassVertexLayoutForLoading;
+        
+        gGrassVertexLayoutForDrawing.mBindingCount = 2;
+        gGrassVertexLayoutForDrawing.mAttribCount = 4;
+        
+        gGrassVertexLayoutForDrawing.mBindings[1].mStride = sizeof(uint32_t);
+        	gGrassVertexLayoutForDrawing.mBindings[1].mRate = VERTEX_BINDING_RATE_INSTANCE;
+        
+        gGrassVertexLayoutForDrawing.mAttribs[2].mSemantic = SEMANTIC_CUSTOM;
+            strcpy(gGrassVertexLayoutForDrawing.mAttribs[2].mSemanticName, "INSTANCEID");
+        gGrassVertexLayoutForDrawing.mAttribs[2].mSemanticNameLength = (uint32_t)strlen("INSTANCEID");
+        gGrassVertexLayoutForDrawing.mAttribs[2].mFormat = TinyImageFormat_R32_UINT;
+        gGrassVertexLayoutForDrawing.mAttribs[2].mBinding = 1;
+        gGrassVertexLayoutForDrawing.mAttribs[2].mLocation = 0;
+        gGrassVertexLayoutForDrawing.mAttribs[2].mOffset = 0;
+        
+        // Not in the meshes, filled in by mergeGrassMeshes()
+        gGrassVertexLayoutForDrawing.mAttribs[3].mSemantic = SEMANTIC_TEXCOORD0;
+        gGrassVertexLayoutForDrawing.mAttribs[3].mFormat = TinyImageFormat_R32_UINT;
+        gGrassVertexLayoutForDrawing.mAttribs[3].mBinding = 0;
+        gGrassVertexLayoutForDrawing.mAttribs[3].mLocation = 2;
+        gGrassVertexLayoutForDrawing.mAttribs[3].mOffset = offsetof(GrassVertex, mClump);
+        
+        // Procedural blades only have the instance buffer
+        gGrassVertexLayoutProcedural.mBindingCount = 1;
+        gGrassVertexLayoutProcedural.mAttribCount = 1;
+        gGrassVertexLayoutProcedural.mBindings[0] = gGrassVertexLayoutForDrawing.mBindings[1];
+        gGrassVertexLayoutProcedural.mAttribs[0] = gGrassVertexLayoutForDrawing.mAttribs[2];
+        gGrassVertexLayoutProcedural.mAttribs[0].mBinding = 0;
+		
+		///
+	    // Init samplers & load textures
+	    
+		SamplerDesc samplerDesc = { FILTER_LINEAR,
+                                    FILTER_LINEAR,
+                                    MIPMAP_MODE_NEAREST,
+                                    ADDRESS_MODE_CLAMP_TO_EDGE,
+                                    ADDRESS_MODE_CLAMP_TO_EDGE,
+                                    ADDRESS_MODE_CLAMP_TO_EDGE };
+        addSampler(pRenderer, &samplerDesc, &pSampler); 
+		
+		// Height map texture
+		TextureLoadDesc heightMapDesc = {};
+        heightMapDesc.pFileName = "height_map.tex";
+        heightMapDesc.ppTexture = &pHeightMap;
+        heightMapDesc.mCreationFlag = TEXTURE_CREATION_FLAG_SRGB;
+        addResource(&heightMapDesc, &gStartup.mSkyAndTerrainToken);
+        
+        // Skybox cubemap, BC1 compressed & already encoded for the UNORM swapchain (see Tools/bake_skybox.py),
+        // so no SRGB flag.
+        TextureLoadDesc skyboxDesc = {};
+        skyboxDesc.pFileName = "skybox.tex";
+        skyboxDesc.ppTexture = &pSkyboxTexture;
+        addResource(&skyboxDesc, &gStartup.mSkyAndTerrainToken);
+        
+        // Grass meshes
+        for (uint32_t i = 0; i < gGrassDrawUniformData.mLod.mLevelCount; i += 1) {
+	    
+	    	char *filename = (char*)tempAlloc(128);
+	    	sprintf(filename, "grass_lod_%i.bin", i);
+	    
+		    GeometryLoadDesc loadDesc = {};
+	        loadDesc.pFileName = filename;
+	        loadDesc.pVertexLayout = &gGrassVertexLayoutForLoading;
+	        loadDesc.ppGeometry = &pGrassGeoms[i];
+	        loadDesc.ppGeometryData = &pGrassGeomDatas[i];
+	        loadDesc.mFlags = GEOMETRY_LOAD_FLAG_SHADOWED;
+	        addResource(&loadDesc, &gStartup.mGrassMeshToken);
+	    }
+	    
+	    return true;
+    }
+    
+    // Called once per frame until everything is loaded. Each step only runs once the loads it
+    // depends on have completed, so nothing here blocks.
+    void updateStartupLoading()
+    {
+    	if (gStartup.mGrassReady) return;
+    	
+    	///
+    	// Terrain & sky
+    	if (!gStartup.mSkyAndTerrainReady && isTokenCompleted(&gStartup.mSkyAndTerrainToken))
+    	{
+	        if (!pHeightMap) 
+	        {
+	        	LOGF(LogLevel::eERROR, "Failed to load height map.");
+	        	requestShutdown();
+	        	return;
+	        }
+		    if (!pSkyboxTexture) {
+		    	LOGF(LogLevel::eERROR, "Failed to load skybox texture.");
+		    	requestShutdown();
+		    	return;
+		    }
+		    
+		    gStartup.mSkyAndTerrainReady = true;
+		    addTerrainEdits();
+		    updateTextureDescriptorSets();
+		    
+		    memTrackTexture(pHeightMap, MEMORY_CATEGORY_TERRAIN);
+		    memTrackTexture(pSkyboxTexture, MEMORY_CATEGORY_SKYBOX);
+		    
+		    LOGF(LogLevel::eINFO, "Startup: terrain & sky loaded after %.1f ms", (float)(getUSec(true)-gStartup.mStartUs)/1000.0f);
+    	}
+    	
+    	///
+    	// Grass meshes
+    	if (!gStartup.mGrassMeshMerged && isTokenCompleted(&gStartup.mGrassMeshToken))
+    	{
+    		for (uint32_t i = 0; i < gGrassDrawUniformData.mLod.mLevelCount; i += 1) {
+				if (!pGrassGeoms[i] || !pGrassGeomDatas[i]) {
+					LOGF(LogLevel::eERROR, "Failed to load grass.");
+					requestShutdown();
+		        	return;
+				}
+		    }
+		    
+		    // Index buffers are 16 bit, see mergeGrassMeshes(). The shadow copy in GeometryData is the same size.
+		    for (uint32_t i = 0; i < gGrassDrawUniformData.mLod.mLevelCount; i += 1) {
+		    	uint64_t bytes = pGrassGeoms[i]->mVertexCount*sizeof(GrassVertex) + pGrassGeoms[i]->mIndexCount*sizeof(uint16_t);
+		    	memTrack(pGrassGeoms[i], MEMORY_CATEGORY_GRASS, bytes, false);
+		    	memTrack(pGrassGeomDatas[i], MEMORY_CATEGORY_GRASS, bytes, true);
+		    }
+		    
+		    TRACE_SCOPE("Startup: merge grass meshes", PROFILE_INVALID_TOKEN);
+		    mergeGrassMeshes();
+		    gStartup.mGrassMeshMerged = true;
+    	}
+    	
+    	///
+    	// Grass instances
+    	if (!gStartup.mGrassInstancesQueued && tfrg_atomic32_load_acquire(&gStartup.mInstanceFillDone))
+    	{
+    		joinThread(gStartup.mInstanceFillThread);
+    		gStartup.mInstanceFillJoined = true;
+    		
+		    BufferLoadDesc vboDesc = {};
+		    vboDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_VERTEX_BUFFER;
+		    vboDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_ONLY;
+		    vboDesc.mDesc.mFlags = BUFFER_CREATION_FLAG_NONE;
+		    vboDesc.mDesc.mSize = sizeof(uint32_t)*MAX_GRASS_CAP;
+		    vboDesc.pData = gStartup.pGrassInstanceData;
+		    vboDesc.mDesc.pName = "GrassInstanceData";
+		    vboDesc.ppBuffer = &pGrassInstanceVbo;
+		    addTrackedBuffer(&vboDesc, &gStartup.mGrassBufferToken, MEMORY_CATEGORY_GRASS);
+		    
+		    gStartup.mGrassInstancesQueued = true;
+    	}
+    	
+    	///
+    	// Grass is drawn once its buffers have landed. Culling samples the height map, so it waits for that too.
+    	if (gStartup.mSkyAndTerrainReady && gStartup.mGrassMeshMerged && gStartup.mGrassInstancesQueued
+    		&& isTokenCompleted(&gStartup.mGrassMeshToken) && isTokenCompleted(&gStartup.mGrassBufferToken))
+    	{
+    		memUntrack(gStartup.pGrassInstanceData);
+    		tf_free(gStartup.pGrassInstanceData);
+    		gStartup.pGrassInstanceData = NULL;
+    		
+    		gStartup.mGrassReady = true;
+    		
+		    LOGF(LogLevel::eINFO, "Startup: grass loaded after %.1f ms", (float)(getUSec(true)-gStartup.mStartUs)/1000.0f);
+		    
+		    // Everything static is in now, including the peak from the instance data
+		    memLogReport("startup");
+		    if (!memCheckBudget("startup")) requestShutdown();
+    	}
+    }
+    
+    // Called after a frame is presented
+    void recordStartupMilestones(bool drewTerrainAndSky, bool drewGrass)
+    {
+    	if (gStartup.mFullQualityUs != 0) return;
+    	
+    	int64_t now = getUSec(true);
+    	
+    	if (gStartup.mFirstFrameUs == 0 && drewTerrainAndSky) {
+    		gStartup.mFirstFrameUs = now;
+    		traceAddEvent("Startup: time to first frame", gStartup.mStartUs, now, TRACE_TRACK_CPU, gTrace.mFrame);
+    		LOGF(LogLevel::eINFO, "Time to first frame: %.1f ms", (float)(now-gStartup.mStartUs)/1000.0f);
+    	}
+    	if (drewGrass) {
+    		gStartup.mFullQualityUs = now;
+    		traceAddEvent("Startup: time to full quality", gStartup.mStartUs, now, TRACE_TRACK_CPU, gTrace.mFrame);
+    		LOGF(LogLevel::eINFO, "Time to full quality: %.1f ms", (float)(now-gStartup.mStartUs)/1000.0f);
+    	}
+    }
+    
+    // Combine grash meshes into one vbo
+    // #Volatile mirrored in Benchmarks/cpu_benchmarks.cpp
+    void mergeGrassMeshes()
     {
-        waitQueueIdle(pGraphicsQueue);
+        uint32_t totalVertexCount = 0;
+        uint32_t totalIndexCount = 0;
+        for (uint32_t i = 0; i < gGrassDrawUniformData.mLod.mLevelCount; i += 1)
+        {
+        	uint32_t blades = 1;
+        	if (gGrassClumps && i > 0) {
+        		blades = GRASS_CLUMP_TARGET_VERTICES/pGrassGeoms[i]->mVertexCount;
+        		blades = blades < 1 ? 1 : (blades > GRASS_MAX_CLUMP_SIZE ? GRASS_MAX_CLUMP_SIZE : blades);
+        	}
+        	gGrassMeshLods[i].mBladesPerInstance = blades;
+        	gGrassMeshLods[i].mIndexCount = pGrassGeoms[i]->mIndexCount*blades;
+        	
+        	totalVertexCount += pGrassGeoms[i]->mVertexCount*blades;
+        	totalIndexCount += pGrassGeoms[i]->mIndexCount*blades;
+        	
+        	if (gExpectedLodIndexCounts[i] && gExpectedLodIndexCounts[i] != pGrassGeoms[i]->mIndexCount) {
+        		LOGF(LogLevel::eWARNING, "grass_lod_%u has %u indices but grass_lods.txt expects %u, regenerate the LOD chain.",
+        			i, pGrassGeoms[i]->mIndexCount, gExpectedLodIndexCounts[i]);
+        	}
+        }
         
-        exitUserInterface();
-
-        exitFontSystem();
+        GrassVertex *vertices = (GrassVertex*)tempAlloc(sizeof(GrassVertex)*totalVertexCount);
+        uint32_t *indices = (uint32_t*)tempAlloc(sizeof(uint32_t)*totalIndexCount);
 
-        exitProfiler();
-        
-        exitCameraController(pCameraController);
-        
-        exitResourceLoaderInterface(pRenderer);
-        
-        exitSemaphore(pRenderer, pImageAcquiredSemaphore);
+		uint32_t nextBaseVertex = 0;        
+		uint32_t nextBaseIndex = 0;        
+        for (uint32_t i = 0; i < gGrassDrawUniformData.mLod.mLevelCount; i += 1)
+        {
+        	uint32_t blades = gGrassMeshLods[i].mBladesPerInstance;
+        	
+        	// Blade after blade, so each blade's vertices stay together for the vertex cache
+        	for (uint32_t blade = 0; blade < blades; blade += 1)
+        	{
+	        	for (uint32_t j = 0; j < pGrassGeoms[i]->mVertexCount; j += 1)
+	            {
+	        		vertices[nextBaseVertex+j].mPosition
+	        			= ((float3*)pGrassGeomDatas[i]->pShadow->pAttributes[SEMANTIC_POSITION])[j];
+	        		vertices[nextBaseVertex+j].mNormal
+	        			= ((uint32_t*)pGrassGeomDatas[i]->pShadow->pAttributes[SEMANTIC_NORMAL])[j];
+	        		vertices[nextBaseVertex+j].mClump = blade | (blades << 16);
+	        	}
+	            for (uint32_t j = 0; j < pGrassGeoms[i]->mIndexCount; j += 1)
+	            {
+	        		indices[nextBaseIndex+j] = ((uint16_t*)pGrassGeomDatas[i]->pShadow->pIndices)[j] + nextBaseVertex;
+	        	}
+	        	
+	        	nextBaseVertex += pGrassGeoms[i]->mVertexCount;
+	        	nextBaseIndex += pGrassGeoms[i]->mIndexCount;
+        	}
+        }
         
-        exitGpuCmdRing(pRenderer, &gGraphicsCmdRing);
+        const char *bladesPerLevel = "";
+        for (uint32_t i = 0; i < gGrassDrawUniformData.mLod.mLevelCount; i += 1)
+        	bladesPerLevel = tempPrint("%s %u", bladesPerLevel, gGrassMeshLods[i].mBladesPerInstance);
+        LOGF(LogLevel::eINFO, "Grass blades per instance by LOD:%s", bladesPerLevel);
         
-        exitQueue(pRenderer, pGraphicsQueue);
-
-        exitRenderer(pRenderer);
-        pRenderer = NULL;
+        // The loader copies the data into staging memory in addResource(), so temporary storage is fine here
+        BufferLoadDesc vboDesc = {};
+	    vboDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_VERTEX_BUFFER;
+	    vboDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_ONLY;
+	    vboDesc.mDesc.mFlags = BUFFER_CREATION_FLAG_NONE;
+	    vboDesc.mDesc.mSize = totalVertexCount*sizeof(GrassVertex);
+	    vboDesc.pData = vertices;
+	    vboDesc.ppBuffer = &pGrassVbo;
+	    addTrackedBuffer(&vboDesc, &gStartup.mGrassMeshToken, MEMORY_CATEGORY_GRASS);
+	    vboDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_INDEX_BUFFER;
+	    vboDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_ONLY;
+	    vboDesc.mDesc.mFlags = BUFFER_CREATION_FLAG_NONE;
+	    vboDesc.mDesc.mSize = totalIndexCount*sizeof(uint32_t);
+	    vboDesc.pData = indices;
+	    vboDesc.ppBuffer = &pGrassIbo;
+	    addTrackedBuffer(&vboDesc, &gStartup.mGrassMeshToken, MEMORY_CATEGORY_GRASS);
+    }
+    
+    // What the culling pass should put in each LOD level's draws, for the meshes or for procedural blades
+    void updateGrassLodDraws()
+    {
+    	LodSettings *pLod = &gGrassDrawUniformData.mLod;
+    	
+    	gGrassDrawUniformData.mProceduralBlades = gProceduralBlades ? 1 : 0;
+    	gSceneUniformData.mBladeSegmentScale = gBladeSegmentsNear*gBladeSegmentDistance;
+    	
+    	for (uint32_t i = 0; i < pLod->mLevelCount; i += 1) {
+    		if (!gProceduralBlades) {
+    			pLod->mLevels[i].mIndexCount = gGrassMeshLods[i].mIndexCount;
+    			pLod->mLevels[i].mBladesPerInstance = gGrassMeshLods[i].mBladesPerInstance;
+    			pLod->mLevels[i].mBladeSegments = 0;
+    			continue;
+    		}
+    		
+    		// Closest blade this level can be drawn for, is in a tile whose center is at the threshold
+    		float closest = pLod->mLevels[i].mThreshold - (float)gTileGrid.mDimension*0.7072f;
+    		float segments = gSceneUniformData.mBladeSegmentScale/fmaxf(closest, gBladeSegmentDistance);
+    		uint32_t maxSegments = (uint32_t)ceilf(segments);
+    		maxSegments = maxSegments < 1 ? 1 : (maxSegments > GRASS_MAX_BLADE_SEGMENTS ? GRASS_MAX_BLADE_SEGMENTS : maxSegments);
+    		uint32_t verticesPerBlade = 6*maxSegments-3;
+    		
+    		uint32_t blades = 1;
+    		if (gGrassClumps && i > 0) {
+    			blades = GRASS_CLUMP_TARGET_VERTICES/verticesPerBlade;
+    			blades = blades < 1 ? 1 : (blades > GRASS_MAX_CLUMP_SIZE ? GRASS_MAX_CLUMP_SIZE : blades);
+    		}
+    		
+    		pLod->mLevels[i].mIndexCount = verticesPerBlade*blades;
+    		pLod->mLevels[i].mBladesPerInstance = blades;
+    		pLod->mLevels[i].mBladeSegments = maxSegments;
+    	}
+    	
+    	// See "Grass shader variants"
+    	gGrassDrawUniformData.mFarVariantLevel = pLod->mLevelCount;
+    	for (uint32_t i = 0; i < pLod->mLevelCount; i += 1) {
+    		if (pLod->mLevels[i].mThreshold >= gGrassFarVariantDistance) {
+    			gGrassDrawUniformData.mFarVariantLevel = i;
+    			break;
+    		}
+    	}
+    }
+    
+    // See "Far-field grass". The terrain is shaded like the field would be where it's faded out.
+    // #Volatile the density matches grass_draw.comp
+    void updateFarGrass()
+    {
+    	if (!gFarGrass) {
+    		gSceneUniformData.mFarGrass = Vector4(0);
+    		return;
+    	}
+    	const LodSettings *pLod = &gGrassDrawUniformData.mLod;
+    	float end = fmaxf(gFarGrassEnd, gFarGrassStart+1.0f);
+    	float distanceFactor = fminf(end/pLod->mLowestDetailDistance, 1.0f);
+    	float fade = (distanceFactor-pLod->mDensityFadeStartPercent)/(1.0f-pLod->mDensityFadeStartPercent);
+    	float density = fminf(1.0f + (pLod->mMinDensityPercent-1.0f)*fade, 1.0f);
+    	float bladesPerSquareMeter = (float)gGrassDrawUniformData.mPerceivedNumberOfGrass/((float)TERRAIN_WIDTH*(float)TERRAIN_HEIGHT)*density;
+    	gSceneUniformData.mFarGrass = Vector4(gFarGrassStart, end, bladesPerSquareMeter, 0);
+    }
+    
+    // See "Grass species". Grass is the species the UI edits.
+    void updateGrassSpecies()
+    {
+    	GrassSpecies *pGrass = &gGrassSpecies[0];
+    	pGrass->mBaseColor = v3ToF3(gSceneUniformData.mGrassBaseColor);
+    	pGrass->mTipColor = v3ToF3(gSceneUniformData.mGrassTipColor);
+    	pGrass->mMinWidth = gSceneUniformData.mMinGrassWidth;
+    	pGrass->mMaxWidth = gSceneUniformData.mMaxGrassWidth;
+    	pGrass->mMinHeight = gSceneUniformData.mMinGrassHeight;
+    	pGrass->mMaxHeight = gSceneUniformData.mMaxGrassHeight;
+    	
+    	// Tile bounds & splatting have to fit the tallest species that's mixed in
+    	gGrassDrawUniformData.mMaxBladeHeight = 0.0f;
+    	for (uint32_t i = 0; i < gGrassDrawUniformData.mSpeciesCount; i += 1)
+    		gGrassDrawUniformData.mMaxBladeHeight = fmaxf(gGrassDrawUniformData.mMaxBladeHeight, gGrassSpecies[i].mMaxHeight);
+    }
+    
+    ///
+    // Tile grid buffers, see "Tile grid". Sized for gTileGrid, rebuilt by applyTileGrid().
+    bool addTileGridBuffers()
+    {
+    	TileGrid *pGrid = &gTileGrid;
+    	
+    	pGrid->pTiles = (TileEntry*)tf_malloc(sizeof(TileEntry)*pGrid->mCount);
+    	memTrack(pGrid->pTiles, MEMORY_CATEGORY_GRASS, sizeof(TileEntry)*pGrid->mCount, true);
+    	for (uint32_t i = 0; i < pGrid->mCount; i += 1) {
+    		pGrid->pTiles[i].mTileSeed = rand();
+    		pGrid->pTiles[i].mXTile = i % pGrid->mCountX;
+    		pGrid->pTiles[i].mYTile = i / pGrid->mCountX;
+    		pGrid->pTiles[i].mSpeciesMix = grassSpeciesMix(
+    			((float)pGrid->pTiles[i].mXTile+0.5f)*(float)pGrid->mDimension,
+    			((float)pGrid->pTiles[i].mYTile+0.5f)*(float)pGrid->mDimension);
+    	}
+    	
+    	if (!heapAlloc(&gStaticHeap, sizeof(TileEntry)*pGrid->mCount, sizeof(TileEntry), MEMORY_CATEGORY_GRASS, &gGrassTileData)) return false;
+    	heapUpload(&gGrassTileData, pGrid->pTiles);
+	    
+	    BufferLoadDesc indirectDesc = {};
+	    indirectDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_BUFFER | DESCRIPTOR_TYPE_RW_BUFFER | DESCRIPTOR_TYPE_INDIRECT_BUFFER;
+	    indirectDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_ONLY;
+	    indirectDesc.mDesc.mFlags = BUFFER_CREATION_FLAG_NONE;
+	    indirectDesc.mDesc.mStartState = RESOURCE_STATE_UNORDERED_ACCESS;
+	    // A draw per species of each tile, see "Grass species"
+	    indirectDesc.mDesc.mSize = sizeof(GrassDrawArgument)*pGrid->mCount*MAX_GRASS_SPECIES*MAX_GRASS_VIEWS*GRASS_VARIANT_COUNT;
+	    indirectDesc.mDesc.pName = "GrassDrawBuffer";
+	    indirectDesc.pData = NULL;
+	    indirectDesc.ppBuffer = &pGrassDrawBuffer;
+	    indirectDesc.mDesc.mElementCount = pGrid->mCount*MAX_GRASS_SPECIES*MAX_GRASS_VIEWS*GRASS_VARIANT_COUNT;
+	    indirectDesc.mDesc.mStructStride = sizeof(GrassDrawArgument);
+	    addTrackedBuffer(&indirectDesc, nullptr, MEMORY_CATEGORY_GRASS);
+	    
+	    indirectDesc.mDesc.mSize = sizeof(GrassProceduralDrawArgument)*pGrid->mCount*MAX_GRASS_SPECIES*MAX_GRASS_VIEWS*GRASS_VARIANT_COUNT;
+	    indirectDesc.mDesc.pName = "GrassProceduralDrawBuffer";
+	    indirectDesc.ppBuffer = &pGrassProceduralDrawBuffer;
+	    indirectDesc.mDesc.mStructStride = sizeof(GrassProceduralDrawArgument);
+	    addTrackedBuffer(&indirectDesc, nullptr, MEMORY_CATEGORY_GRASS);
+	    
+	    // Tile index & blade count for each splatted tile & species, see "Grass splatting"
+	    indirectDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_BUFFER | DESCRIPTOR_TYPE_RW_BUFFER;
+	    indirectDesc.mDesc.mSize = sizeof(uint32_t)*2*pGrid->mCount*MAX_GRASS_SPECIES;
+	    indirectDesc.mDesc.pName = "GrassSplatTileBuffer";
+	    indirectDesc.ppBuffer = &pGrassSplatTileBuffer;
+	    indirectDesc.mDesc.mElementCount = pGrid->mCount*MAX_GRASS_SPECIES;
+	    indirectDesc.mDesc.mStructStride = sizeof(uint32_t)*2;
+	    addTrackedBuffer(&indirectDesc, nullptr, MEMORY_CATEGORY_GRASS);
+	    
+	    // Zeroed, so no tile starts out looking like it has a result for the current epoch
+	    indirectDesc.mDesc.mSize = sizeof(GrassTileCullState)*pGrid->mCount*MAX_GRASS_VIEWS;
+	    indirectDesc.mDesc.pName = "GrassCullStateBuffer";
+	    indirectDesc.ppBuffer = &pGrassCullStateBuffer;
+	    indirectDesc.mDesc.mElementCount = pGrid->mCount*MAX_GRASS_VIEWS;
+	    indirectDesc.mDesc.mStructStride = sizeof(GrassTileCullState);
+	    indirectDesc.mForceReset = true;
+	    addTrackedBuffer(&indirectDesc, nullptr, MEMORY_CATEGORY_GRASS);
+	    return true;
+    }
+    
+    void removeTileGridBuffers()
+    {
+    	memUntrack(gTileGrid.pTiles);
+    	tf_free(gTileGrid.pTiles);
+    	gTileGrid.pTiles = NULL;
+    	
+        heapFree(&gStaticHeap, &gGrassTileData);
+        removeTrackedBuffer(pGrassDrawBuffer);
+        removeTrackedBuffer(pGrassProceduralDrawBuffer);
+        removeTrackedBuffer(pGrassSplatTileBuffer);
+        removeTrackedBuffer(pGrassCullStateBuffer);
+    }
+    
+    // The tile size was changed from the UI or by the tuner. Like applyFramesInFlight(), waits for the GPU.
+    void applyTileGrid()
+    {
+    	// Startup loading may still be uploading the tile data, the change waits for it
+    	if (gTileGrid.mRequestedDimension == gTileGrid.mDimension || !gStartup.mGrassReady) return;
+    	
+    	waitQueueIdle(pGraphicsQueue);
+    	removeTileGridBuffers();
+    	
+    	tileGridSetDimension(gTileGrid.mRequestedDimension);
+    	// The old tile data's range is free again, so only running out of VRAM fails this
+    	if (!addTileGridBuffers()) {
+    		requestShutdown();
+    		return;
+    	}
+    	waitForAllResourceLoads();
+    	updateTileGridDescriptorSets();
+    	
+    	// The new cull state has no results, so culling has to run even if nothing moved
+    	gCoherentCulling.mEpoch += 1;
+    	if (gCoherentCulling.mEpoch == 0) gCoherentCulling.mEpoch = 1;
+    	
+    	LOGF(LogLevel::eINFO, "Grass tiles: %um, %ux%u", gTileGrid.mDimension, gTileGrid.mCountX, gTileGrid.mCountY);
+    }
+    
+    void removeStaticResources()
+    {
+    	// We might be exiting before startup loading finished
+    	if (!gStartup.mInstanceFillJoined) joinThread(gStartup.mInstanceFillThread);
+    	waitForAllResourceLoads();
+    	memUntrack(gStartup.pGrassInstanceData);
+    	tf_free(gStartup.pGrassInstanceData);
+    	
+    	heightFieldExit();
+    	removeTerrainEdits();
+    	memUntrack(pHeightMap);
+    	memUntrack(pSkyboxTexture);
+        if (pHeightMap) removeResource(pHeightMap);
+        if (pSkyboxTexture) removeResource(pSkyboxTexture);
         
-        exitGPUConfiguration();
+        for (uint32_t i = 0; i < gGrassDrawUniformData.mLod.mLevelCount; i += 1) {
+        	memUntrack(pGrassGeoms[i]);
+        	memUntrack(pGrassGeomDatas[i]);
+        	if (pGrassGeoms[i]) removeResource(pGrassGeoms[i]);
+        	if (pGrassGeomDatas[i]) removeResource(pGrassGeomDatas[i]);
+	    }
+        removeSampler(pRenderer, pSampler);
         
-        exitTemporaryStorage();
+        for (uint32_t i = 0; i < gMaxFramesInFlight; i += 1)
+        	for (uint32_t v = 0; v < MAX_GRASS_VIEWS; v += 1) heapFree(&gUploadHeap, &gSceneUbos[i][v]);
+        removeTileGridBuffers();
+        if (pGrassInstanceVbo) removeTrackedBuffer(pGrassInstanceVbo);
+        if (pGrassVbo) removeTrackedBuffer(pGrassVbo);
+        if (pGrassIbo) removeTrackedBuffer(pGrassIbo);
+        for (uint32_t i = 0; i < gMaxFramesInFlight; i += 1) heapFree(&gUploadHeap, &gGrassDrawUbos[i]);
+        for (uint32_t i = 0; i < gMaxFramesInFlight; i += 1) heapFree(&gUploadHeap, &gGrassSpeciesBuffers[i]);
+        removeTrackedBuffer(pGrassDrawCountBuffer);
+        heapFree(&gStaticHeap, &gGrassDrawCountReset);
+        removeTrackedBuffer(pGrassSplatArgsBuffer);
+        heapFree(&gStaticHeap, &gGrassSplatArgsReset);
+        for (uint32_t i = 0; i < gMaxFramesInFlight; i += 1)
+        	for (uint32_t v = 0; v < MAX_GRASS_VIEWS; v += 1) heapFree(&gUploadHeap, &gSkyboxUbos[i][v]);
+        removeBufferHeap(&gUploadHeap);
+        removeBufferHeap(&gStaticHeap);
     }
-
-    bool Load(ReloadDesc *pReloadDesc)
+    
+    ///
+    // Swapchain & depth buffers (RELOAD_TYPE_RESIZE, RELOAD_TYPE_RENDERTARGET)
+    bool addRenderTargets()
     {
-		
-		///
-		// Load UI
-		loadProfilerUI(mSettings.mWidth, mSettings.mHeight);
-		
-		UIComponentDesc guiDesc = {};
-        guiDesc.mStartPosition = vec2(mSettings.mWidth * 0.01f, mSettings.mHeight * 0.2f);
-		uiAddComponent(GetName(), &guiDesc, &pGuiWindow);
-		uiSetComponentFlags(pGuiWindow, GUI_COMPONENT_FLAGS_NONE);
-		
-		addUiWidgets();
-
 		///
 		// Init swapchain
 		
@@ -447,6 +4549,7 @@ public:
     		LOGF(LogLevel::eERROR, "Failed to add swapchain.");
     		return false;
     	}
+    	memTrack(pSwapChain, MEMORY_CATEGORY_RENDER_TARGETS, memRenderTargetBytes(pSwapChain->ppRenderTargets[0])*pSwapChain->mImageCount, false);
     	
     	///
 	    // Init depth buffer
@@ -463,14 +4566,114 @@ public:
         depthRT.mSampleQuality = 0;
         depthRT.mWidth = mSettings.mWidth;
         depthRT.mFlags = TEXTURE_CREATION_FLAG_ON_TILE | TEXTURE_CREATION_FLAG_VR_MULTIVIEW;
-        addRenderTarget(pRenderer, &depthRT, &pDepthBuffer);
+        addTrackedRenderTarget(pRenderer, &depthRT, &pDepthBuffer, MEMORY_CATEGORY_RENDER_TARGETS);
 		
 		if (pDepthBuffer == NULL) 
 		{
     		LOGF(LogLevel::eERROR, "Failed to add depth buffer render target.");
     		return false;
     	}
-
+    	
+    	///
+    	// Transients, created by the frame graph (see "Frame graph")
+    	
+    	// Views after the main one get their own depth buffer
+    	fgDeclareTransientRenderTarget(FG_RESOURCE_SECONDARY_DEPTH, &depthRT);
+    	
+    	// Grass splat buffer, one uint per pixel of the main view (see "Grass splatting")
+    	gGrassDrawUniformData.mSplatWidth = mSettings.mWidth;
+    	gGrassDrawUniformData.mSplatHeight = mSettings.mHeight;
+    	
+    	BufferDesc splatDesc = {};
+    	splatDesc.mDescriptors = DESCRIPTOR_TYPE_BUFFER | DESCRIPTOR_TYPE_RW_BUFFER;
+    	splatDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_ONLY;
+    	splatDesc.mStartState = RESOURCE_STATE_UNORDERED_ACCESS;
+    	splatDesc.mSize = sizeof(uint32_t)*mSettings.mWidth*mSettings.mHeight;
+    	splatDesc.mElementCount = mSettings.mWidth*mSettings.mHeight;
+    	splatDesc.mStructStride = sizeof(uint32_t);
+    	splatDesc.pName = "GrassSplatBuffer";
+    	fgDeclareTransientBuffer(FG_RESOURCE_SPLAT_BUFFER, &splatDesc);
+    	
+    	declareFrameGraph(true, true, true, false, true, true, true, gSplitSubmission, MAX_GRASS_VIEWS);
+    	if (!fgAddTransients(pRenderer)) 
+		{
+    		LOGF(LogLevel::eERROR, "Failed to add frame graph transients.");
+    		return false;
+    	}
+    	pSecondaryViewDepthBuffer = fgRenderTarget(FG_RESOURCE_SECONDARY_DEPTH);
+    	pGrassSplatBuffer = fgBuffer(FG_RESOURCE_SPLAT_BUFFER);
+    	
+    	// Not a transient, it's read by the next frames
+    	addTemporalGrassBuffer();
+    	
+    	return true;
+    }
+    
+    // See "Temporal grass". Recreated with the render targets & when the frame count changes.
+    void addTemporalGrassBuffer()
+    {
+    	const uint32_t slots = gTemporalGrass.mFrames > 1 ? gTemporalGrass.mFrames : 0;
+    	
+    	BufferLoadDesc historyDesc = {};
+    	historyDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_BUFFER | DESCRIPTOR_TYPE_RW_BUFFER;
+    	historyDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_ONLY;
+    	historyDesc.mDesc.mStartState = RESOURCE_STATE_UNORDERED_ACCESS;
+    	// The far grass shaders are bound to it even when it's off
+    	historyDesc.mDesc.mElementCount = slots > 0 ? slots*mSettings.mWidth*mSettings.mHeight : 1;
+    	historyDesc.mDesc.mStructStride = sizeof(uint32_t);
+    	historyDesc.mDesc.mSize = historyDesc.mDesc.mStructStride*historyDesc.mDesc.mElementCount;
+    	historyDesc.mDesc.pName = "GrassTemporalBuffer";
+    	historyDesc.ppBuffer = &pGrassTemporalBuffer;
+    	addTrackedBuffer(&historyDesc, nullptr, MEMORY_CATEGORY_RENDER_TARGETS);
+    	
+    	// Nothing's been drawn into it. Each slot is cleared right before it's drawn into.
+    	for (uint32_t i = 0; i < TEMPORAL_GRASS_MAX_FRAMES; i += 1) {
+    		gTemporalGrass.mSlotValid[i] = false;
+    		gTemporalGrass.mSectorDrawn[i] = false;
+    	}
+    }
+    
+    // The frame count or mode was changed from the UI. Like applyTileGrid(), waits for the GPU.
+    void applyTemporalGrass()
+    {
+    	if (gTemporalGrass.mRequestedFrames == gTemporalGrass.mFrames && gTemporalGrass.mRequestedBySector == gTemporalGrass.mBySector) return;
+    	
+    	waitQueueIdle(pGraphicsQueue);
+    	removeTrackedBuffer(pGrassTemporalBuffer);
+    	gTemporalGrass.mFrames = gTemporalGrass.mRequestedFrames;
+    	gTemporalGrass.mBySector = gTemporalGrass.mRequestedBySector;
+    	addTemporalGrassBuffer();
+    	updateSplatDescriptorSets();
+    	
+    	// Update() set this frame up for the old count, so it's drawn without
+    	gTemporalGrass.mDrawFrames = 0;
+    	gSceneUniformData.mTemporalHistory[0] = 0;
+    	gGrassDrawUniformData.mTemporalFrames = 1;
+    	gGrassDrawUniformData.mTemporalSectors = 0;
+    	gCoherentCulling.mEpoch += 1;
+    	if (gCoherentCulling.mEpoch == 0) gCoherentCulling.mEpoch = 1;
+    }
+    
+    void removeRenderTargets()
+    {
+        memUntrack(pSwapChain);
+        removeSwapChain(pRenderer, pSwapChain);
+        
+        removeTrackedRenderTarget(pRenderer, pDepthBuffer);
+        
+        fgForgetRenderTargets();
+        fgRemoveTransients(pRenderer);
+        pSecondaryViewDepthBuffer = NULL;
+        pGrassSplatBuffer = NULL;
+        
+        removeTrackedBuffer(pGrassTemporalBuffer);
+        pGrassTemporalBuffer = NULL;
+    }
+    
+    ///
+    // Shaders, root signatures & descriptor sets (RELOAD_TYPE_SHADER)
+    bool addShaders()
+    {
 		///
 	    // Init shaders
 
@@ -484,14 +4687,29 @@ public:
     		return false;
     	}
     	
-        shaderDesc.mVert.pFileName = "grass.vert";
-        shaderDesc.mFrag.pFileName = "grass.frag";
-        addShader(pRenderer, &shaderDesc, &pGrassShader);
-		if (!pGrassShader) 
-		{
-    		LOGF(LogLevel::eERROR, "Failed to add shader.");
-    		return false;
-    	}
+        // See "Grass shader variants"
+        const char *grassVertNames[GRASS_VARIANT_COUNT] = { "grass.vert", "grass_far.vert" };
+        const char *grassProceduralVertNames[GRASS_VARIANT_COUNT] = { "grass_procedural.vert", "grass_procedural_far.vert" };
+        const char *grassFragNames[GRASS_VARIANT_COUNT] = { "grass.frag", "grass_far.frag" };
+        for (uint32_t i = 0; i < GRASS_VARIANT_COUNT; i += 1) {
+	        shaderDesc.mVert.pFileName = grassVertNames[i];
+	        shaderDesc.mFrag.pFileName = grassFragNames[i];
+	        addShader(pRenderer, &shaderDesc, &pGrassShaders[i]);
+			if (!pGrassShaders[i]) 
+			{
+	    		LOGF(LogLevel::eERROR, "Failed to add shader.");
+	    		return false;
+	    	}
+	    	
+	        shaderDesc.mVert.pFileName = grassProceduralVertNames[i];
+	        shaderDesc.mFrag.pFileName = grassFragNames[i];
+	        addShader(pRenderer, &shaderDesc, &pGrassProceduralShaders[i]);
+			if (!pGrassProceduralShaders[i]) 
+			{
+	    		LOGF(LogLevel::eERROR, "Failed to add shader.");
+	    		return false;
+	    	}
+        }
     	
     	shaderDesc.mVert.pFileName = "skybox.vert";
         shaderDesc.mFrag.pFileName = "skybox.frag";
@@ -501,6 +4719,14 @@ public:
     		LOGF(LogLevel::eERROR, "Failed to add shader.");
     		return false;
     	}
+    	shaderDesc.mVert.pFileName = "grass_splat_resolve.vert";
+        shaderDesc.mFrag.pFileName = "grass_splat_resolve.frag";
+        addShader(pRenderer, &shaderDesc, &pGrassSplatResolveShader);
+		if (!pGrassSplatResolveShader) 
+		{
+    		LOGF(LogLevel::eERROR, "Failed to add shader.");
+    		return false;
+    	}
     	shaderDesc = {};
     	shaderDesc.mComp.pFileName = "grass_draw.comp";
         addShader(pRenderer, &shaderDesc, &pGrassDrawShader);
@@ -509,16 +4735,60 @@ public:
     		LOGF(LogLevel::eERROR, "Failed to add shader.");
     		return false;
     	}
+    	shaderDesc.mComp.pFileName = "grass_splat_clear.comp";
+        addShader(pRenderer, &shaderDesc, &pGrassSplatClearShader);
+		if (!pGrassSplatClearShader) 
+		{
+    		LOGF(LogLevel::eERROR, "Failed to add shader.");
+    		return false;
+    	}
+    	shaderDesc.mComp.pFileName = "grass_splat.comp";
+        addShader(pRenderer, &shaderDesc, &pGrassSplatShader);
+		if (!pGrassSplatShader) 
+		{
+    		LOGF(LogLevel::eERROR, "Failed to add shader.");
+    		return false;
+    	}
+    	shaderDesc.mComp.pFileName = "grass_temporal.comp";
+        addShader(pRenderer, &shaderDesc, &pGrassTemporalShader);
+		if (!pGrassTemporalShader) 
+		{
+    		LOGF(LogLevel::eERROR, "Failed to add shader.");
+    		return false;
+    	}
     	
+    	return true;
+    }
+    
+    void removeShaders()
+    {
+    	removeShader(pRenderer, pTerrainShader);
+    	for (uint32_t i = 0; i < GRASS_VARIANT_COUNT; i += 1) {
+    		removeShader(pRenderer, pGrassShaders[i]);
+    		removeShader(pRenderer, pGrassProceduralShaders[i]);
+    	}
+    	removeShader(pRenderer, pSkyboxShader);
+    	removeShader(pRenderer, pGrassDrawShader);
+    	removeShader(pRenderer, pGrassSplatClearShader);
+    	removeShader(pRenderer, pGrassSplatShader);
+    	removeShader(pRenderer, pGrassSplatResolveShader);
+    	removeShader(pRenderer, pGrassTemporalShader);
+    }
+    
+    bool addRootSignatures()
+    {
     	///
     	// Init root signature
     	
     	// (This should probably be divided into multiple root signatures)
     	
-    	Shader *shaders[3];
+    	Shader *shaders[2+2*GRASS_VARIANT_COUNT];
         shaders[0] = pTerrainShader;
-        shaders[1] = pGrassShader;
-        shaders[2] = pSkyboxShader;
+        shaders[1] = pSkyboxShader;
+        for (uint32_t i = 0; i < GRASS_VARIANT_COUNT; i += 1) {
+        	shaders[2+i*2+0] = pGrassShaders[i];
+        	shaders[2+i*2+1] = pGrassProceduralShaders[i];
+        }
         RootSignatureDesc rootDesc = {};
         rootDesc.mShaderCount = sizeof(shaders)/sizeof(Shader*);
         rootDesc.ppShaders = shaders;
@@ -529,6 +4799,18 @@ public:
         rootDesc.ppShaders = &pGrassDrawShader;
         addRootSignature(pRenderer, &rootDesc, &pGrassDrawRootSignature);
         
+        // The temporal grass reprojection splats too
+        Shader *splatShaders[3] = { pGrassSplatClearShader, pGrassSplatShader, pGrassTemporalShader };
+        rootDesc = {};
+        rootDesc.mShaderCount = 3;
+        rootDesc.ppShaders = splatShaders;
+        addRootSignature(pRenderer, &rootDesc, &pGrassSplatRootSignature);
+        
+        rootDesc = {};
+        rootDesc.mShaderCount = 1;
+        rootDesc.ppShaders = &pGrassSplatResolveShader;
+        addRootSignature(pRenderer, &rootDesc, &pGrassSplatResolveRootSignature);
+        
         if (!pRootSignature) 
 		{
     		LOGF(LogLevel::eERROR, "Failed to add root signature.");
@@ -539,113 +4821,241 @@ public:
     		LOGF(LogLevel::eERROR, "Failed to add grass draw root signature.");
     		return false;
     	}
-    	
-    	///
-	    // Init buffers
-	    
-	    uint32_t *grassInstanceData = NULL;
-    	
-    	{ // Shared
-    		BufferLoadDesc uboDesc = {};
-		    uboDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		    uboDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_CPU_TO_GPU;
-		    uboDesc.mDesc.mFlags = BUFFER_CREATION_FLAG_PERSISTENT_MAP_BIT;
-		    uboDesc.mDesc.mSize = sizeof(SceneUniformData);
-		    uboDesc.pData = NULL;
-		    uboDesc.mDesc.pName = "SceneUniformData";
-		    
-		    for (uint32_t i = 0; i < gNumberOfFrames; i += 1) {
-			    uboDesc.ppBuffer = &pSceneUbos[i];
-			    addResource(&uboDesc, nullptr);
-		    }
-		
-		    gSceneUniformData.mTerrainSize = Vector2(TERRAIN_WIDTH, TERRAIN_HEIGHT);
-		    gSceneUniformData.mSunDirection = Vector3(-1.f, -0.6f,  0.2f);
+        if (!pGrassSplatRootSignature || !pGrassSplatResolveRootSignature) 
+		{
+    		LOGF(LogLevel::eERROR, "Failed to add grass splat root signatures.");
+    		return false;
     	}
     	
-	    { // Grass
-		    
-		    for (uint32_t i = 0; i < GRASS_TILE_COUNT; i += 1) {
-		    
-		    	uint32_t xTile = i % GRASS_TILE_COUNT_X;
-		    	uint32_t yTile = i / GRASS_TILE_COUNT_X;
-		    
-		    	gGrassTileData.mTiles[i].mTileSeed = rand();
-		    	gGrassTileData.mTiles[i].mXTile = xTile;
-		    	gGrassTileData.mTiles[i].mYTile = yTile;
-		    }
-            
-	    	BufferLoadDesc tileDataDesc = {};
-		    tileDataDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_BUFFER;
-		    tileDataDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_ONLY;
-		    tileDataDesc.mDesc.mFlags = BUFFER_CREATION_FLAG_NONE;
-		    tileDataDesc.mDesc.mStartState = RESOURCE_STATE_SHADER_RESOURCE;
-		    tileDataDesc.pData = &gGrassTileData;
-		    tileDataDesc.mDesc.pName = "GrassTileData";
-		    tileDataDesc.ppBuffer = &pGrassTileBuffer;
-		    tileDataDesc.mDesc.mStructStride = sizeof(TileEntry);
-		    tileDataDesc.mDesc.mElementCount = GRASS_TILE_COUNT;
-		    tileDataDesc.mDesc.mSize = tileDataDesc.mDesc.mStructStride*tileDataDesc.mDesc.mElementCount;
-		    addResource(&tileDataDesc, nullptr);
-		    
-		    grassInstanceData = (uint32_t*)tf_malloc(sizeof(uint32_t)*MAX_GRASS_CAP);
-		    for (uint32_t i = 0; i < MAX_GRASS_CAP; i += 1) {
-		    	grassInstanceData[i] = i;
+    	return true;
+    }
+    
+    void removeRootSignatures()
+    {
+        removeRootSignature(pRenderer, pRootSignature);
+        removeRootSignature(pRenderer, pGrassDrawRootSignature);
+        removeRootSignature(pRenderer, pGrassSplatRootSignature);
+        removeRootSignature(pRenderer, pGrassSplatResolveRootSignature);
+    }
+    
+    void addDescriptorSets()
+    {
+        // Per frame sets that depend on the view are indexed with viewSetIndex()
+        
+        { // terrain ubo descriptor set
+	    	DescriptorSetDesc setDesc = { pRootSignature, DESCRIPTOR_UPDATE_FREQ_PER_FRAME, gMaxFramesInFlight*MAX_GRASS_VIEWS };
+	        addDescriptorSet(pRenderer, &setDesc, &pDescriptorSetTerrainUbo);
+		    for (uint32_t i = 0; i < gMaxFramesInFlight; i += 1) {
+		    	for (uint32_t v = 0; v < MAX_GRASS_VIEWS; v += 1) {
+			    	// The far field is shaded from each tile's species mix, see "Far-field grass"
+			    	DescriptorData params[2] = {};
+			    	heapDescriptor(&params[0], "scene", &gSceneUbos[i][v]);
+			    	heapDescriptor(&params[1], "speciesData", &gGrassSpeciesBuffers[i]);
+		            updateDescriptorSet(pRenderer, viewSetIndex(i, v), pDescriptorSetTerrainUbo, 2, params);
+		    	}
 		    }
-		    
-		    BufferLoadDesc vboDesc = {};
-		    vboDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_VERTEX_BUFFER;
-		    vboDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_ONLY;
-		    vboDesc.mDesc.mFlags = BUFFER_CREATION_FLAG_NONE;
-		    vboDesc.mDesc.mSize = sizeof(uint32_t)*MAX_GRASS_CAP;
-		    vboDesc.pData = grassInstanceData;
-		    vboDesc.mDesc.pName = "GrassInstanceData";
-		    vboDesc.ppBuffer = &pGrassInstanceVbo;
-		    addResource(&vboDesc, nullptr);
-		    
-		    BufferLoadDesc indirectDesc = {};
-		    indirectDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_BUFFER | DESCRIPTOR_TYPE_RW_BUFFER | DESCRIPTOR_TYPE_INDIRECT_BUFFER;
-		    indirectDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_ONLY;
-		    indirectDesc.mDesc.mFlags = BUFFER_CREATION_FLAG_NONE;
-		    indirectDesc.mDesc.mStartState = RESOURCE_STATE_SHADER_RESOURCE;
-            indirectDesc.mDesc.mSize = sizeof(GrassDrawArgument)*GRASS_TILE_COUNT;
-		    indirectDesc.mDesc.pName = "GrassDrawBuffer";
-		    indirectDesc.pData = NULL;
-		    indirectDesc.ppBuffer = &pGrassDrawBuffer;
-		    indirectDesc.mDesc.mElementCount = GRASS_TILE_COUNT;
-    		indirectDesc.mDesc.mStructStride = sizeof(GrassDrawArgument);
-		    
-		    addResource(&indirectDesc, nullptr);
-		    
-		    BufferLoadDesc uboDesc = {};
-		    uboDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		    uboDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_CPU_TO_GPU;
-		    uboDesc.mDesc.mFlags = BUFFER_CREATION_FLAG_PERSISTENT_MAP_BIT;
-		    uboDesc.mDesc.mSize = sizeof(GrassDrawUniformData);
-		    uboDesc.pData = NULL;
-		    uboDesc.mDesc.pName = "GrassDrawUniformData";
-		    
-		    for (uint32_t i = 0; i < gNumberOfFrames; i += 1) {
-			    uboDesc.ppBuffer = &pGrassDrawUbos[i];
-			    addResource(&uboDesc, nullptr);
+	    }
+	    
+        { // grass ubo descriptor set
+	    	DescriptorSetDesc setDesc = { pRootSignature, DESCRIPTOR_UPDATE_FREQ_PER_FRAME, gMaxFramesInFlight*MAX_GRASS_VIEWS };
+    		addDescriptorSet(pRenderer, &setDesc, &pDescriptorSetGrass);
+    		DescriptorData params[2] = {};
+            for (uint32_t i = 0; i < gMaxFramesInFlight; i += 1)
+            {
+            	for (uint32_t v = 0; v < MAX_GRASS_VIEWS; v += 1)
+            	{
+	                heapDescriptor(&params[0], "scene", &gSceneUbos[i][v]);
+	                heapDescriptor(&params[1], "speciesData", &gGrassSpeciesBuffers[i]);
+	            
+	                updateDescriptorSet(pRenderer, viewSetIndex(i, v), pDescriptorSetGrass, 2, params);
+            	}
+            }
+	    }
+        { // grass draw call compute set
+	    	DescriptorSetDesc setDesc = { pGrassDrawRootSignature, DESCRIPTOR_UPDATE_FREQ_PER_FRAME, gMaxFramesInFlight };
+    		addDescriptorSet(pRenderer, &setDesc, &pDescriptorSetGrassDrawCompute);
+    		
+    		for (uint32_t i = 0; i < gMaxFramesInFlight; i += 1) {
+	    		DescriptorData params[5] = {};
+	    		// View independent data is the same in every view's scene ubo, so just use the main view's
+	            heapDescriptor(&params[0], "scene", &gSceneUbos[i][0]);
+	            heapDescriptor(&params[1], "drawInfo", &gGrassDrawUbos[i]);
+	            
+	    	    params[2].mCount = 1;
+	            params[2].pName = "drawCounts";
+	            params[2].ppBuffers = &pGrassDrawCountBuffer;
+	            
+	    	    params[3].mCount = 1;
+	            params[3].pName = "splatArgs";
+	            params[3].ppBuffers = &pGrassSplatArgsBuffer;
+	            
+	            heapDescriptor(&params[4], "speciesData", &gGrassSpeciesBuffers[i]);
+	        
+	            updateDescriptorSet(pRenderer, i, pDescriptorSetGrassDrawCompute, 5, params);
+    		}
+    		
+	    }
+	    
+        { // skybox ubo descriptor set
+	    	DescriptorSetDesc setDesc = { pRootSignature, DESCRIPTOR_UPDATE_FREQ_PER_FRAME, gMaxFramesInFlight*MAX_GRASS_VIEWS };
+	        addDescriptorSet(pRenderer, &setDesc, &pDescriptorSetSkyboxUbos);
+		    for (uint32_t i = 0; i < gMaxFramesInFlight; i += 1) {
+		    	for (uint32_t v = 0; v < MAX_GRASS_VIEWS; v += 1) {
+			    	DescriptorData params[2] = {};
+			    	heapDescriptor(&params[0], "skyboxData", &gSkyboxUbos[i][v]);
+			    	heapDescriptor(&params[1], "scene", &gSceneUbos[i][v]);
+		            updateDescriptorSet(pRenderer, viewSetIndex(i, v), pDescriptorSetSkyboxUbos, 2, params);
+		    	}
 		    }
 		    
+		    setDesc = { pRootSignature, DESCRIPTOR_UPDATE_FREQ_NONE, 1 };
+	        addDescriptorSet(pRenderer, &setDesc, &pDescriptorSetSkyboxTextures);
 	    }
-	    { // Skybox
-	    	BufferLoadDesc uboDesc = {};
-		    uboDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		    uboDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_CPU_TO_GPU;
-		    uboDesc.mDesc.mFlags = BUFFER_CREATION_FLAG_PERSISTENT_MAP_BIT;
-		    uboDesc.mDesc.mSize = sizeof(SkyboxUniformData);
-		    uboDesc.pData = NULL;
-		    uboDesc.mDesc.pName = "SkyboxUniformData";
-		    
-		    for (uint32_t i = 0; i < gNumberOfFrames; i += 1) {
-			    uboDesc.ppBuffer = &pSkyboxUbos[i];
-			    addResource(&uboDesc, nullptr);
-		    }
+        
+	    { // textures descriptor sets, filled in updateTextureDescriptorSets()
+	    	DescriptorSetDesc setDesc = { pRootSignature, DESCRIPTOR_UPDATE_FREQ_NONE, 1 };
+	        addDescriptorSet(pRenderer, &setDesc, &pDescriptorSetHeightMap);
+	        
+	    	setDesc = { pGrassDrawRootSignature, DESCRIPTOR_UPDATE_FREQ_NONE, 1 };
+	        addDescriptorSet(pRenderer, &setDesc, &pDescriptorSetHeightMapDrawCompute);
 	    }
 	    
+	    { // grass splatting sets, the splat buffer is filled in by updateSplatDescriptorSets()
+	    	DescriptorSetDesc setDesc = { pGrassSplatRootSignature, DESCRIPTOR_UPDATE_FREQ_NONE, 1 };
+	        addDescriptorSet(pRenderer, &setDesc, &pDescriptorSetGrassSplat);
+	    	setDesc = { pGrassSplatResolveRootSignature, DESCRIPTOR_UPDATE_FREQ_NONE, 1 };
+	        addDescriptorSet(pRenderer, &setDesc, &pDescriptorSetGrassSplatResolve);
+	        
+	    	setDesc = { pGrassSplatRootSignature, DESCRIPTOR_UPDATE_FREQ_PER_FRAME, gMaxFramesInFlight };
+	        addDescriptorSet(pRenderer, &setDesc, &pDescriptorSetGrassSplatPerFrame);
+	    	setDesc = { pGrassSplatResolveRootSignature, DESCRIPTOR_UPDATE_FREQ_PER_FRAME, gMaxFramesInFlight };
+	        addDescriptorSet(pRenderer, &setDesc, &pDescriptorSetGrassSplatResolvePerFrame);
+	        
+	        // Splatting is main view only, so it only needs the main view's scene ubo
+	        for (uint32_t i = 0; i < gMaxFramesInFlight; i += 1) {
+	    		DescriptorData params[3] = {};
+	            heapDescriptor(&params[0], "scene", &gSceneUbos[i][0]);
+	            heapDescriptor(&params[1], "drawInfo", &gGrassDrawUbos[i]);
+	            heapDescriptor(&params[2], "speciesData", &gGrassSpeciesBuffers[i]);
+	            updateDescriptorSet(pRenderer, i, pDescriptorSetGrassSplatPerFrame, 3, params);
+	            
+	            updateDescriptorSet(pRenderer, i, pDescriptorSetGrassSplatResolvePerFrame, 3, params);
+	        }
+	    }
+	    
+	    updateTileGridDescriptorSets();
+	    
+	    // Otherwise this happens when the textures finish loading
+	    if (gStartup.mSkyAndTerrainReady) updateTextureDescriptorSets();
+    }
+    
+    // The tile grid's buffers are recreated when the tile size changes, see applyTileGrid()
+    void updateTileGridDescriptorSets()
+    {
+    	DescriptorData params[5] = {};
+        heapDescriptor(&params[0], "tileData", &gGrassTileData);
+	    params[1].mCount = 1;
+        params[1].pName = "splatTiles";
+        params[1].ppBuffers = &pGrassSplatTileBuffer;
+	    params[2].mCount = 1;
+        params[2].pName = "drawBuffer";
+        params[2].ppBuffers = &pGrassDrawBuffer;
+	    params[3].mCount = 1;
+        params[3].pName = "proceduralDrawBuffer";
+        params[3].ppBuffers = &pGrassProceduralDrawBuffer;
+	    params[4].mCount = 1;
+        params[4].pName = "cullState";
+        params[4].ppBuffers = &pGrassCullStateBuffer;
+        
+        for (uint32_t i = 0; i < gMaxFramesInFlight; i += 1) {
+        	for (uint32_t v = 0; v < MAX_GRASS_VIEWS; v += 1) {
+        		updateDescriptorSet(pRenderer, viewSetIndex(i, v), pDescriptorSetGrass, 1, params);
+        		updateDescriptorSet(pRenderer, viewSetIndex(i, v), pDescriptorSetTerrainUbo, 1, params);
+        	}
+        	updateDescriptorSet(pRenderer, i, pDescriptorSetGrassSplatPerFrame, 2, params);
+        	// Culling reads the species mixes, see "Grass species"
+        	updateDescriptorSet(pRenderer, i, pDescriptorSetGrassDrawCompute, 5, params);
+        }
+    }
+    
+    // Textures are created by the loader thread, so these sets can't be filled until they've landed
+    void updateTextureDescriptorSets()
+    {
+    	{
+	    	DescriptorData params[2] = {};
+	    	params[0].pName = "Sampler";
+	        params[0].ppSamplers = &pSampler;
+	        params[0].mCount = 1;
+		    params[1].pName = "Skybox";
+	        params[1].ppTextures = &pSkyboxTexture;
+	        params[1].mCount = 1;
+            updateDescriptorSet(pRenderer, 0, pDescriptorSetSkyboxTextures, 2, params);
+    	}
+    	{
+		    DescriptorData params[3] = {};
+		    params[0].pName = "HeightMap";
+	        params[0].ppTextures = &pHeightMap;
+	        params[0].mCount = 1;
+		    params[1].pName = "Sampler";
+	        params[1].ppSamplers = &pSampler;
+	        params[1].mCount = 1;
+		    params[2].pName = "heightEdits";
+	        params[2].ppBuffers = &gTerrainEdits.pBuffer;
+	        params[2].mCount = 1;
+	        
+	        updateDescriptorSet(pRenderer, 0, pDescriptorSetHeightMap, 3, params);
+    	}
+    	
+	    // Everything that samples the height map adds the sculpted offsets, see "Terrain editing"
+	    DescriptorData  params[2] = {};
+	    params[0].pName = "HeightMap";
+        params[0].ppTextures = &pHeightMap;
+        params[0].mCount = 1;
+	    params[1].pName = "heightEdits";
+        params[1].ppBuffers = &gTerrainEdits.pBuffer;
+        params[1].mCount = 1;
+        
+        updateDescriptorSet(pRenderer, 0, pDescriptorSetHeightMapDrawCompute, 2, params);
+        updateDescriptorSet(pRenderer, 0, pDescriptorSetGrassSplat, 2, params);
+    }
+    
+    // The splat & temporal grass buffers are recreated with the render targets, see "Grass splatting"
+    // & "Temporal grass"
+    void updateSplatDescriptorSets()
+    {
+    	DescriptorData params[2] = {};
+	    params[0].pName = "splatBuffer";
+        params[0].ppBuffers = &pGrassSplatBuffer;
+        params[0].mCount = 1;
+	    params[1].pName = "temporalHistory";
+        params[1].ppBuffers = &pGrassTemporalBuffer;
+        params[1].mCount = 1;
+        
+        updateDescriptorSet(pRenderer, 0, pDescriptorSetGrassSplat, 2, params);
+        updateDescriptorSet(pRenderer, 0, pDescriptorSetGrassSplatResolve, 1, params);
+        // Written by grass_far.frag
+        updateDescriptorSet(pRenderer, 0, pDescriptorSetHeightMap, 1, &params[1]);
+    }
+    
+    void removeDescriptorSets()
+    {
+        removeDescriptorSet(pRenderer, pDescriptorSetGrass);
+        removeDescriptorSet(pRenderer, pDescriptorSetGrassDrawCompute);
+        removeDescriptorSet(pRenderer, pDescriptorSetSkyboxUbos);
+        removeDescriptorSet(pRenderer, pDescriptorSetSkyboxTextures);
+        removeDescriptorSet(pRenderer, pDescriptorSetTerrainUbo);
+        removeDescriptorSet(pRenderer, pDescriptorSetHeightMap);
+        removeDescriptorSet(pRenderer, pDescriptorSetHeightMapDrawCompute);
+        removeDescriptorSet(pRenderer, pDescriptorSetGrassSplat);
+        removeDescriptorSet(pRenderer, pDescriptorSetGrassSplatPerFrame);
+        removeDescriptorSet(pRenderer, pDescriptorSetGrassSplatResolve);
+        removeDescriptorSet(pRenderer, pDescriptorSetGrassSplatResolvePerFrame);
+    }
+    
+    ///
+    // Pipelines (RELOAD_TYPE_SHADER, RELOAD_TYPE_RENDERTARGET)
+    bool addPipelines()
+    {
 	    ///
 	    // Init pipelines
 	    
@@ -685,42 +5095,6 @@ public:
 	        RasterizerStateDesc basicRasterizerStateDesc = {};
 	        basicRasterizerStateDesc.mCullMode = CULL_MODE_NONE; // Grass straws are planes, and we want to be able to see both sides.
 	        
-	        // Vertex layout
-	        
-	        gGrassVertexLayoutForLoading.mBindingCount = 1;
-	        gGrassVertexLayoutForLoading.mAttribCount = 2;
-	        
-	        gGrassVertexLayoutForLoading.mBindings[0].mStride = sizeof(GrassVertex);
-	        gGrassVertexLayoutForLoading.mBindings[0].mRate = VERTEX_BINDING_RATE_VERTEX;
-	        
-	        gGrassVertexLayoutForLoading.mAttribs[0].mSemantic = SEMANTIC_POSITION;
-	        gGrassVertexLayoutForLoading.mAttribs[0].mFormat = TinyImageFormat_R32G32B32_SFLOAT;
-	        gGrassVertexLayoutForLoading.mAttribs[0].mBinding = 0;
-	        gGrassVertexLayoutForLoading.mAttribs[0].mLocation = 0;
-	        gGrassVertexLayoutForLoading.mAttribs[0].mOffset = offsetof(GrassVertex, mPosition);;
-	        
-	        gGrassVertexLayoutForLoading.mAttribs[1].mSemantic = SEMANTIC_NORMAL;
-	        gGrassVertexLayoutForLoading.mAttribs[1].mFormat = TinyImageFormat_R32_UINT;
-	        gGrassVertexLayoutForLoading.mAttribs[1].mBinding = 0;
-	        gGrassVertexLayoutForLoading.mAttribs[1].mLocation = 1;
-	        gGrassVertexLayoutForLoading.mAttribs[1].mOffset = offsetof(GrassVertex, mNormal);
-	        
-	        gGrassVertexLayoutForDrawing = gGrassVertexLayoutForLoading;
-	        
-	        gGrassVertexLayoutForDrawing.mBindingCount = 2;
-	        gGrassVertexLayoutForDrawing.mAttribCount = 3;
-	        
-	        gGrassVertexLayoutForDrawing.mBindings[1].mStride = sizeof(uint32_t);
-        	gGrassVertexLayoutForDrawing.mBindings[1].mRate = VERTEX_BINDING_RATE_INSTANCE;
-	        
-	        gGrassVertexLayoutForDrawing.mAttribs[2].mSemantic = SEMANTIC_CUSTOM;
-            strcpy(gGrassVertexLayoutForDrawing.mAttribs[2].mSemanticName, "INSTANCEID");
-	        gGrassVertexLayoutForDrawing.mAttribs[2].mSemanticNameLength = (uint32_t)strlen("INSTANCEID");
-	        gGrassVertexLayoutForDrawing.mAttribs[2].mFormat = TinyImageFormat_R32_UINT;
-	        gGrassVertexLayoutForDrawing.mAttribs[2].mBinding = 1;
-	        gGrassVertexLayoutForDrawing.mAttribs[2].mLocation = 0;
-	        gGrassVertexLayoutForDrawing.mAttribs[2].mOffset = 0;
-	        
 	        
 	        PipelineDesc pipelineDesc = {};
 	        pipelineDesc.mType = PIPELINE_TYPE_GRAPHICS;
@@ -732,18 +5106,31 @@ public:
 	        //pipelineSettings.mSampleCount = SAMPLE_COUNT_8;
 	        pipelineSettings.mSampleQuality = pSwapChain->ppRenderTargets[0]->mSampleQuality;
 	        pipelineSettings.pRootSignature = pRootSignature;
-	        pipelineSettings.pShaderProgram = pGrassShader;
 	        pipelineSettings.pRasterizerState = &basicRasterizerStateDesc;
 	        pipelineSettings.pDepthState = &depthStateDesc;
 	        pipelineSettings.mDepthStencilFormat = pDepthBuffer->mFormat;
-	        pipelineSettings.pVertexLayout = &gGrassVertexLayoutForDrawing;
-	        addPipeline(pRenderer, &pipelineDesc, &pGrassPipeline);
 	        
-			if (!pGrassPipeline) 
-			{
-	    		LOGF(LogLevel::eERROR, "Failed to add grass pipeline.");
-	    		return false;
-	    	}
+	        for (uint32_t i = 0; i < GRASS_VARIANT_COUNT; i += 1) {
+		        pipelineSettings.pShaderProgram = pGrassShaders[i];
+		        pipelineSettings.pVertexLayout = &gGrassVertexLayoutForDrawing;
+		        addPipeline(pRenderer, &pipelineDesc, &pGrassPipelines[i]);
+		        
+				if (!pGrassPipelines[i]) 
+				{
+		    		LOGF(LogLevel::eERROR, "Failed to add grass pipeline.");
+		    		return false;
+		    	}
+		    	
+		        pipelineSettings.pShaderProgram = pGrassProceduralShaders[i];
+		        pipelineSettings.pVertexLayout = &gGrassVertexLayoutProcedural;
+		        addPipeline(pRenderer, &pipelineDesc, &pGrassProceduralPipelines[i]);
+		        
+				if (!pGrassProceduralPipelines[i]) 
+				{
+		    		LOGF(LogLevel::eERROR, "Failed to add procedural grass pipeline.");
+		    		return false;
+		    	}
+	        }
 	    	
 	    	// Grass draw compute pipeline
 	    	pipelineDesc = {};
@@ -752,10 +5139,54 @@ public:
 		    pipelineDesc.mComputeDesc.pShaderProgram = pGrassDrawShader;
 		    addPipeline(pRenderer, &pipelineDesc, &pGrassDrawComputePipeline);
 		}
+		{ // Grass splatting
+	    	PipelineDesc pipelineDesc = {};
+		    pipelineDesc.mType = PIPELINE_TYPE_COMPUTE;
+		    pipelineDesc.mComputeDesc.pRootSignature = pGrassSplatRootSignature;
+		    pipelineDesc.mComputeDesc.pShaderProgram = pGrassSplatClearShader;
+		    addPipeline(pRenderer, &pipelineDesc, &pGrassSplatClearPipeline);
+		    pipelineDesc.mComputeDesc.pShaderProgram = pGrassSplatShader;
+		    addPipeline(pRenderer, &pipelineDesc, &pGrassSplatPipeline);
+		    pipelineDesc.mComputeDesc.pShaderProgram = pGrassTemporalShader;
+		    addPipeline(pRenderer, &pipelineDesc, &pGrassTemporalPipeline);
+		    
+		    // Resolve writes the splats' depth, and is tested against what's already been drawn
+		    DepthStateDesc resolveDepthStateDesc = {};
+		    resolveDepthStateDesc.mDepthTest = true;
+		    resolveDepthStateDesc.mDepthWrite = true;
+		    resolveDepthStateDesc.mDepthFunc = CMP_GEQUAL;
+		    
+	    	RasterizerStateDesc rasterizerStateDesc = {};
+	        rasterizerStateDesc.mCullMode = CULL_MODE_NONE;
+	        
+		    pipelineDesc = {};
+	        pipelineDesc.mType = PIPELINE_TYPE_GRAPHICS;
+	        GraphicsPipelineDesc& pipelineSettings = pipelineDesc.mGraphicsDesc;
+	        pipelineSettings.mPrimitiveTopo = PRIMITIVE_TOPO_TRI_LIST;
+	        pipelineSettings.mRenderTargetCount = 1;
+	        pipelineSettings.pColorFormats = &pSwapChain->ppRenderTargets[0]->mFormat;
+	        pipelineSettings.mSampleCount = pSwapChain->ppRenderTargets[0]->mSampleCount;
+	        pipelineSettings.mSampleQuality = pSwapChain->ppRenderTargets[0]->mSampleQuality;
+	        pipelineSettings.pRootSignature = pGrassSplatResolveRootSignature;
+	        pipelineSettings.pShaderProgram = pGrassSplatResolveShader;
+	        pipelineSettings.pRasterizerState = &rasterizerStateDesc;
+	        pipelineSettings.pDepthState = &resolveDepthStateDesc;
+	        pipelineSettings.mDepthStencilFormat = pDepthBuffer->mFormat;
+	        addPipeline(pRenderer, &pipelineDesc, &pGrassSplatResolvePipeline);
+	        
+			if (!pGrassSplatClearPipeline || !pGrassSplatPipeline || !pGrassSplatResolvePipeline || !pGrassTemporalPipeline) 
+			{
+	    		LOGF(LogLevel::eERROR, "Failed to add grass splat pipelines.");
+	    		return false;
+	    	}
+		}
 		{ // Skybox
 	        
-	        depthStateDesc.mDepthTest = false;
-            depthStateDesc.mDepthWrite = false; // Everything should draw over the skybox
+	        // Drawn last at depth 0 (far plane with reverse-Z), so GEQUAL only passes where
+	        // nothing else was drawn and we only shade the sky that's actually visible.
+	        depthStateDesc.mDepthTest = true;
+            depthStateDesc.mDepthWrite = false;
+            depthStateDesc.mDepthFunc = CMP_GEQUAL;
 	        
 	    	RasterizerStateDesc basicRasterizerStateDesc = {};
 	        basicRasterizerStateDesc.mCullMode = CULL_MODE_BACK;
@@ -779,320 +5210,51 @@ public:
 			{
 	    		LOGF(LogLevel::eERROR, "Failed to add skybox pipeline.");
 	    		return false;
-	    	}
-		}
-		
-		
-		///
-	    // Init samplers & load textures
-	    
-		SamplerDesc samplerDesc = { FILTER_LINEAR,
-                                    FILTER_LINEAR,
-                                    MIPMAP_MODE_NEAREST,
-                                    ADDRESS_MODE_CLAMP_TO_EDGE,
-                                    ADDRESS_MODE_CLAMP_TO_EDGE,
-                                    ADDRESS_MODE_CLAMP_TO_EDGE };
-        addSampler(pRenderer, &samplerDesc, &pSampler); 
-		
-		// Height map texture
-		TextureLoadDesc heightMapDesc = {};
-        heightMapDesc.pFileName = "height_map.tex";
-        heightMapDesc.ppTexture = &pHeightMap;
-        heightMapDesc.mCreationFlag = TEXTURE_CREATION_FLAG_SRGB;
-        addResource(&heightMapDesc, NULL);
-        
-        // Skybox textures
-        const char* skyboxNames[] = { "skybox_back.tex",  "skybox_left.tex",   "skybox_front.tex",
-                                      "skybox_right.tex", "skybox_bottom.tex", "skybox_top.tex" };
-        for (uint32_t i = 0; i < 6; i += 1) {
-        	TextureLoadDesc skyboxDesc = {};
-	        skyboxDesc.pFileName = skyboxNames[i];
-	        skyboxDesc.ppTexture = &pSkyboxTextures[i];
-	        skyboxDesc.mCreationFlag = TEXTURE_CREATION_FLAG_SRGB;
-	        addResource(&skyboxDesc, NULL);
-        }
-        
-        // Grass meshes
-        for (uint32_t i = 0; i < TF_ARRAY_COUNT(pGrassGeoms); i += 1) {
-	    
-	    	char *filename = (char*)tempAlloc(128);
-	    	sprintf(filename, "grass_lod_%i.bin", i);
-	    
-		    GeometryLoadDesc loadDesc = {};
-	        loadDesc.pFileName = filename;
-	        loadDesc.pVertexLayout = &gGrassVertexLayoutForLoading;
-	        loadDesc.ppGeometry = &pGrassGeoms[i];
-	        loadDesc.ppGeometryData = &pGrassGeomDatas[i];
-	        loadDesc.mFlags = GEOMETRY_LOAD_FLAG_SHADOWED;
-	        addResource(&loadDesc, NULL);
-	    }
-        
-        waitForAllResourceLoads();
-        
-        tf_free(grassInstanceData);
-        
-        ///
-        // Check resource loading result
-        if (!pHeightMap) 
-        {
-        	LOGF(LogLevel::eERROR, "Failed to load height map.");
-        	return false;
-        }
-        for (uint32_t i = 0; i < TF_ARRAY_COUNT(pGrassGeoms); i += 1) {
-			if (!pGrassGeoms[i] || !pGrassGeomDatas[i]) {
-				LOGF(LogLevel::eERROR, "Failed to load grass.");
-	        	return false;
-			}
-	    }
-	    for (uint32_t i = 0; i < 6; i += 1) {
-	    	if (!pSkyboxTextures[i]) {
-	    		LOGF(LogLevel::eERROR, "Failed to load skybox texture.");
-	        	return false;
-	    	}
-        }
-
-        // Combine grash meshes into one vbo
-        
-        uint32_t totalVertexCount = 0;
-        uint32_t totalIndexCount = 0;
-        for (uint32_t i = 0; i < NUMBER_OF_GRASS_LOD; i += 1)
-        {
-        	totalVertexCount += pGrassGeoms[i]->mVertexCount;
-        	totalIndexCount += pGrassGeoms[i]->mIndexCount;
-        	
-        	gGrassDrawUniformData.mLod.mLevels[i].mIndexCount = pGrassGeoms[i]->mIndexCount;
-        }
-        
-        GrassVertex *vertices = (GrassVertex*)tempAlloc(sizeof(GrassVertex)*totalVertexCount);
-        uint32_t *indices = (uint32_t*)tempAlloc(sizeof(uint32_t)*totalIndexCount);
-
-		uint32_t nextBaseVertex = 0;        
-		uint32_t nextBaseIndex = 0;        
-        for (uint32_t i = 0; i < NUMBER_OF_GRASS_LOD; i += 1)
-        {
-        	
-        	for (uint32_t j = 0; j < pGrassGeoms[i]->mVertexCount; j += 1)
-            {
-        		vertices[nextBaseVertex+j].mPosition
-        			= ((float3*)pGrassGeomDatas[i]->pShadow->pAttributes[SEMANTIC_POSITION])[j];
-        		vertices[nextBaseVertex+j].mNormal
-        			= ((uint32_t*)pGrassGeomDatas[i]->pShadow->pAttributes[SEMANTIC_NORMAL])[j];
-        	}
-            for (uint32_t j = 0; j < pGrassGeoms[i]->mIndexCount; j += 1)
-            {
-        		indices[nextBaseIndex+j] = ((uint16_t*)pGrassGeomDatas[i]->pShadow->pIndices)[j] + nextBaseVertex;
-        	}
-        	
-        	nextBaseVertex += pGrassGeoms[i]->mVertexCount;
-        	nextBaseIndex += pGrassGeoms[i]->mIndexCount;
-        }
-        
-        BufferLoadDesc vboDesc = {};
-	    vboDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_VERTEX_BUFFER;
-	    vboDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_ONLY;
-	    vboDesc.mDesc.mFlags = BUFFER_CREATION_FLAG_NONE;
-	    vboDesc.mDesc.mSize = totalVertexCount*sizeof(GrassVertex);
-	    vboDesc.pData = vertices;
-	    vboDesc.ppBuffer = &pGrassVbo;
-	    addResource(&vboDesc, nullptr);
-        BufferLoadDesc iboDesc = {};
-	    vboDesc.mDesc.mDescriptors = DESCRIPTOR_TYPE_INDEX_BUFFER;
-	    vboDesc.mDesc.mMemoryUsage = RESOURCE_MEMORY_USAGE_GPU_ONLY;
-	    vboDesc.mDesc.mFlags = BUFFER_CREATION_FLAG_NONE;
-	    vboDesc.mDesc.mSize = totalIndexCount*sizeof(uint32_t);
-	    vboDesc.pData = indices;
-	    vboDesc.ppBuffer = &pGrassIbo;
-	    addResource(&vboDesc, nullptr);
-	    
-	    waitForAllResourceLoads();
-	    
-	    
-        { // terrain ubo descriptor set
-	    	DescriptorSetDesc setDesc = { pRootSignature, DESCRIPTOR_UPDATE_FREQ_PER_FRAME, gNumberOfFrames };
-	        addDescriptorSet(pRenderer, &setDesc, &pDescriptorSetTerrainUbo);
-		    for (uint32_t i = 0; i < gNumberOfFrames; i += 1) {
-		    	DescriptorData params[1] = {};
-		    	params[0].mCount = 1;
-	            params[0].pName = "scene";
-	            params[0].ppBuffers = &pSceneUbos[i];
-	            updateDescriptorSet(pRenderer, i, pDescriptorSetTerrainUbo, 1, params);
-		    }
-	    }
-	    
-        { // grass ubo descriptor set
-	    	DescriptorSetDesc setDesc = { pRootSignature, DESCRIPTOR_UPDATE_FREQ_PER_FRAME, gNumberOfFrames };
-    		addDescriptorSet(pRenderer, &setDesc, &pDescriptorSetGrass);
-    		DescriptorData params[2] = {};
-            for (uint32_t i = 0; i < gNumberOfFrames; i += 1)
-            {
-	    	    params[0].mCount = 1;
-                params[0].pName = "tileData";
-                params[0].ppBuffers = &pGrassTileBuffer;
-            
-                params[1].mCount = 1;
-                params[1].pName = "scene";
-                params[1].ppBuffers = &pSceneUbos[i];
-            
-                updateDescriptorSet(pRenderer, i, pDescriptorSetGrass, 2, params);
-            }
-	    }
-        { // grass draw call compute set
-	    	DescriptorSetDesc setDesc = { pGrassDrawRootSignature, DESCRIPTOR_UPDATE_FREQ_PER_FRAME, gNumberOfFrames };
-    		addDescriptorSet(pRenderer, &setDesc, &pDescriptorSetGrassDrawCompute);
-    		
-    		for (uint32_t i = 0; i < gNumberOfFrames; i += 1) {
-	    		DescriptorData params[3] = {};
-	    	    params[0].mCount = 1;
-	            params[0].pName = "scene";
-	            params[0].ppBuffers = &pSceneUbos[i];
-	            
-	    	    params[1].mCount = 1;
-	            params[1].pName = "drawBuffer";
-	            params[1].ppBuffers = &pGrassDrawBuffer;
-	        
-	    	    params[2].mCount = 1;
-	            params[2].pName = "drawInfo";
-	            params[2].ppBuffers = &pGrassDrawUbos[i];
-	        
-	            updateDescriptorSet(pRenderer, i, pDescriptorSetGrassDrawCompute, 3, params);
-    		}
-    		
-	    }
-	    
-        { // skybox ubo descriptor set
-	    	DescriptorSetDesc setDesc = { pRootSignature, DESCRIPTOR_UPDATE_FREQ_PER_FRAME, gNumberOfFrames };
-	        addDescriptorSet(pRenderer, &setDesc, &pDescriptorSetSkyboxUbos);
-		    for (uint32_t i = 0; i < gNumberOfFrames; i += 1) {
-		    	DescriptorData params[2] = {};
-		    	params[0].mCount = 1;
-	            params[0].pName = "skyboxData";
-	            params[0].ppBuffers = &pSkyboxUbos[i];
-	            params[1].mCount = 1;
-	            params[1].pName = "scene";
-	            params[1].ppBuffers = &pSceneUbos[i];
-	            updateDescriptorSet(pRenderer, i, pDescriptorSetSkyboxUbos, 2, params);
-		    }
-		    
-		    setDesc = { pRootSignature, DESCRIPTOR_UPDATE_FREQ_NONE, 1 };
-	        addDescriptorSet(pRenderer, &setDesc, &pDescriptorSetSkyboxTextures);
-		    
-			const char* skyboxDescNames[] = { "SkyboxBack",  "SkyboxLeft",   "SkyboxFront",
-                                              "SkyboxRight", "SkyboxBottom", "SkyboxTop" };
-	    	DescriptorData params[7] = {};
-	    	params[0].pName = "Sampler";
-	        params[0].ppSamplers = &pSampler;
-	        params[0].mCount = 1;
-		    for (uint32_t i = 0; i < 6; i += 1) {
-			    params[i+1].pName = skyboxDescNames[i];
-		        params[i+1].ppTextures = &pSkyboxTextures[i];
-		        params[i+1].mCount = 1;
-	        }
-            updateDescriptorSet(pRenderer, 0, pDescriptorSetSkyboxTextures, 7, params);
-	    }
-        
-	    { // textures descriptor set (never updated)
-	    	DescriptorSetDesc setDesc = { pRootSignature, DESCRIPTOR_UPDATE_FREQ_NONE, 1 };
-	        addDescriptorSet(pRenderer, &setDesc, &pDescriptorSetHeightMap);
-		    DescriptorData params[2] = {};
-		    params[0].pName = "HeightMap";
-	        params[0].ppTextures = &pHeightMap;
-	        params[0].mCount = 1;
-		    params[1].pName = "Sampler";
-	        params[1].ppSamplers = &pSampler;
-	        params[1].mCount = 1;
-	        
-	        updateDescriptorSet(pRenderer, 0, pDescriptorSetHeightMap, 2, params);
-	    }
-	    
-    	DescriptorSetDesc setDesc = { pGrassDrawRootSignature, DESCRIPTOR_UPDATE_FREQ_NONE, 1 };
-        addDescriptorSet(pRenderer, &setDesc, &pDescriptorSetHeightMapDrawCompute);
-	    DescriptorData  params[1] = {};
-	    params[0].pName = "HeightMap";
-        params[0].ppTextures = &pHeightMap;
-        params[0].mCount = 1;
-        
-        updateDescriptorSet(pRenderer, 0, pDescriptorSetHeightMapDrawCompute, 1, params);
-		
-		///
-		// Load UI
-		UserInterfaceLoadDesc uiLoad = {};
-        uiLoad.mColorFormat = pSwapChain->ppRenderTargets[0]->mFormat;
-        uiLoad.mHeight = mSettings.mHeight;
-        uiLoad.mWidth = mSettings.mWidth;
-        uiLoad.mLoadType = pReloadDesc->mType;
-        loadUserInterface(&uiLoad);
-
-		///
-		// Load font system
-        FontSystemLoadDesc fontLoad = {};
-        fontLoad.mColorFormat = pSwapChain->ppRenderTargets[0]->mFormat;
-        fontLoad.mHeight = mSettings.mHeight;
-        fontLoad.mWidth = mSettings.mWidth;
-        fontLoad.mLoadType = pReloadDesc->mType;
-        loadFontSystem(&fontLoad);
+	    	}
+		}
 		
-        return true;
+		return true;
     }
-
-    void Unload(ReloadDesc *pReloadDesc)
+    
+    void removePipelines()
     {
-        waitQueueIdle(pGraphicsQueue);
-        
-        unloadFontSystem(pReloadDesc->mType);
-        unloadUserInterface(pReloadDesc->mType);
-        
-        removeResource(pHeightMap);
-        for (uint32_t i = 0; i < 6; i += 1) removeResource(pSkyboxTextures[i]);
-        
-        for (uint32_t i = 0; i < TF_ARRAY_COUNT(pGrassGeoms); i += 1) {
-        	removeResource(pGrassGeoms[i]);
-        	removeResource(pGrassGeomDatas[i]);
-	    }
-        
-        removeSampler(pRenderer, pSampler);
-        
-        removeRootSignature(pRenderer, pRootSignature);
-        removeRootSignature(pRenderer, pGrassDrawRootSignature);
-        
         removePipeline(pRenderer, pTerrainPipeline);
-        removePipeline(pRenderer, pGrassPipeline);
+        for (uint32_t i = 0; i < GRASS_VARIANT_COUNT; i += 1) {
+        	removePipeline(pRenderer, pGrassPipelines[i]);
+        	removePipeline(pRenderer, pGrassProceduralPipelines[i]);
+        }
         removePipeline(pRenderer, pSkyboxPipeline);
         removePipeline(pRenderer, pGrassDrawComputePipeline);
-        
-        removeDescriptorSet(pRenderer, pDescriptorSetGrass);
-        removeDescriptorSet(pRenderer, pDescriptorSetGrassDrawCompute);
-        removeDescriptorSet(pRenderer, pDescriptorSetSkyboxUbos);
-        removeDescriptorSet(pRenderer, pDescriptorSetSkyboxTextures);
-        removeDescriptorSet(pRenderer, pDescriptorSetTerrainUbo);
-        removeDescriptorSet(pRenderer, pDescriptorSetHeightMap);
-        removeDescriptorSet(pRenderer, pDescriptorSetHeightMapDrawCompute);
-        
-        for (uint32_t i = 0; i < gNumberOfFrames; i += 1) removeResource(pSceneUbos[i]);
-        removeResource(pGrassTileBuffer);
-        removeResource(pGrassInstanceVbo);
-        removeResource(pGrassVbo);
-        removeResource(pGrassIbo);
-        for (uint32_t i = 0; i < gNumberOfFrames; i += 1) removeResource(pGrassDrawUbos[i]);
-        removeResource(pGrassDrawBuffer);
-        for (uint32_t i = 0; i < gNumberOfFrames; i += 1) removeResource(pSkyboxUbos[i]);
-        
-    	removeShader(pRenderer, pTerrainShader);
-    	removeShader(pRenderer, pGrassShader);
-    	removeShader(pRenderer, pSkyboxShader);
-    	removeShader(pRenderer, pGrassDrawShader);
-    	
-        removeSwapChain(pRenderer, pSwapChain);
-        
-        removeRenderTarget(pRenderer, pDepthBuffer);
-        
-        uiRemoveComponent(pGuiWindow);
-        unloadProfilerUI();
+        removePipeline(pRenderer, pGrassSplatClearPipeline);
+        removePipeline(pRenderer, pGrassSplatPipeline);
+        removePipeline(pRenderer, pGrassSplatResolvePipeline);
+        removePipeline(pRenderer, pGrassTemporalPipeline);
     }
 
     void Update(float deltaTime)
     { 
+    	// The render thread's UI may be reading or writing anything in here, see "Render thread"
+    	renderThreadLockState();
     
     	resetTemporaryStorage();
+    	
+    	// Draw() leaves the render thread idle when a trace is requested
+    	if (gRenderThread.mIdle) traceBeginFrame();
+    	TRACE_SCOPE("Update", gUpdateToken);
+    	
+    	updateStartupLoading();
+    	
+    	///
+    	// Frame pacing
+    	
+    	// Draw() also leaves the render thread idle in low latency mode, otherwise the render
+    	// thread polls the fences itself
+    	if (gLowLatencyMode && gRenderThread.mIdle && pLastSubmittedFence) {
+    		// Nothing queued up on the GPU when we sample input, so it gets on screen as soon as possible
+    		waitForFences(pRenderer, 1, &pLastSubmittedFence);
+    	}
+    	if (gRenderThread.mIdle) pollFrameLatency();
+    	gInputSampleTimeUs = getUSec(true);
     
     	///
 	    // Update camera
@@ -1109,171 +5271,763 @@ public:
     	}
     
     	pCameraController->update(deltaTime);
+    	tileTuneUpdate();
     	
     	mat4 viewMat = pCameraController->getViewMatrix();
-
-        const float aspectInverse = (float)mSettings.mHeight / (float)mSettings.mWidth;
-        const float horizontal_fov = PI / 2.0f;
-        CameraMatrix projMat = CameraMatrix::perspectiveReverseZ(horizontal_fov, aspectInverse, 0.1f, 10000.0f);
-        CameraMatrix pv = projMat * viewMat;
-        
-        gSceneUniformData.mCameraToClip = pv;
-        
+    	Vector3 cameraPos = pCameraController->getViewPosition();
+    	
         static float currentTime = 0.0;
         currentTime += deltaTime;
         
-	    gSceneUniformData.mViewDir = (pCameraController->getViewMatrix() * Vector4(0, 0, 1, 0.0)).getXYZ();
-	    gSceneUniformData.mCameraPos = pCameraController->getViewPosition();
 	    gSceneUniformData.mTime = currentTime;
-	    gSceneUniformData.mMaxInstancesPerTile = MAX_GRASS_CAP/GRASS_TILE_COUNT;
+	    updateGrassLodDraws();
+	    updateFarGrass();
+	    updateGrassSpecies();
+	    // The camera looks down +z
+	    const Vector3 viewDir = normalize(inverse(viewMat).getCol2().getXYZ());
+	    // Before the queries, so they see this frame's edits. Not while dragging a slider.
+	    if (!uiIsFocused()) updateTerrainSculpt(cameraPos, viewDir, deltaTime);
+	    updateGrassQueries(cameraPos, viewDir);
 	    
-	    gSkyboxUniformData.mView = pCameraController->getViewMatrix();
-	    gSkyboxUniformData.mProjection = projMat;
+	    ///
+	    // Update views
+	    // #Volatile mirrored in Benchmarks/cpu_benchmarks.cpp
 	    
-	    gGrassDrawUniformData.mViewPosition =
-            float3(pCameraController->getViewPosition().getX(), pCameraController->getViewPosition().getY(),
-                                                     pCameraController->getViewPosition().getZ());
-        
-        CameraMatrix::extractFrustumClipPlanes(
-            pv, 
-        	gGrassDrawUniformData.rcp,
-        	gGrassDrawUniformData.lcp,
-        	gGrassDrawUniformData.tcp,
-        	gGrassDrawUniformData.bcp,
-        	gGrassDrawUniformData.fcp,
-        	gGrassDrawUniformData.ncp,
-        	true
-    	);
-    	
-    	// Forward horizontal plane
-        gGrassDrawUniformData.fhp = Vector4(normalize(cross(gGrassDrawUniformData.rcp.getXYZ(), Vector3(0, 1, 0))), 1);
-		
-		// Forward vertical plane
-        gGrassDrawUniformData.fvp = Vector4(normalize(cross(Vector3(0, 1, 0), gGrassDrawUniformData.rcp.getXYZ())), 1);
+	    TRACE_SCOPE("Grass update", pGrassUpdateToken);
+	    
+	    gGrassDrawUniformData.mViewCount = gViewCount;
+	    
+	    for (uint32_t v = 0; v < gViewCount; v += 1) {
+	    	RenderView *pView = &gViews[v];
+	    	
+	    	switch (pView->mKind) {
+	    		case VIEW_KIND_MAIN:
+	    			pView->mView = viewMat;
+	    			pView->mCameraPos = cameraPos;
+	    			break;
+	    		case VIEW_KIND_REAR_MIRROR:
+	    			// Same eye, turned around
+	    			pView->mView = Matrix4::rotationY(PI) * viewMat;
+	    			pView->mCameraPos = cameraPos;
+	    			break;
+	    		case VIEW_KIND_MINIMAP:
+	    			// Straight down from high above the camera, north up
+	    			pView->mCameraPos = cameraPos + Vector3(0, 900.0f, 0);
+	    			pView->mView = Matrix4::rotationX(-PI/2.0f) * Matrix4::translation(-pView->mCameraPos);
+	    			break;
+	    	}
+	    	
+	        const float aspectInverse = ((float)mSettings.mHeight*pView->mViewportHeight) / ((float)mSettings.mWidth*pView->mViewportWidth);
+	        const float horizontal_fov = PI / 2.0f;
+	        pView->mProjection = CameraMatrix::perspectiveReverseZ(horizontal_fov, aspectInverse, 0.1f, 10000.0f);
+	        pView->mCameraToClip = pView->mProjection * pView->mView;
+	        pView->mViewDir = (pView->mView * Vector4(0, 0, 1, 0.0)).getXYZ();
+	        
+	        GrassViewData *pGrassView = &gGrassDrawUniformData.mViews[v];
+	        
+	        pGrassView->mViewPosition = float3(pView->mCameraPos.getX(), pView->mCameraPos.getY(), pView->mCameraPos.getZ());
+	        pGrassView->mLodDistanceScale = pView->mLodDistanceScale;
+	        
+	        if (v == 0) {
+	        	// Both fov & the splat threshold are about the main view's width
+	        	gGrassDrawUniformData.mSplatMaxPixels = gSplatMaxPixels;
+	        	gGrassDrawUniformData.mSplatPixelScale = (float)mSettings.mWidth*pView->mViewportWidth*0.5f/tanf(horizontal_fov*0.5f);
+	        }
+	        
+	        CameraMatrix::extractFrustumClipPlanes(
+	            pView->mCameraToClip, 
+	        	pGrassView->rcp,
+	        	pGrassView->lcp,
+	        	pGrassView->tcp,
+	        	pGrassView->bcp,
+	        	pGrassView->fcp,
+	        	pGrassView->ncp,
+	        	true
+	    	);
+	    	
+	    	// Forward horizontal plane
+	        pGrassView->fhp = Vector4(normalize(cross(pGrassView->rcp.getXYZ(), Vector3(0, 1, 0))), 1);
+			
+			// Forward vertical plane
+	        pGrassView->fvp = Vector4(normalize(cross(Vector3(0, 1, 0), pGrassView->rcp.getXYZ())), 1);
+	    }
+	    
+	    updateTemporalGrass();
+	    updateCoherentCulling();
+	    
+	    renderThreadUnlockState();
+    }
+    
+    // See "Temporal grass". Call once the main view is up to date, before updateCoherentCulling().
+    void updateTemporalGrass()
+    {
+    	TemporalGrass *pTemporal = &gTemporalGrass;
+    	const RenderView *pView = &gViews[0];
+    	const uint32_t frames = pTemporal->mFrames;
+    	
+    	pTemporal->mDrawFrames = 0;
+    	pTemporal->mRefreshedSectors = 0;
+    	gSceneUniformData.mTemporalHistory[0] = 0;
+    	gGrassDrawUniformData.mTemporalFrames = 1;
+    	gGrassDrawUniformData.mTemporalSectors = 0;
+    	if (frames < 2 || !gStartup.mGrassReady) return;
+    	
+    	// The other frames of the cycle, newest first, up to the first one that's missing or was
+    	// drawn from too far away
+    	const Matrix4 cameraToClip = pView->mCameraToClip.getPrimaryMatrix();
+    	const float minTurnCos = cosf(pTemporal->mMaxTurn);
+    	uint32_t usableSlots = 0;
+    	for (uint32_t i = 0; i+1 < frames; i += 1) {
+    		const uint32_t slot = (pTemporal->mFrame+frames-1-i) % frames;
+    		if (!pTemporal->mSlotValid[slot]
+    			|| length(pView->mCameraPos-pTemporal->mSlotCameraPos[slot]) > pTemporal->mMaxMotion
+    			|| dot(normalize(pView->mViewDir), normalize(pTemporal->mSlotViewDir[slot])) < minTurnCos)
+    		{
+    			break;
+    		}
+    		gSceneUniformData.mTemporalHistory[1+i] = slot;
+    		gSceneUniformData.mTemporalReprojection[i] = cameraToClip*inverse(pTemporal->mSlotCameraToClip[slot]);
+    		usableSlots += 1;
+    	}
+    	
+    	const uint32_t writeSlot = pTemporal->mFrame % frames;
+    	if (pTemporal->mBySector) {
+    		// Sectors last drawn in a slot that isn't usable (or before it) are redrawn with this
+    		// frame's turn. Slots are one per frame, so that's anything older than the usable ones.
+    		const uint32_t oldestUsable = pTemporal->mFrame-usableSlots;
+    		uint32_t refresh = 1u << writeSlot;
+    		for (uint32_t s = 0; s < frames; s += 1) {
+    			if (pTemporal->mSectorDrawn[s] && pTemporal->mSectorFrame[s] >= oldestUsable) continue;
+    			if (pTemporal->mSectorDrawn[s] && (refresh & (1u << s)) == 0) pTemporal->mForcedRefreshes += 1;
+    			refresh |= 1u << s;
+    		}
+    		for (uint32_t s = 0; s < frames; s += 1) {
+    			if ((refresh & (1u << s)) == 0) continue;
+    			pTemporal->mSectorDrawn[s] = true;
+    			pTemporal->mSectorFrame[s] = pTemporal->mFrame;
+    			pTemporal->mRefreshedSectors += 1;
+    		}
+    		
+    		pTemporal->mDrawFrames = 1;
+    		gSceneUniformData.mTemporalHistory[0] = usableSlots;
+    		gGrassDrawUniformData.mTemporalSectors = frames;
+    		gGrassDrawUniformData.mTemporalRefresh = refresh;
+    		gGrassDrawUniformData.mTemporalFrame = pTemporal->mFrame;
+    		for (uint32_t s = 0; s < frames; s += 1) gGrassDrawUniformData.mTemporalSectorFrames[s] = pTemporal->mSectorFrame[s];
+    	} else {
+    		// Thinned blades need every other frame of the cycle, or this frame draws every blade
+    		// rather than leave holes
+    		const bool historyValid = usableSlots+1 == frames;
+    		if (!historyValid && pTemporal->mSlotValid[(pTemporal->mFrame+frames-1) % frames]) pTemporal->mDroppedFrames += 1;
+    		pTemporal->mDrawFrames = historyValid ? frames : 1;
+    		gSceneUniformData.mTemporalHistory[0] = historyValid ? frames-1 : 0;
+    	}
+    	gSceneUniformData.mTemporalGrass[1] = pTemporal->mFrame;
+    	gSceneUniformData.mTemporalGrass[2] = writeSlot*mSettings.mWidth*mSettings.mHeight;
+    	gSceneUniformData.mTemporalGrass[3] = mSettings.mWidth;
+    	gGrassDrawUniformData.mTemporalFrames = pTemporal->mDrawFrames;
+    	
+    	pTemporal->mSlotValid[writeSlot] = true;
+    	pTemporal->mSlotCameraToClip[writeSlot] = cameraToClip;
+    	pTemporal->mSlotCameraPos[writeSlot] = pView->mCameraPos;
+    	pTemporal->mSlotViewDir[writeSlot] = pView->mViewDir;
+    	pTemporal->mFrame += 1;
+    }
+    
+    // See "Coherent culling". Call once the views' GrassViewData is up to date.
+    void updateCoherentCulling()
+    {
+    	CoherentCulling *pCulling = &gCoherentCulling;
+    	
+    	pCulling->mViewsMoved = false;
+    	bool rebaseMotion = false;
+    	for (uint32_t v = 0; v < gViewCount; v += 1) {
+    		GrassViewData *pGrassView = &gGrassDrawUniformData.mViews[v];
+    		const Vector4 planes[8] = {
+    			pGrassView->rcp, pGrassView->lcp, pGrassView->tcp, pGrassView->bcp,
+    			pGrassView->fcp, pGrassView->ncp, pGrassView->fhp, pGrassView->fvp,
+    		};
+    		
+    		// A corner's distance to a plane through the view changes by at most how far the view moved,
+    		// plus its distance times how far the plane's normal moved
+    		const float3 lastPosition = pCulling->mLastPositions[v];
+    		float translation = length(Vector3(pGrassView->mViewPosition.x-lastPosition.x,
+    			pGrassView->mViewPosition.y-lastPosition.y, pGrassView->mViewPosition.z-lastPosition.z));
+    		float rotation = 0.0f;
+    		for (uint32_t i = 0; i < 8; i += 1) {
+    			rotation = fmaxf(rotation, length(planes[i].getXYZ()-pCulling->mLastPlanes[v][i].getXYZ()));
+    			pCulling->mLastPlanes[v][i] = planes[i];
+    		}
+    		pCulling->mLastPositions[v] = pGrassView->mViewPosition;
+    		
+    		if (translation > 0.0f || rotation > 0.0f) pCulling->mViewsMoved = true;
+    		pGrassView->mMotion = Vector4(pGrassView->mMotion.getX()+translation, pGrassView->mMotion.getY()+rotation, 0, 0);
+    		if (pGrassView->mMotion.getX() > COHERENT_MOTION_RESET || pGrassView->mMotion.getY() > COHERENT_MOTION_RESET) {
+    			rebaseMotion = true;
+    		}
+    	}
+    	if (rebaseMotion) {
+    		for (uint32_t v = 0; v < MAX_GRASS_VIEWS; v += 1) {
+    			gGrassDrawUniformData.mViews[v].mMotion = Vector4(0);
+    		}
+    	}
+    	
+    	// Everything else culling depends on
+    	GrassDrawUniformData parameters = gGrassDrawUniformData;
+    	parameters.mCullEpoch = pCulling->mEnabled;
+    	// Temporal grass only skips what the cached results draw, & the dispatch runs every frame
+    	// while it does, see Draw(). Thinning stays, so toggling it doesn't replay stale counts.
+    	parameters.mTemporalRefresh = 0;
+    	parameters.mTemporalFrame = 0;
+    	memset(parameters.mTemporalSectorFrames, 0, sizeof(parameters.mTemporalSectorFrames));
+    	for (uint32_t v = 0; v < MAX_GRASS_VIEWS; v += 1) {
+    		float lodDistanceScale = parameters.mViews[v].mLodDistanceScale;
+    		parameters.mViews[v] = {};
+    		parameters.mViews[v].mLodDistanceScale = v < gViewCount ? lodDistanceScale : 0.0f;
+    	}
+    	const float sceneParameters[6] = {
+    		gSceneUniformData.mMaxFloorY, gSceneUniformData.mMaxGrassHeight,
+    		gSceneUniformData.mMaxNaturalAngle, gSceneUniformData.mMaxWindLeanAngle,
+    		gSceneUniformData.mFarGrass.getX(), gSceneUniformData.mFarGrass.getY(),
+    	};
+    	
+    	if (rebaseMotion || memcmp(&parameters, &pCulling->mLastParameters, sizeof(parameters)) != 0
+    		|| memcmp(sceneParameters, pCulling->mLastSceneParameters, sizeof(sceneParameters)) != 0)
+    	{
+    		pCulling->mEpoch += 1;
+    		if (pCulling->mEpoch == 0) pCulling->mEpoch = 1;
+    		pCulling->mLastParameters = parameters;
+    		memcpy(pCulling->mLastSceneParameters, sceneParameters, sizeof(sceneParameters));
+    	}
+    	
+    	// The tile size tuner times full culls, see "Tile grid"
+    	gGrassDrawUniformData.mCullEpoch = pCulling->mEnabled && !gTileTuner.mActive ? pCulling->mEpoch : 0;
     }
 
+    ///
+    // Declares what each pass in Draw() reads & writes, see "Frame graph". Also called in
+    // addRenderTargets() with everything on, to find the transients' worst-case lifetimes.
+    void declareFrameGraph(bool editTerrain, bool drawGrass, bool cullGrass, bool proceduralBlades, bool splatGrass, bool temporalGrass, bool captureFrame, bool splitSubmission, uint32_t viewCount)
+    {
+    	fgReset();
+    	
+    	const FrameGraphResourceId drawArgs = proceduralBlades ? FG_RESOURCE_GRASS_PROCEDURAL_DRAW_ARGS : FG_RESOURCE_GRASS_DRAW_ARGS;
+    	
+    	// Uploads the sculpted heights & has the tiles under them culled again
+    	if (editTerrain) {
+    		fgDeclarePass(FG_PASS_EDIT_TERRAIN, false);
+    		fgWrite(FG_PASS_EDIT_TERRAIN, FG_RESOURCE_HEIGHT_EDITS, RESOURCE_STATE_COPY_DEST);
+    		if (drawGrass) fgWrite(FG_PASS_EDIT_TERRAIN, FG_RESOURCE_GRASS_CULL_STATE, RESOURCE_STATE_COPY_DEST);
+    	}
+    	
+    	// Without culling, the splat args & tiles are also last frame's
+    	if (drawGrass && cullGrass) {
+    		fgDeclarePass(FG_PASS_RESET_GRASS_COUNTERS, false);
+    		fgWrite(FG_PASS_RESET_GRASS_COUNTERS, FG_RESOURCE_GRASS_DRAW_COUNTS, RESOURCE_STATE_COPY_DEST);
+    		if (splatGrass) fgWrite(FG_PASS_RESET_GRASS_COUNTERS, FG_RESOURCE_SPLAT_ARGS, RESOURCE_STATE_COPY_DEST);
+    		
+    		fgDeclarePass(FG_PASS_CULL_GRASS, false);
+    		fgWrite(FG_PASS_CULL_GRASS, FG_RESOURCE_GRASS_DRAW_COUNTS, RESOURCE_STATE_UNORDERED_ACCESS);
+    		fgWrite(FG_PASS_CULL_GRASS, drawArgs, RESOURCE_STATE_UNORDERED_ACCESS);
+    		fgWrite(FG_PASS_CULL_GRASS, FG_RESOURCE_GRASS_CULL_STATE, RESOURCE_STATE_UNORDERED_ACCESS);
+    		fgRead(FG_PASS_CULL_GRASS, FG_RESOURCE_HEIGHT_EDITS, RESOURCE_STATE_SHADER_RESOURCE);
+    		if (splatGrass) {
+    			fgWrite(FG_PASS_CULL_GRASS, FG_RESOURCE_SPLAT_ARGS, RESOURCE_STATE_UNORDERED_ACCESS);
+    			fgWrite(FG_PASS_CULL_GRASS, FG_RESOURCE_SPLAT_TILES, RESOURCE_STATE_UNORDERED_ACCESS);
+    		}
+    	}
+    	
+    	// Temporal grass is resolved with the splats
+    	if (drawGrass && (splatGrass || temporalGrass)) {
+    		fgDeclarePass(FG_PASS_CLEAR_SPLATS, false);
+    		fgWrite(FG_PASS_CLEAR_SPLATS, FG_RESOURCE_SPLAT_BUFFER, RESOURCE_STATE_UNORDERED_ACCESS);
+    	}
+    	
+    	if (drawGrass && splatGrass) {
+    		fgDeclarePass(FG_PASS_SPLAT_GRASS, false);
+    		fgRead(FG_PASS_SPLAT_GRASS, FG_RESOURCE_SPLAT_ARGS, RESOURCE_STATE_INDIRECT_ARGUMENT);
+    		fgRead(FG_PASS_SPLAT_GRASS, FG_RESOURCE_SPLAT_TILES, RESOURCE_STATE_UNORDERED_ACCESS);
+    		fgWrite(FG_PASS_SPLAT_GRASS, FG_RESOURCE_SPLAT_BUFFER, RESOURCE_STATE_UNORDERED_ACCESS);
+    		fgRead(FG_PASS_SPLAT_GRASS, FG_RESOURCE_HEIGHT_EDITS, RESOURCE_STATE_SHADER_RESOURCE);
+    	}
+    	
+    	if (drawGrass && temporalGrass) {
+    		fgDeclarePass(FG_PASS_REPROJECT_GRASS, false);
+    		fgWrite(FG_PASS_REPROJECT_GRASS, FG_RESOURCE_TEMPORAL_HISTORY, RESOURCE_STATE_UNORDERED_ACCESS);
+    		fgWrite(FG_PASS_REPROJECT_GRASS, FG_RESOURCE_SPLAT_BUFFER, RESOURCE_STATE_UNORDERED_ACCESS);
+    	}
+    	
+    	// Clears the render targets, so it's declared even before the terrain has loaded
+    	fgDeclarePass(FG_PASS_TERRAIN, false);
+    	fgWrite(FG_PASS_TERRAIN, FG_RESOURCE_SWAPCHAIN, RESOURCE_STATE_RENDER_TARGET);
+    	fgWrite(FG_PASS_TERRAIN, FG_RESOURCE_DEPTH, RESOURCE_STATE_DEPTH_WRITE);
+    	if (viewCount > 1) fgWrite(FG_PASS_TERRAIN, FG_RESOURCE_SECONDARY_DEPTH, RESOURCE_STATE_DEPTH_WRITE);
+    	fgRead(FG_PASS_TERRAIN, FG_RESOURCE_HEIGHT_EDITS, RESOURCE_STATE_SHADER_RESOURCE);
+    	
+    	// Render targets stay bound from the terrain, unless it was submitted early
+    	fgDeclarePass(FG_PASS_SCENE, !splitSubmission);
+    	fgWrite(FG_PASS_SCENE, FG_RESOURCE_SWAPCHAIN, RESOURCE_STATE_RENDER_TARGET);
+    	fgWrite(FG_PASS_SCENE, FG_RESOURCE_DEPTH, RESOURCE_STATE_DEPTH_WRITE);
+    	if (viewCount > 1) fgWrite(FG_PASS_SCENE, FG_RESOURCE_SECONDARY_DEPTH, RESOURCE_STATE_DEPTH_WRITE);
+    	if (drawGrass) {
+    		fgRead(FG_PASS_SCENE, drawArgs, RESOURCE_STATE_INDIRECT_ARGUMENT);
+    		fgRead(FG_PASS_SCENE, FG_RESOURCE_GRASS_DRAW_COUNTS, RESOURCE_STATE_INDIRECT_ARGUMENT);
+    		fgRead(FG_PASS_SCENE, FG_RESOURCE_HEIGHT_EDITS, RESOURCE_STATE_SHADER_RESOURCE); // grass.vert
+    	}
+    	if (drawGrass && (splatGrass || temporalGrass)) fgRead(FG_PASS_SCENE, FG_RESOURCE_SPLAT_BUFFER, RESOURCE_STATE_SHADER_RESOURCE);
+    	// grass_far.frag keeps what it draws
+    	if (drawGrass && temporalGrass) fgWrite(FG_PASS_SCENE, FG_RESOURCE_TEMPORAL_HISTORY, RESOURCE_STATE_UNORDERED_ACCESS);
+    	
+    	// Before the UI, so it isn't in the capture. The UI then has to bind the swapchain again.
+    	if (captureFrame) {
+    		fgDeclarePass(FG_PASS_CAPTURE, false);
+    		fgRead(FG_PASS_CAPTURE, FG_RESOURCE_SWAPCHAIN, RESOURCE_STATE_COPY_SOURCE);
+    		fgWrite(FG_PASS_CAPTURE, FG_RESOURCE_CAPTURE_BUFFER, RESOURCE_STATE_COPY_DEST);
+    	}
+    	
+    	fgDeclarePass(FG_PASS_UI, !captureFrame);
+    	fgWrite(FG_PASS_UI, FG_RESOURCE_SWAPCHAIN, RESOURCE_STATE_RENDER_TARGET);
+    }
+    
     void Draw()
     {
-        if ((bool)pSwapChain->mEnableVsync != mSettings.mVSyncEnabled)
-        {
-            waitQueueIdle(pGraphicsQueue);
-            ::toggleVSync(pRenderer, &pSwapChain);
-        }
+    	// Read with the lock, as the render thread's UI may be changing them, see "Render thread"
+    	renderThreadLockState();
+    	const bool recreate = (bool)pSwapChain->mEnableVsync != mSettings.mVSyncEnabled
+    		|| gRequestedFramesInFlight != gCmdRingFrameCount
+    		|| (gTileGrid.mRequestedDimension != gTileGrid.mDimension && gStartup.mGrassReady)
+    		|| gTemporalGrass.mRequestedFrames != gTemporalGrass.mFrames || gTemporalGrass.mRequestedBySector != gTemporalGrass.mBySector;
+    	const bool threaded = gRenderThread.mRequested && !gTrace.mActive;
+    	// The next Update() waits on the GPU or starts a trace, neither of which can overlap the render thread
+    	const bool waitAfterPush = gLowLatencyMode || gTraceRequested;
+    	renderThreadUnlockState();
+    	
+    	// What's recreated here may be in use by the render thread
+    	if (recreate || !threaded) renderThreadWait();
+    	if (recreate) {
+	        if ((bool)pSwapChain->mEnableVsync != mSettings.mVSyncEnabled)
+	        {
+	            waitQueueIdle(pGraphicsQueue);
+	            ::toggleVSync(pRenderer, &pSwapChain);
+	        }
+	        
+	        applyFramesInFlight();
+	        applyTileGrid();
+	        applyTemporalGrass();
+    	}
         
+        float waitMs = 0.0f;
+        FrameSnapshot *pSnapshot = renderThreadNextSnapshot(&waitMs);
+        renderThreadLockState();
+        takeFrameSnapshot(pSnapshot);
+        pSnapshot->mThreaded = threaded;
+        pSnapshot->mMainWaitMs = waitMs;
+        renderThreadUnlockState();
+        
+        if (threaded) {
+        	renderThreadPush();
+        	if (waitAfterPush) renderThreadWait();
+        } else {
+        	renderFrame(pSnapshot);
+        }
+    }
+    
+    // Everything renderFrame() needs that Update() changes, see "Render thread". Call with the state locked.
+    void takeFrameSnapshot(FrameSnapshot *pSnapshot)
+    {
+    	// What Update() set the views up for, the UI may have changed gViewCount since
+    	const uint32_t viewCount = gGrassDrawUniformData.mViewCount;
+    	for (uint32_t v = 0; v < viewCount; v += 1) {
+    		SceneUniformData *pScene = &pSnapshot->mScenes[v];
+    		*pScene = gSceneUniformData;
+        	pScene->mCameraToClip = gViews[v].mCameraToClip;
+        	pScene->mViewDir = gViews[v].mViewDir;
+        	pScene->mCameraPos = gViews[v].mCameraPos;
+        	pScene->mTemporalGrass[0] = v == 0 ? gTemporalGrass.mDrawFrames : 0; // See "Temporal grass"
+        	
+        	SkyboxUniformData *pSkybox = &pSnapshot->mSkyboxes[v];
+        	*pSkybox = gSkyboxUniformData;
+	        pSkybox->mView = gViews[v].mView;
+	        pSkybox->mProjection = gViews[v].mProjection;
+	        
+	        pSnapshot->mViews[v] = gViews[v];
+    	}
+    	pSnapshot->mViewCount = viewCount;
+    	pSnapshot->mGrassDraw = gGrassDrawUniformData;
+    	memcpy(pSnapshot->mSpecies, gGrassSpecies, sizeof(gGrassSpecies));
+    	// Species that aren't mixed in get no share of the tiles' instances, see SpeciesInstanceStarts()
+    	for (uint32_t s = gGrassDrawUniformData.mSpeciesCount; s < MAX_GRASS_SPECIES; s += 1) pSnapshot->mSpecies[s].mDensity = 0.0f;
+    	
+    	pSnapshot->mDrawTerrainAndSky = gStartup.mSkyAndTerrainReady;
+    	pSnapshot->mDrawGrass = gStartup.mGrassReady;
+    	pSnapshot->mSplitSubmission = gSplitSubmission;
+    	pSnapshot->mTemporalDrawFrames = gTemporalGrass.mDrawFrames;
+    	pSnapshot->mViewsMoved = gCoherentCulling.mViewsMoved;
+    	pSnapshot->mCullEpoch = gCoherentCulling.mEpoch;
+    	
+    	pSnapshot->pHeightEdits = gTerrainEdits.pBuffer;
+    	terrainEditTakeUpload(&pSnapshot->mHeightEditUpload);
+    	
+    	pSnapshot->mInputSampleUs = gInputSampleTimeUs;
+    }
+    
+    // Draw()'s work from here on, on the render thread if it's on. Only reads the snapshot & what
+    // Update() doesn't touch, see "Render thread".
+    void renderFrame(const FrameSnapshot *pSnapshot)
+    {
         // Grab next frame
         uint32_t swapchainImageIndex;
+        TraceCpuScope acquireScope = traceCpuBegin("Acquire image", gAcquireImageToken);
         acquireNextImage(pRenderer, pSwapChain, pImageAcquiredSemaphore, NULL, &swapchainImageIndex);
+        traceCpuEnd(&acquireScope);
         RenderTarget *pRenderTarget = pSwapChain->ppRenderTargets[swapchainImageIndex];
-        GpuCmdRingElement elem = getNextGpuCmdRingElement(&gGraphicsCmdRing, true, 1);
+        GpuCmdRingElement elem = getNextGpuCmdRingElement(&gGraphicsCmdRing, true, 2);
         
         // Wait for last command buffer to be done on this frame (as it is potentially still being used)
         waitForFences(pRenderer, 1, &elem.pFence);
+        pollFrameLatency(); // Before this slot's latency sample is overwritten
+        traceReadGpuFrame(gFrameIndex);
+        renderThreadLockState();
+        captureUpdate(gFrameIndex);
+        heightFieldReadFrame(gFrameIndex);
+        renderThreadUnlockState();
         
+        TraceCpuScope uboScope = traceCpuBegin("Ubo updates", gUboUpdateToken);
         
-        // Update scene ubo
-        BufferUpdateDesc bufferUpdateDesc = { pSceneUbos[gFrameIndex] };
-        beginUpdateResource(&bufferUpdateDesc);
-        memcpy(bufferUpdateDesc.pMappedData, &gSceneUniformData, sizeof(SceneUniformData));
-        endUpdateResource(&bufferUpdateDesc);
+        // Update scene & skybox ubo's, one per view
+        for (uint32_t v = 0; v < pSnapshot->mViewCount; v += 1) {
+	        BufferUpdateDesc bufferUpdateDesc = heapUpdateDesc(&gSceneUbos[gFrameIndex][v]);
+	        beginUpdateResource(&bufferUpdateDesc);
+	        memcpy(bufferUpdateDesc.pMappedData, &pSnapshot->mScenes[v], sizeof(SceneUniformData));
+	        endUpdateResource(&bufferUpdateDesc);
+	        
+	        bufferUpdateDesc = heapUpdateDesc(&gSkyboxUbos[gFrameIndex][v]);
+	        beginUpdateResource(&bufferUpdateDesc);
+	        memcpy(bufferUpdateDesc.pMappedData, &pSnapshot->mSkyboxes[v], sizeof(SkyboxUniformData));
+	        endUpdateResource(&bufferUpdateDesc);
+        }
         
         // Update grass draw ubo
-        bufferUpdateDesc = { pGrassDrawUbos[gFrameIndex] };
+        BufferUpdateDesc bufferUpdateDesc = heapUpdateDesc(&gGrassDrawUbos[gFrameIndex]);
         beginUpdateResource(&bufferUpdateDesc);
-        memcpy(bufferUpdateDesc.pMappedData, &gGrassDrawUniformData, sizeof(GrassDrawUniformData));
+        memcpy(bufferUpdateDesc.pMappedData, &pSnapshot->mGrassDraw, sizeof(GrassDrawUniformData));
         endUpdateResource(&bufferUpdateDesc);
         
-        // Update skybox ubo
-        bufferUpdateDesc = { pSkyboxUbos[gFrameIndex] };
+        bufferUpdateDesc = heapUpdateDesc(&gGrassSpeciesBuffers[gFrameIndex]);
         beginUpdateResource(&bufferUpdateDesc);
-        memcpy(bufferUpdateDesc.pMappedData, &gSkyboxUniformData, sizeof(gSkyboxUniformData));
+        memcpy(bufferUpdateDesc.pMappedData, pSnapshot->mSpecies, sizeof(pSnapshot->mSpecies));
         endUpdateResource(&bufferUpdateDesc);
         
+        traceCpuEnd(&uboScope);
+        
+        TraceCpuScope recordScope = traceCpuBegin("Record commands", gRecordCommandsToken);
+        
         resetCmdPool(pRenderer, elem.pCmdPool);
         
         Cmd* cmd = elem.pCmds[0];
         beginCmd(cmd);
         
         cmdBeginGpuFrameProfile(cmd, gGpuProfileToken);
+        traceGpuBeginFrame(cmd, gFrameIndex);
+        
+        renderThreadLockState();
+        heightFieldRecordReadback(cmd, gFrameIndex); // Once, for grass queries
+        // See "Frame capture". A new capture waits for the last one to finish writing.
+        if (gCaptureRequested && !gCapture.mActive) {
+        	gCaptureRequested = false;
+        	captureStart(pRenderTarget);
+        }
+        CaptureSlot *pCaptureSlot = captureBeginFrame(gFrameIndex);
+        renderThreadUnlockState();
+        
+        // Until startup loading is done we draw whatever has landed, see "Startup loading"
+        const bool drawTerrainAndSky = pSnapshot->mDrawTerrainAndSky;
+        const bool drawGrass = pSnapshot->mDrawGrass;
+        const uint32_t viewCount = pSnapshot->mViewCount;
+        const bool splitSubmission = pSnapshot->mSplitSubmission;
+        // What the culling pass was told in updateGrassLodDraws(), in case the UI has toggled it since
+        const bool proceduralBlades = pSnapshot->mGrassDraw.mProceduralBlades != 0;
+        const bool splatGrass = drawGrass && pSnapshot->mGrassDraw.mSplatMaxPixels > 0.0f;
+        const bool temporalGrass = drawGrass && pSnapshot->mTemporalDrawFrames > 0;
+        // Nothing culling depends on has changed, so last frame's draws still hold, see "Coherent culling"
+        // Sculpting only resets the cull state of the tiles it touched, see "Terrain editing"
+        const bool editTerrain = pSnapshot->mHeightEditUpload.mDirty && pSnapshot->pHeightEdits;
+        // Temporal sectors are picked in the dispatch, so it can't be skipped while they're on
+        const bool cullGrass = drawGrass && (pSnapshot->mGrassDraw.mCullEpoch == 0 || pSnapshot->mViewsMoved
+        	|| gCoherentCulling.mCulledEpoch != pSnapshot->mCullEpoch || editTerrain || pSnapshot->mGrassDraw.mTemporalSectors > 1);
+        if (cullGrass) gCoherentCulling.mCulledEpoch = pSnapshot->mCullEpoch;
+        
+        // Every pass below is wrapped in fgBeginPass(), which issues its barriers, see "Frame graph"
+        fgImportRenderTarget(FG_RESOURCE_SWAPCHAIN, pRenderTarget, RESOURCE_STATE_PRESENT, RESOURCE_STATE_PRESENT);
+        fgImportRenderTarget(FG_RESOURCE_DEPTH, pDepthBuffer, RESOURCE_STATE_DEPTH_WRITE, RESOURCE_STATE_UNDEFINED);
+        fgImportBuffer(FG_RESOURCE_GRASS_DRAW_ARGS, pGrassDrawBuffer, RESOURCE_STATE_UNORDERED_ACCESS, RESOURCE_STATE_UNDEFINED);
+        fgImportBuffer(FG_RESOURCE_GRASS_PROCEDURAL_DRAW_ARGS, pGrassProceduralDrawBuffer, RESOURCE_STATE_UNORDERED_ACCESS, RESOURCE_STATE_UNDEFINED);
+        fgImportBuffer(FG_RESOURCE_GRASS_DRAW_COUNTS, pGrassDrawCountBuffer, RESOURCE_STATE_INDIRECT_ARGUMENT, RESOURCE_STATE_UNDEFINED);
+        fgImportBuffer(FG_RESOURCE_SPLAT_ARGS, pGrassSplatArgsBuffer, RESOURCE_STATE_INDIRECT_ARGUMENT, RESOURCE_STATE_UNDEFINED);
+        fgImportBuffer(FG_RESOURCE_SPLAT_TILES, pGrassSplatTileBuffer, RESOURCE_STATE_UNORDERED_ACCESS, RESOURCE_STATE_UNDEFINED);
+        fgImportBuffer(FG_RESOURCE_GRASS_CULL_STATE, pGrassCullStateBuffer, RESOURCE_STATE_UNORDERED_ACCESS, RESOURCE_STATE_UNDEFINED);
+        fgImportBuffer(FG_RESOURCE_TEMPORAL_HISTORY, pGrassTemporalBuffer, RESOURCE_STATE_UNORDERED_ACCESS, RESOURCE_STATE_UNDEFINED);
+        fgImportBuffer(FG_RESOURCE_HEIGHT_EDITS, pSnapshot->pHeightEdits, RESOURCE_STATE_SHADER_RESOURCE, RESOURCE_STATE_UNDEFINED);
+        // Readback buffers never leave COPY_DEST. As an output, the capture pass is never culled.
+        fgImportBuffer(FG_RESOURCE_CAPTURE_BUFFER, pCaptureSlot ? pCaptureSlot->pBuffer : NULL, RESOURCE_STATE_COPY_DEST,
+        	pCaptureSlot ? RESOURCE_STATE_COPY_DEST : RESOURCE_STATE_UNDEFINED);
+        declareFrameGraph(editTerrain, drawGrass, cullGrass, proceduralBlades, splatGrass, temporalGrass, pCaptureSlot != NULL, splitSubmission, viewCount);
+        fgCompile();
+        
+        // Sculpted heights & the cull state of the tiles under them, see "Terrain editing"
+        if (fgBeginPass(cmd, FG_PASS_EDIT_TERRAIN)) {
+        	gpuScopeBegin(cmd, "Edit terrain");
+        	terrainEditRecordUploads(cmd, gFrameIndex, &pSnapshot->mHeightEditUpload, drawGrass);
+        	gpuScopeEnd(cmd);
+        }
+        
+        ///
+        // Compute grass draw calls
+        //
+        // One dispatch for all views. Each tile is tested against every view and appended
+        // to that view's list, so the heightmap sampling & bounds are only done once.
+        if (drawGrass) {
+            gpuScopeBegin(cmd, "Compute grass draw calls");
+            
+            if (fgBeginPass(cmd, FG_PASS_RESET_GRASS_COUNTERS)) {
+            	cmdUpdateBuffer(cmd, pGrassDrawCountBuffer, 0, gGrassDrawCountReset.pBuffer, gGrassDrawCountReset.mRange.mOffset,
+            		sizeof(uint32_t)*MAX_GRASS_VIEWS*GRASS_VARIANT_COUNT);
+            	// Same as the draw count, the culling pass appends the splatted tiles to the dispatch args
+            	if (splatGrass) cmdUpdateBuffer(cmd, pGrassSplatArgsBuffer, 0, gGrassSplatArgsReset.pBuffer, gGrassSplatArgsReset.mRange.mOffset, sizeof(uint32_t)*3);
+            }
+            
+            if (fgBeginPass(cmd, FG_PASS_CLEAR_SPLATS)) {
+            	cmdBindPipeline(cmd, pGrassSplatClearPipeline);
+            	cmdBindDescriptorSet(cmd, gFrameIndex, pDescriptorSetGrassSplatPerFrame);
+            	cmdBindDescriptorSet(cmd, 0, pDescriptorSetGrassSplat);
+            	cmdDispatch(cmd, (uint32_t)ceil((float)(mSettings.mWidth*mSettings.mHeight)/256.0f), 1, 1);
+            }
+            
+            if (fgBeginPass(cmd, FG_PASS_CULL_GRASS)) {
+            	cmdBindPipeline(cmd, pGrassDrawComputePipeline);
+            	
+            	cmdBindDescriptorSet(cmd, gFrameIndex, pDescriptorSetGrassDrawCompute);
+            	cmdBindDescriptorSet(cmd, 0, pDescriptorSetHeightMapDrawCompute);
+            	
+            	cmdDispatch(cmd, (uint32_t)ceil(gTileGrid.mCountX/32.0f), (uint32_t)ceil(gTileGrid.mCountY/32.0f), 1);
+            }
+            gpuScopeEnd(cmd);
+            
+            ///
+            // Splat sub-pixel grass, see "Grass splatting"
+            if (fgBeginPass(cmd, FG_PASS_SPLAT_GRASS)) {
+            	gpuScopeBegin(cmd, "Splat grass");
+            	// One group per splatted tile
+            	cmdBindPipeline(cmd, pGrassSplatPipeline);
+            	cmdBindDescriptorSet(cmd, gFrameIndex, pDescriptorSetGrassSplatPerFrame);
+            	cmdBindDescriptorSet(cmd, 0, pDescriptorSetGrassSplat);
+            	cmdExecuteIndirect(cmd, INDIRECT_DISPATCH, 1, pGrassSplatArgsBuffer, 0, NULL, 0);
+            	gpuScopeEnd(cmd);
+            }
+            
+            ///
+            // Reproject the last frames' far blades into the splats, see "Temporal grass"
+            if (fgBeginPass(cmd, FG_PASS_REPROJECT_GRASS)) {
+            	gpuScopeBegin(cmd, "Reproject grass");
+            	cmdBindPipeline(cmd, pGrassTemporalPipeline);
+            	cmdBindDescriptorSet(cmd, gFrameIndex, pDescriptorSetGrassSplatPerFrame);
+            	cmdBindDescriptorSet(cmd, 0, pDescriptorSetGrassSplat);
+            	cmdDispatch(cmd, (uint32_t)ceil((float)(mSettings.mWidth*mSettings.mHeight)/256.0f), 1, 1);
+            	gpuScopeEnd(cmd);
+            }
+        }
         
         // Bind render targets
-		RenderTargetBarrier barriers[] = {
-			{ pRenderTarget, RESOURCE_STATE_PRESENT, RESOURCE_STATE_RENDER_TARGET },
-		};
-        cmdResourceBarrier(cmd, 0, NULL, 0, NULL, 1, barriers);
+        fgBeginPass(cmd, FG_PASS_TERRAIN); // Always alive, it writes the swapchain
         BindRenderTargetsDesc bindRenderTargets = {};
         bindRenderTargets.mRenderTargetCount = 1;
         bindRenderTargets.mRenderTargets[0] = { pRenderTarget, LOAD_ACTION_CLEAR };
         bindRenderTargets.mDepthStencil = { pDepthBuffer, LOAD_ACTION_CLEAR };
         cmdBindRenderTargets(cmd, &bindRenderTargets); // Load action is CLEAR, so render target will be cleared here
-         
-        cmdSetViewport(cmd, 0.0f, 0.0f, (float)pRenderTarget->mWidth, (float)pRenderTarget->mHeight, 0.0f, 1.0f);
-        cmdSetScissor(cmd, 0, 0, pRenderTarget->mWidth, pRenderTarget->mHeight);
         
-        
-        ///
-        // Draw skybox
-        cmdBeginGpuTimestampQuery(cmd, gGpuProfileToken, "Draw Skybox");
-        cmdBindPipeline(cmd, pSkyboxPipeline);
-        cmdBindDescriptorSet(cmd, gFrameIndex, pDescriptorSetSkyboxUbos);
-        cmdBindDescriptorSet(cmd, 0, pDescriptorSetSkyboxTextures);
-        // 6 verts * 6 faces
-        cmdDraw(cmd, 6*6, 0);
-        cmdEndGpuTimestampQuery(cmd, gGpuProfileToken);
-        
-        ///
-        // Draw terrain
-        cmdBeginGpuTimestampQuery(cmd, gGpuProfileToken, "Draw terrain");
-        cmdBindPipeline(cmd, pTerrainPipeline);
-        cmdBindDescriptorSet(cmd, gFrameIndex, pDescriptorSetTerrainUbo);
-        cmdBindDescriptorSet(cmd, 0, pDescriptorSetHeightMap);
-        
-        uint32_t numberOfQuads = (uint32_t)
-        	((gSceneUniformData.mTerrainSize.getX()/gSceneUniformData.mSampleGranularity)
-        	* (gSceneUniformData.mTerrainSize.getY()/gSceneUniformData.mSampleGranularity));
+        for (uint32_t v = 0; v < viewCount; v += 1) {
         	
-        cmdDraw(cmd, numberOfQuads*6, 0);
-        
-        cmdEndGpuTimestampQuery(cmd, gGpuProfileToken);
-        
-        ///
-        // Compute grass draw calls
-        cmdBeginGpuTimestampQuery(cmd, gGpuProfileToken, "Compute grass draw calls");
-        cmdBindPipeline(cmd, pGrassDrawComputePipeline);
-        
-        cmdBindDescriptorSet(cmd, gFrameIndex, pDescriptorSetGrassDrawCompute);
-        cmdBindDescriptorSet(cmd, 0, pDescriptorSetHeightMapDrawCompute);
+        	const uint32_t setIndex = viewSetIndex(gFrameIndex, v);
+        	
+	        // Views after the main one are drawn on top of it, so they get their own depth buffer.
+	        // Their viewports don't overlap, so it only needs clearing once.
+	        if (v == 1) {
+	        	bindRenderTargets.mRenderTargets[0] = { pRenderTarget, LOAD_ACTION_LOAD };
+	        	bindRenderTargets.mDepthStencil = { pSecondaryViewDepthBuffer, LOAD_ACTION_CLEAR };
+	        	cmdBindRenderTargets(cmd, NULL);
+	        	cmdBindRenderTargets(cmd, &bindRenderTargets);
+	        }
+	        setViewViewport(cmd, pRenderTarget, &pSnapshot->mViews[v]);
+	        
+	        if (!drawTerrainAndSky) continue;
+	        
+	        ///
+	        // Draw terrain
+	        gpuScopeBegin(cmd, "Draw terrain");
+	        cmdBindPipeline(cmd, pTerrainPipeline);
+	        cmdBindDescriptorSet(cmd, setIndex, pDescriptorSetTerrainUbo);
+	        cmdBindDescriptorSet(cmd, 0, pDescriptorSetHeightMap);
+	        
+	        uint32_t numberOfQuads = (uint32_t)
+	        	((pSnapshot->mScenes[0].mTerrainSize.getX()/pSnapshot->mScenes[0].mSampleGranularity)
+	        	* (pSnapshot->mScenes[0].mTerrainSize.getY()/pSnapshot->mScenes[0].mSampleGranularity));
+	        	
+	        cmdDraw(cmd, numberOfQuads*6, 0);
+	        
+	        gpuScopeEnd(cmd);
+        }
         
-        cmdDispatch(cmd, (uint32_t)ceil(GRASS_TILE_COUNT_X/32.0f), (uint32_t)ceil(GRASS_TILE_COUNT_Y/32.0f), 1);
+        FlushResourceUpdateDesc flushUpdateDesc = {};
+        flushUpdateDesc.mNodeIndex = 0;
+        flushResourceUpdates(&flushUpdateDesc);
         
-        BufferBarrier drawBufferBarrier = { pGrassDrawBuffer, RESOURCE_STATE_SHADER_RESOURCE, RESOURCE_STATE_INDIRECT_ARGUMENT };
-        cmdResourceBarrier(cmd, 1, &drawBufferBarrier, 0, NULL, 0, NULL);
-        cmdEndGpuTimestampQuery(cmd, gGpuProfileToken);
+        Semaphore* waitSemaphores[] = { flushUpdateDesc.pOutSubmittedSemaphore, pImageAcquiredSemaphore };
+        bool waitedForSemaphores = false;
         
         ///
-        // Draw grass
-        cmdBeginGpuTimestampQuery(cmd, gGpuProfileToken, "Draw grass");
-    	cmdBindPipeline(cmd, pGrassPipeline);
-        cmdBindDescriptorSet(cmd, 0, pDescriptorSetHeightMap);
-        cmdBindDescriptorSet(cmd, gFrameIndex, pDescriptorSetGrass);
-        
-        cmdBindIndexBuffer(cmd, pGrassIbo, INDEX_TYPE_UINT32, 0);
+        // Early submit
+        //
+        // Everything up to here (culling & terrain) only depends on last frame's grass draw
+        // buffer being consumed, so hand it to the GPU now. It's the same queue, so the second half
+        // is still ordered after this, and only the second half signals the fence.
+        if (splitSubmission) {
+        	cmdBindRenderTargets(cmd, NULL);
+        	endCmd(cmd);
+        	traceCpuEnd(&recordScope);
+        	
+	        QueueSubmitDesc submitDesc = {};
+	        submitDesc.mCmdCount = 1;
+	        submitDesc.mWaitSemaphoreCount = TF_ARRAY_COUNT(waitSemaphores);
+	        submitDesc.ppCmds = &cmd;
+	        submitDesc.ppWaitSemaphores = waitSemaphores;
+	        TraceCpuScope submitScope = traceCpuBegin("Queue submit", gQueueSubmitToken);
+	        queueSubmit(pGraphicsQueue, &submitDesc);
+	        traceCpuEnd(&submitScope);
+	        waitedForSemaphores = true;
+	        
+	        recordScope = traceCpuBegin("Record commands", gRecordCommandsToken);
+	        cmd = elem.pCmds[1];
+	        beginCmd(cmd);
+        }
         
-        // We bind Instance vbo + LOD models
-        uint32_t strides[2] = { sizeof(GrassVertex), sizeof(uint32_t) };
-        uint64_t offsets[2] = { 0, 0 };
-        Buffer   *vbos[2]   = { pGrassVbo, pGrassInstanceVbo };
+        // Only takes barriers with split submission, otherwise the render targets are still bound
+        const bool drawScene = fgBeginPass(cmd, FG_PASS_SCENE);
+        if (splitSubmission) {
+	        bindRenderTargets.mRenderTargets[0] = { pRenderTarget, LOAD_ACTION_LOAD };
+	        bindRenderTargets.mDepthStencil = { pDepthBuffer, LOAD_ACTION_LOAD };
+	        cmdBindRenderTargets(cmd, &bindRenderTargets);
+        }
         
-        cmdBindVertexBuffer(cmd, 2, vbos, strides, offsets);
+        for (uint32_t v = 0; v < viewCount; v += 1) {
+        	
+        	const uint32_t setIndex = viewSetIndex(gFrameIndex, v);
+        	
+        	// Rebind the depth buffer the views above used
+        	if (v == 1 || (v == 0 && viewCount > 1 && !splitSubmission)) {
+        		bindRenderTargets.mRenderTargets[0] = { pRenderTarget, LOAD_ACTION_LOAD };
+	        	bindRenderTargets.mDepthStencil = { v == 0 ? pDepthBuffer : pSecondaryViewDepthBuffer, LOAD_ACTION_LOAD };
+	        	cmdBindRenderTargets(cmd, NULL);
+	        	cmdBindRenderTargets(cmd, &bindRenderTargets);
+        	}
+        	setViewViewport(cmd, pRenderTarget, &pSnapshot->mViews[v]);
+	        
+	        if (drawScene && drawGrass) {
+		        ///
+		        // Draw grass
+		        gpuScopeBegin(cmd, "Draw grass");
+		    	
+		        if (proceduralBlades) {
+		        	// Only the instance vbo, blades are made from the vertex index
+		        	uint32_t stride = sizeof(uint32_t);
+		        	uint64_t offset = 0;
+		        	cmdBindVertexBuffer(cmd, 1, &pGrassInstanceVbo, &stride, &offset);
+		        } else {
+			        cmdBindIndexBuffer(cmd, pGrassIbo, INDEX_TYPE_UINT32, 0);
+		        
+			        // We bind Instance vbo + LOD models
+			        uint32_t strides[2] = { sizeof(GrassVertex), sizeof(uint32_t) };
+			        uint64_t offsets[2] = { 0, 0 };
+			        Buffer   *vbos[2]   = { pGrassVbo, pGrassInstanceVbo };
+		        
+			        cmdBindVertexBuffer(cmd, 2, vbos, strides, offsets);
+		        }
+		        
+		        // One list per shader variant, see "Grass shader variants"
+		        for (uint32_t variant = 0; variant < GRASS_VARIANT_COUNT; variant += 1) {
+		        	const uint32_t list = v*GRASS_VARIANT_COUNT+variant;
+		        	
+			    	cmdBindPipeline(cmd, proceduralBlades ? pGrassProceduralPipelines[variant] : pGrassPipelines[variant]);
+			        cmdBindDescriptorSet(cmd, 0, pDescriptorSetHeightMap);
+			        cmdBindDescriptorSet(cmd, setIndex, pDescriptorSetGrass);
+			        
+			        if (proceduralBlades) {
+			        	cmdExecuteIndirect(cmd, INDIRECT_DRAW, gTileGrid.mCount*MAX_GRASS_SPECIES,
+			        		pGrassProceduralDrawBuffer, list*gTileGrid.mCount*MAX_GRASS_SPECIES*sizeof(GrassProceduralDrawArgument),
+			        		pGrassDrawCountBuffer, list*sizeof(uint32_t));
+			        } else {
+				        cmdExecuteIndirect(cmd, INDIRECT_DRAW_INDEX, gTileGrid.mCount*MAX_GRASS_SPECIES,
+				        	pGrassDrawBuffer, list*gTileGrid.mCount*MAX_GRASS_SPECIES*sizeof(GrassDrawArgument),
+				        	pGrassDrawCountBuffer, list*sizeof(uint32_t));
+			        }
+		        }
+	        
+		        gpuScopeEnd(cmd);
+	        }
+	        
+	        ///
+	        // Resolve splatted grass
+	        //
+	        // Before the skybox so it gets depth tested like the rest of the grass
+	        if (drawScene && (splatGrass || temporalGrass) && v == 0) {
+	        	gpuScopeBegin(cmd, "Resolve grass splats");
+	        	cmdBindPipeline(cmd, pGrassSplatResolvePipeline);
+	        	cmdBindDescriptorSet(cmd, gFrameIndex, pDescriptorSetGrassSplatResolvePerFrame);
+	        	cmdBindDescriptorSet(cmd, 0, pDescriptorSetGrassSplatResolve);
+	        	cmdDraw(cmd, 3, 0);
+	        	gpuScopeEnd(cmd);
+	        }
+	        
+	        ///
+	        // Draw skybox
+	        //
+	        // After all opaque geometry, see skybox pipeline
+	        if (drawScene && drawTerrainAndSky) {
+		        gpuScopeBegin(cmd, "Draw Skybox");
+		        cmdBindPipeline(cmd, pSkyboxPipeline);
+		        cmdBindDescriptorSet(cmd, setIndex, pDescriptorSetSkyboxUbos);
+		        cmdBindDescriptorSet(cmd, 0, pDescriptorSetSkyboxTextures);
+		        // 6 verts * 6 faces
+		        cmdDraw(cmd, 6*6, 0);
+		        gpuScopeEnd(cmd);
+	        }
+        }
         
-        cmdExecuteIndirect(cmd, INDIRECT_DRAW_INDEX, GRASS_TILE_COUNT, pGrassDrawBuffer, 0, NULL, 0);
+        ///
+        // Capture the frame, see "Frame capture"
+        if (pCaptureSlot) {
+        	cmdBindRenderTargets(cmd, NULL);
+        	fgBeginPass(cmd, FG_PASS_CAPTURE);
+        	gpuScopeBegin(cmd, "Capture frame");
+        	captureRecordCopy(cmd, pCaptureSlot, pRenderTarget);
+        	gpuScopeEnd(cmd);
+        }
         
-        drawBufferBarrier = { pGrassDrawBuffer, RESOURCE_STATE_INDIRECT_ARGUMENT, RESOURCE_STATE_SHADER_RESOURCE };
-        cmdResourceBarrier(cmd, 1, &drawBufferBarrier, 0, NULL, 0, NULL);
+        fgBeginPass(cmd, FG_PASS_UI);
+        if (pCaptureSlot) {
+        	bindRenderTargets = {};
+        	bindRenderTargets.mRenderTargetCount = 1;
+        	bindRenderTargets.mRenderTargets[0] = { pRenderTarget, LOAD_ACTION_LOAD };
+        	cmdBindRenderTargets(cmd, &bindRenderTargets);
+        }
         
-        cmdEndGpuTimestampQuery(cmd, gGpuProfileToken);
+        cmdSetViewport(cmd, 0.0f, 0.0f, (float)pRenderTarget->mWidth, (float)pRenderTarget->mHeight, 0.0f, 1.0f);
+        cmdSetScissor(cmd, 0, 0, pRenderTarget->mWidth, pRenderTarget->mHeight);
         
         ///
         // Draw UI
+        //
+        // Widgets write straight into what Update() reads, & the stats below come from both threads
+        renderThreadLockState();
         
         FontDrawDesc infoDraw;
         infoDraw.mFontColor = 0xff00ffff;
@@ -1281,39 +6035,111 @@ public:
         infoDraw.mFontID = gFontID;
         float2 txtSizePx = cmdDrawCpuProfile(cmd, float2(8.f, 15.f), &infoDraw);
         float2 textPos = float2(8.f, txtSizePx.y + 75.f);
-        cmdDrawGpuProfile(cmd, textPos, gGpuProfileToken, &infoDraw);
+        float2 gpuTxtSizePx = cmdDrawGpuProfile(cmd, textPos, gGpuProfileToken, &infoDraw);
+        
+        // Latency readout goes with the profiler output
+        infoDraw.pText = tempPrint("Input to present: %.2f ms (avg %.2f ms, max %.2f ms), %u frames in flight%s%s",
+        	gLatencyStats.mLastMs, gLatencyStats.mAverageMs, gLatencyStats.mMaxMs, gFramesInFlight,
+        	gLowLatencyMode ? ", low latency" : "", splitSubmission ? ", split submit" : "");
+        cmdDrawTextWithFont(cmd, float2(8.f, textPos.y + gpuTxtSizePx.y + 10.f), &infoDraw);
+        infoDraw.pText = tempPrint("Frame graph: %u passes (%u culled), %u barriers in %u batches, %.2f MB aliased",
+        	gFrameGraph.mPassCount, gFrameGraph.mCulledPassCount, gFrameGraph.mBarrierCount, gFrameGraph.mBarrierBatchCount, memToMB(gFrameGraph.mAliasedBytes));
+        cmdDrawTextWithFont(cmd, float2(8.f, textPos.y + gpuTxtSizePx.y + 35.f), &infoDraw);
+        
+        float2 memoryTextPos = float2(8.f, textPos.y + gpuTxtSizePx.y + 60.f);
+        if (pSnapshot->mThreaded) {
+        	infoDraw.pText = tempPrint("Render thread: one frame behind, main thread waited %.2f ms for it, it waited %.2f ms for the main thread",
+        		pSnapshot->mMainWaitMs, gRenderThread.mRenderWaitMs);
+        	cmdDrawTextWithFont(cmd, memoryTextPos, &infoDraw);
+        	memoryTextPos.y += 25.f;
+        }
+        if (!drawGrass) {
+        	infoDraw.pText = drawTerrainAndSky ? "Loading grass..." : "Loading terrain & sky...";
+        	cmdDrawTextWithFont(cmd, memoryTextPos, &infoDraw);
+        	memoryTextPos.y += 25.f;
+        }
+        if (gCapture.mActive) {
+        	infoDraw.pText = tempPrint("Capturing: %u frames left, %u written, %u dropped", gCapture.mFramesLeft,
+        		tfrg_atomic32_load_relaxed(&gCapture.mWrittenFrameCount), gCapture.mDroppedFrameCount);
+        	cmdDrawTextWithFont(cmd, memoryTextPos, &infoDraw);
+        	memoryTextPos.y += 25.f;
+        }
+        if (gTileTuner.mActive) {
+        	infoDraw.pText = tempPrint("Tuning tile size: %um, camera %u/%u", gTileTuneCandidates[gTileTuner.mCandidate],
+        		gTileTuner.mCamera+1, (uint32_t)TF_ARRAY_COUNT(gTileTuneCameras));
+        	cmdDrawTextWithFont(cmd, memoryTextPos, &infoDraw);
+        	memoryTextPos.y += 25.f;
+        }
+        if (gTemporalGrass.mFrames > 1 && gTemporalGrass.mBySector) {
+        	infoDraw.pText = tempPrint("Temporal grass: %u of %u far sectors drawn this frame, %u redrawn early",
+        		gTemporalGrass.mRefreshedSectors, gTemporalGrass.mFrames, gTemporalGrass.mForcedRefreshes);
+        	cmdDrawTextWithFont(cmd, memoryTextPos, &infoDraw);
+        	memoryTextPos.y += 25.f;
+        } else if (gTemporalGrass.mFrames > 1) {
+        	infoDraw.pText = tempPrint("Temporal grass: 1 in %u far blades per frame, history dropped %u times",
+        		gTemporalGrass.mDrawFrames, gTemporalGrass.mDroppedFrames);
+        	cmdDrawTextWithFont(cmd, memoryTextPos, &infoDraw);
+        	memoryTextPos.y += 25.f;
+        }
+        if (gGrassQueryDemo.mRays > 0) {
+        	const GrassQueryDemo *pDemo = &gGrassQueryDemo;
+        	infoDraw.pText = tempPrint("Grass queries: %u/%u rays hit (middle at %.1fm), %u blades in box, %u within %.0fm: %.0f us, %.0f%% cached",
+        		pDemo->mHitCount, pDemo->mRays, pDemo->mCenterDistance, pDemo->mBoxCount, pDemo->mRadiusCount,
+        		GRASS_QUERY_DEMO_RADIUS, pDemo->mMicroseconds, pDemo->mCacheHitRate*100.0f);
+        	cmdDrawTextWithFont(cmd, memoryTextPos, &infoDraw);
+        	memoryTextPos.y += 25.f;
+        }
+        if (gTerrainEdits.mSculptBrush != TERRAIN_BRUSH_NONE) {
+        	const TerrainEdits *pEdits = &gTerrainEdits;
+        	infoDraw.pText = tempPrint("Sculpting: brush %.0f us, last upload %u texels in %u copies, %u tiles culled again",
+        		pEdits->mBrushMicroseconds, pEdits->mUploadedTexels, pEdits->mUploadCopies, pEdits->mResetTiles);
+        	cmdDrawTextWithFont(cmd, memoryTextPos, &infoDraw);
+        	memoryTextPos.y += 25.f;
+        }
+        if (gShowMemoryPanel) drawMemoryPanel(cmd, memoryTextPos, &infoDraw);
 
-        cmdBeginGpuTimestampQuery(cmd, gGpuProfileToken, "Draw UI");
+        gpuScopeBegin(cmd, "Draw UI");
         cmdDrawUserInterface(cmd);
-        cmdEndGpuTimestampQuery(cmd, gGpuProfileToken);
+        gpuScopeEnd(cmd);
+        
+        renderThreadUnlockState();
         
         cmdBindRenderTargets(cmd, NULL);
         
-        barriers[0] = { pRenderTarget, RESOURCE_STATE_RENDER_TARGET, RESOURCE_STATE_PRESENT };
-        cmdResourceBarrier(cmd, 0, NULL, 0, NULL, 1, barriers);
+        // Swapchain to present
+        fgEndFrame(cmd);
+        
+        // When the GPU is done with the frame, see LatencyStats
+        QueryPool *pLatencyPool = gLatencyStats.pQueryPools[gFrameIndex];
+        QueryDesc latencyQuery = { 0 };
+        cmdResetQuery(cmd, pLatencyPool, 0, 1);
+        cmdBeginQuery(cmd, pLatencyPool, &latencyQuery);
+        cmdEndQuery(cmd, pLatencyPool, &latencyQuery);
+        cmdResolveQuery(cmd, pLatencyPool, 0, 1);
         
+        traceGpuEndFrame(cmd);
         cmdEndGpuFrameProfile(cmd, gGpuProfileToken);
         
         endCmd(cmd);
-        
-        FlushResourceUpdateDesc flushUpdateDesc = {};
-        flushUpdateDesc.mNodeIndex = 0;
-        flushResourceUpdates(&flushUpdateDesc);
-        
-        Semaphore* waitSemaphores[] = { flushUpdateDesc.pOutSubmittedSemaphore, pImageAcquiredSemaphore };
+        traceCpuEnd(&recordScope);
         
         // Submit commands
         QueueSubmitDesc submitDesc = {};
         submitDesc.mCmdCount = 1;
         submitDesc.mSignalSemaphoreCount = 1;
-        submitDesc.mWaitSemaphoreCount = TF_ARRAY_COUNT(waitSemaphores);
+        submitDesc.mWaitSemaphoreCount = waitedForSemaphores ? 0 : TF_ARRAY_COUNT(waitSemaphores);
         submitDesc.ppCmds = &cmd;
         submitDesc.ppSignalSemaphores = &elem.pSemaphore;
-        submitDesc.ppWaitSemaphores = waitSemaphores;
+        submitDesc.ppWaitSemaphores = waitedForSemaphores ? NULL : waitSemaphores;
         submitDesc.pSignalFence = elem.pFence;
-        uint64_t submitToken = cpuProfileEnter(gQueueSubmitToken);
+        TraceCpuScope submitScope = traceCpuBegin("Queue submit", gQueueSubmitToken);
         queueSubmit(pGraphicsQueue, &submitDesc);
-        cpuProfileLeave(gQueueSubmitToken, submitToken);
+        traceCpuEnd(&submitScope);
+        
+        pLastSubmittedFence = elem.pFence;
+        gLatencyStats.mInputTimeUs[gFrameIndex] = pSnapshot->mInputSampleUs;
+        gLatencyStats.pFences[gFrameIndex] = elem.pFence;
+        gLatencyStats.mPending[gFrameIndex] = true;
 
 		// Present
         QueuePresentDesc presentDesc = {};
@@ -1323,16 +6149,130 @@ public:
         presentDesc.ppWaitSemaphores = &elem.pSemaphore;
         presentDesc.mSubmitDone = true;
 
+        TraceCpuScope presentScope = traceCpuBegin("Present", gPresentToken);
         queuePresent(pGraphicsQueue, &presentDesc);
+        traceCpuEnd(&presentScope);
         flipProfiler();
         
-        gFrameIndex = (gFrameIndex + 1) % gNumberOfFrames;
+        recordStartupMilestones(drawTerrainAndSky, drawGrass);
+        
+        gFrameIndex = (gFrameIndex + 1) % gFramesInFlight;
+        
+        traceEndFrame();
+    }
+    
+    // Current & peak per category, totals turn red when over budget
+    void drawMemoryPanel(Cmd *cmd, float2 pos, FontDrawDesc *pDraw)
+    {
+    	const float lineHeight = 20.f;
+    	
+    	pDraw->pText = "Memory         VRAM (peak)              Host (peak)";
+    	cmdDrawTextWithFont(cmd, pos, pDraw);
+    	pos.y += lineHeight;
+    	
+    	for (uint32_t i = 0; i < MEMORY_CATEGORY_COUNT; i += 1) {
+    		MemoryCategoryStats *pStats = &gMemory.mCategories[i];
+    		pDraw->pText = tempPrint("%-14s %8.1f MB (%8.1f)    %8.1f MB (%8.1f)", gMemoryCategoryNames[i],
+    			memToMB(pStats->mGpuBytes), memToMB(pStats->mGpuPeakBytes), memToMB(pStats->mHostBytes), memToMB(pStats->mHostPeakBytes));
+    		cmdDrawTextWithFont(cmd, pos, pDraw);
+    		pos.y += lineHeight;
+    	}
+    	
+    	uint32_t color = pDraw->mFontColor;
+    	if (memGpuOverBudget() || memHostOverBudget()) pDraw->mFontColor = 0xff0000ff;
+    	pDraw->pText = tempPrint("%-14s %8.1f MB (%8.1f)    %8.1f MB (%8.1f)", "Total",
+    		memToMB(gMemory.mTotal.mGpuBytes), memToMB(gMemory.mTotal.mGpuPeakBytes), memToMB(gMemory.mTotal.mHostBytes), memToMB(gMemory.mTotal.mHostPeakBytes));
+    	cmdDrawTextWithFont(cmd, pos, pDraw);
+    	pos.y += lineHeight;
+    	
+    	if (gMemory.mGpuBudgetBytes != 0 || gMemory.mHostBudgetBytes != 0) {
+    		pDraw->pText = tempPrint("%-14s %8.1f MB             %8.1f MB", "Budget",
+    			memToMB(gMemory.mGpuBudgetBytes), memToMB(gMemory.mHostBudgetBytes));
+    		cmdDrawTextWithFont(cmd, pos, pDraw);
+    		pos.y += lineHeight;
+    	}
+    	pDraw->mFontColor = color;
+    	
+    	const BufferHeap *pHeaps[] = { &gUploadHeap, &gStaticHeap };
+    	const char *pHeapNames[] = { "Upload heap", "Static heap" };
+    	for (uint32_t i = 0; i < TF_ARRAY_COUNT(pHeaps); i += 1) {
+    		pDraw->pText = tempPrint("%-14s %u ranges, %.1f / %.1f KB, %.0f%% fragmented", pHeapNames[i], pHeaps[i]->mAllocationCount,
+    			(float)pHeaps[i]->mUsedBytes/1024.0f, (float)pHeaps[i]->mSize/1024.0f, heapFragmentation(pHeaps[i])*100.0f);
+    		cmdDrawTextWithFont(cmd, pos, pDraw);
+    		pos.y += lineHeight;
+    	}
+    }
+    
+    void setViewViewport(Cmd *cmd, RenderTarget *pRenderTarget, const RenderView *pView)
+    {
+    	float viewportX = pView->mViewportX*(float)pRenderTarget->mWidth;
+    	float viewportY = pView->mViewportY*(float)pRenderTarget->mHeight;
+    	float viewportWidth = pView->mViewportWidth*(float)pRenderTarget->mWidth;
+    	float viewportHeight = pView->mViewportHeight*(float)pRenderTarget->mHeight;
+        cmdSetViewport(cmd, viewportX, viewportY, viewportWidth, viewportHeight, 0.0f, 1.0f);
+        cmdSetScissor(cmd, (uint32_t)viewportX, (uint32_t)viewportY, (uint32_t)viewportWidth, (uint32_t)viewportHeight);
     }
 
     const char *GetName() { return "Charlie_Submission"; }
 };
 
 void addUiWidgets() {
+	SliderUintWidget viewCountWidget;
+    viewCountWidget.mMin = 1;
+    viewCountWidget.mMax = MAX_GRASS_VIEWS;
+    viewCountWidget.mStep = 1;
+    viewCountWidget.pData = &gViewCount;
+    uiAddComponentWidget(pGuiWindow, "Views (main, rear mirror, minimap)", &viewCountWidget, WIDGET_TYPE_SLIDER_UINT);
+    
+    SliderUintWidget framesInFlightWidget;
+    framesInFlightWidget.mMin = 1;
+    framesInFlightWidget.mMax = gMaxFramesInFlight;
+    framesInFlightWidget.mStep = 1;
+    framesInFlightWidget.pData = &gRequestedFramesInFlight;
+    uiAddComponentWidget(pGuiWindow, "Frames in flight", &framesInFlightWidget, WIDGET_TYPE_SLIDER_UINT);
+    
+    CheckboxWidget splitSubmissionWidget;
+    splitSubmissionWidget.pData = &gSplitSubmission;
+    uiAddComponentWidget(pGuiWindow, "Split submission", &splitSubmissionWidget, WIDGET_TYPE_CHECKBOX);
+    
+    CheckboxWidget lowLatencyWidget;
+    lowLatencyWidget.pData = &gLowLatencyMode;
+    uiAddComponentWidget(pGuiWindow, "Low latency mode", &lowLatencyWidget, WIDGET_TYPE_CHECKBOX);
+    
+    CheckboxWidget renderThreadWidget;
+    renderThreadWidget.pData = &gRenderThread.mRequested;
+    uiAddComponentWidget(pGuiWindow, "Render thread", &renderThreadWidget, WIDGET_TYPE_CHECKBOX);
+    
+    CheckboxWidget memoryPanelWidget;
+    memoryPanelWidget.pData = &gShowMemoryPanel;
+    uiAddComponentWidget(pGuiWindow, "Show memory usage", &memoryPanelWidget, WIDGET_TYPE_CHECKBOX);
+    
+    SliderUintWidget traceFramesWidget;
+    traceFramesWidget.mMin = 1;
+    traceFramesWidget.mMax = 1000;
+    traceFramesWidget.mStep = 1;
+    traceFramesWidget.pData = &gTraceFrameCount;
+    uiAddComponentWidget(pGuiWindow, "Trace frames", &traceFramesWidget, WIDGET_TYPE_SLIDER_UINT);
+    
+    ButtonWidget traceButtonWidget;
+    UIWidget *pTraceButton = uiAddComponentWidget(pGuiWindow, "Capture trace (written to Debug/)", &traceButtonWidget, WIDGET_TYPE_BUTTON);
+    uiSetWidgetOnEditedCallback(pTraceButton, NULL, [](void *pUserData) { gTraceRequested = true; });
+    
+    SliderUintWidget captureFramesWidget;
+    captureFramesWidget.mMin = 1;
+    captureFramesWidget.mMax = 10000;
+    captureFramesWidget.mStep = 1;
+    captureFramesWidget.pData = &gCaptureFrameCount;
+    uiAddComponentWidget(pGuiWindow, "Capture frames", &captureFramesWidget, WIDGET_TYPE_SLIDER_UINT);
+    
+    CheckboxWidget captureRawWidget;
+    captureRawWidget.pData = &gCaptureRaw;
+    uiAddComponentWidget(pGuiWindow, "Capture raw frames", &captureRawWidget, WIDGET_TYPE_CHECKBOX);
+    
+    ButtonWidget captureButtonWidget;
+    UIWidget *pCaptureButton = uiAddComponentWidget(pGuiWindow, "Capture frames (written to Screenshots/)", &captureButtonWidget, WIDGET_TYPE_BUTTON);
+    uiSetWidgetOnEditedCallback(pCaptureButton, NULL, [](void *pUserData) { gCaptureRequested = true; });
+    
 	SliderUintWidget numberOfGrassWidget;
     numberOfGrassWidget.mMin = 0;
     numberOfGrassWidget.mMax = MAX_GRASS_CAP;
@@ -1408,17 +6348,90 @@ void addUiWidgets() {
     lodFloatWidget.mMax = 4000.0f;
     lodFloatWidget.pData = &gGrassDrawUniformData.mLod.mLowestDetailDistance;
     uiAddComponentWidget(pGuiWindow, "Lowest detail distance", &lodFloatWidget, WIDGET_TYPE_SLIDER_FLOAT);
+    
+    CheckboxWidget proceduralBladesWidget;
+    proceduralBladesWidget.pData = &gProceduralBlades;
+    uiAddComponentWidget(pGuiWindow, "Procedural blades", &proceduralBladesWidget, WIDGET_TYPE_CHECKBOX);
+    CheckboxWidget coherentCullingWidget;
+    coherentCullingWidget.pData = &gCoherentCulling.mEnabled;
+    uiAddComponentWidget(pGuiWindow, "Coherent culling", &coherentCullingWidget, WIDGET_TYPE_CHECKBOX);
+    SliderUintWidget tileSizeWidget;
+    tileSizeWidget.mMin = MIN_GRASS_TILE_DIMENSION;
+    tileSizeWidget.mMax = MAX_GRASS_TILE_DIMENSION;
+    tileSizeWidget.mStep = 1;
+    tileSizeWidget.pData = &gTileGrid.mRequestedDimension;
+    uiAddComponentWidget(pGuiWindow, "Grass tile size (m)", &tileSizeWidget, WIDGET_TYPE_SLIDER_UINT);
+    ButtonWidget tuneButtonWidget;
+    UIWidget *pTuneButton = uiAddComponentWidget(pGuiWindow, "Tune tile size for this GPU", &tuneButtonWidget, WIDGET_TYPE_BUTTON);
+    uiSetWidgetOnEditedCallback(pTuneButton, NULL, [](void *pUserData) { gTileTuneRequested = true; });
+    lodFloatWidget.mMin = 1.0f;
+    lodFloatWidget.mMax = (float)GRASS_MAX_BLADE_SEGMENTS;
+    lodFloatWidget.pData = &gBladeSegmentsNear;
+    uiAddComponentWidget(pGuiWindow, "Blade segments near", &lodFloatWidget, WIDGET_TYPE_SLIDER_FLOAT);
+    lodFloatWidget.mMin = 1.0f;
+    lodFloatWidget.mMax = 500.0f;
+    lodFloatWidget.pData = &gBladeSegmentDistance;
+    uiAddComponentWidget(pGuiWindow, "Blade segment distance", &lodFloatWidget, WIDGET_TYPE_SLIDER_FLOAT);
+    lodFloatWidget.mMin = 0.0f;
+    lodFloatWidget.mMax = 4000.0f;
+    lodFloatWidget.pData = &gGrassFarVariantDistance;
+    uiAddComponentWidget(pGuiWindow, "Far shader variant from (m)", &lodFloatWidget, WIDGET_TYPE_SLIDER_FLOAT);
+    lodFloatWidget.mMin = 0.0f;
+    lodFloatWidget.mMax = 8.0f;
+    lodFloatWidget.pData = &gSplatMaxPixels;
+    uiAddComponentWidget(pGuiWindow, "Splat blades below (px)", &lodFloatWidget, WIDGET_TYPE_SLIDER_FLOAT);
+    SliderUintWidget temporalFramesWidget;
+    temporalFramesWidget.mMin = 1;
+    temporalFramesWidget.mMax = TEMPORAL_GRASS_MAX_FRAMES;
+    temporalFramesWidget.mStep = 1;
+    temporalFramesWidget.pData = &gTemporalGrass.mRequestedFrames;
+    uiAddComponentWidget(pGuiWindow, "Temporal grass frames", &temporalFramesWidget, WIDGET_TYPE_SLIDER_UINT);
+    CheckboxWidget temporalSectorsWidget;
+    temporalSectorsWidget.pData = &gTemporalGrass.mRequestedBySector;
+    uiAddComponentWidget(pGuiWindow, "Temporal grass by sector", &temporalSectorsWidget, WIDGET_TYPE_CHECKBOX);
+    SliderUintWidget grassQueryWidget;
+    grassQueryWidget.mMin = 0;
+    grassQueryWidget.mMax = GRASS_QUERY_DEMO_MAX_RAYS;
+    grassQueryWidget.mStep = 1;
+    grassQueryWidget.pData = &gGrassQueryDemo.mRays;
+    uiAddComponentWidget(pGuiWindow, "Grass query rays", &grassQueryWidget, WIDGET_TYPE_SLIDER_UINT);
+    SliderUintWidget sculptWidget;
+    sculptWidget.mMin = TERRAIN_BRUSH_NONE;
+    sculptWidget.mMax = TERRAIN_BRUSH_COUNT-1;
+    sculptWidget.mStep = 1;
+    sculptWidget.pData = &gTerrainEdits.mSculptBrush;
+    uiAddComponentWidget(pGuiWindow, "Sculpt: 0 off, 1 raise, 2 lower, 3 smooth, 4 flatten", &sculptWidget, WIDGET_TYPE_SLIDER_UINT);
+    SliderFloatWidget sculptFloatWidget;
+    sculptFloatWidget.pData = &gTerrainEdits.mSculptRadius;
+    sculptFloatWidget.mMin = 5.0f;
+    sculptFloatWidget.mMax = TERRAIN_EDIT_MAX_RADIUS;
+    uiAddComponentWidget(pGuiWindow, "Sculpt radius (m)", &sculptFloatWidget, WIDGET_TYPE_SLIDER_FLOAT);
+    sculptFloatWidget.pData = &gTerrainEdits.mSculptStrength;
+    sculptFloatWidget.mMin = 0.5f;
+    sculptFloatWidget.mMax = 50.0f;
+    uiAddComponentWidget(pGuiWindow, "Sculpt strength (m/s)", &sculptFloatWidget, WIDGET_TYPE_SLIDER_FLOAT);
+    SliderUintWidget speciesWidget;
+    speciesWidget.mMin = 1;
+    speciesWidget.mMax = MAX_GRASS_SPECIES;
+    speciesWidget.mStep = 1;
+    speciesWidget.pData = &gGrassDrawUniformData.mSpeciesCount;
+    uiAddComponentWidget(pGuiWindow, "Grass species", &speciesWidget, WIDGET_TYPE_SLIDER_UINT);
+    CheckboxWidget farGrassWidget;
+    farGrassWidget.pData = &gFarGrass;
+    uiAddComponentWidget(pGuiWindow, "Far-field grass", &farGrassWidget, WIDGET_TYPE_CHECKBOX);
+    lodFloatWidget.mMin = 50.0f;
+    lodFloatWidget.mMax = 4000.0f;
+    lodFloatWidget.pData = &gFarGrassStart;
+    uiAddComponentWidget(pGuiWindow, "Far-field grass start", &lodFloatWidget, WIDGET_TYPE_SLIDER_FLOAT);
+    lodFloatWidget.pData = &gFarGrassEnd;
+    uiAddComponentWidget(pGuiWindow, "Far-field grass end", &lodFloatWidget, WIDGET_TYPE_SLIDER_FLOAT);
+    
     lodFloatWidget.mMin = 1.0f;
     lodFloatWidget.mMax = 4000.0f;
-    const char *labels[NUMBER_OF_GRASS_LOD] = {
-    	"LOD Threshold 0",
-    	"LOD Threshold 1",
-    	"LOD Threshold 2",
-    	"LOD Threshold 3",
-    };
-    for (uint32_t i = 0; i < NUMBER_OF_GRASS_LOD; i += 1) {
+    // The UI copies the label, so temporary storage is fine
+    for (uint32_t i = 0; i < gGrassDrawUniformData.mLod.mLevelCount; i += 1) {
     	lodFloatWidget.pData = &gGrassDrawUniformData.mLod.mLevels[i].mThreshold;
-    	uiAddComponentWidget(pGuiWindow, labels[i], &lodFloatWidget, WIDGET_TYPE_SLIDER_FLOAT);
+    	uiAddComponentWidget(pGuiWindow, tempPrint("LOD Threshold %u", i), &lodFloatWidget, WIDGET_TYPE_SLIDER_FLOAT);
     }
     
     Color3PickerWidget baseColorWidget;
@@ -0,0 +1,294 @@
+"""
+	Bakes the six skybox PNG's into one BC1 compressed cubemap (DDS).
+
+	Usage:
+		python Tools/bake_skybox.py [RawAssets/Textures] [RawAssets/Textures/skybox.dds]
+
+	Then run the AssetPipeline on skybox.dds like the other textures, which gives the
+	skybox.tex that the app loads. The baked skybox.dds is committed, so this only needs
+	running again when the PNG's change.
+
+	Colors:
+		The source PNG's are 16 bit and hold linear values (that's why skybox.frag used to
+		gamma correct them by hand). We encode them to sRGB here, and store the result as
+		BC1_RGBA_UNORM, not _SRGB. The swapchain is UNORM (see "@SwapchainFormat"), so the
+		shader can write sampled values straight out.
+
+	Faces:
+		The old skybox drew six quads, each with its own Tex2D and UV's (see skybox.vert.fsl).
+		The new one samples the cube with the same cube-space position that quad vertex had,
+		so for every cube face texel we compute that position, find which old quad it lands
+		on and look up the PNG texel it used to show. This makes the result line up exactly
+		with what we had, regardless of how the images were authored.
+
+	Only needs the Python standard library.
+"""
+
+import os
+import struct
+import sys
+import zlib
+
+FACE_SIZE = 1024
+
+# Three corners (position, uv) of each quad the old skybox.vert.fsl drew, enough to solve
+# for its uv mapping. #Volatile positions must match the cube in skybox.vert.fsl
+OLD_QUADS = {
+	"back":   [(( 1,  1, -1), (1, 1)), ((-1,  1, -1), (0, 1)), ((-1, -1, -1), (0, 0))],
+	"left":   [((-1,  1,  1), (0, 1)), ((-1, -1,  1), (0, 0)), ((-1, -1, -1), (1, 0))],
+	"front":  [(( 1, -1,  1), (0, 0)), ((-1, -1,  1), (1, 0)), ((-1,  1,  1), (1, 1))],
+	"right":  [(( 1,  1, -1), (0, 1)), (( 1, -1, -1), (0, 0)), (( 1, -1,  1), (1, 0))],
+	"bottom": [((-1,  1,  1), (1, 0)), ((-1,  1, -1), (1, 1)), (( 1,  1, -1), (0, 1))],
+	"top":    [((-1, -1, -1), (1, 0)), ((-1, -1,  1), (1, 1)), (( 1, -1,  1), (0, 1))],
+}
+
+# D3D/Vulkan cubemap face order and conventions: (major axis, sign, sc axis & sign, tc axis & sign)
+CUBE_FACES = [
+	(0,  1, (2, -1), (1, -1)), # +X
+	(0, -1, (2,  1), (1, -1)), # -X
+	(1,  1, (0,  1), (2,  1)), # +Y
+	(1, -1, (0,  1), (2, -1)), # -Y
+	(2,  1, (0,  1), (1, -1)), # +Z
+	(2, -1, (0, -1), (1, -1)), # -Z
+]
+
+###
+# PNG decoding (8/16 bit RGB/RGBA, non-interlaced)
+
+def read_png(path):
+	with open(path, "rb") as f:
+		data = f.read()
+	if data[:8] != b"\x89PNG\r\n\x1a\n":
+		raise ValueError("%s: not a PNG" % path)
+
+	pos = 8
+	idat = []
+	width = height = bitDepth = colorType = 0
+	while pos < len(data):
+		length, kind = struct.unpack(">I4s", data[pos:pos+8])
+		chunk = data[pos+8:pos+8+length]
+		if kind == b"IHDR":
+			width, height, bitDepth, colorType, _, _, interlace = struct.unpack(">IIBBBBB", chunk)
+			if colorType not in (2, 6) or bitDepth not in (8, 16) or interlace != 0:
+				raise ValueError("%s: unsupported PNG format" % path)
+		elif kind == b"IDAT":
+			idat.append(chunk)
+		pos += 12 + length
+
+	channels = 3 if colorType == 2 else 4
+	bpp = channels*bitDepth//8
+	stride = width*bpp
+	raw = zlib.decompress(b"".join(idat))
+
+	rows = []
+	prev = bytearray(stride)
+	for y in range(height):
+		filterType = raw[y*(stride+1)]
+		line = bytearray(raw[y*(stride+1)+1:(y+1)*(stride+1)])
+		if filterType == 1:
+			for i in range(bpp, stride):
+				line[i] = (line[i] + line[i-bpp]) & 0xff
+		elif filterType == 2:
+			for i in range(stride):
+				line[i] = (line[i] + prev[i]) & 0xff
+		elif filterType == 3:
+			for i in range(stride):
+				left = line[i-bpp] if i >= bpp else 0
+				line[i] = (line[i] + ((left + prev[i]) >> 1)) & 0xff
+		elif filterType == 4:
+			for i in range(stride):
+				a = line[i-bpp] if i >= bpp else 0
+				b = prev[i]
+				c = prev[i-bpp] if i >= bpp else 0
+				p = a + b - c
+				pa, pb, pc = abs(p - a), abs(p - b), abs(p - c)
+				pred = a if (pa <= pb and pa <= pc) else (b if pb <= pc else c)
+				line[i] = (line[i] + pred) & 0xff
+		rows.append(line)
+		prev = line
+
+	# Normalized RGB floats, row major
+	maxValue = float((1 << bitDepth) - 1)
+	pixels = []
+	for line in rows:
+		if bitDepth == 16:
+			values = struct.unpack(">%dH" % (width*channels), bytes(line))
+		else:
+			values = line
+		for x in range(width):
+			base = x*channels
+			pixels.append((values[base]/maxValue, values[base+1]/maxValue, values[base+2]/maxValue))
+	return width, height, pixels
+
+###
+# Color
+
+def linear_to_srgb(c):
+	c = min(max(c, 0.0), 1.0)
+	return 12.92*c if c <= 0.0031308 else 1.055*(c ** (1.0/2.4)) - 0.055
+
+def build_srgb_lut(size=4096):
+	return [int(round(linear_to_srgb(i/(size-1))*255.0)) for i in range(size)]
+
+###
+# BC1
+
+def pack565(r, g, b):
+	return ((r*31 + 127)//255 << 11) | ((g*63 + 127)//255 << 5) | ((b*31 + 127)//255)
+
+def unpack565(c):
+	r = (c >> 11) & 31
+	g = (c >> 5) & 63
+	b = c & 31
+	return ((r << 3) | (r >> 2), (g << 2) | (g >> 4), (b << 3) | (b >> 2))
+
+def encode_bc1_block(block):
+	# Endpoints from the bounding box, inset a bit so the interpolated colors are used
+	minR = min(p[0] for p in block); maxR = max(p[0] for p in block)
+	minG = min(p[1] for p in block); maxG = max(p[1] for p in block)
+	minB = min(p[2] for p in block); maxB = max(p[2] for p in block)
+	insetR = (maxR - minR) >> 4
+	insetG = (maxG - minG) >> 4
+	insetB = (maxB - minB) >> 4
+	c0 = pack565(maxR - insetR, maxG - insetG, maxB - insetB)
+	c1 = pack565(minR + insetR, minG + insetG, minB + insetB)
+
+	if c0 == c1:
+		return struct.pack("<HHI", c0, c1, 0)
+	if c0 < c1:
+		c0, c1 = c1, c0
+
+	# c0 > c1 selects the 4 color mode
+	e0 = unpack565(c0)
+	e1 = unpack565(c1)
+	palette = [
+		e0,
+		e1,
+		tuple((2*a + b)//3 for a, b in zip(e0, e1)),
+		tuple((a + 2*b)//3 for a, b in zip(e0, e1)),
+	]
+
+	indices = 0
+	for i, p in enumerate(block):
+		best = 0
+		bestDist = 1 << 30
+		for j, q in enumerate(palette):
+			d = (p[0]-q[0])**2 + (p[1]-q[1])**2 + (p[2]-q[2])**2
+			if d < bestDist:
+				best = j
+				bestDist = d
+		indices |= best << (2*i)
+	return struct.pack("<HHI", c0, c1, indices)
+
+def encode_bc1(size, texels):
+	out = bytearray()
+	for by in range(0, size, 4):
+		for bx in range(0, size, 4):
+			block = [texels[(by+y)*size + bx+x] for y in range(4) for x in range(4)]
+			out += encode_bc1_block(block)
+	return out
+
+###
+# Face remapping
+
+def solve_uv_mapping(corners):
+	# Each quad is axis aligned, so uv is an affine function of the two axes the quad spans
+	(p0, t0), (p1, t1), (p2, t2) = corners
+	axes = [a for a in range(3) if not (p0[a] == p1[a] == p2[a])]
+	a, b = axes
+	# Solve [x y 1] * M = uv using the three corners
+	rows = [(p[a], p[b], 1.0) for p in (p0, p1, p2)]
+	det = (rows[0][0]*(rows[1][1]*rows[2][2] - rows[1][2]*rows[2][1])
+		 - rows[0][1]*(rows[1][0]*rows[2][2] - rows[1][2]*rows[2][0])
+		 + rows[0][2]*(rows[1][0]*rows[2][1] - rows[1][1]*rows[2][0]))
+	def solve(values):
+		res = []
+		for col in range(3):
+			m = [list(r) for r in rows]
+			for r in range(3):
+				m[r][col] = values[r]
+			d = (m[0][0]*(m[1][1]*m[2][2] - m[1][2]*m[2][1])
+			   - m[0][1]*(m[1][0]*m[2][2] - m[1][2]*m[2][0])
+			   + m[0][2]*(m[1][0]*m[2][1] - m[1][1]*m[2][0]))
+			res.append(d/det)
+		return res
+	return a, b, solve([t0[0], t1[0], t2[0]]), solve([t0[1], t1[1], t2[1]])
+
+def find_old_quad(p):
+	for name, corners in OLD_QUADS.items():
+		plane = [axis for axis in range(3) if corners[0][0][axis] == corners[1][0][axis] == corners[2][0][axis]][0]
+		if abs(p[plane] - corners[0][0][plane]) < 1e-6:
+			return name
+	raise ValueError("No quad at %s" % (p,))
+
+def bake_face(face, size, images, mappings, lut):
+	major, sign, (scAxis, scSign), (tcAxis, tcSign) = face
+	texels = []
+	for y in range(size):
+		tc = (y + 0.5)/size*2.0 - 1.0
+		for x in range(size):
+			sc = (x + 0.5)/size*2.0 - 1.0
+			p = [0.0, 0.0, 0.0]
+			p[major] = float(sign)
+			p[scAxis] = sc*scSign
+			p[tcAxis] = tc*tcSign
+
+			name = find_old_quad(p)
+			a, b, uCoef, vCoef = mappings[name]
+			u = uCoef[0]*p[a] + uCoef[1]*p[b] + uCoef[2]
+			v = vCoef[0]*p[a] + vCoef[1]*p[b] + vCoef[2]
+
+			width, height, pixels = images[name]
+			px = min(max(int(u*width), 0), width - 1)
+			py = min(max(int(v*height), 0), height - 1)
+			r, g, b = pixels[py*width + px]
+			n = len(lut) - 1
+			texels.append((lut[int(min(max(r, 0.0), 1.0)*n)], lut[int(min(max(g, 0.0), 1.0)*n)], lut[int(min(max(b, 0.0), 1.0)*n)]))
+	return texels
+
+###
+# DDS
+
+def write_dds_cubemap(path, size, faces):
+	DDSD_CAPS, DDSD_HEIGHT, DDSD_WIDTH, DDSD_PIXELFORMAT, DDSD_LINEARSIZE = 0x1, 0x2, 0x4, 0x1000, 0x80000
+	DDSCAPS_COMPLEX, DDSCAPS_TEXTURE = 0x8, 0x1000
+	DDSCAPS2_CUBEMAP_ALLFACES = 0x200 | 0x400 | 0x800 | 0x1000 | 0x2000 | 0x4000 | 0x8000
+	DDPF_FOURCC = 0x4
+
+	header = struct.pack("<4sIIIIIII44x", b"DDS ", 124,
+		DDSD_CAPS | DDSD_HEIGHT | DDSD_WIDTH | DDSD_PIXELFORMAT | DDSD_LINEARSIZE,
+		size, size, len(faces[0]), 0, 1)
+	pixelFormat = struct.pack("<II4sIIIII", 32, DDPF_FOURCC, b"DXT1", 0, 0, 0, 0, 0)
+	caps = struct.pack("<IIII4x", DDSCAPS_COMPLEX | DDSCAPS_TEXTURE, DDSCAPS2_CUBEMAP_ALLFACES, 0, 0)
+
+	with open(path, "wb") as f:
+		f.write(header + pixelFormat + caps)
+		for face in faces:
+			f.write(face)
+
+def main():
+	srcDir = sys.argv[1] if len(sys.argv) > 1 else os.path.join("RawAssets", "Textures")
+	dstPath = sys.argv[2] if len(sys.argv) > 2 else os.path.join(srcDir, "skybox.dds")
+
+	images = {}
+	for name in OLD_QUADS:
+		path = os.path.join(srcDir, "skybox_%s.png" % name)
+		print("Reading %s" % path)
+		images[name] = read_png(path)
+
+	mappings = { name: solve_uv_mapping(corners) for name, corners in OLD_QUADS.items() }
+	lut = build_srgb_lut()
+
+	faces = []
+	for i, face in enumerate(CUBE_FACES):
+		print("Baking face %d/6" % (i + 1))
+		faces.append(encode_bc1(FACE_SIZE, bake_face(face, FACE_SIZE, images, mappings, lut)))
+
+	write_dds_cubemap(dstPath, FACE_SIZE, faces)
+
+	srcBytes = sum(w*h*8 for w, h, _ in images.values()) # What the 16 bit RGBA textures took
+	dstBytes = sum(len(f) for f in faces)
+	print("Wrote %s (%.1f MB, was %.1f MB)" % (dstPath, dstBytes/1048576.0, srcBytes/1048576.0))
+
+if __name__ == "__main__":
+	main()
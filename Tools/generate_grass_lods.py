@@ -0,0 +1,452 @@
+"""
+	Generates the grass LOD chain from the full detail blade (grass_lod_0.gltf).
+
+	Usage:
+		python Tools/generate_grass_lods.py [RawAssets/Models/grass_lod_0.gltf] [RawAssets/Models] [Models/grass_lods.txt]
+			[--ratio 0.4] [--max-levels 8] [--pixels 1.0] [--screen-width 1920] [--fov 90] [--world-scale 9.4]
+
+	Writes grass_lod_1.gltf ... grass_lod_N.gltf (+ .bin) next to the source, overwriting what's
+	there, and rewrites grass_lod_0 in vertex cache order. Run the AssetPipeline on them like
+	before to get the Models/grass_lod_*.bin the app loads. The thresholds go straight to
+	Models/grass_lods.txt, which the app reads at startup (see "LOD chain" in
+	Charlie_Submission.cpp). The app accepts up to MAX_GRASS_LOD levels.
+
+	Simplification:
+		Greedy edge collapses ordered by quadric error (Garland & Heckbert). Blades are flat,
+		open meshes, so face quadrics alone would happily eat the outline. Every boundary edge
+		also gets a heavily weighted plane perpendicular to its face, which makes silhouette
+		changes the expensive ones. Collapses that flip or degenerate a triangle are rejected.
+		Each level is simplified from the one before it, down to a single triangle.
+
+	Thresholds:
+		For every level we measure the geometric error against level 0 as the symmetric
+		Hausdorff distance (sampled over vertices, edges and faces), in model units. The blade
+		is scaled up by --world-scale at runtime (max grass height / model height), and a
+		world-space error e at distance d covers e*(screenWidth/2)/(d*tan(fov/2)) pixels for
+		the app's horizontal fov. The threshold is the distance where that drops to --pixels,
+		so switching to the level can't move the outline by more than that on screen.
+		Distance based widening in grass.vert makes far blades wider than the model, so this
+		is slightly conservative.
+
+	Vertex cache:
+		Triangles of each level are reordered with Tom Forsyth's linear-speed vertex cache
+		optimisation, then vertices are renumbered in first-use order for fetch locality.
+
+	Only needs the Python standard library.
+"""
+
+import json
+import math
+import os
+import struct
+import sys
+
+COMPONENT_FLOAT = 5126
+COMPONENT_UINT16 = 5123
+COMPONENT_UINT32 = 5125
+
+BOUNDARY_WEIGHT = 1000.0
+MAX_FLIP_COS = 0.2 # Collapses that turn a triangle more than ~78 degrees are rejected
+
+###
+# Small vector helpers
+
+def sub(a, b): return (a[0]-b[0], a[1]-b[1], a[2]-b[2])
+def add(a, b): return (a[0]+b[0], a[1]+b[1], a[2]+b[2])
+def mul(a, s): return (a[0]*s, a[1]*s, a[2]*s)
+def dot(a, b): return a[0]*b[0]+a[1]*b[1]+a[2]*b[2]
+def cross(a, b): return (a[1]*b[2]-a[2]*b[1], a[2]*b[0]-a[0]*b[2], a[0]*b[1]-a[1]*b[0])
+def length(a): return math.sqrt(dot(a, a))
+def normalize(a):
+	l = length(a)
+	return mul(a, 1.0/l) if l > 0 else a
+def lerp(a, b, t): return tuple(x+(y-x)*t for x, y in zip(a, b))
+
+###
+# glTF in/out (one mesh, one primitive, POSITION/NORMAL/TEXCOORD_0 + indices)
+
+def read_accessor(gltf, blob, index):
+	accessor = gltf["accessors"][index]
+	view = gltf["bufferViews"][accessor["bufferView"]]
+	components = { "SCALAR": 1, "VEC2": 2, "VEC3": 3, "VEC4": 4 }[accessor["type"]]
+	fmt = { COMPONENT_FLOAT: "f", COMPONENT_UINT16: "H", COMPONENT_UINT32: "I" }[accessor["componentType"]]
+	size = struct.calcsize(fmt)
+	stride = view.get("byteStride", size*components)
+	offset = view.get("byteOffset", 0) + accessor.get("byteOffset", 0)
+
+	values = []
+	for i in range(accessor["count"]):
+		v = struct.unpack_from("<" + fmt*components, blob, offset + i*stride)
+		values.append(v if components > 1 else v[0])
+	return values
+
+def read_gltf(path):
+	with open(path, "r") as f:
+		gltf = json.load(f)
+	with open(os.path.join(os.path.dirname(path), gltf["buffers"][0]["uri"]), "rb") as f:
+		blob = f.read()
+
+	primitive = gltf["meshes"][0]["primitives"][0]
+	attributes = primitive["attributes"]
+	positions = read_accessor(gltf, blob, attributes["POSITION"])
+	normals = read_accessor(gltf, blob, attributes["NORMAL"])
+	uvs = read_accessor(gltf, blob, attributes["TEXCOORD_0"]) if "TEXCOORD_0" in attributes else [(0.0, 0.0)]*len(positions)
+	indices = read_accessor(gltf, blob, primitive["indices"])
+
+	triangles = [tuple(indices[i:i+3]) for i in range(0, len(indices), 3)]
+	return gltf, [list(v) for v in zip(positions, normals, uvs)], triangles
+
+def write_gltf(path, template, vertices, triangles, node_name):
+	name = os.path.splitext(os.path.basename(path))[0]
+	bin_name = name + ".bin"
+
+	positions = b"".join(struct.pack("<3f", *v[0]) for v in vertices)
+	normals = b"".join(struct.pack("<3f", *v[1]) for v in vertices)
+	uvs = b"".join(struct.pack("<2f", *v[2]) for v in vertices)
+	indices = b"".join(struct.pack("<3H", *t) for t in triangles)
+	views = [positions, normals, uvs, indices]
+
+	buffer_views = []
+	offset = 0
+	for i, data in enumerate(views):
+		buffer_views.append({ "buffer": 0, "byteLength": len(data), "byteOffset": offset, "target": 34963 if i == 3 else 34962 })
+		offset += len(data)
+
+	mins = [min(v[0][i] for v in vertices) for i in range(3)]
+	maxs = [max(v[0][i] for v in vertices) for i in range(3)]
+
+	gltf = {
+		"asset": { "generator": "Tools/generate_grass_lods.py", "version": "2.0" },
+		"scene": 0,
+		"scenes": [{ "name": "Scene", "nodes": [0] }],
+		"nodes": [{ "mesh": 0, "name": node_name }],
+		"meshes": [{ "name": template["meshes"][0].get("name", "Plane"), "primitives": [
+			{ "attributes": { "POSITION": 0, "NORMAL": 1, "TEXCOORD_0": 2 }, "indices": 3 }
+		]}],
+		"accessors": [
+			{ "bufferView": 0, "componentType": COMPONENT_FLOAT, "count": len(vertices), "max": maxs, "min": mins, "type": "VEC3" },
+			{ "bufferView": 1, "componentType": COMPONENT_FLOAT, "count": len(vertices), "type": "VEC3" },
+			{ "bufferView": 2, "componentType": COMPONENT_FLOAT, "count": len(vertices), "type": "VEC2" },
+			{ "bufferView": 3, "componentType": COMPONENT_UINT16, "count": len(triangles)*3, "type": "SCALAR" },
+		],
+		"bufferViews": buffer_views,
+		"buffers": [{ "byteLength": offset, "uri": bin_name }],
+	}
+
+	with open(path, "w") as f:
+		json.dump(gltf, f, indent="\t")
+	with open(os.path.join(os.path.dirname(path), bin_name), "wb") as f:
+		for data in views:
+			f.write(data)
+
+###
+# Quadric error simplification
+
+def plane_quadric(n, p, weight):
+	# Q = w * (n n^T, n d, d^2) for the plane n.x + d = 0, stored as the 10 unique terms
+	a, b, c = n
+	d = -dot(n, p)
+	return [weight*x for x in (a*a, a*b, a*c, a*d, b*b, b*c, b*d, c*c, c*d, d*d)]
+
+def quadric_add(q0, q1):
+	return [x+y for x, y in zip(q0, q1)]
+
+def quadric_error(q, p):
+	x, y, z = p
+	return (q[0]*x*x + 2*q[1]*x*y + 2*q[2]*x*z + 2*q[3]*x
+	      + q[4]*y*y + 2*q[5]*y*z + 2*q[6]*y
+	      + q[7]*z*z + 2*q[8]*z
+	      + q[9])
+
+def triangle_normal(vertices, t):
+	p0, p1, p2 = (vertices[i][0] for i in t)
+	return cross(sub(p1, p0), sub(p2, p0))
+
+def edges_of(triangles):
+	counts = {}
+	for t in triangles:
+		for i in range(3):
+			e = tuple(sorted((t[i], t[(i+1) % 3])))
+			counts[e] = counts.get(e, 0) + 1
+	return counts
+
+def vertex_quadrics(vertices, triangles):
+	quadrics = [[0.0]*10 for _ in vertices]
+	edge_counts = edges_of(triangles)
+	for t in triangles:
+		n = triangle_normal(vertices, t)
+		area = length(n)*0.5
+		if area == 0: continue
+		n = normalize(n)
+		q = plane_quadric(n, vertices[t[0]][0], area)
+		for i in t:
+			quadrics[i] = quadric_add(quadrics[i], q)
+
+		# Boundary edges get a plane perpendicular to the face through the edge
+		for i in range(3):
+			a, b = t[i], t[(i+1) % 3]
+			if edge_counts[tuple(sorted((a, b)))] != 1: continue
+			edge = sub(vertices[b][0], vertices[a][0])
+			edge_length = length(edge)
+			if edge_length == 0: continue
+			side = normalize(cross(edge, n))
+			q = plane_quadric(side, vertices[a][0], BOUNDARY_WEIGHT*edge_length*edge_length)
+			quadrics[a] = quadric_add(quadrics[a], q)
+			quadrics[b] = quadric_add(quadrics[b], q)
+	return quadrics
+
+def collapse_is_valid(vertices, triangles, keep, remove, position):
+	for t in triangles:
+		if remove not in t or keep in t: continue
+		before = triangle_normal(vertices, t)
+		points = [position if i in (keep, remove) else vertices[i][0] for i in t]
+		after = cross(sub(points[1], points[0]), sub(points[2], points[0]))
+		if length(after) < 1e-12 or length(before) < 1e-12: return False
+		if dot(normalize(before), normalize(after)) < MAX_FLIP_COS: return False
+	for t in triangles:
+		if keep not in t or remove in t: continue
+		before = triangle_normal(vertices, t)
+		points = [position if i == keep else vertices[i][0] for i in t]
+		after = cross(sub(points[1], points[0]), sub(points[2], points[0]))
+		if length(after) < 1e-12 or length(before) < 1e-12: return False
+		if dot(normalize(before), normalize(after)) < MAX_FLIP_COS: return False
+	return True
+
+def best_collapse(vertices, triangles, quadrics):
+	best = None
+	for (a, b) in edges_of(triangles):
+		q = quadric_add(quadrics[a], quadrics[b])
+		# Candidate positions: either end or the midpoint. Keeps attributes easy to carry along.
+		for keep, remove, t in ((a, b, 0.0), (b, a, 0.0), (a, b, 0.5)):
+			position = lerp(vertices[keep][0], vertices[remove][0], t)
+			cost = quadric_error(q, position)
+			if best is not None and cost >= best[0]: continue
+			if not collapse_is_valid(vertices, triangles, keep, remove, position): continue
+			best = (cost, keep, remove, t)
+	return best
+
+def simplify(vertices, triangles, target_triangle_count):
+	vertices = [list(v) for v in vertices]
+	triangles = list(triangles)
+	quadrics = vertex_quadrics(vertices, triangles)
+
+	while len(triangles) > target_triangle_count:
+		collapse = best_collapse(vertices, triangles, quadrics)
+		if collapse is None: break
+		_, keep, remove, t = collapse
+
+		if t != 0.0:
+			vertices[keep] = [
+				lerp(vertices[keep][0], vertices[remove][0], t),
+				normalize(lerp(vertices[keep][1], vertices[remove][1], t)),
+				lerp(vertices[keep][2], vertices[remove][2], t),
+			]
+		quadrics[keep] = quadric_add(quadrics[keep], quadrics[remove])
+
+		remapped = []
+		for tri in triangles:
+			tri = tuple(keep if i == remove else i for i in tri)
+			if len(set(tri)) == 3: remapped.append(tri)
+		triangles = remapped
+
+	return compact(vertices, triangles)
+
+def compact(vertices, triangles):
+	# Drops unused vertices, numbering the rest in first-use order
+	remap = {}
+	out_vertices = []
+	out_triangles = []
+	for t in triangles:
+		for i in t:
+			if i not in remap:
+				remap[i] = len(out_vertices)
+				out_vertices.append(vertices[i])
+		out_triangles.append(tuple(remap[i] for i in t))
+	return out_vertices, out_triangles
+
+###
+# Error measurement
+
+def closest_point_on_triangle(p, a, b, c):
+	# Ericson, Real-Time Collision Detection 5.1.5
+	ab, ac, ap = sub(b, a), sub(c, a), sub(p, a)
+	d1, d2 = dot(ab, ap), dot(ac, ap)
+	if d1 <= 0 and d2 <= 0: return a
+	bp = sub(p, b)
+	d3, d4 = dot(ab, bp), dot(ac, bp)
+	if d3 >= 0 and d4 <= d3: return b
+	vc = d1*d4 - d3*d2
+	if vc <= 0 and d1 >= 0 and d3 <= 0: return add(a, mul(ab, d1/(d1-d3)))
+	cp = sub(p, c)
+	d5, d6 = dot(ab, cp), dot(ac, cp)
+	if d6 >= 0 and d5 <= d6: return c
+	vb = d5*d2 - d1*d6
+	if vb <= 0 and d2 >= 0 and d6 <= 0: return add(a, mul(ac, d2/(d2-d6)))
+	va = d3*d6 - d5*d4
+	if va <= 0 and (d4-d3) >= 0 and (d5-d6) >= 0:
+		return add(b, mul(sub(c, b), (d4-d3)/((d4-d3)+(d5-d6))))
+	denom = 1.0/(va+vb+vc)
+	return add(a, add(mul(ab, vb*denom), mul(ac, vc*denom)))
+
+def surface_samples(vertices, triangles, steps=6):
+	samples = []
+	for t in triangles:
+		a, b, c = (vertices[i][0] for i in t)
+		for i in range(steps+1):
+			for j in range(steps+1-i):
+				u, v = i/steps, j/steps
+				samples.append(add(a, add(mul(sub(b, a), u), mul(sub(c, a), v))))
+	return samples
+
+def distance_to_mesh(p, vertices, triangles):
+	best = float("inf")
+	for t in triangles:
+		q = closest_point_on_triangle(p, *(vertices[i][0] for i in t))
+		best = min(best, length(sub(p, q)))
+	return best
+
+def hausdorff(mesh0, mesh1):
+	error = 0.0
+	for p in surface_samples(*mesh0): error = max(error, distance_to_mesh(p, *mesh1))
+	for p in surface_samples(*mesh1): error = max(error, distance_to_mesh(p, *mesh0))
+	return error
+
+###
+# Vertex cache optimisation (Forsyth, "Linear-Speed Vertex Cache Optimisation")
+
+CACHE_SIZE = 32
+CACHE_DECAY_POWER = 1.5
+LAST_TRI_SCORE = 0.75
+VALENCE_BOOST_SCALE = 2.0
+VALENCE_BOOST_POWER = 0.5
+
+def vertex_score(cache_position, remaining_triangles):
+	if remaining_triangles == 0: return -1.0
+	score = 0.0
+	if cache_position >= 0:
+		if cache_position < 3:
+			score = LAST_TRI_SCORE
+		else:
+			score = (1.0 - (cache_position-3)/(CACHE_SIZE-3)) ** CACHE_DECAY_POWER
+	return score + VALENCE_BOOST_SCALE * remaining_triangles ** -VALENCE_BOOST_POWER
+
+def optimize_vertex_cache(vertex_count, triangles):
+	vertex_triangles = [[] for _ in range(vertex_count)]
+	for ti, t in enumerate(triangles):
+		for i in t: vertex_triangles[i].append(ti)
+
+	remaining = [len(ts) for ts in vertex_triangles]
+	cache = []
+	scores = [vertex_score(-1, remaining[i]) for i in range(vertex_count)]
+	emitted = [False]*len(triangles)
+	out = []
+
+	while len(out) < len(triangles):
+		# Best triangle touching the cache, or the best of all if the cache has nothing left
+		candidates = { ti for v in cache for ti in vertex_triangles[v] if not emitted[ti] }
+		if not candidates:
+			candidates = [ti for ti in range(len(triangles)) if not emitted[ti]]
+		best = max(candidates, key=lambda ti: (sum(scores[i] for i in triangles[ti]), -ti))
+
+		emitted[best] = True
+		out.append(triangles[best])
+		for i in triangles[best]:
+			remaining[i] -= 1
+			if i in cache: cache.remove(i)
+			cache.insert(0, i)
+		cache = cache[:CACHE_SIZE]
+
+		for i in set(cache) | set(triangles[best]):
+			position = cache.index(i) if i in cache else -1
+			scores[i] = vertex_score(position, remaining[i])
+	return out
+
+def acmr(triangles, cache_size=16):
+	# Average cache miss ratio for a FIFO cache, for the log
+	cache = []
+	misses = 0
+	for t in triangles:
+		for i in t:
+			if i in cache: continue
+			misses += 1
+			cache.append(i)
+			if len(cache) > cache_size: cache.pop(0)
+	return misses/len(triangles) if triangles else 0.0
+
+def optimize(vertices, triangles):
+	return compact(vertices, optimize_vertex_cache(len(vertices), triangles))
+
+###
+
+def main():
+	# --name value options, everything else is positional
+	options = {}
+	positional = []
+	it = iter(sys.argv[1:])
+	for a in it:
+		if a.startswith("--"):
+			options[a[2:]] = float(next(it))
+		else:
+			positional.append(a)
+
+	source = positional[0] if len(positional) > 0 else "RawAssets/Models/grass_lod_0.gltf"
+	out_dir = positional[1] if len(positional) > 1 else os.path.dirname(source)
+	thresholds_path = positional[2] if len(positional) > 2 else "Models/grass_lods.txt"
+
+	ratio = options.get("ratio", 0.4)
+	max_levels = int(options.get("max-levels", 8)) # #Volatile MAX_GRASS_LOD in terrain_config.h
+	pixels = options.get("pixels", 1.0)
+	screen_width = options.get("screen-width", 1920)
+	fov = math.radians(options.get("fov", 90.0)) # horizontal_fov in Charlie_Submission.cpp
+	world_scale = options.get("world-scale", 18.5/1.96848) # mMaxGrassHeight / BASE_GRASS_HEIGHT
+
+	template, vertices, triangles = read_gltf(source)
+	base = compact(vertices, triangles)
+
+	levels = [optimize(*base)]
+	while len(levels) < max_levels and len(levels[-1][1]) > 1:
+		target = max(1, int(len(levels[-1][1])*ratio))
+		level = simplify(*levels[-1], target)
+		if len(level[1]) >= len(levels[-1][1]):
+			break # Nothing left to collapse without flipping something
+		levels.append(optimize(*level))
+
+	pixels_per_unit_at_unit_distance = (screen_width/2.0)/math.tan(fov/2.0)
+	errors = [hausdorff(base, level) if i > 0 else 0.0 for i, level in enumerate(levels)]
+
+	# A level that isn't more accurate than the next (cheaper) one would never be picked
+	i = 1
+	while i < len(levels)-1:
+		if errors[i] >= errors[i+1]:
+			print("Dropping %i triangle level, the %i triangle one is as accurate" % (len(levels[i][1]), len(levels[i+1][1])))
+			del levels[i], errors[i]
+		else:
+			i += 1
+
+	thresholds = []
+	for i, level in enumerate(levels):
+		error = errors[i]
+		threshold = error*world_scale*pixels_per_unit_at_unit_distance/pixels
+		thresholds.append(threshold)
+
+		path = os.path.join(out_dir, "grass_lod_%i.gltf" % i)
+		write_gltf(path, template, level[0], level[1], "grass%i" % i)
+		print("LOD %i: %3i vertices, %3i triangles, ACMR %.2f, error %.5f -> threshold %.1f" % (
+			i, len(level[0]), len(level[1]), acmr(level[1]), error, threshold))
+
+	os.makedirs(os.path.dirname(thresholds_path) or ".", exist_ok=True)
+	with open(thresholds_path, "w") as f:
+		f.write("# Generated by Tools/generate_grass_lods.py, one line per level: <distance threshold> <index count>\n")
+		f.write("# %i px tolerance at %i px wide, %.0f degree fov, world scale %.3f\n" % (pixels, screen_width, math.degrees(fov), world_scale))
+		for threshold, level in zip(thresholds, levels):
+			f.write("%.3f %i\n" % (threshold, len(level[1])*3))
+
+	for i in range(len(levels), max_levels):
+		stale = os.path.join(out_dir, "grass_lod_%i.gltf" % i)
+		if os.path.exists(stale):
+			print("Note: %s is left over from a longer chain and isn't used anymore" % stale)
+
+	print("Wrote %i levels, thresholds in %s" % (len(levels), thresholds_path))
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,1261 @@
+#pragma once
+
+/*
+
+				Grass queries
+
+	The blades only exist in grass.vert.fsl: where a blade stands, how tall & wide it is and
+	which way it leans all come from hashing its tile's seed & its index in the tile. This
+	redoes the same hash & placement on the CPU, so gameplay code can ask how much grass is
+	somewhere, raycast into it or find the blades around something without reading anything
+	back from the GPU.
+
+	The blades are the ones drawn up close, at full density & the most detailed LOD (so the
+	count is rounded up to whole instances like grass_draw.comp does). Each is a segment from
+	its base to its tip, leaning like in grass_far.vert, with half its width as radius. Wind
+	& the distance widening aren't included, they depend on the time & camera. Placement uses
+	the same float math as the shader, but GPU's may fuse multiply-adds, so positions match
+	to float rounding rather than bit for bit.
+
+	Tiles are generated when a query first touches them & kept in an LRU cache, laid out 4
+	blades wide so each query tests 4 blades per instruction (SSE when there is one). Each
+	cached tile's blades are sorted into a grid of cells by where they stand, with the bounds
+	of each cell's blades, so a ray only tests the blades of cells it passes, walking them
+	front to back until it hits one. grassQueryRaycast4() casts 4 rays at once, testing each
+	blade against all 4 instead. The bounds of every tile generated so far are kept after
+	it's evicted, so rays skip tiles they don't pass without touching the cache. The cache is
+	flushed whenever the field changes (see grassQuerySetField()). Not thread safe, use one
+	GrassQuery per thread.
+
+	Standalone on purpose, Benchmarks/cpu_benchmarks.cpp includes it as well.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "terrain_config.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GRASS_QUERY_SSE 1
+#include <emmintrin.h>
+#else
+#define GRASS_QUERY_SSE 0
+#endif
+
+#define GRASS_QUERY_DEFAULT_CACHE_TILES 256
+#define GRASS_QUERY_TILE_CELLS 8 // Per side of a tile, see GrassQueryTileBlades. At most 8, a tile's cells are a 64 bit mask.
+
+///
+// Inputs
+
+// Normalized heights (the .r grass.vert samples), mWidth*mHeight, row major
+typedef struct GrassQueryHeightField {
+	const float *pHeights;
+	uint32_t     mWidth;
+	uint32_t     mHeight;
+} GrassQueryHeightField;
+
+typedef struct GrassQuerySpecies {
+	float    mDensity;
+	float    mMinWidth;
+	float    mMaxWidth;
+	float    mMinHeight;
+	float    mMaxHeight;
+	uint32_t mBladesPerInstance; // Of the mesh it's drawn with up close
+} GrassQuerySpecies;
+
+// Everything placement depends on. Compared as a whole, so zero it before filling it in.
+typedef struct GrassQueryField {
+	float    mTileDimension;
+	uint32_t mTileCountX;
+	uint32_t mTileCountY;
+	// TileEntry::mTileSeed & mSpeciesMix of tile 0, then every mTileStride bytes
+	const uint32_t *pTileSeeds;
+	const uint32_t *pSpeciesMixes;
+	uint32_t mTileStride;
+
+	uint32_t mBladesPerTile; // GrassDrawUniformData::mPerceivedNumberOfGrass/tile count
+	uint32_t mMaxInstancesPerTile; // SceneUniformData::mMaxInstancesPerTile
+	uint32_t mSpeciesCount;
+	GrassQuerySpecies mSpecies[MAX_GRASS_SPECIES]; // Zeroed past mSpeciesCount
+
+	float    mMaxNaturalAngle;
+	float    mMaxFloorY;
+	float    mTerrainSize[2];
+	float    mHeightSamplePercent; // HEIGHT_MAP_SAMPLE_FOR_HEIGHT_PERCENT
+	GrassQueryHeightField mHeightField; // Without heights, every blade stands at y = 0
+} GrassQueryField;
+
+///
+// Results
+
+typedef struct GrassQueryBlade {
+	float    mBase[3];
+	float    mTip[3];
+	float    mRadius;
+	uint32_t mTile;
+	uint32_t mId; // Index in its species | species << 24, seeds it like in grass.vert
+} GrassQueryBlade;
+
+typedef struct GrassQueryHit {
+	float           mDistance;
+	GrassQueryBlade mBlade;
+} GrassQueryHit;
+
+///
+// Cache
+
+// One tile's blades, structure of arrays. Sorted by the cell of the tile their base is in, row by
+// row, so cell c's blades are mCellStart[c] up to mCellStart[c+1], each cell padded to a multiple
+// of 4 with blades that never match. A cell's bounds include how far its blades lean out of it.
+typedef struct GrassQueryTileBlades {
+	float    *pBaseX;
+	float    *pBaseY;
+	float    *pBaseZ;
+	float    *pTipX;
+	float    *pTipY;
+	float    *pTipZ;
+	float    *pRadius;
+	uint32_t *pId;
+	uint32_t  mCount;
+	uint32_t  mTile;
+	float     mBaseMinY;   // Of the bases
+	float     mBaseMaxY;
+	float     mBoundsMin[3]; // Of the whole segments, radius included
+	float     mBoundsMax[3];
+	uint32_t  mCellStart[GRASS_QUERY_TILE_CELLS*GRASS_QUERY_TILE_CELLS+1];
+	float     mCellMin[3][GRASS_QUERY_TILE_CELLS*GRASS_QUERY_TILE_CELLS]; // Per axis, 4 cells per load
+	float     mCellMax[3][GRASS_QUERY_TILE_CELLS*GRASS_QUERY_TILE_CELLS];
+	uint64_t  mCellMask; // Bit c set if cell c has blades
+	int32_t   mCellRing; // Farthest, in cells, any cell's bounds reach out of it
+	int32_t   mPrev; // LRU list, most recently used first
+	int32_t   mNext;
+} GrassQueryTileBlades;
+
+typedef struct GrassQuery {
+	GrassQueryField mField;
+	float     mReach;      // Farthest any blade reaches out of its tile, radius included
+	float     mMaxRadius;  // Widest blade's, see grassQueryRayBlades()
+
+	uint32_t  mCacheTiles;
+	uint32_t  mBladeCapacity; // Per cached tile, a multiple of 4 with room for each cell's padding
+	GrassQueryTileBlades *pEntries;
+	int32_t  *pTileToEntry; // -1 when not cached
+	float    *pTileBounds;  // Per tile, mBoundsMin & mBoundsMax once generated, NaN before
+	uint32_t *pTileStamps;  // Per tile, the last mStamp it was tested in, see grassQueryRaycast4()
+	uint32_t  mStamp;
+	uint32_t  mTileCount;
+	int32_t   mHead;
+	int32_t   mTail;
+	uint32_t  mUsedEntries;
+	float    *pArena; // Every entry's arrays
+	uint64_t  mArenaBytes;
+	float    *pScratch; // One entry's arrays, to sort a tile's blades into its cells
+
+	uint64_t  mHits;
+	uint64_t  mMisses;
+} GrassQuery;
+
+///
+// 4 wide math, SSE or plain floats
+
+#if GRASS_QUERY_SSE
+typedef __m128 GqFloat4;
+static inline GqFloat4 gqLoad(const float *p) { return _mm_loadu_ps(p); }
+static inline GqFloat4 gqSet(float f) { return _mm_set1_ps(f); }
+static inline GqFloat4 gqAdd(GqFloat4 a, GqFloat4 b) { return _mm_add_ps(a, b); }
+static inline GqFloat4 gqSub(GqFloat4 a, GqFloat4 b) { return _mm_sub_ps(a, b); }
+static inline GqFloat4 gqMul(GqFloat4 a, GqFloat4 b) { return _mm_mul_ps(a, b); }
+static inline GqFloat4 gqDiv(GqFloat4 a, GqFloat4 b) { return _mm_div_ps(a, b); }
+static inline GqFloat4 gqMin(GqFloat4 a, GqFloat4 b) { return _mm_min_ps(a, b); }
+static inline GqFloat4 gqMax(GqFloat4 a, GqFloat4 b) { return _mm_max_ps(a, b); }
+static inline GqFloat4 gqSqrt(GqFloat4 a) { return _mm_sqrt_ps(a); }
+static inline GqFloat4 gqLessEqual(GqFloat4 a, GqFloat4 b) { return _mm_cmple_ps(a, b); }
+static inline GqFloat4 gqGreater(GqFloat4 a, GqFloat4 b) { return _mm_cmpgt_ps(a, b); }
+static inline GqFloat4 gqAnd(GqFloat4 a, GqFloat4 b) { return _mm_and_ps(a, b); }
+static inline GqFloat4 gqSelect(GqFloat4 mask, GqFloat4 a, GqFloat4 b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+static inline uint32_t gqMask(GqFloat4 mask) { return (uint32_t)_mm_movemask_ps(mask); }
+static inline void gqStore(float *p, GqFloat4 a) { _mm_storeu_ps(p, a); }
+#else
+// Masks are 1.0 or 0.0 per lane
+typedef struct GqFloat4 { float v[4]; } GqFloat4;
+#define GQ_LANES(expression) GqFloat4 r; for (int i = 0; i < 4; i += 1) r.v[i] = (expression); return r
+static inline GqFloat4 gqLoad(const float *p) { GQ_LANES(p[i]); }
+static inline GqFloat4 gqSet(float f) { GQ_LANES(f); }
+static inline GqFloat4 gqAdd(GqFloat4 a, GqFloat4 b) { GQ_LANES(a.v[i]+b.v[i]); }
+static inline GqFloat4 gqSub(GqFloat4 a, GqFloat4 b) { GQ_LANES(a.v[i]-b.v[i]); }
+static inline GqFloat4 gqMul(GqFloat4 a, GqFloat4 b) { GQ_LANES(a.v[i]*b.v[i]); }
+static inline GqFloat4 gqDiv(GqFloat4 a, GqFloat4 b) { GQ_LANES(a.v[i]/b.v[i]); }
+static inline GqFloat4 gqMin(GqFloat4 a, GqFloat4 b) { GQ_LANES(a.v[i] < b.v[i] ? a.v[i] : b.v[i]); }
+static inline GqFloat4 gqMax(GqFloat4 a, GqFloat4 b) { GQ_LANES(a.v[i] > b.v[i] ? a.v[i] : b.v[i]); }
+static inline GqFloat4 gqSqrt(GqFloat4 a) { GQ_LANES(sqrtf(a.v[i])); }
+static inline GqFloat4 gqLessEqual(GqFloat4 a, GqFloat4 b) { GQ_LANES(a.v[i] <= b.v[i] ? 1.0f : 0.0f); }
+static inline GqFloat4 gqGreater(GqFloat4 a, GqFloat4 b) { GQ_LANES(a.v[i] > b.v[i] ? 1.0f : 0.0f); }
+static inline GqFloat4 gqAnd(GqFloat4 a, GqFloat4 b) { GQ_LANES(a.v[i] != 0.0f && b.v[i] != 0.0f ? 1.0f : 0.0f); }
+static inline GqFloat4 gqSelect(GqFloat4 mask, GqFloat4 a, GqFloat4 b) { GQ_LANES(mask.v[i] != 0.0f ? a.v[i] : b.v[i]); }
+static inline uint32_t gqMask(GqFloat4 mask) {
+	return (mask.v[0] != 0.0f ? 1u : 0u) | (mask.v[1] != 0.0f ? 2u : 0u) | (mask.v[2] != 0.0f ? 4u : 0u) | (mask.v[3] != 0.0f ? 8u : 0u);
+}
+static inline void gqStore(float *p, GqFloat4 a) { for (int i = 0; i < 4; i += 1) p[i] = a.v[i]; }
+#undef GQ_LANES
+#endif
+
+static inline uint32_t gqMaskCount(uint32_t mask) {
+	static const uint8_t counts[16] = { 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4 };
+	return counts[mask & 0xF];
+}
+
+///
+// Shader mirrors. #Volatile: these follow grass.vert.fsl, grass_draw.comp.fsl,
+// grass_species.h.fsl & sampleHeight() in shared.h.fsl
+
+static inline float grassQueryHash(uint32_t x) {
+	x = ((x >> 16) ^ x) * 0x45d9f3b;
+	x = ((x >> 16) ^ x) * 0x45d9f3b;
+	x = (x >> 16) ^ x;
+	return float(x) / float(0xFFFFFFFF);
+}
+static inline float grassQueryRand(uint32_t *pSeed) {
+	*pSeed *= 0xDEADBEEF;
+	return grassQueryHash(*pSeed);
+}
+static inline uint32_t grassQuerySpeciesSeed(uint32_t tileSeed, uint32_t species) {
+	return tileSeed ^ (species*0x9E3779B9);
+}
+
+// Out of bounds texels read as 0, like LoadTex2D()
+static inline float grassQueryTexel(const GrassQueryHeightField *pHeightField, uint32_t x, uint32_t y) {
+	if (x >= pHeightField->mWidth || y >= pHeightField->mHeight) return 0.0f;
+	return pHeightField->pHeights[(size_t)y*pHeightField->mWidth + x];
+}
+static inline float grassQueryFrac(float x) { return x-floorf(x); }
+static inline float grassQueryLerp(float a, float b, float t) { return a+t*(b-a); }
+// fminf & fmaxf are calls without -ffast-math, these are one instruction. With a NaN, returns b.
+static inline float grassQueryMin(float a, float b) { return a < b ? a : b; }
+static inline float grassQueryMax(float a, float b) { return a > b ? a : b; }
+
+// terrainHeight() in shared.h.fsl, the heights having any sculpted offsets added in
+static inline float grassQuerySampleHeight(const GrassQueryField *pField, float x, float z) {
+	const GrassQueryHeightField *pHeightField = &pField->mHeightField;
+	if (!pHeightField->pHeights) return 0.0f;
+
+	float u = grassQueryFrac((x/pField->mTerrainSize[0])*pField->mHeightSamplePercent);
+	float v = grassQueryFrac((z/pField->mTerrainSize[1])*pField->mHeightSamplePercent);
+	float tx = u*(float)pHeightField->mWidth;
+	float ty = v*(float)pHeightField->mHeight;
+	uint32_t x0 = (uint32_t)floorf(tx), x1 = (uint32_t)ceilf(tx);
+	uint32_t y0 = (uint32_t)floorf(ty), y1 = (uint32_t)ceilf(ty);
+
+	float top = grassQueryLerp(grassQueryTexel(pHeightField, x0, y1), grassQueryTexel(pHeightField, x1, y1), grassQueryFrac(tx));
+	float bottom = grassQueryLerp(grassQueryTexel(pHeightField, x0, y0), grassQueryTexel(pHeightField, x1, y0), grassQueryFrac(tx));
+	return grassQueryLerp(bottom, top, grassQueryFrac(ty));
+}
+
+// First & one past the last instance of a species within its tile, as SpeciesInstanceStarts()
+// splits them
+#define GRASS_QUERY_SPECIES_INSTANCE_UNITS 1024
+static inline void grassQuerySpeciesInstances(const GrassQueryField *pField, uint32_t mix, uint32_t species, uint32_t *pStart, uint32_t *pEnd) {
+	uint32_t weights[MAX_GRASS_SPECIES];
+	uint32_t total = 0;
+	for (uint32_t s = 0; s < MAX_GRASS_SPECIES; s += 1) {
+		const float density = fminf(fmaxf(pField->mSpecies[s].mDensity, 0.0f), 15.9f);
+		weights[s] = ((mix >> (8*s)) & 0xFF)*(uint32_t)(density*16.0f + 0.5f);
+		total += weights[s];
+	}
+
+	const uint32_t maxInstances = pField->mMaxInstancesPerTile;
+	uint32_t starts[MAX_GRASS_SPECIES+1];
+	uint32_t before = 0;
+	starts[0] = 0;
+	for (uint32_t s = 1; s < MAX_GRASS_SPECIES; s += 1) {
+		before += weights[s-1];
+		uint32_t units = total > 0 ? before*GRASS_QUERY_SPECIES_INSTANCE_UNITS/total : 0;
+		starts[s] = (maxInstances/GRASS_QUERY_SPECIES_INSTANCE_UNITS)*units + (maxInstances%GRASS_QUERY_SPECIES_INSTANCE_UNITS)*units/GRASS_QUERY_SPECIES_INSTANCE_UNITS;
+	}
+	starts[MAX_GRASS_SPECIES] = maxInstances;
+	*pStart = starts[species];
+	*pEnd = starts[species+1];
+}
+
+// Blades of each species in a tile, as grass_draw.comp splits them at full density
+static inline uint32_t grassQuerySpeciesBlades(const GrassQueryField *pField, uint32_t mix, uint32_t species) {
+	uint32_t mixTotal = 0;
+	for (uint32_t s = 0; s < pField->mSpeciesCount; s += 1) mixTotal += (mix >> (8*s)) & 0xFF;
+	uint32_t weight = (mix >> (8*species)) & 0xFF;
+	if (weight == 0 || mixTotal == 0) return 0;
+
+	const GrassQuerySpecies *pSpecies = &pField->mSpecies[species];
+	uint32_t count = (uint32_t)((float)pField->mBladesPerTile*((float)weight/(float)mixTotal)*pSpecies->mDensity + 0.5f);
+	if (count == 0) return 0;
+
+	uint32_t bladesPerInstance = pSpecies->mBladesPerInstance > 0 ? pSpecies->mBladesPerInstance : 1;
+	uint32_t instances = (count+bladesPerInstance-1)/bladesPerInstance;
+	uint32_t start, end;
+	grassQuerySpeciesInstances(pField, mix, species, &start, &end);
+	if (instances > end-start) instances = end-start;
+	return instances*bladesPerInstance;
+}
+
+///
+// Cache
+
+static inline uint32_t grassQueryTileSeed(const GrassQueryField *pField, uint32_t tile) {
+	return *(const uint32_t*)((const uint8_t*)pField->pTileSeeds + (size_t)tile*pField->mTileStride);
+}
+static inline uint32_t grassQueryTileMix(const GrassQueryField *pField, uint32_t tile) {
+	return *(const uint32_t*)((const uint8_t*)pField->pSpeciesMixes + (size_t)tile*pField->mTileStride);
+}
+
+static inline void grassQueryUnlink(GrassQuery *pQuery, int32_t entry) {
+	GrassQueryTileBlades *pEntry = &pQuery->pEntries[entry];
+	if (pEntry->mPrev >= 0) pQuery->pEntries[pEntry->mPrev].mNext = pEntry->mNext;
+	else pQuery->mHead = pEntry->mNext;
+	if (pEntry->mNext >= 0) pQuery->pEntries[pEntry->mNext].mPrev = pEntry->mPrev;
+	else pQuery->mTail = pEntry->mPrev;
+	pEntry->mPrev = pEntry->mNext = -1;
+}
+static inline void grassQueryPushFront(GrassQuery *pQuery, int32_t entry) {
+	GrassQueryTileBlades *pEntry = &pQuery->pEntries[entry];
+	pEntry->mPrev = -1;
+	pEntry->mNext = pQuery->mHead;
+	if (pQuery->mHead >= 0) pQuery->pEntries[pQuery->mHead].mPrev = entry;
+	pQuery->mHead = entry;
+	if (pQuery->mTail < 0) pQuery->mTail = entry;
+}
+
+// Drops every cached tile, keeps the memory
+static inline void grassQueryFlush(GrassQuery *pQuery) {
+	for (uint32_t i = 0; i < pQuery->mTileCount; i += 1) {
+		pQuery->pTileToEntry[i] = -1;
+		pQuery->pTileBounds[6*i] = NAN;
+	}
+	pQuery->mHead = pQuery->mTail = -1;
+	pQuery->mUsedEntries = 0;
+}
+
+static inline void grassQueryExit(GrassQuery *pQuery) {
+	free(pQuery->pEntries);
+	free(pQuery->pTileToEntry);
+	free(pQuery->pTileBounds);
+	free(pQuery->pTileStamps);
+	free(pQuery->pArena);
+	free(pQuery->pScratch);
+	*pQuery = {};
+}
+
+// cacheTiles is how many tiles are kept, 0 for GRASS_QUERY_DEFAULT_CACHE_TILES
+static inline void grassQueryInit(GrassQuery *pQuery, uint32_t cacheTiles) {
+	*pQuery = {};
+	pQuery->mCacheTiles = cacheTiles > 0 ? cacheTiles : GRASS_QUERY_DEFAULT_CACHE_TILES;
+	pQuery->pEntries = (GrassQueryTileBlades*)calloc(pQuery->mCacheTiles, sizeof(GrassQueryTileBlades));
+	pQuery->mHead = pQuery->mTail = -1;
+}
+
+// Call whenever anything in the field may have changed (every frame is fine). Returns true if
+// it had, which flushes the cache.
+static inline bool grassQuerySetField(GrassQuery *pQuery, const GrassQueryField *pField) {
+	if (memcmp(pField, &pQuery->mField, sizeof(GrassQueryField)) == 0) return false;
+	memcpy(&pQuery->mField, pField, sizeof(GrassQueryField)); // With the padding, for the memcmp
+
+	const uint32_t tileCount = pField->mTileCountX*pField->mTileCountY;
+	if (tileCount != pQuery->mTileCount) {
+		free(pQuery->pTileToEntry);
+		free(pQuery->pTileBounds);
+		free(pQuery->pTileStamps);
+		pQuery->pTileToEntry = (int32_t*)malloc(sizeof(int32_t)*(tileCount > 0 ? tileCount : 1));
+		pQuery->pTileBounds = (float*)malloc(6*sizeof(float)*(tileCount > 0 ? tileCount : 1));
+		pQuery->pTileStamps = (uint32_t*)calloc(tileCount > 0 ? tileCount : 1, sizeof(uint32_t));
+		pQuery->mStamp = 0;
+		pQuery->mTileCount = tileCount;
+	}
+
+	// Most blades any tile can have, whatever its mix
+	uint32_t capacity = 0;
+	float maxHeight = 0.0f;
+	float maxRadius = 0.0f;
+	for (uint32_t s = 0; s < pField->mSpeciesCount; s += 1) {
+		const GrassQuerySpecies *pSpecies = &pField->mSpecies[s];
+		uint32_t bladesPerInstance = pSpecies->mBladesPerInstance > 0 ? pSpecies->mBladesPerInstance : 1;
+		uint32_t most = (uint32_t)((float)pField->mBladesPerTile*pSpecies->mDensity + 0.5f) + bladesPerInstance;
+		if (most > pField->mMaxInstancesPerTile*bladesPerInstance) most = pField->mMaxInstancesPerTile*bladesPerInstance;
+		capacity += most;
+		maxHeight = fmaxf(maxHeight, fmaxf(pSpecies->mMinHeight, pSpecies->mMaxHeight));
+		maxRadius = fmaxf(maxRadius, 0.5f*fmaxf(fabsf(pSpecies->mMinWidth), fabsf(pSpecies->mMaxWidth)));
+	}
+	capacity = ((capacity+3) & ~3u) + 3*GRASS_QUERY_TILE_CELLS*GRASS_QUERY_TILE_CELLS;
+	const float lean = fminf(fabsf(pField->mMaxNaturalAngle), 3.14159265f/2.0f);
+	pQuery->mReach = maxHeight*sinf(lean) + maxRadius;
+	pQuery->mMaxRadius = maxRadius;
+
+	if (capacity != pQuery->mBladeCapacity) {
+		free(pQuery->pArena);
+		pQuery->mBladeCapacity = capacity;
+		pQuery->mArenaBytes = (uint64_t)pQuery->mCacheTiles*capacity*8*sizeof(float);
+		pQuery->pArena = (float*)malloc(pQuery->mArenaBytes > 0 ? (size_t)pQuery->mArenaBytes : sizeof(float));
+		free(pQuery->pScratch);
+		pQuery->pScratch = (float*)malloc((capacity > 0 ? capacity : 1)*8*sizeof(float));
+		for (uint32_t i = 0; i < pQuery->mCacheTiles; i += 1) {
+			GrassQueryTileBlades *pEntry = &pQuery->pEntries[i];
+			float *p = pQuery->pArena + (size_t)i*capacity*8;
+			pEntry->pBaseX = p; p += capacity;
+			pEntry->pBaseY = p; p += capacity;
+			pEntry->pBaseZ = p; p += capacity;
+			pEntry->pTipX = p; p += capacity;
+			pEntry->pTipY = p; p += capacity;
+			pEntry->pTipZ = p; p += capacity;
+			pEntry->pRadius = p; p += capacity;
+			pEntry->pId = (uint32_t*)p;
+		}
+	}
+
+	grassQueryFlush(pQuery);
+	return true;
+}
+
+// Column or row of a tile's cells p is in, clamped to the tile. The queries use it too, so a
+// blade on a cell's edge is always in the cells they look at.
+static inline uint32_t grassQueryCellCoordinate(float p, float tileStart, float tileDimension) {
+	const float cells = (float)GRASS_QUERY_TILE_CELLS;
+	return (uint32_t)fminf(fmaxf(floorf((p-tileStart)/tileDimension*cells), 0.0f), cells-1.0f);
+}
+static inline uint32_t grassQueryCell(const float box[4], float tileDimension, float x, float z) {
+	return grassQueryCellCoordinate(z, box[1], tileDimension)*GRASS_QUERY_TILE_CELLS + grassQueryCellCoordinate(x, box[0], tileDimension);
+}
+
+// Sorts the blades by cell, a counting sort through the scratch arrays, & pads each cell
+static inline void grassQuerySortCells(const GrassQuery *pQuery, const float box[4], GrassQueryTileBlades *pEntry) {
+	const uint32_t cellCount = GRASS_QUERY_TILE_CELLS*GRASS_QUERY_TILE_CELLS;
+	const uint32_t count = pEntry->mCount;
+	const uint32_t capacity = pQuery->mBladeCapacity;
+	float *pScratch = pQuery->pScratch;
+
+	uint32_t cellBlades[GRASS_QUERY_TILE_CELLS*GRASS_QUERY_TILE_CELLS] = {};
+	for (uint32_t b = 0; b < count; b += 1) cellBlades[grassQueryCell(box, pQuery->mField.mTileDimension, pEntry->pBaseX[b], pEntry->pBaseZ[b])] += 1;
+	pEntry->mCellStart[0] = 0;
+	for (uint32_t c = 0; c < cellCount; c += 1) {
+		pEntry->mCellStart[c+1] = pEntry->mCellStart[c] + ((cellBlades[c]+3) & ~3u);
+		for (uint32_t i = 0; i < 3; i += 1) {
+			pEntry->mCellMin[i][c] = INFINITY;
+			pEntry->mCellMax[i][c] = -INFINITY;
+		}
+	}
+
+	float *const arrays[8] = {
+		pEntry->pBaseX, pEntry->pBaseY, pEntry->pBaseZ, pEntry->pTipX,
+		pEntry->pTipY, pEntry->pTipZ, pEntry->pRadius, (float*)pEntry->pId,
+	};
+	for (uint32_t a = 0; a < 8; a += 1) {
+		memcpy(pScratch + (size_t)a*capacity, arrays[a], count*sizeof(float));
+		// Padding never matches, NaN fails every comparison
+		const float fill = a < 7 ? NAN : 0.0f;
+		for (uint32_t i = 0; i < pEntry->mCellStart[cellCount]; i += 1) arrays[a][i] = fill;
+	}
+
+	uint32_t next[GRASS_QUERY_TILE_CELLS*GRASS_QUERY_TILE_CELLS];
+	memcpy(next, pEntry->mCellStart, sizeof(next));
+	for (uint32_t b = 0; b < count; b += 1) {
+		const uint32_t c = grassQueryCell(box, pQuery->mField.mTileDimension, pScratch[b], pScratch[2*(size_t)capacity + b]);
+		const uint32_t to = next[c]++;
+		for (uint32_t a = 0; a < 8; a += 1) memcpy(&arrays[a][to], &pScratch[(size_t)a*capacity + b], sizeof(float));
+
+		const float radius = pEntry->pRadius[to];
+		const float ends[2][3] = {
+			{ pEntry->pBaseX[to], pEntry->pBaseY[to], pEntry->pBaseZ[to] },
+			{ pEntry->pTipX[to], pEntry->pTipY[to], pEntry->pTipZ[to] },
+		};
+		for (uint32_t e = 0; e < 2; e += 1) {
+			for (uint32_t i = 0; i < 3; i += 1) {
+				pEntry->mCellMin[i][c] = fminf(pEntry->mCellMin[i][c], ends[e][i]-radius);
+				pEntry->mCellMax[i][c] = fmaxf(pEntry->mCellMax[i][c], ends[e][i]+radius);
+			}
+		}
+	}
+
+	const float cellSize = pQuery->mField.mTileDimension/(float)GRASS_QUERY_TILE_CELLS;
+	float overhang = 0.0f;
+	pEntry->mCellMask = 0;
+	for (uint32_t c = 0; c < cellCount; c += 1) {
+		if (pEntry->mCellStart[c] == pEntry->mCellStart[c+1]) continue;
+		pEntry->mCellMask |= 1ull << c;
+		const float cellX = box[0] + (float)(c % GRASS_QUERY_TILE_CELLS)*cellSize;
+		const float cellZ = box[1] + (float)(c / GRASS_QUERY_TILE_CELLS)*cellSize;
+		overhang = fmaxf(overhang, fmaxf(cellX-pEntry->mCellMin[0][c], pEntry->mCellMax[0][c]-(cellX+cellSize)));
+		overhang = fmaxf(overhang, fmaxf(cellZ-pEntry->mCellMin[2][c], pEntry->mCellMax[2][c]-(cellZ+cellSize)));
+	}
+	pEntry->mCellRing = (int32_t)fminf(ceilf(overhang/cellSize), (float)GRASS_QUERY_TILE_CELLS);
+}
+
+// Places a tile's blades like grass.vert
+static inline void grassQueryGenerate(const GrassQuery *pQuery, uint32_t tile, GrassQueryTileBlades *pEntry) {
+	const GrassQueryField *pField = &pQuery->mField;
+	const uint32_t xTile = tile % pField->mTileCountX;
+	const uint32_t yTile = tile / pField->mTileCountX;
+	const uint32_t tileSeed = grassQueryTileSeed(pField, tile);
+	const uint32_t mix = grassQueryTileMix(pField, tile);
+
+	const float tileDimension = pField->mTileDimension;
+	const float box[4] = {
+		(float)xTile*tileDimension,
+		(float)yTile*tileDimension,
+		(float)xTile*tileDimension + tileDimension,
+		(float)yTile*tileDimension + tileDimension,
+	};
+
+	pEntry->mTile = tile;
+	pEntry->mBaseMinY = 1e30f;
+	pEntry->mBaseMaxY = -1e30f;
+	for (uint32_t i = 0; i < 3; i += 1) {
+		pEntry->mBoundsMin[i] = 1e30f;
+		pEntry->mBoundsMax[i] = -1e30f;
+	}
+
+	uint32_t count = 0;
+	for (uint32_t s = 0; s < pField->mSpeciesCount; s += 1) {
+		const GrassQuerySpecies *pSpecies = &pField->mSpecies[s];
+		uint32_t blades = grassQuerySpeciesBlades(pField, mix, s);
+		const uint32_t room = pQuery->mBladeCapacity-3*GRASS_QUERY_TILE_CELLS*GRASS_QUERY_TILE_CELLS;
+		if (blades > room-count) blades = room-count;
+		const uint32_t speciesSeed = grassQuerySpeciesSeed(tileSeed, s);
+
+		for (uint32_t blade = 0; blade < blades; blade += 1) {
+			uint32_t seed = speciesSeed*blade;
+
+			float x = box[0] + grassQueryRand(&seed)*(box[2]-box[0]);
+			float z = box[1] + grassQueryRand(&seed)*(box[3]-box[1]);
+			float y = pField->mMaxFloorY*grassQuerySampleHeight(pField, x, z);
+
+			float width = pSpecies->mMinWidth+(grassQueryRand(&seed)*(pSpecies->mMaxWidth-pSpecies->mMinWidth));
+			float height = pSpecies->mMinHeight+(grassQueryRand(&seed)*(pSpecies->mMaxHeight-pSpecies->mMinHeight));
+			grassQueryRand(&seed); // Rotation about y, doesn't move the tip
+			float lean = grassQueryRand(&seed)*pField->mMaxNaturalAngle;
+			grassQueryRand(&seed); // Sway
+			grassQueryRand(&seed);
+			float axisX = grassQueryRand(&seed)*2-1;
+			float axisZ = grassQueryRand(&seed)*2-1;
+			float axisLength = sqrtf(axisX*axisX + axisZ*axisZ);
+			if (axisLength > 0.0f) {
+				axisX /= axisLength;
+				axisZ /= axisLength;
+			}
+
+			// rotateAxisAngle((0, height, 0), axis, lean), the axis is horizontal
+			float sinLean = sinf(lean)*height;
+			float tipX = x - axisZ*sinLean;
+			float tipY = y + cosf(lean)*height;
+			float tipZ = z + axisX*sinLean;
+			float radius = 0.5f*fabsf(width);
+
+			pEntry->pBaseX[count] = x;
+			pEntry->pBaseY[count] = y;
+			pEntry->pBaseZ[count] = z;
+			pEntry->pTipX[count] = tipX;
+			pEntry->pTipY[count] = tipY;
+			pEntry->pTipZ[count] = tipZ;
+			pEntry->pRadius[count] = radius;
+			pEntry->pId[count] = blade | (s << 24);
+			count += 1;
+
+			pEntry->mBaseMinY = fminf(pEntry->mBaseMinY, y);
+			pEntry->mBaseMaxY = fmaxf(pEntry->mBaseMaxY, y);
+			const float ends[2][3] = { { x, y, z }, { tipX, tipY, tipZ } };
+			for (uint32_t e = 0; e < 2; e += 1) {
+				for (uint32_t i = 0; i < 3; i += 1) {
+					pEntry->mBoundsMin[i] = fminf(pEntry->mBoundsMin[i], ends[e][i]-radius);
+					pEntry->mBoundsMax[i] = fmaxf(pEntry->mBoundsMax[i], ends[e][i]+radius);
+				}
+			}
+		}
+	}
+	pEntry->mCount = count;
+	grassQuerySortCells(pQuery, box, pEntry);
+}
+
+// A tile's blades, generated if they aren't cached. Valid until the next call.
+static inline const GrassQueryTileBlades *grassQueryTile(GrassQuery *pQuery, uint32_t tile) {
+	int32_t entry = pQuery->pTileToEntry[tile];
+	if (entry >= 0) {
+		pQuery->mHits += 1;
+		if (entry != pQuery->mHead) {
+			grassQueryUnlink(pQuery, entry);
+			grassQueryPushFront(pQuery, entry);
+		}
+		return &pQuery->pEntries[entry];
+	}
+
+	pQuery->mMisses += 1;
+	if (pQuery->mUsedEntries < pQuery->mCacheTiles) {
+		entry = (int32_t)pQuery->mUsedEntries;
+		pQuery->mUsedEntries += 1;
+	} else {
+		entry = pQuery->mTail;
+		if (pQuery->pEntries[entry].mTile != UINT32_MAX) pQuery->pTileToEntry[pQuery->pEntries[entry].mTile] = -1;
+		grassQueryUnlink(pQuery, entry);
+	}
+	grassQueryGenerate(pQuery, tile, &pQuery->pEntries[entry]);
+	pQuery->pTileToEntry[tile] = entry;
+	memcpy(&pQuery->pTileBounds[6*tile], pQuery->pEntries[entry].mBoundsMin, 3*sizeof(float));
+	memcpy(&pQuery->pTileBounds[6*tile+3], pQuery->pEntries[entry].mBoundsMax, 3*sizeof(float));
+	grassQueryPushFront(pQuery, entry);
+	return &pQuery->pEntries[entry];
+}
+
+// Drops one tile's cached blades & bounds, e.g. after the heights under it were edited.
+// Its entry goes to the back of the LRU list, so it's the first to be reused.
+static inline void grassQueryInvalidateTile(GrassQuery *pQuery, uint32_t tile) {
+	if (tile >= pQuery->mTileCount) return;
+	pQuery->pTileBounds[6*tile] = NAN;
+	if (pQuery->pTileToEntry[tile] < 0) return;
+	const int32_t entry = pQuery->pTileToEntry[tile];
+	pQuery->pTileToEntry[tile] = -1;
+	pQuery->pEntries[entry].mTile = UINT32_MAX;
+	if (entry == pQuery->mTail) return;
+	
+	grassQueryUnlink(pQuery, entry);
+	GrassQueryTileBlades *pEntry = &pQuery->pEntries[entry];
+	pEntry->mPrev = pQuery->mTail;
+	pQuery->pEntries[pQuery->mTail].mNext = entry;
+	pQuery->mTail = entry;
+}
+
+static inline void grassQueryBlade(const GrassQueryTileBlades *pEntry, uint32_t i, GrassQueryBlade *pBlade) {
+	pBlade->mBase[0] = pEntry->pBaseX[i];
+	pBlade->mBase[1] = pEntry->pBaseY[i];
+	pBlade->mBase[2] = pEntry->pBaseZ[i];
+	pBlade->mTip[0] = pEntry->pTipX[i];
+	pBlade->mTip[1] = pEntry->pTipY[i];
+	pBlade->mTip[2] = pEntry->pTipZ[i];
+	pBlade->mRadius = pEntry->pRadius[i];
+	pBlade->mTile = pEntry->mTile;
+	pBlade->mId = pEntry->pId[i];
+}
+
+// Tiles overlapping [minX, maxX] x [minZ, maxZ], false if there are none
+static inline bool grassQueryTileRange(const GrassQuery *pQuery, float minX, float minZ, float maxX, float maxZ, uint32_t range[4]) {
+	const GrassQueryField *pField = &pQuery->mField;
+	if (pQuery->mTileCount == 0 || !(minX <= maxX) || !(minZ <= maxZ)) return false;
+
+	float x0 = floorf(minX/pField->mTileDimension), x1 = floorf(maxX/pField->mTileDimension);
+	float z0 = floorf(minZ/pField->mTileDimension), z1 = floorf(maxZ/pField->mTileDimension);
+	if (x1 < 0.0f || z1 < 0.0f || x0 >= (float)pField->mTileCountX || z0 >= (float)pField->mTileCountY) return false;
+	range[0] = x0 < 0.0f ? 0 : (uint32_t)x0;
+	range[1] = z0 < 0.0f ? 0 : (uint32_t)z0;
+	range[2] = x1 >= (float)pField->mTileCountX ? pField->mTileCountX-1 : (uint32_t)x1;
+	range[3] = z1 >= (float)pField->mTileCountY ? pField->mTileCountY-1 : (uint32_t)z1;
+	return true;
+}
+
+// Cells of tile x, z whose bases can be in [minX, maxX] x [minZ, maxZ], the tile overlapping it.
+// A row's cells are next to each other, so row z's blades are mCellStart[z*cells + range[0]] up
+// to mCellStart[z*cells + range[2] + 1].
+static inline void grassQueryCellRange(const GrassQuery *pQuery, uint32_t x, uint32_t z, float minX, float minZ, float maxX, float maxZ, uint32_t range[4]) {
+	const float tileDimension = pQuery->mField.mTileDimension;
+	const float origin[2] = { (float)x*tileDimension, (float)z*tileDimension };
+	range[0] = grassQueryCellCoordinate(minX, origin[0], tileDimension);
+	range[1] = grassQueryCellCoordinate(minZ, origin[1], tileDimension);
+	range[2] = grassQueryCellCoordinate(maxX, origin[0], tileDimension);
+	range[3] = grassQueryCellCoordinate(maxZ, origin[1], tileDimension);
+}
+
+///
+// Queries
+
+// Blades whose base is inside the box
+static inline uint32_t grassQueryCountInBox(GrassQuery *pQuery, const float boxMin[3], const float boxMax[3]) {
+	uint32_t range[4];
+	if (!grassQueryTileRange(pQuery, boxMin[0], boxMin[2], boxMax[0], boxMax[2], range)) return 0;
+
+	const float tileDimension = pQuery->mField.mTileDimension;
+	const GqFloat4 minX = gqSet(boxMin[0]), minY = gqSet(boxMin[1]), minZ = gqSet(boxMin[2]);
+	const GqFloat4 maxX = gqSet(boxMax[0]), maxY = gqSet(boxMax[1]), maxZ = gqSet(boxMax[2]);
+
+	uint32_t count = 0;
+	for (uint32_t z = range[1]; z <= range[3]; z += 1) {
+		for (uint32_t x = range[0]; x <= range[2]; x += 1) {
+			const GrassQueryTileBlades *pEntry = grassQueryTile(pQuery, z*pQuery->mField.mTileCountX + x);
+			if (pEntry->mCount == 0 || pEntry->mBaseMinY > boxMax[1] || pEntry->mBaseMaxY < boxMin[1]) continue;
+
+			// Whole tile inside
+			if ((float)x*tileDimension >= boxMin[0] && (float)(x+1)*tileDimension <= boxMax[0]
+				&& (float)z*tileDimension >= boxMin[2] && (float)(z+1)*tileDimension <= boxMax[2]
+				&& pEntry->mBaseMinY >= boxMin[1] && pEntry->mBaseMaxY <= boxMax[1])
+			{
+				count += pEntry->mCount;
+				continue;
+			}
+
+			uint32_t cells[4];
+			grassQueryCellRange(pQuery, x, z, boxMin[0], boxMin[2], boxMax[0], boxMax[2], cells);
+			for (uint32_t row = cells[1]; row <= cells[3]; row += 1) {
+				const uint32_t end = pEntry->mCellStart[row*GRASS_QUERY_TILE_CELLS + cells[2] + 1];
+				for (uint32_t i = pEntry->mCellStart[row*GRASS_QUERY_TILE_CELLS + cells[0]]; i < end; i += 4) {
+					GqFloat4 bx = gqLoad(pEntry->pBaseX+i), by = gqLoad(pEntry->pBaseY+i), bz = gqLoad(pEntry->pBaseZ+i);
+					GqFloat4 inside = gqAnd(gqAnd(gqLessEqual(minX, bx), gqLessEqual(bx, maxX)),
+						gqAnd(gqAnd(gqLessEqual(minY, by), gqLessEqual(by, maxY)), gqAnd(gqLessEqual(minZ, bz), gqLessEqual(bz, maxZ))));
+					count += gqMaskCount(gqMask(inside));
+				}
+			}
+		}
+	}
+	return count;
+}
+
+// Blades whose base is within radius of center. Returns how many there are, only the first
+// maxBlades are written.
+static inline uint32_t grassQueryGatherRadius(GrassQuery *pQuery, const float center[3], float radius, GrassQueryBlade *pBlades, uint32_t maxBlades) {
+	uint32_t range[4];
+	if (!grassQueryTileRange(pQuery, center[0]-radius, center[2]-radius, center[0]+radius, center[2]+radius, range)) return 0;
+
+	const GqFloat4 cx = gqSet(center[0]), cy = gqSet(center[1]), cz = gqSet(center[2]);
+	const GqFloat4 radiusSquared = gqSet(radius*radius);
+
+	uint32_t count = 0;
+	for (uint32_t z = range[1]; z <= range[3]; z += 1) {
+		for (uint32_t x = range[0]; x <= range[2]; x += 1) {
+			const GrassQueryTileBlades *pEntry = grassQueryTile(pQuery, z*pQuery->mField.mTileCountX + x);
+			if (pEntry->mCount == 0 || pEntry->mBaseMinY > center[1]+radius || pEntry->mBaseMaxY < center[1]-radius) continue;
+
+			uint32_t cells[4];
+			grassQueryCellRange(pQuery, x, z, center[0]-radius, center[2]-radius, center[0]+radius, center[2]+radius, cells);
+			for (uint32_t row = cells[1]; row <= cells[3]; row += 1) {
+				const uint32_t end = pEntry->mCellStart[row*GRASS_QUERY_TILE_CELLS + cells[2] + 1];
+				for (uint32_t i = pEntry->mCellStart[row*GRASS_QUERY_TILE_CELLS + cells[0]]; i < end; i += 4) {
+					GqFloat4 dx = gqSub(gqLoad(pEntry->pBaseX+i), cx);
+					GqFloat4 dy = gqSub(gqLoad(pEntry->pBaseY+i), cy);
+					GqFloat4 dz = gqSub(gqLoad(pEntry->pBaseZ+i), cz);
+					uint32_t mask = gqMask(gqLessEqual(gqAdd(gqAdd(gqMul(dx, dx), gqMul(dy, dy)), gqMul(dz, dz)), radiusSquared));
+					for (; mask != 0; mask &= mask-1) {
+						uint32_t lane = 0;
+						while (((mask >> lane) & 1) == 0) lane += 1;
+						if (count < maxBlades) grassQueryBlade(pEntry, i+lane, &pBlades[count]);
+						count += 1;
+					}
+				}
+			}
+		}
+	}
+	return count;
+}
+
+// Reciprocals for slab tests. Huge rather than infinite for axes the ray is parallel to, so 0*it
+// isn't NaN.
+static inline float grassQueryInverse(float d) {
+	return fabsf(d) < 1e-12f ? (d < 0.0f ? -1e30f : 1e30f) : 1.0f/d;
+}
+
+// Where the ray enters a box, false if it misses it before tMax. inverse is grassQueryInverse()
+// of each axis of the direction.
+static inline bool grassQueryRayBox(const float boxMin[3], const float boxMax[3], const float origin[3], const float inverse[3], float tMax, float *pEnter) {
+	float tMin = 0.0f;
+	for (uint32_t i = 0; i < 3; i += 1) {
+		float t0 = (boxMin[i]-origin[i])*inverse[i];
+		float t1 = (boxMax[i]-origin[i])*inverse[i];
+		tMin = grassQueryMax(tMin, grassQueryMin(t0, t1));
+		tMax = grassQueryMin(tMax, grassQueryMax(t0, t1));
+	}
+	if (tMin > tMax) return false;
+	*pEnter = tMin;
+	return true;
+}
+
+// Ray against blades first up to end of a tile, closer than *pBest. Both are multiples of 4. The
+// distance is where the ray gets within the radius, assuming it's about perpendicular, so up to
+// the radius before its closest approach: bounds are tested up to mMaxRadius past *pBest.
+static inline bool grassQueryRayBlades(const GrassQueryTileBlades *pEntry, uint32_t first, uint32_t end, const float origin[3], const float direction[3], float *pBest, GrassQueryHit *pHit) {
+	const GqFloat4 ox = gqSet(origin[0]), oy = gqSet(origin[1]), oz = gqSet(origin[2]);
+	const GqFloat4 dx = gqSet(direction[0]), dy = gqSet(direction[1]), dz = gqSet(direction[2]);
+	const GqFloat4 zero = gqSet(0.0f), one = gqSet(1.0f), epsilon = gqSet(1e-8f);
+
+	bool hit = false;
+	for (uint32_t i = first; i < end; i += 4) {
+		const GqFloat4 bx = gqLoad(pEntry->pBaseX+i), by = gqLoad(pEntry->pBaseY+i), bz = gqLoad(pEntry->pBaseZ+i);
+		const GqFloat4 ex = gqSub(gqLoad(pEntry->pTipX+i), bx), ey = gqSub(gqLoad(pEntry->pTipY+i), by), ez = gqSub(gqLoad(pEntry->pTipZ+i), bz);
+		const GqFloat4 wx = gqSub(ox, bx), wy = gqSub(oy, by), wz = gqSub(oz, bz);
+		const GqFloat4 radius = gqLoad(pEntry->pRadius+i);
+
+		// Closest points of ray o + t*d (|d| = 1) & segment b + s*e
+		GqFloat4 de = gqAdd(gqAdd(gqMul(dx, ex), gqMul(dy, ey)), gqMul(dz, ez));
+		GqFloat4 ee = gqAdd(gqAdd(gqMul(ex, ex), gqMul(ey, ey)), gqMul(ez, ez));
+		GqFloat4 dw = gqAdd(gqAdd(gqMul(dx, wx), gqMul(dy, wy)), gqMul(dz, wz));
+		GqFloat4 ew = gqAdd(gqAdd(gqMul(ex, wx), gqMul(ey, wy)), gqMul(ez, wz));
+		GqFloat4 denominator = gqSub(ee, gqMul(de, de));
+
+		GqFloat4 s = gqSelect(gqGreater(denominator, epsilon), gqDiv(gqSub(ew, gqMul(de, dw)), denominator), zero);
+		s = gqMin(gqMax(s, zero), one);
+		GqFloat4 t = gqMax(gqSub(gqMul(s, de), dw), zero);
+		s = gqMin(gqMax(gqDiv(gqAdd(ew, gqMul(t, de)), gqMax(ee, epsilon)), zero), one);
+
+		GqFloat4 px = gqSub(gqAdd(wx, gqMul(t, dx)), gqMul(s, ex));
+		GqFloat4 py = gqSub(gqAdd(wy, gqMul(t, dy)), gqMul(s, ey));
+		GqFloat4 pz = gqSub(gqAdd(wz, gqMul(t, dz)), gqMul(s, ez));
+		GqFloat4 distanceSquared = gqAdd(gqAdd(gqMul(px, px), gqMul(py, py)), gqMul(pz, pz));
+		GqFloat4 radiusSquared = gqMul(radius, radius);
+
+		uint32_t mask = gqMask(gqLessEqual(distanceSquared, radiusSquared));
+		if (mask == 0) continue;
+
+		float distances[4];
+		gqStore(distances, gqMax(gqSub(t, gqSqrt(gqMax(gqSub(radiusSquared, distanceSquared), zero))), zero));
+		for (uint32_t lane = 0; lane < 4; lane += 1) {
+			if (((mask >> lane) & 1) == 0 || distances[lane] >= *pBest) continue;
+			*pBest = distances[lane];
+			pHit->mDistance = distances[lane];
+			grassQueryBlade(pEntry, i+lane, &pHit->mBlade);
+			hit = true;
+		}
+	}
+	return hit;
+}
+
+// Ray against the cells in mask, 4 cells' bounds per test, rows & cells in the order the ray goes
+static inline bool grassQueryRayCells(const GrassQuery *pQuery, const GrassQueryTileBlades *pEntry, uint64_t mask, const float origin[3], const float direction[3], const GqFloat4 inverse[3], float *pBest, GrassQueryHit *pHit) {
+	const GqFloat4 o[3] = { gqSet(origin[0]), gqSet(origin[1]), gqSet(origin[2]) };
+	const GqFloat4 zero = gqSet(0.0f);
+	const uint32_t cells = GRASS_QUERY_TILE_CELLS;
+	const bool backX = direction[0] < 0.0f, backZ = direction[2] < 0.0f;
+	bool hit = false;
+	for (uint32_t zi = 0; zi < cells; zi += 1) {
+		const uint32_t z = backZ ? cells-1-zi : zi;
+		for (uint32_t gi = 0; gi < cells/4; gi += 1) {
+			const uint32_t first = z*cells + (backX ? cells/4-1-gi : gi)*4;
+			const uint32_t group = (uint32_t)(mask >> first) & 0xF;
+			if (group == 0) continue;
+			GqFloat4 tEnter = zero, tExit = gqSet(*pBest + pQuery->mMaxRadius);
+			for (uint32_t i = 0; i < 3; i += 1) {
+				GqFloat4 t0 = gqMul(gqSub(gqLoad(&pEntry->mCellMin[i][first]), o[i]), inverse[i]);
+				GqFloat4 t1 = gqMul(gqSub(gqLoad(&pEntry->mCellMax[i][first]), o[i]), inverse[i]);
+				tEnter = gqMax(tEnter, gqMin(t0, t1));
+				tExit = gqMin(tExit, gqMax(t0, t1));
+			}
+			const uint32_t lanes = gqMask(gqLessEqual(tEnter, tExit)) & group;
+			for (uint32_t li = 0; li < 4 && lanes != 0; li += 1) {
+				const uint32_t lane = backX ? 3-li : li;
+				if (((lanes >> lane) & 1) == 0) continue;
+				const uint32_t c = first+lane;
+				if (grassQueryRayBlades(pEntry, pEntry->mCellStart[c], pEntry->mCellStart[c+1], origin, direction, pBest, pHit)) hit = true;
+			}
+		}
+	}
+	return hit;
+}
+
+// Cells x0 to x1 of rows z0 to z1, clipped to the tile, one bit per cell
+static inline uint64_t grassQueryCellRect(int32_t x0, int32_t z0, int32_t x1, int32_t z1) {
+	const int32_t last = GRASS_QUERY_TILE_CELLS-1;
+	x0 = x0 < 0 ? 0 : x0;
+	z0 = z0 < 0 ? 0 : z0;
+	x1 = x1 > last ? last : x1;
+	z1 = z1 > last ? last : z1;
+	if (x0 > x1 || z0 > z1) return 0;
+	const uint64_t row = ((1ull << (x1-x0+1))-1) << x0;
+	uint64_t rect = 0;
+	for (int32_t z = z0; z <= z1; z += 1) rect |= row << (z*GRASS_QUERY_TILE_CELLS);
+	return rect;
+}
+
+// Ray against a tile's blades, closer than *pBest. Each blade is a segment with a radius. Walks the
+// cells the ray passes front to back (the tile's grid grown by mCellRing, as blades lean out of
+// their cells), testing the cells within mCellRing of each it hasn't tested yet. A cell past the
+// first hit can't hold anything closer, so it stops there.
+static inline bool grassQueryRayTile(const GrassQuery *pQuery, const GrassQueryTileBlades *pEntry, const float origin[3], const float direction[3], const float inverse[3], float *pBest, GrassQueryHit *pHit) {
+	float enter;
+	if (pEntry->mCellMask == 0 || !grassQueryRayBox(pEntry->mBoundsMin, pEntry->mBoundsMax, origin, inverse, *pBest + pQuery->mMaxRadius, &enter)) return false;
+
+	const GqFloat4 inverse4[3] = { gqSet(inverse[0]), gqSet(inverse[1]), gqSet(inverse[2]) };
+	const float tileDimension = pQuery->mField.mTileDimension;
+	const float cellSize = tileDimension/(float)GRASS_QUERY_TILE_CELLS;
+	const int32_t ring = pEntry->mCellRing;
+	const int32_t lo = -ring, hi = GRASS_QUERY_TILE_CELLS-1+ring;
+	const float tileStart[2] = {
+		(float)(pEntry->mTile % pQuery->mField.mTileCountX)*tileDimension,
+		(float)(pEntry->mTile / pQuery->mField.mTileCountX)*tileDimension,
+	};
+	const float o2[2] = { origin[0], origin[2] };
+	const float d2[2] = { direction[0], direction[2] };
+
+	// Amanatides & Woo over the cells, from where the ray enters the tile's bounds
+	int32_t cell[2], step[2];
+	float tNext[2], tDelta[2];
+	for (uint32_t i = 0; i < 2; i += 1) {
+		float c = floorf((o2[i]+d2[i]*enter-tileStart[i])/cellSize);
+		cell[i] = c < (float)lo ? lo : (c > (float)hi ? hi : (int32_t)c);
+		const float edge = tileStart[i] + (float)cell[i]*cellSize;
+		if (d2[i] > 1e-12f) {
+			step[i] = 1;
+			tNext[i] = (edge+cellSize-o2[i])/d2[i];
+			tDelta[i] = cellSize/d2[i];
+		} else if (d2[i] < -1e-12f) {
+			step[i] = -1;
+			tNext[i] = (edge-o2[i])/d2[i];
+			tDelta[i] = -cellSize/d2[i];
+		} else {
+			step[i] = 0;
+			tNext[i] = tDelta[i] = INFINITY;
+		}
+	}
+
+	uint64_t tested = 0;
+	float cellEnter = enter;
+	bool hit = false;
+	while (cellEnter <= *pBest + pQuery->mMaxRadius) {
+		const uint64_t mask = grassQueryCellRect(cell[0]-ring, cell[1]-ring, cell[0]+ring, cell[1]+ring) & pEntry->mCellMask & ~tested;
+		if (mask != 0) {
+			tested |= mask;
+			if (grassQueryRayCells(pQuery, pEntry, mask, origin, direction, inverse4, pBest, pHit)) hit = true;
+			if (tested == pEntry->mCellMask) break;
+		}
+
+		const uint32_t axis = tNext[0] < tNext[1] ? 0 : 1;
+		cellEnter = tNext[axis];
+		cell[axis] += step[axis];
+		tNext[axis] += tDelta[axis];
+		if (cell[axis] < lo || cell[axis] > hi) break;
+	}
+	return hit;
+}
+
+// Amanatides & Woo over the tiles along a ray, over the grid grown by the ring of tiles blades
+// can lean in from. Each step gives the tiles around the ray's tile it hasn't given yet.
+typedef struct GrassQueryWalk {
+	int32_t mCell[2];
+	int32_t mStep[2];
+	float   mNext[2];
+	float   mDelta[2];
+	float   mEnter; // Of the current tile
+	float   mExit;  // Of the grown grid, or the ray's end
+	int32_t mRing;
+	int32_t mAxis;  // The current tile was stepped into along, -1 for the first
+} GrassQueryWalk;
+
+// direction is normalized. False if the ray misses the grid.
+static inline bool grassQueryWalkBegin(const GrassQuery *pQuery, const float origin[3], const float direction[3], float maxDistance, GrassQueryWalk *pWalk) {
+	const GrassQueryField *pField = &pQuery->mField;
+	const float tileDimension = pField->mTileDimension;
+	const int32_t ring = (int32_t)ceilf(pQuery->mReach/tileDimension);
+	const int32_t counts[2] = { (int32_t)pField->mTileCountX, (int32_t)pField->mTileCountY };
+	const float o2[2] = { origin[0], origin[2] };
+	const float d2[2] = { direction[0], direction[2] };
+
+	// Clipped to the grid, grown by the ring
+	float tEnter = 0.0f, tExit = maxDistance;
+	for (uint32_t i = 0; i < 2; i += 1) {
+		const float lo = -(float)ring*tileDimension;
+		const float hi = (float)(counts[i]+ring)*tileDimension;
+		if (fabsf(d2[i]) < 1e-12f) {
+			if (o2[i] < lo || o2[i] > hi) return false;
+			continue;
+		}
+		float t0 = (lo-o2[i])/d2[i];
+		float t1 = (hi-o2[i])/d2[i];
+		tEnter = grassQueryMax(tEnter, grassQueryMin(t0, t1));
+		tExit = grassQueryMin(tExit, grassQueryMax(t0, t1));
+	}
+	if (tEnter > tExit) return false;
+
+	for (uint32_t i = 0; i < 2; i += 1) {
+		float c = floorf((o2[i]+d2[i]*tEnter)/tileDimension);
+		pWalk->mCell[i] = c < (float)-ring ? -ring : (c > (float)(counts[i]-1+ring) ? counts[i]-1+ring : (int32_t)c);
+		if (d2[i] > 1e-12f) {
+			pWalk->mStep[i] = 1;
+			pWalk->mNext[i] = ((float)(pWalk->mCell[i]+1)*tileDimension-o2[i])/d2[i];
+			pWalk->mDelta[i] = tileDimension/d2[i];
+		} else if (d2[i] < -1e-12f) {
+			pWalk->mStep[i] = -1;
+			pWalk->mNext[i] = ((float)pWalk->mCell[i]*tileDimension-o2[i])/d2[i];
+			pWalk->mDelta[i] = -tileDimension/d2[i];
+		} else {
+			pWalk->mStep[i] = 0;
+			pWalk->mNext[i] = pWalk->mDelta[i] = INFINITY;
+		}
+	}
+	pWalk->mEnter = tEnter;
+	pWalk->mExit = tExit;
+	pWalk->mRing = ring;
+	pWalk->mAxis = -1;
+	return true;
+}
+
+// Tiles x range[0] to range[2], z range[1] to range[3] of this step, unclipped. The ring only
+// moves forward, so after the first tile only the row or column it moved into is new.
+static inline void grassQueryWalkTiles(const GrassQueryWalk *pWalk, int32_t range[4]) {
+	range[0] = pWalk->mCell[0]-pWalk->mRing;
+	range[1] = pWalk->mCell[1]-pWalk->mRing;
+	range[2] = pWalk->mCell[0]+pWalk->mRing;
+	range[3] = pWalk->mCell[1]+pWalk->mRing;
+	if (pWalk->mAxis >= 0) range[pWalk->mAxis] = range[pWalk->mAxis+2] = pWalk->mCell[pWalk->mAxis] + pWalk->mStep[pWalk->mAxis]*pWalk->mRing;
+}
+
+// False once the ray leaves the grid. Every tile a blade leaning over the ray before mEnter can
+// be in has been given by then, so a caller with a hit closer than mEnter can stop.
+static inline bool grassQueryWalkNext(const GrassQuery *pQuery, GrassQueryWalk *pWalk) {
+	const int32_t axis = pWalk->mNext[0] < pWalk->mNext[1] ? 0 : 1;
+	pWalk->mAxis = axis;
+	pWalk->mEnter = pWalk->mNext[axis];
+	if (pWalk->mEnter > pWalk->mExit) return false;
+	pWalk->mCell[axis] += pWalk->mStep[axis];
+	pWalk->mNext[axis] += pWalk->mDelta[axis];
+	const int32_t count = (int32_t)(axis == 0 ? pQuery->mField.mTileCountX : pQuery->mField.mTileCountY);
+	return pWalk->mCell[axis] >= -pWalk->mRing && pWalk->mCell[axis] <= count-1+pWalk->mRing;
+}
+
+// Where the ray passes tile x, z's footprint grown by how far blades reach out of it, within
+// [0, tMax]. Tells whether it's worth generating the tile's blades.
+static inline bool grassQueryRayFootprint(const GrassQuery *pQuery, int32_t x, int32_t z, const float origin[3], const float inverse[3], float tMax, float *pEnter, float *pExit) {
+	const float tileDimension = pQuery->mField.mTileDimension;
+	const float x0 = ((float)x*tileDimension-pQuery->mReach-origin[0])*inverse[0];
+	const float x1 = ((float)(x+1)*tileDimension+pQuery->mReach-origin[0])*inverse[0];
+	const float z0 = ((float)z*tileDimension-pQuery->mReach-origin[2])*inverse[2];
+	const float z1 = ((float)(z+1)*tileDimension+pQuery->mReach-origin[2])*inverse[2];
+	const float t0 = grassQueryMax(0.0f, grassQueryMax(grassQueryMin(x0, x1), grassQueryMin(z0, z1)));
+	const float t1 = grassQueryMin(tMax, grassQueryMin(grassQueryMax(x0, x1), grassQueryMax(z0, z1)));
+	*pEnter = t0;
+	*pExit = t1;
+	return t0 <= t1;
+}
+
+// Tile x, z for grassQueryRaycast(). A tile generated before is skipped by its bounds (so its
+// heights too) without touching the cache, others if the ray doesn't pass their footprint.
+static inline bool grassQueryRayWalkTile(GrassQuery *pQuery, int32_t x, int32_t z, const float origin[3], const float direction[3], const float inverse[3], float *pBest, GrassQueryHit *pHit) {
+	const GrassQueryField *pField = &pQuery->mField;
+	if (x < 0 || z < 0 || x >= (int32_t)pField->mTileCountX || z >= (int32_t)pField->mTileCountY) return false;
+	const uint32_t tile = (uint32_t)z*pField->mTileCountX + (uint32_t)x;
+
+	const float *pBounds = &pQuery->pTileBounds[6*tile];
+	const float tMax = *pBest + pQuery->mMaxRadius;
+	float t0, t1;
+	if (pBounds[0] == pBounds[0]) {
+		if (pBounds[0] > pBounds[3] || !grassQueryRayBox(pBounds, pBounds+3, origin, inverse, tMax, &t0)) return false;
+	} else if (!grassQueryRayFootprint(pQuery, x, z, origin, inverse, tMax, &t0, &t1)) {
+		return false;
+	}
+
+	const GrassQueryTileBlades *pEntry = grassQueryTile(pQuery, tile);
+	return grassQueryRayTile(pQuery, pEntry, origin, direction, inverse, pBest, pHit);
+}
+
+// Closest blade along the ray within maxDistance. Walks the tiles the ray crosses, testing the
+// ones around each that blades could lean in from, the one it starts in first.
+static inline bool grassQueryRaycast(GrassQuery *pQuery, const float origin[3], const float direction[3], float maxDistance, GrassQueryHit *pHit) {
+	if (pQuery->mTileCount == 0) return false;
+
+	float length = sqrtf(direction[0]*direction[0] + direction[1]*direction[1] + direction[2]*direction[2]);
+	if (!(length > 0.0f)) return false;
+	const float d[3] = { direction[0]/length, direction[1]/length, direction[2]/length };
+	const float inverse[3] = { grassQueryInverse(d[0]), grassQueryInverse(d[1]), grassQueryInverse(d[2]) };
+
+	GrassQueryWalk walk;
+	if (!grassQueryWalkBegin(pQuery, origin, d, maxDistance, &walk)) return false;
+
+	float best = walk.mExit;
+	bool hit = grassQueryRayWalkTile(pQuery, walk.mCell[0], walk.mCell[1], origin, d, inverse, &best, pHit);
+	do {
+		if (walk.mEnter > best + pQuery->mMaxRadius) break;
+
+		int32_t range[4];
+		grassQueryWalkTiles(&walk, range);
+		for (int32_t z = range[1]; z <= range[3]; z += 1) {
+			for (int32_t x = range[0]; x <= range[2]; x += 1) {
+				if (walk.mAxis < 0 && x == walk.mCell[0] && z == walk.mCell[1]) continue;
+				if (grassQueryRayWalkTile(pQuery, x, z, origin, d, inverse, &best, pHit)) hit = true;
+			}
+		}
+	} while (grassQueryWalkNext(pQuery, &walk));
+	return hit;
+}
+
+// The rays in lanes against blades first up to end, each broadcast. Only lanes in mask are tested.
+static inline uint32_t grassQueryRayBlades4(const GrassQueryTileBlades *pEntry, uint32_t first, uint32_t end, const GqFloat4 o[3], const GqFloat4 d[3], uint32_t mask, float best[4], GrassQueryHit hits[4]) {
+	const GqFloat4 zero = gqSet(0.0f), one = gqSet(1.0f), epsilon = gqSet(1e-8f);
+	uint32_t hitMask = 0;
+	for (uint32_t i = first; i < end; i += 1) {
+		const float bx = pEntry->pBaseX[i], by = pEntry->pBaseY[i], bz = pEntry->pBaseZ[i];
+		if (bx != bx) break; // The cell's padding
+		const float ex = pEntry->pTipX[i]-bx, ey = pEntry->pTipY[i]-by, ez = pEntry->pTipZ[i]-bz;
+		const GqFloat4 wx = gqSub(o[0], gqSet(bx)), wy = gqSub(o[1], gqSet(by)), wz = gqSub(o[2], gqSet(bz));
+		const GqFloat4 vx = gqSet(ex), vy = gqSet(ey), vz = gqSet(ez);
+		const GqFloat4 ee = gqSet(ex*ex + ey*ey + ez*ez);
+		const GqFloat4 radiusSquared = gqSet(pEntry->pRadius[i]*pEntry->pRadius[i]);
+
+		// Like grassQueryRayBlades(), with the rays in the lanes rather than the blades
+		GqFloat4 de = gqAdd(gqAdd(gqMul(d[0], vx), gqMul(d[1], vy)), gqMul(d[2], vz));
+		GqFloat4 dw = gqAdd(gqAdd(gqMul(d[0], wx), gqMul(d[1], wy)), gqMul(d[2], wz));
+		GqFloat4 ew = gqAdd(gqAdd(gqMul(vx, wx), gqMul(vy, wy)), gqMul(vz, wz));
+		GqFloat4 denominator = gqSub(ee, gqMul(de, de));
+
+		GqFloat4 s = gqSelect(gqGreater(denominator, epsilon), gqDiv(gqSub(ew, gqMul(de, dw)), denominator), zero);
+		s = gqMin(gqMax(s, zero), one);
+		GqFloat4 t = gqMax(gqSub(gqMul(s, de), dw), zero);
+		s = gqMin(gqMax(gqDiv(gqAdd(ew, gqMul(t, de)), gqMax(ee, epsilon)), zero), one);
+
+		GqFloat4 px = gqSub(gqAdd(wx, gqMul(t, d[0])), gqMul(s, vx));
+		GqFloat4 py = gqSub(gqAdd(wy, gqMul(t, d[1])), gqMul(s, vy));
+		GqFloat4 pz = gqSub(gqAdd(wz, gqMul(t, d[2])), gqMul(s, vz));
+		GqFloat4 distanceSquared = gqAdd(gqAdd(gqMul(px, px), gqMul(py, py)), gqMul(pz, pz));
+
+		uint32_t lanes = gqMask(gqLessEqual(distanceSquared, radiusSquared)) & mask;
+		if (lanes == 0) continue;
+
+		float distances[4];
+		gqStore(distances, gqMax(gqSub(t, gqSqrt(gqMax(gqSub(radiusSquared, distanceSquared), zero))), zero));
+		for (uint32_t lane = 0; lane < 4; lane += 1) {
+			if (((lanes >> lane) & 1) == 0 || distances[lane] >= best[lane]) continue;
+			best[lane] = distances[lane];
+			hits[lane].mDistance = distances[lane];
+			grassQueryBlade(pEntry, i, &hits[lane].mBlade);
+			hitMask |= 1u << lane;
+		}
+	}
+	return hitMask;
+}
+
+// Lanes in mask whose ray passes the box within [0, tMax], & where they enter & leave it
+static inline uint32_t grassQueryRayBox4(const float boxMin[3], const float boxMax[3], const GqFloat4 o[3], const GqFloat4 inverse[3], GqFloat4 tMax, uint32_t mask, GqFloat4 *pEnter, GqFloat4 *pExit) {
+	GqFloat4 tEnter = gqSet(0.0f), tExit = tMax;
+	for (uint32_t i = 0; i < 3; i += 1) {
+		GqFloat4 t0 = gqMul(gqSub(gqSet(boxMin[i]), o[i]), inverse[i]);
+		GqFloat4 t1 = gqMul(gqSub(gqSet(boxMax[i]), o[i]), inverse[i]);
+		tEnter = gqMax(tEnter, gqMin(t0, t1));
+		tExit = gqMin(tExit, gqMax(t0, t1));
+	}
+	if (pEnter) *pEnter = tEnter;
+	if (pExit) *pExit = tExit;
+	return gqMask(gqLessEqual(tEnter, tExit)) & mask;
+}
+
+// 4 rays for grassQueryRaycast4(), one per lane. Lanes that don't walk keep a best of -infinity,
+// so they never pass a test.
+typedef struct GrassQueryRay4 {
+	float    mOrigin[4][3];
+	float    mDirection[4][3]; // Normalized
+	GqFloat4 mOrigin4[3];
+	GqFloat4 mDirection4[3];
+	GqFloat4 mInverse4[3];
+	float    mBest[4];
+} GrassQueryRay4;
+
+// Tile x, z for grassQueryRaycast4(), like grassQueryRayWalkTile() for every ray at once & only
+// once per call. The cells tested are those within mCellRing of where any of the rays pass the
+// tile's bounds, each against all the rays.
+static inline uint32_t grassQueryRayWalkTile4(GrassQuery *pQuery, int32_t x, int32_t z, GrassQueryRay4 *pRays, GrassQueryHit hits[4]) {
+	const GrassQueryField *pField = &pQuery->mField;
+	if (x < 0 || z < 0 || x >= (int32_t)pField->mTileCountX || z >= (int32_t)pField->mTileCountY) return 0;
+	const uint32_t tile = (uint32_t)z*pField->mTileCountX + (uint32_t)x;
+	if (pQuery->pTileStamps[tile] == pQuery->mStamp) return 0;
+	pQuery->pTileStamps[tile] = pQuery->mStamp;
+
+	const GqFloat4 slack = gqSet(pQuery->mMaxRadius);
+	const float tileDimension = pField->mTileDimension;
+	const float *pBounds = &pQuery->pTileBounds[6*tile];
+	uint32_t lanes;
+	if (pBounds[0] == pBounds[0]) {
+		lanes = pBounds[0] > pBounds[3] ? 0 : grassQueryRayBox4(pBounds, pBounds+3, pRays->mOrigin4, pRays->mInverse4, gqAdd(gqLoad(pRays->mBest), slack), 0xF, NULL, NULL);
+	} else {
+		const float footprintMin[3] = { (float)x*tileDimension-pQuery->mReach, -INFINITY, (float)z*tileDimension-pQuery->mReach };
+		const float footprintMax[3] = { (float)(x+1)*tileDimension+pQuery->mReach, INFINITY, (float)(z+1)*tileDimension+pQuery->mReach };
+		lanes = grassQueryRayBox4(footprintMin, footprintMax, pRays->mOrigin4, pRays->mInverse4, gqAdd(gqLoad(pRays->mBest), slack), 0xF, NULL, NULL);
+	}
+	if (lanes == 0) return 0;
+
+	const GrassQueryTileBlades *pEntry = grassQueryTile(pQuery, tile);
+	GqFloat4 tEnter, tExit;
+	lanes = grassQueryRayBox4(pEntry->mBoundsMin, pEntry->mBoundsMax, pRays->mOrigin4, pRays->mInverse4, gqAdd(gqLoad(pRays->mBest), slack), lanes, &tEnter, &tExit);
+	if (lanes == 0 || pEntry->mCellMask == 0) return 0;
+
+	float enters[4], exits[4];
+	gqStore(enters, tEnter);
+	gqStore(exits, tExit);
+	const float cellSize = tileDimension/(float)GRASS_QUERY_TILE_CELLS;
+	const float tileStart[2] = { (float)x*tileDimension, (float)z*tileDimension };
+	const int32_t ring = pEntry->mCellRing;
+	uint64_t cells = 0;
+	for (uint32_t lane = 0; lane < 4; lane += 1) {
+		if (((lanes >> lane) & 1) == 0) continue;
+		const float *o = pRays->mOrigin[lane], *d = pRays->mDirection[lane];
+		int32_t range[4];
+		for (uint32_t i = 0; i < 2; i += 1) {
+			const float a = o[2*i]+d[2*i]*enters[lane], b = o[2*i]+d[2*i]*exits[lane];
+			range[i] = (int32_t)floorf((grassQueryMin(a, b)-tileStart[i])/cellSize) - ring;
+			range[i+2] = (int32_t)floorf((grassQueryMax(a, b)-tileStart[i])/cellSize) + ring;
+		}
+		cells |= grassQueryCellRect(range[0], range[1], range[2], range[3]);
+	}
+	cells &= pEntry->mCellMask;
+
+	uint32_t hitMask = 0;
+	for (uint32_t c = 0; c < GRASS_QUERY_TILE_CELLS*GRASS_QUERY_TILE_CELLS && (cells >> c) != 0; c += 1) {
+		if (((cells >> c) & 1) == 0) continue;
+		const float cellMin[3] = { pEntry->mCellMin[0][c], pEntry->mCellMin[1][c], pEntry->mCellMin[2][c] };
+		const float cellMax[3] = { pEntry->mCellMax[0][c], pEntry->mCellMax[1][c], pEntry->mCellMax[2][c] };
+		const uint32_t cellLanes = grassQueryRayBox4(cellMin, cellMax, pRays->mOrigin4, pRays->mInverse4, gqAdd(gqLoad(pRays->mBest), slack), lanes, NULL, NULL);
+		if (cellLanes != 0) hitMask |= grassQueryRayBlades4(pEntry, pEntry->mCellStart[c], pEntry->mCellStart[c+1], pRays->mOrigin4, pRays->mDirection4, cellLanes, pRays->mBest, hits);
+	}
+	return hitMask;
+}
+
+// grassQueryRaycast() for 4 rays at once, each blade tested against all 4. Fastest for rays that
+// pass the same tiles (e.g. fanned out from one point). Each ray walks its own tiles, but a tile
+// is only tested once per call, for all of them. Returns which rays hit, bit i for ray i.
+static inline uint32_t grassQueryRaycast4(GrassQuery *pQuery, const float origins[4][3], const float directions[4][3], float maxDistance, GrassQueryHit hits[4]) {
+	if (pQuery->mTileCount == 0) return 0;
+
+	GrassQueryRay4 rays;
+	GrassQueryWalk walks[4];
+	uint32_t walking = 0;
+	for (uint32_t r = 0; r < 4; r += 1) {
+		const float *v = directions[r];
+		const float length = sqrtf(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+		for (uint32_t i = 0; i < 3; i += 1) {
+			rays.mOrigin[r][i] = origins[r][i];
+			rays.mDirection[r][i] = length > 0.0f ? v[i]/length : 0.0f;
+		}
+		rays.mBest[r] = -INFINITY;
+		if (length > 0.0f && grassQueryWalkBegin(pQuery, rays.mOrigin[r], rays.mDirection[r], maxDistance, &walks[r])) {
+			rays.mBest[r] = walks[r].mExit;
+			walking |= 1u << r;
+		}
+	}
+	if (walking == 0) return 0;
+
+	for (uint32_t i = 0; i < 3; i += 1) {
+		float origin[4], direction[4], inverse[4];
+		for (uint32_t r = 0; r < 4; r += 1) {
+			origin[r] = rays.mOrigin[r][i];
+			direction[r] = rays.mDirection[r][i];
+			inverse[r] = grassQueryInverse(direction[r]);
+		}
+		rays.mOrigin4[i] = gqLoad(origin);
+		rays.mDirection4[i] = gqLoad(direction);
+		rays.mInverse4[i] = gqLoad(inverse);
+	}
+
+	pQuery->mStamp += 1;
+	if (pQuery->mStamp == 0) {
+		memset(pQuery->pTileStamps, 0, sizeof(uint32_t)*pQuery->mTileCount);
+		pQuery->mStamp = 1;
+	}
+
+	// The tiles the rays start in first, then each ray's walk in turn
+	uint32_t hitMask = 0;
+	for (uint32_t r = 0; r < 4; r += 1) {
+		if (((walking >> r) & 1) != 0) hitMask |= grassQueryRayWalkTile4(pQuery, walks[r].mCell[0], walks[r].mCell[1], &rays, hits);
+	}
+	while (walking != 0) {
+		for (uint32_t r = 0; r < 4; r += 1) {
+			if (((walking >> r) & 1) == 0) continue;
+			GrassQueryWalk *pWalk = &walks[r];
+			if (pWalk->mEnter > rays.mBest[r] + pQuery->mMaxRadius) {
+				walking &= ~(1u << r);
+				continue;
+			}
+
+			int32_t range[4];
+			grassQueryWalkTiles(pWalk, range);
+			for (int32_t z = range[1]; z <= range[3]; z += 1) {
+				for (int32_t x = range[0]; x <= range[2]; x += 1) hitMask |= grassQueryRayWalkTile4(pQuery, x, z, &rays, hits);
+			}
+			if (!grassQueryWalkNext(pQuery, pWalk)) walking &= ~(1u << r);
+		}
+	}
+	return hitMask;
+}
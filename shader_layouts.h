@@ -0,0 +1,129 @@
+#pragma once
+
+/*
+
+				Shader layouts
+
+	Byte layout of the structures reflected in shaders, see "Structures reflected in shaders"
+	in Charlie_Submission.cpp. The app declares them with The Forge's vector types, and
+	Benchmarks/cpu_benchmarks.cpp mirrors them without The Forge. Both check their own
+	declarations against this table with SHADER_LAYOUT_CHECK(), so a field added to one side
+	(or moved in the FSL & only one side) fails to build instead of silently drifting.
+
+	#Volatile: when one of these changes, change the struct in the app, its mirror in the
+	benchmarks, the FSL & this table. Offsets that depend on the limits in terrain_config.h are
+	written in terms of them.
+
+*/
+
+#include <stddef.h>
+
+#include "terrain_config.h"
+
+#define SHADER_LAYOUT_LOD_SETTINGS_SIZE (16*MAX_GRASS_LOD + 16)
+#define SHADER_LAYOUT_GRASS_VIEW_SIZE 160
+#define SHADER_LAYOUT_GRASS_VIEWS_END (16 + SHADER_LAYOUT_LOD_SETTINGS_SIZE + SHADER_LAYOUT_GRASS_VIEW_SIZE*MAX_GRASS_VIEWS)
+
+// X(struct, field, offset)
+#define SHADER_LAYOUT_FIELDS(X) \
+	X(LodLevelInfo, mThreshold, 0) \
+	X(LodLevelInfo, mIndexCount, 4) \
+	X(LodLevelInfo, mBladesPerInstance, 8) \
+	X(LodLevelInfo, mBladeSegments, 12) \
+	X(LodSettings, mLevels, 0) \
+	X(LodSettings, mDensityFadeStartPercent, 16*MAX_GRASS_LOD) \
+	X(LodSettings, mMinDensityPercent, 16*MAX_GRASS_LOD + 4) \
+	X(LodSettings, mLowestDetailDistance, 16*MAX_GRASS_LOD + 8) \
+	X(LodSettings, mLevelCount, 16*MAX_GRASS_LOD + 12) \
+	X(SceneUniformData, mCameraToClip, 0) \
+	X(SceneUniformData, mSunDirection, 64) \
+	X(SceneUniformData, mTerrainSize, 80) \
+	X(SceneUniformData, mDaylightFactor, 88) \
+	X(SceneUniformData, mMaxFloorY, 92) \
+	X(SceneUniformData, mTime, 96) \
+	X(SceneUniformData, mWindStrength, 100) \
+	X(SceneUniformData, mMaxWindLeanAngle, 104) \
+	X(SceneUniformData, mWindSpeed, 108) \
+	X(SceneUniformData, mMaxNaturalAngle, 112) \
+	X(SceneUniformData, mMinGrassWidth, 116) \
+	X(SceneUniformData, mMaxGrassWidth, 120) \
+	X(SceneUniformData, mMinGrassHeight, 124) \
+	X(SceneUniformData, mMaxGrassHeight, 128) \
+	X(SceneUniformData, mMaxInstancesPerTile, 132) \
+	X(SceneUniformData, mSampleGranularity, 136) \
+	X(SceneUniformData, mBladeSegmentScale, 140) \
+	X(SceneUniformData, mViewDir, 144) \
+	X(SceneUniformData, mCameraPos, 160) \
+	X(SceneUniformData, mGrassBaseColor, 176) \
+	X(SceneUniformData, mGrassTipColor, 192) \
+	X(SceneUniformData, mWindDir, 208) \
+	X(SceneUniformData, mFarGrass, 224) \
+	X(SceneUniformData, mTileGrid, 240) \
+	X(SceneUniformData, mTemporalGrass, 256) \
+	X(SceneUniformData, mTemporalHistory, 272) \
+	X(SceneUniformData, mTemporalReprojection, 288) \
+	X(SceneUniformData, mHeightEdits, 288 + 64*(TEMPORAL_GRASS_MAX_FRAMES-1)) \
+	X(GrassViewData, mViewPosition, 0) \
+	X(GrassViewData, mLodDistanceScale, 12) \
+	X(GrassViewData, rcp, 16) \
+	X(GrassViewData, lcp, 32) \
+	X(GrassViewData, tcp, 48) \
+	X(GrassViewData, bcp, 64) \
+	X(GrassViewData, fcp, 80) \
+	X(GrassViewData, ncp, 96) \
+	X(GrassViewData, fhp, 112) \
+	X(GrassViewData, fvp, 128) \
+	X(GrassViewData, mMotion, 144) \
+	X(GrassDrawUniformData, mPerceivedNumberOfGrass, 0) \
+	X(GrassDrawUniformData, mViewCount, 4) \
+	X(GrassDrawUniformData, mProceduralBlades, 8) \
+	X(GrassDrawUniformData, mCullEpoch, 12) \
+	X(GrassDrawUniformData, mLod, 16) \
+	X(GrassDrawUniformData, mViews, 16 + SHADER_LAYOUT_LOD_SETTINGS_SIZE) \
+	X(GrassDrawUniformData, mSplatMaxPixels, SHADER_LAYOUT_GRASS_VIEWS_END) \
+	X(GrassDrawUniformData, mSplatPixelScale, SHADER_LAYOUT_GRASS_VIEWS_END + 4) \
+	X(GrassDrawUniformData, mSplatWidth, SHADER_LAYOUT_GRASS_VIEWS_END + 8) \
+	X(GrassDrawUniformData, mSplatHeight, SHADER_LAYOUT_GRASS_VIEWS_END + 12) \
+	X(GrassDrawUniformData, mFarVariantLevel, SHADER_LAYOUT_GRASS_VIEWS_END + 16) \
+	X(GrassDrawUniformData, mTemporalFrames, SHADER_LAYOUT_GRASS_VIEWS_END + 20) \
+	X(GrassDrawUniformData, mMaxBladeHeight, SHADER_LAYOUT_GRASS_VIEWS_END + 24) \
+	X(GrassDrawUniformData, mSpeciesCount, SHADER_LAYOUT_GRASS_VIEWS_END + 28) \
+	X(GrassDrawUniformData, mTemporalSectors, SHADER_LAYOUT_GRASS_VIEWS_END + 32) \
+	X(GrassDrawUniformData, mTemporalRefresh, SHADER_LAYOUT_GRASS_VIEWS_END + 36) \
+	X(GrassDrawUniformData, mTemporalFrame, SHADER_LAYOUT_GRASS_VIEWS_END + 40) \
+	X(GrassDrawUniformData, mTemporalSectorFrames, SHADER_LAYOUT_GRASS_VIEWS_END + 48) \
+	X(GrassSpecies, mBaseColor, 0) \
+	X(GrassSpecies, mDensity, 12) \
+	X(GrassSpecies, mTipColor, 16) \
+	X(GrassSpecies, mMinWidth, 32) \
+	X(GrassSpecies, mMaxWidth, 36) \
+	X(GrassSpecies, mMinHeight, 40) \
+	X(GrassSpecies, mMaxHeight, 44) \
+	X(GrassSpecies, mFirstLod, 48) \
+	X(GrassSpecies, mLastLod, 52) \
+	X(SkyboxUniformData, mView, 0) \
+	X(SkyboxUniformData, mProjection, 64) \
+	X(GrassVertex, mPosition, 0) \
+	X(GrassVertex, mNormal, 12) \
+	X(GrassVertex, mClump, 16)
+
+// X(struct, size)
+#define SHADER_LAYOUT_SIZES(X) \
+	X(LodLevelInfo, 16) \
+	X(LodSettings, SHADER_LAYOUT_LOD_SETTINGS_SIZE) \
+	X(SceneUniformData, 288 + 64*(TEMPORAL_GRASS_MAX_FRAMES-1) + 16) \
+	X(GrassViewData, SHADER_LAYOUT_GRASS_VIEW_SIZE) \
+	X(GrassDrawUniformData, SHADER_LAYOUT_GRASS_VIEWS_END + 64) \
+	X(GrassSpecies, 64) \
+	X(SkyboxUniformData, 128) \
+	X(GrassVertex, 20)
+
+#define SHADER_LAYOUT_CHECK_FIELD(type, field, offset) \
+	static_assert(offsetof(type, field) == (offset), #type "::" #field " doesn't match shader_layouts.h");
+#define SHADER_LAYOUT_CHECK_SIZE(type, size) \
+	static_assert(sizeof(type) == (size), "sizeof(" #type ") doesn't match shader_layouts.h");
+
+// At file scope, after the structs are declared
+#define SHADER_LAYOUT_CHECK() \
+	SHADER_LAYOUT_FIELDS(SHADER_LAYOUT_CHECK_FIELD) \
+	SHADER_LAYOUT_SIZES(SHADER_LAYOUT_CHECK_SIZE)
@@ -1,11 +1,37 @@
 
-#define GRASS_TILE_DIMENSION  15
 #define TERRAIN_WIDTH 2480
 #define TERRAIN_HEIGHT 2480
-#define GRASS_TILE_COUNT_X (TERRAIN_WIDTH/GRASS_TILE_DIMENSION)
-#define GRASS_TILE_COUNT_Y (TERRAIN_HEIGHT/GRASS_TILE_DIMENSION)
-#define GRASS_TILE_COUNT (GRASS_TILE_COUNT_X*GRASS_TILE_COUNT_Y)
 
-#define NUMBER_OF_GRASS_LOD 4
+// The terrain only stretches this much of the height map over its size, see sampleHeight() in
+// Shaders/FSL/shared.h.fsl. The CPU samples it the same way for grass queries.
+#define HEIGHT_MAP_SAMPLE_FOR_HEIGHT_PERCENT 0.15
 
-#define MAX_GRASS_CAP  100000000
\ No newline at end of file
+// Side of a grass tile in meters. The one in use is picked at load, see "Tile grid" in
+// Charlie_Submission.cpp. Shaders get it & the tile counts from SceneData::TileGrid.
+#define DEFAULT_GRASS_TILE_DIMENSION 15
+#define MIN_GRASS_TILE_DIMENSION 8
+#define MAX_GRASS_TILE_DIMENSION 64
+
+// Capacity for grass LOD levels. How many are actually used comes from the asset,
+// see "LOD chain" in Charlie_Submission.cpp and Tools/generate_grass_lods.py.
+#define MAX_GRASS_LOD 8
+
+#define MAX_GRASS_CAP  100000000
+
+// Number of views (main camera, rear-view mirror, minimap...) the grass culling pass
+// can produce draw lists for in a single dispatch.
+#define MAX_GRASS_VIEWS 3
+
+// Grass vertex/fragment shader variants, each LOD level is drawn with one of them.
+// See "Grass shader variants" in Charlie_Submission.cpp.
+#define GRASS_VARIANT_NEAR 0
+#define GRASS_VARIANT_FAR 1
+#define GRASS_VARIANT_COUNT 2
+
+// Most frames temporal grass can spread the far blades over, see "Temporal grass" in Charlie_Submission.cpp
+#define TEMPORAL_GRASS_MAX_FRAMES 4
+
+// Blade types (grass, clover...) a tile can mix, see "Grass species" in Charlie_Submission.cpp.
+// Each species gets a share of the tile's instance range in proportion to its mix weight times
+// its density, & the tile's mix packs one byte per species.
+#define MAX_GRASS_SPECIES 4